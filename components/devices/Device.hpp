@@ -19,9 +19,13 @@ static const char* const farmhubVersion = reinterpret_cast<const char*>(esp_app_
 #include <Console.hpp>
 #include <CrashManager.hpp>
 #include <DebugConsole.hpp>
+#include <EnergyPlanner.hpp>
+#include <Executor.hpp>
 #include <HttpUpdate.hpp>
 #include <KernelStatus.hpp>
 #include <Log.hpp>
+#include <LogJson.hpp>
+#include <NvsStore.hpp>
 #include <Strings.hpp>
 #include <mqtt/MqttLog.hpp>
 
@@ -171,8 +175,8 @@ std::shared_ptr<TConfiguration> loadConfig(const std::shared_ptr<FileSystem>& fs
     return config;
 }
 
-std::shared_ptr<MqttRoot> initMqtt(const std::shared_ptr<ModuleStates>& states, const std::shared_ptr<MdnsDriver>& mdns, const std::shared_ptr<MqttDriver::Config>& mqttConfig, const std::string& instance, const std::string& location) {
-    auto mqtt = std::make_shared<MqttDriver>(states->networkReady, mdns, mqttConfig, instance, states->mqttReady);
+std::shared_ptr<MqttRoot> initMqtt(const std::shared_ptr<ModuleStates>& states, const std::shared_ptr<MdnsDriver>& mdns, const std::shared_ptr<FileSystem>& fs, const std::shared_ptr<MqttDriver::Config>& mqttConfig, const std::string& instance, const std::string& location) {
+    auto mqtt = std::make_shared<MqttDriver>(states->networkReady, mdns, fs, mqttConfig, instance, states->mqttReady);
     return std::make_shared<MqttRoot>(mqtt, (location.empty() ? "" : location + "/") + "devices/ugly-duckling/" + instance);
 }
 
@@ -190,6 +194,51 @@ void registerBasicCommands(const std::shared_ptr<MqttRoot>& mqttRoot) {
             duration.count());
         esp_deep_sleep_start();
     });
+    mqttRoot->registerCommand("tasks", [](const JsonObject&, JsonObject& response) {
+        auto tasks = response["tasks"].to<JsonObject>();
+        TaskRegistry::populateTelemetry(tasks);
+    });
+}
+
+void restoreLogLevels(NvsStore& logLevels) {
+    LogTags::forEach([&](std::string_view name, Level /*level*/) {
+        Level level;
+        if (logLevels.get(std::string(name), level)) {
+            LogTags::setLevel(name, level);
+        }
+    });
+}
+
+void registerLogLevelsCommand(const std::shared_ptr<MqttRoot>& mqttRoot, const std::shared_ptr<NvsStore>& logLevels) {
+    // Sets the levels of the given tags, e.g. {"levels": {"mqtt": 5, "wifi": null}}; null restores the default level
+    mqttRoot->registerCommand("log-levels", [logLevels](const JsonObject& request, JsonObject& response) {
+        for (auto entry : request["levels"].as<JsonObject>()) {
+            std::string name = entry.key().c_str();
+            std::optional<Level> level;
+            if (!entry.value().isNull()) {
+                level = entry.value().as<Level>();
+            }
+            if (!LogTags::setLevel(name, level)) {
+                response["unknown"].add(name);
+                continue;
+            }
+            if (level.has_value()) {
+                LOGI("Log level of '%s' set to %d",
+                    name.c_str(), static_cast<int>(*level));
+                logLevels->set(name, *level);
+            } else {
+                LOGI("Log level of '%s' restored to default",
+                    name.c_str());
+                if (logLevels->contains(name)) {
+                    logLevels->remove(name);
+                }
+            }
+        }
+        auto levels = response["levels"].to<JsonObject>();
+        LogTags::forEach([&](std::string_view name, Level level) {
+            levels[std::string(name)] = level;
+        });
+    });
 }
 
 void registerFileCommands(const std::shared_ptr<MqttRoot>& mqttRoot, const std::shared_ptr<FileSystem>& fs) {
@@ -264,7 +313,12 @@ void registerHttpUpdateCommand(const std::shared_ptr<MqttRoot>& mqttRoot, const
     });
 }
 
-void initTelemetryPublishTask(
+/**
+ * @brief Publishes telemetry right away, waiting at most `timeout` for it to be sent.
+ */
+using TelemetryPublishing = std::function<PublishStatus(ticks timeout)>;
+
+TelemetryPublishing initTelemetryPublishTask(
     milliseconds publishInterval,
     const std::shared_ptr<Watchdog>& watchdog,
     const std::shared_ptr<MqttRoot>& mqttRoot,
@@ -272,11 +326,17 @@ void initTelemetryPublishTask(
     const std::shared_ptr<PowerManager>& powerManager,
     const std::shared_ptr<WiFiDriver>& wifi,
     const std::shared_ptr<TelemetryCollector>& telemetryCollector,
+    const std::shared_ptr<EnergyPlanner>& energyPlanner,
+    const std::shared_ptr<PooledQueue<LogRecord>>& logRecords,
+    bool publishTasks,
     const std::shared_ptr<CopyQueue<bool>>& telemetryPublishQueue) {
-    Task::loop("telemetry", 8192, [publishInterval, watchdog, mqttRoot, batteryManager, powerManager, wifi, telemetryCollector, telemetryPublishQueue](Task& task) {
-        task.markWakeTime();
-
-        mqttRoot->publish("telemetry", [batteryManager, powerManager, wifi, telemetryCollector](JsonObject& telemetry) {
+    auto telemetryTopic = mqttRoot->topic("telemetry");
+    // Telemetry is also published during shutdown, while the telemetry task might be publishing, too
+    auto publishing = std::make_shared<Mutex>();
+    TelemetryPublishing publishTelemetry = [mqttRoot, telemetryTopic, batteryManager, powerManager, wifi, telemetryCollector, energyPlanner, logRecords, publishTasks, publishing](ticks timeout) {
+        Lock lock(*publishing);
+        auto status = mqttRoot->publishTelemetry(telemetryTopic, [mqttRoot, batteryManager, powerManager, wifi, telemetryCollector, energyPlanner, logRecords, publishTasks](JsonObject& telemetry) {
+            PowerManagementLockGuard collecting(Workloads::telemetry);
             telemetry["uptime"] = duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
             telemetry["timestamp"] = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
 
@@ -294,11 +354,26 @@ void initTelemetryPublishTask(
                 }
             }
 
+            if (energyPlanner != nullptr) {
+                auto energy = telemetry["energy"].to<JsonObject>();
+                energyPlanner->populateTelemetry(energy);
+            }
+
             auto wifiData = telemetry["wifi"].to<JsonObject>();
             wifi->populateTelemetry(wifiData);
 
-#if defined(FARMHUB_DEBUG) || defined(FARMHUB_REPORT_MEMORY)
+            auto mqttData = telemetry["mqtt"].to<JsonObject>();
+            mqttRoot->populateTelemetry(mqttData);
+
             auto memoryData = telemetry["memory"].to<JsonObject>();
+            // Queues, rings and buffers allocated up front and kept for good
+            auto preallocatedData = memoryData["preallocated"].to<JsonObject>();
+            auto mqttFootprint = mqttRoot->getFootprint();
+            auto logFootprint = ConsoleProvider::getFootprint() + logRecords->getFootprint();
+            preallocatedData["mqtt"] = mqttFootprint;
+            preallocatedData["log"] = logFootprint;
+            preallocatedData["total"] = mqttFootprint + logFootprint;
+#if defined(FARMHUB_DEBUG) || defined(FARMHUB_REPORT_MEMORY)
             memoryData["free-heap"] = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
             memoryData["min-heap"] = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
 #endif
@@ -306,8 +381,30 @@ void initTelemetryPublishTask(
             auto powerManagementData = telemetry["pm"].to<JsonObject>();
             powerManager->populateTelemetry(powerManagementData);
 
-            auto features = telemetry["features"].to<JsonArray>();
-            telemetryCollector->collect(features); }, Retention::NoRetain, QoS::AtLeastOnce);
+            if (publishTasks) {
+                auto tasksData = telemetry["tasks"].to<JsonObject>();
+                TaskRegistry::populateTelemetry(tasksData);
+            }
+
+            telemetryCollector->collect(telemetry); }, Retention::NoRetain, QoS::AtLeastOnce, timeout);
+        if (status != PublishStatus::Success && status != PublishStatus::Deferred) {
+            // Make sure the server can resync if it missed this delta
+            telemetryCollector->requestKeyframe();
+        }
+        return status;
+    };
+
+    Task::loop("telemetry", 8192, [publishInterval, watchdog, mqttRoot, telemetryCollector, energyPlanner, telemetryPublishQueue, publishTelemetry, lastConnectionCount = 0U](Task& task) mutable {
+        task.markWakeTime();
+
+        // The server might have missed deltas while we were disconnected
+        auto connectionCount = mqttRoot->getConnectionCount();
+        if (connectionCount != lastConnectionCount) {
+            lastConnectionCount = connectionCount;
+            telemetryCollector->requestKeyframe();
+        }
+
+        publishTelemetry(MqttDriver::MQTT_NETWORK_TIMEOUT);
 
         // Signal that we are still alive
         watchdog->restart();
@@ -318,9 +415,13 @@ void initTelemetryPublishTask(
         Task::delay(task.ticksUntil(debounceInterval));
 
         // Allow other tasks to trigger telemetry updates
-        auto timeout = task.ticksUntil(publishInterval - debounceInterval);
+        auto interval = energyPlanner == nullptr
+            ? publishInterval
+            : energyPlanner->scale(publishInterval);
+        auto timeout = task.ticksUntil(interval - debounceInterval);
         telemetryPublishQueue->pollIn(timeout);
     });
+    return publishTelemetry;
 }
 
 enum class InitState : std::uint8_t {
@@ -336,6 +437,9 @@ static void startDevice() {
 
     initNvsFlash();
 
+    auto logLevels = std::make_shared<NvsStore>("log-levels");
+    restoreLogLevels(*logLevels);
+
     // Install GPIO ISR service
     ESP_ERROR_CHECK(gpio_install_isr_service(0));
 
@@ -353,14 +457,9 @@ static void startDevice() {
 
     auto powerManager = std::make_shared<PowerManager>(settings->sleepWhenIdle.get());
 
-    auto logRecords = std::make_shared<Queue<LogRecord>>("logs",
-#ifdef FARMHUB_DEBUG
-        128
-#else
-        32
-#endif
-    );
-    ConsoleProvider::init(logRecords, settings->publishLogs.get());
+    auto logRecords = std::make_shared<PooledQueue<LogRecord>>("logs", settings->logQueueSize.get());
+    auto crashLog = std::make_shared<CrashLog>(crashLogStorage);
+    ConsoleProvider::init(logRecords, settings->publishLogs.get(), crashLog);
 
     LOGD("\n"
          "   ______                   _    _       _\n"
@@ -413,7 +512,7 @@ static void startDevice() {
     });
 
     // Init battery management
-    auto shutdownManager = std::make_shared<ShutdownManager>();
+    auto shutdownManager = std::make_shared<ShutdownManager>(shutdownReport);
     std::shared_ptr<BatteryManager> batteryManager;
     if (battery != nullptr) {
         LOGD("Battery configured");
@@ -434,9 +533,10 @@ static void startDevice() {
 
     // Init MQTT connection
     auto mqttConfig = loadConfig<MqttDriver::Config>(fs, "/mqtt-config.json");
-    auto mqttRoot = initMqtt(states, mdns, mqttConfig, settings->instance.get(), settings->location.get());
-    MqttLog::init(settings->publishLogs.get(), logRecords, mqttRoot);
+    auto mqttRoot = initMqtt(states, mdns, fs, mqttConfig, settings->instance.get(), settings->location.get());
+    auto mqttLog = MqttLog::init(settings->publishLogs.get(), logRecords, mqttRoot, mqttConfig->log.get());
     registerBasicCommands(mqttRoot);
+    registerLogLevelsCommand(mqttRoot, logLevels);
     registerFileCommands(mqttRoot, fs);
 
     // Handle any pending HTTP update (will reboot if update was required and was successful)
@@ -446,10 +546,32 @@ static void startDevice() {
     auto pcnt = std::make_shared<PcntManager>();
     auto pulseCounterManager = std::make_shared<PulseCounterManager>();
     auto pwm = std::make_shared<PwmManager>();
-    auto telemetryCollector = std::make_shared<TelemetryCollector>();
+    auto telemetryCollector = std::make_shared<TelemetryCollector>(settings->telemetry.get());
+    // Runs periodic measurements of peripherals on a single task
+    auto executor = std::make_shared<Executor>("executor", 4096);
+
+    // Adapt how often we do things to the state of the battery
+    std::shared_ptr<EnergyPlanner> energyPlanner;
+    if (batteryManager != nullptr && settings->energy.get()->enabled.get()) {
+        energyPlanner = std::make_shared<EnergyPlanner>(settings->energy.get());
+        executor->schedule("energy-planner", 1min, 10s, [energyPlanner, batteryManager, powerManager, states, executor, mqttLog, publishLogs = settings->publishLogs.get()]() {
+            auto plan = energyPlanner->plan(EnergyState {
+                .charge = batteryManager->getPercentage(),
+                .current = batteryManager->getCurrent(),
+                .timeToEmpty = batteryManager->getTimeToEmpty(),
+                .sleepRatio = powerManager->takeSleepRatio(),
+                .time = states->rtcInSync.isSet()
+                    ? std::optional(system_clock::now())
+                    : std::nullopt,
+            });
+            executor->setPeriodScale(plan.factor);
+            mqttLog->setPublishLevel(std::min(publishLogs, plan.logLevel));
+        });
+    }
 
     // Init peripherals
     auto peripheralServices = PeripheralServices {
+        .executor = executor,
         .i2c = i2c,
         .pcntManager = pcnt,
         .pulseCounterManager = pulseCounterManager,
@@ -458,7 +580,7 @@ static void startDevice() {
         .telemetryPublisher = telemetryPublisher,
     };
     auto peripheralManager = std::make_shared<PeripheralManager>(telemetryCollector, peripheralServices);
-    shutdownManager->registerShutdownListener([peripheralManager]() {
+    shutdownManager->registerShutdownListener(ShutdownPhase::SafeState, "peripherals", [peripheralManager](steady_clock::time_point /*deadline*/) {
         peripheralManager->shutdown();
     });
     deviceDefinition->registerPeripheralFactories(peripheralManager, peripheralServices, settings);
@@ -469,7 +591,7 @@ static void startDevice() {
         .peripherals = peripheralManager,
     };
     auto functionManager = std::make_shared<FunctionManager>(fs, functionServices, mqttRoot);
-    shutdownManager->registerShutdownListener([functionManager]() {
+    shutdownManager->registerShutdownListener(ShutdownPhase::SafeState, "functions", [functionManager](steady_clock::time_point /*deadline*/) {
         functionManager->shutdown();
     });
     deviceDefinition->registerFunctionFactories(functionManager);
@@ -489,22 +611,16 @@ static void startDevice() {
     JsonDocument peripheralsInitDoc;
     auto peripheralsInitJson = peripheralsInitDoc.to<JsonArray>();
 
-    auto builtInPeripheralsSettings = deviceDefinition->getBuiltInPeripherals();
+    auto peripheralsSettings = deviceDefinition->getBuiltInPeripherals();
     LOGD("Loading configuration for %d built-in peripherals",
-        builtInPeripheralsSettings.size());
-    for (auto& builtInPeripheralSettings : builtInPeripheralsSettings) {
-        if (!peripheralManager->createPeripheral(builtInPeripheralSettings, peripheralsInitJson)) {
-            initState = InitState::PeripheralError;
-        }
-    }
-
-    auto& peripheralsSettings = settings->peripherals.get();
-    LOGI("Loading configuration for %d user-configured peripherals",
         peripheralsSettings.size());
-    for (auto& peripheralSettings : peripheralsSettings) {
-        if (!peripheralManager->createPeripheral(peripheralSettings.get(), peripheralsInitJson)) {
-            initState = InitState::PeripheralError;
-        }
+    LOGI("Loading configuration for %d user-configured peripherals",
+        settings->peripherals.get().size());
+    for (const auto& peripheralSettings : settings->peripherals.get()) {
+        peripheralsSettings.push_back(peripheralSettings.get());
+    }
+    if (!peripheralManager->createPeripherals(peripheralsSettings, peripheralsInitJson, settings->peripheralInitConcurrency.get(), settings->peripheralInitTimeout.get())) {
+        initState = InitState::PeripheralError;
     }
 
     JsonDocument functionsInitDoc;
@@ -518,14 +634,31 @@ static void startDevice() {
         }
     }
 
-    initTelemetryPublishTask(settings->publishInterval.get(), watchdog, mqttRoot, batteryManager, powerManager, wifi, telemetryCollector, telemetryPublishQueue);
+    auto publishTelemetry = initTelemetryPublishTask(settings->publishInterval.get(), watchdog, mqttRoot, batteryManager, powerManager, wifi, telemetryCollector, energyPlanner, logRecords, settings->telemetry.get()->tasks.get(), telemetryPublishQueue);
+
+    // Tell the server what happened before going to sleep with a low battery
+    shutdownManager->registerShutdownListener(ShutdownPhase::Flush, "telemetry", [publishTelemetry](steady_clock::time_point deadline) {
+        publishTelemetry(clampTicks(duration_cast<milliseconds>(deadline - steady_clock::now())));
+    });
+    shutdownManager->registerShutdownListener(ShutdownPhase::Flush, "log", [mqttLog](steady_clock::time_point deadline) {
+        // Pass on lines still waiting in the deferred log, so they are published, too
+        ConsoleProvider::flush(clampTicks(duration_cast<milliseconds>(deadline - steady_clock::now())));
+        mqttLog->flush(clampTicks(duration_cast<milliseconds>(deadline - steady_clock::now())));
+    });
+    // NVS and file writes are committed as they happen, only console output is buffered
+    shutdownManager->registerShutdownListener(ShutdownPhase::Sync, "console", [](steady_clock::time_point deadline) {
+        // Print what was logged since the flush phase
+        ConsoleProvider::flush(clampTicks(duration_cast<milliseconds>(deadline - steady_clock::now())));
+        (void) fflush(stdout);
+        fsync(fileno(stdout));
+    });
 
     // Enable power saving once we are done initializing
     WiFiDriver::setPowerSaveMode(settings->sleepWhenIdle.get());
 
     mqttRoot->publish(
-        "init",
-        [settings, initState, peripheralsInitJson, functionsInitJson, powerManager](JsonObject& json) {
+        mqttRoot->topic("init"),
+        [settings, initState, peripheralsInitJson, functionsInitJson, powerManager, mqttRoot, crashLog, shutdownManager](JsonObject& json) {
             // TODO Remove redundant mentions of "ugly-duckling"
             json["type"] = "ugly-duckling";
             json["model"] = settings->model.get();
@@ -544,13 +677,29 @@ static void startDevice() {
             json["peripherals"].to<JsonArray>().set(peripheralsInitJson);
             json["functions"].to<JsonArray>().set(functionsInitJson);
             json["sleepWhenIdle"] = powerManager->sleepWhenIdle;
+            auto telemetryEncoding = mqttRoot->getTelemetryEncoding();
+            if (telemetryEncoding != MqttEncoding::Json) {
+                auto telemetry = json["telemetry"].to<JsonObject>();
+                telemetry["encoding"] = telemetryEncoding;
+                if (telemetryEncoding == MqttEncoding::MsgPackWithKeys) {
+                    MqttKeyDictionary::populate(telemetry);
+                }
+            }
 
-            CrashManager::handleCrashReport(json);
+            CrashManager::handleCrashReport(json, *crashLog);
+
+            if (shutdownManager->getPreviousShutdown().has_value()) {
+                auto shutdown = json["shutdown"].to<JsonObject>();
+                shutdownManager->reportPreviousShutdown(shutdown);
+            }
         },
         Retention::NoRetain, QoS::AtLeastOnce, 5s);
 
     states->kernelReady.set();
 
+    // We made it this far, configuration changes since the last boot can stay
+    ConfigurationJournal::confirmLoaded();
+
     LOGI("Device ready in %.2f s (kernel version %s on %s instance '%s' with hostname '%s' and IP '%s', SSID '%s', current time is %lld)",
         duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count() / 1000.0,
         farmhubVersion,
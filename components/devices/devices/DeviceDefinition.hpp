@@ -17,7 +17,7 @@
 #include <drivers/LedDriver.hpp>
 
 #include <functions/chicken_door/ChickenDoor.hpp>
-#include <functions/plot_controller/PlotController.hpp>
+#include <functions/plot_controller/PlotControllerFactory.hpp>
 #include <peripherals/Peripheral.hpp>
 #include <peripherals/analog_meter/AnalogMeter.hpp>
 #include <peripherals/environment/Ds18B20SoilSensor.hpp>
@@ -4,7 +4,9 @@
 #include <string>
 
 #include <Configuration.hpp>
+#include <EnergyPlanner.hpp>
 #include <MacAddress.hpp>
+#include <Telemetry.hpp>
 #include <drivers/RtcDriver.hpp>
 
 using namespace farmhub::kernel;
@@ -27,12 +29,33 @@ struct DeviceSettings : ConfigurationSection {
     ArrayProperty<JsonAsString> peripherals { this, "peripherals" };
     ArrayProperty<JsonAsString> functions { this, "functions" };
 
+    /**
+     * @brief How many peripherals to initialize at the same time; one initializes them in order.
+     */
+    Property<size_t> peripheralInitConcurrency { this, "peripheralInitConcurrency", 4 };
+
+    /**
+     * @brief How long a peripheral can take to initialize before we carry on without it.
+     */
+    Property<seconds> peripheralInitTimeout { this, "peripheralInitTimeout", 10s };
+
     Property<bool> sleepWhenIdle { this, "sleepWhenIdle", true };
 
     /**
      * @brief How often to publish telemetry.
      */
     Property<seconds> publishInterval { this, "publishInterval", 5min };
+
+    /**
+     * @brief What to include in telemetry.
+     */
+    NamedConfigurationEntry<TelemetryCollector::Config> telemetry { this, "telemetry" };
+
+    /**
+     * @brief How to adapt to the state of the battery, if there is one.
+     */
+    NamedConfigurationEntry<EnergyPlanner::Config> energy { this, "energy" };
+
     Property<Level> publishLogs { this, "publishLogs",
 #ifdef FARMHUB_DEBUG
         Level::Verbose
@@ -41,6 +64,19 @@ struct DeviceSettings : ConfigurationSection {
 #endif
     };
 
+    /**
+     * @brief Number of log records that can wait to be published over MQTT.
+     *
+     * Slots are allocated up front and stay allocated, about 32 bytes each on the ESP32, plus the message itself while queued.
+     */
+    Property<size_t> logQueueSize { this, "logQueueSize",
+#ifdef FARMHUB_DEBUG
+        128
+#else
+        32
+#endif
+    };
+
     /**
      * @brief How long without successfully published telemetry before the watchdog times out and reboots the device.
      */
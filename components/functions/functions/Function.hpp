@@ -29,7 +29,7 @@ struct FunctionInitParameters {
 using FunctionCreateFn = std::function<Handle(
     FunctionInitParameters& params,
     const std::shared_ptr<FileSystem>& fs,
-    const std::string& jsonSettings,
+    JsonObjectConst jsonSettings,
     JsonObject& initConfigJson)>;
 using FunctionFactory = kernel::Factory<FunctionCreateFn>;
 
@@ -52,14 +52,14 @@ FunctionFactory makeFunctionFactory(
         .create = [settingsTuple, makeImpl = std::move(makeImpl)](
                       FunctionInitParameters& params,
                       const std::shared_ptr<FileSystem>& fs,
-                      const std::string& jsonSettings,
+                      JsonObjectConst jsonSettings,
                       JsonObject& initConfigJson) -> Handle {
             // Construct and load settings
             auto settings = std::apply([](auto&&... a) {
                 return std::make_shared<TSettings>(std::forward<decltype(a)>(a)...);
             },
                 settingsTuple);
-            settings->loadFromString(jsonSettings);
+            settings->load(jsonSettings);
 
             constexpr bool hasConfig = std::is_base_of_v<HasConfig<TConfig>, Impl>;
 
@@ -117,7 +117,7 @@ public:
             manager.createFromSettings(
                 functionSettings,
                 initJson,
-                [&](const std::string& name, const FunctionFactory& factory, const std::string& settings) {
+                [&](const std::string& name, const FunctionFactory& factory, JsonObjectConst settings) {
                     FunctionInitParameters params = {
                         .name = name,
                         .services = services,
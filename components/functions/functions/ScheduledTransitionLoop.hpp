@@ -40,14 +40,14 @@ namespace farmhub::functions {
 template <typename TPeripheral, typename TConfigSpec>
 void runScheduledTransitionLoop(
     const std::string& name,
-    const char* loggingTag,
+    const LogTag& loggingTag,
     const std::shared_ptr<TPeripheral>& peripheral,
     const std::shared_ptr<IScheduler>& scheduler,
     const std::shared_ptr<TelemetryPublisher>& telemetryPublisher,
     Queue<TConfigSpec>& configQueue,
     std::function<void(const TConfigSpec&)> configHandler) {
 
-    Task::run(name, 4096, [name, loggingTag, peripheral, scheduler, telemetryPublisher, &configQueue, configHandler](Task& /*task*/) {
+    Task::run(name, 4096, [name, &loggingTag, peripheral, scheduler, telemetryPublisher, &configQueue, configHandler](Task& /*task*/) {
         auto shouldPublishTelemetry = true;
         while (true) {
             ScheduleResult result = scheduler->tick();
@@ -0,0 +1,185 @@
+#include <sdkconfig.h>
+
+// Virtual time is only available when running tests on the host
+#ifdef CONFIG_IDF_TARGET_LINUX
+
+#include <algorithm>
+#include <cmath>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <functions/plot_controller/PlotController.hpp>
+
+#include <VirtualTime.hpp>
+
+using namespace farmhub::functions::plot_controller;
+using namespace farmhub::test;
+
+namespace {
+
+/**
+ * @brief A plot of soil with a valve, a flow meter and a soil moisture sensor.
+ *
+ * Water flows while the valve is open, and soaks into the soil gradually; the soil dries out at a steady rate.
+ * The state is brought up to date with the (virtual) clock whenever any of the peripherals is used.
+ */
+struct FakePlot {
+    static constexpr Liters FLOW_PER_MINUTE = 10.0;
+    static constexpr double GAIN_PERCENT_PER_LITER = 0.5;
+    static constexpr double EVAPORATION_PERCENT_PER_MINUTE = 0.01;
+    static constexpr auto SOAK_TIME = 20min;
+
+    void update() {
+        auto now = steady_clock::now();
+        auto minutes = duration<double, std::ratio<60>>(now - lastUpdate).count();
+        lastUpdate = now;
+        if (valveOpen) {
+            auto volume = FLOW_PER_MINUTE * minutes;
+            flowedVolume += volume;
+            soaking += volume * GAIN_PERCENT_PER_LITER;
+        }
+        auto soaked = soaking * (1.0 - std::exp(-minutes / duration<double, std::ratio<60>>(SOAK_TIME).count()));
+        soaking -= soaked;
+        moisture = std::clamp(moisture + soaked - (EVAPORATION_PERCENT_PER_MINUTE * minutes), 0.0, 100.0);
+    }
+
+    steady_clock::time_point lastUpdate = steady_clock::now();
+    bool valveOpen = false;
+    Liters flowedVolume = 0;
+    Percent soaking = 0;
+    Percent moisture = 65;
+    std::vector<milliseconds> openings;
+};
+
+struct FakeValve : IValve {
+    explicit FakeValve(const std::shared_ptr<FakePlot>& plot)
+        : plot(plot) {
+    }
+
+    bool transitionTo(std::optional<TargetState> target) override {
+        plot->update();
+        auto open = target == TargetState::Open;
+        if (open == plot->valveOpen) {
+            return false;
+        }
+        plot->valveOpen = open;
+        if (open) {
+            plot->openings.push_back(duration_cast<milliseconds>(steady_clock::now() - start));
+        }
+        return true;
+    }
+
+    ValveState getState() const override {
+        return plot->valveOpen ? ValveState::Open : ValveState::Closed;
+    }
+
+    const std::string& getName() const override {
+        return name;
+    }
+
+    const std::shared_ptr<FakePlot> plot;
+    const steady_clock::time_point start = steady_clock::now();
+    const std::string name = "valve";
+};
+
+struct FakeFlowMeter : IFlowMeter {
+    explicit FakeFlowMeter(const std::shared_ptr<FakePlot>& plot)
+        : plot(plot) {
+    }
+
+    Liters getVolume() override {
+        plot->update();
+        return std::exchange(plot->flowedVolume, 0.0);
+    }
+
+    const std::string& getName() const override {
+        return name;
+    }
+
+    const std::shared_ptr<FakePlot> plot;
+    const std::string name = "flow-meter";
+};
+
+struct FakeSoilMoistureSensor : ISoilMoistureSensor {
+    explicit FakeSoilMoistureSensor(const std::shared_ptr<FakePlot>& plot)
+        : plot(plot) {
+    }
+
+    Percent getMoisture() override {
+        plot->update();
+        return plot->moisture;
+    }
+
+    const std::string& getName() const override {
+        return name;
+    }
+
+    const std::shared_ptr<FakePlot> plot;
+    const std::string name = "soil";
+};
+
+struct SimulationResult {
+    std::vector<milliseconds> openings;
+    Percent moisture;
+    std::vector<TaskWakeup> wakeups;
+    nanoseconds hostTime;
+};
+
+SimulationResult simulatePlot(hours duration) {
+    VirtualTime time(sys_days { 2025y / May / 1 });
+    auto hostStart = VirtualTime::hostTime();
+
+    auto plot = std::make_shared<FakePlot>();
+    auto telemetryPublisher = std::make_shared<TelemetryPublisher>(std::make_shared<CopyQueue<bool>>("telemetry", 1));
+    PlotController controller(
+        "plot",
+        std::make_shared<FakeValve>(plot),
+        std::make_shared<OverrideScheduler>(),
+        std::make_shared<TimeBasedScheduler>(),
+        std::make_shared<MoistureBasedScheduler<SteadyClock>>(
+            farmhub::utils::scheduling::MoistureBasedSchedulerSettings {},
+            std::make_shared<SteadyClock>(),
+            std::make_shared<FakeFlowMeter>(plot),
+            std::make_shared<FakeSoilMoistureSensor>(plot)),
+        telemetryPublisher);
+
+    auto config = std::make_shared<PlotControllerConfig>();
+    // Keep the soil moist; the moisture based scheduler samples the sensor every 30 seconds while idle
+    config->loadFromString(R"({
+        "soilMoistureTarget": { "low": 60, "high": 70 }
+    })");
+    controller.configure(config);
+
+    time.runFor(duration);
+
+    return {
+        .openings = plot->openings,
+        .moisture = plot->moisture,
+        .wakeups = time.getWakeups(),
+        .hostTime = VirtualTime::hostTime() - hostStart,
+    };
+}
+
+}    // namespace
+
+TEST_CASE("plot controller waters a plot for a month in virtual time") {
+    const auto month = hours(30 * 24);
+    auto result = simulatePlot(month);
+
+    // The soil dries out by more than the target range every day, so it needs watering at least daily
+    REQUIRE(result.openings.size() >= 30);
+    REQUIRE(result.moisture > 50.0);
+
+    auto hostSeconds = duration<double>(result.hostTime).count();
+    WARN("Simulated " << month.count() << " hours in " << hostSeconds << " s ("
+                      << month.count() / hostSeconds << " simulated hours per second), "
+                      << result.wakeups.size() << " task wakeups, "
+                      << result.openings.size() << " valve openings");
+
+    // Same inputs, same outcome, down to the order of task wakeups
+    auto repeated = simulatePlot(month);
+    REQUIRE(repeated.openings == result.openings);
+    REQUIRE(repeated.wakeups == result.wakeups);
+}
+
+#endif
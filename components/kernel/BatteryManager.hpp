@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <list>
 #include <memory>
 
@@ -69,19 +70,28 @@ private:
         auto voltage = batteryVoltage.getAverage();
 
         if (voltage != 0 && voltage < battery->parameters.shutdownThreshold) {
-            LOGI("Battery voltage low (%d mV < %d mV), starting shutdown process, will go to deep sleep in %lld seconds",
-                voltage, battery->parameters.shutdownThreshold, duration_cast<seconds>(LOW_BATTERY_SHUTDOWN_TIMEOUT).count());
+            auto deadline = getShutdownDeadline();
+            LOGW("Battery voltage low (%d mV < %d mV), starting shutdown process, will go to deep sleep in %lld ms",
+                voltage, battery->parameters.shutdownThreshold, deadline.count());
 
-            // TODO Publish all MQTT messages, then shut down WiFi, and _then_ start shutting down peripherals
-            //      Doing so would result in less of a power spike, which can be important if the battery is already low
-
-            shutdownManager->startShutdown();
-            Task::delay(LOW_BATTERY_SHUTDOWN_TIMEOUT);
+            shutdownManager->shutdown(deadline);
             enterLowPowerDeepSleep();
         }
-        task.delayUntil(LOW_POWER_CHECK_INTERVAL);
+        task.delayUntil(LOW_POWER_CHECK_INTERVAL, LOW_POWER_CHECK_SLACK);
     };
 
+    /**
+     * @brief How long we can take to shut down: less when the battery is about to run out.
+     */
+    milliseconds getShutdownDeadline() {
+        auto timeToEmpty = battery->getTimeToEmpty();
+        if (!timeToEmpty.has_value()) {
+            return LOW_BATTERY_SHUTDOWN_TIMEOUT;
+        }
+        // Leave most of the remaining energy as reserve
+        return std::clamp<milliseconds>(duration_cast<milliseconds>(*timeToEmpty) / 4, MIN_LOW_BATTERY_SHUTDOWN_TIMEOUT, LOW_BATTERY_SHUTDOWN_TIMEOUT);
+    }
+
     const std::shared_ptr<BatteryDriver> battery;
     const std::shared_ptr<ShutdownManager> shutdownManager;
 
@@ -89,15 +99,23 @@ private:
 
     /**
      * @brief How often we check the battery voltage while in operation.
-     *
-     * We use a prime number to avoid synchronizing with other tasks.
      */
-    static constexpr auto LOW_POWER_CHECK_INTERVAL = 10313ms;
+    static constexpr auto LOW_POWER_CHECK_INTERVAL = 10s;
+
+    /**
+     * @brief How much later we can check the battery voltage, so that we can wake up together with other tasks.
+     */
+    static constexpr auto LOW_POWER_CHECK_SLACK = 2s;
 
     /**
      * @brief Time to wait for shutdown process to finish before going to deep sleep.
      */
-    static constexpr auto LOW_BATTERY_SHUTDOWN_TIMEOUT = 10s;
+    static constexpr milliseconds LOW_BATTERY_SHUTDOWN_TIMEOUT = 10s;
+
+    /**
+     * @brief Time we always allow for shutting down, so actuators can be put in a safe state.
+     */
+    static constexpr milliseconds MIN_LOW_BATTERY_SHUTDOWN_TIMEOUT = 2s;
 };
 
 }    // namespace farmhub::kernel
@@ -1,11 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
+#include <cstddef>
 #include <functional>
 #include <memory>
+#include <new>
 #include <optional>
 
 #include <freertos/FreeRTOS.h>    // NOLINT(misc-header-include-cycle)
+#include <freertos/task.h>        // NOLINT(misc-header-include-cycle)
 
 #include <Time.hpp>
 #include <utility>
@@ -14,6 +21,127 @@ using namespace std::chrono;
 
 namespace farmhub::kernel {
 
+/**
+ * @brief Wakes tasks up with a task notification when a message arrives in a queue or a state is set,
+ * for tasks that cannot block on the queue or event group itself, like a coroutine runner waiting
+ * for several of them at once.
+ *
+ * Subscriptions are kept in a small global table keyed by the queue's or event group's handle instead of
+ * in the queue, so notifying after a message is sent never touches the queue: the receiver might have
+ * destroyed it by then. Lock-free and safe to notify from an ISR. When the table is full, `subscribe()`
+ * fails, and the task has to check back periodically instead.
+ *
+ * Once `unsubscribe()` returns, the task is not notified anymore, so it can exit, and its slot can be
+ * reused by another task: `unsubscribe()` waits for notifications already in progress on the slot to finish.
+ */
+class TaskWakeups {
+public:
+    /**
+     * @brief Wake `task` whenever `source` is notified, until it unsubscribes.
+     *
+     * Check on the source after subscribing; anything that happened before might not wake the task.
+     *
+     * @return Whether there was room for the subscription.
+     */
+    static bool subscribe(const void* source, TaskHandle_t task) {
+        for (auto& subscription : subscriptions) {
+            TaskHandle_t expected = nullptr;
+            if (subscription.task.compare_exchange_strong(expected, task)) {
+                subscription.source.store(source);
+                subscription.active.store(true);
+                subscribers.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void unsubscribe(const void* source, TaskHandle_t task) {
+        for (auto& subscription : subscriptions) {
+            if (subscription.source.load() == source && subscription.task.load() == task) {
+                subscribers.fetch_sub(1);
+                subscription.source.store(nullptr);
+                // Keep the slot taken until notifiers that might still have seen the task are done with it
+                subscription.active.store(false);
+                while (subscription.notifying.load() > 0) {
+                    // A notifying task might be preempted by us, give it a chance to finish
+                    vTaskDelay(1);
+                }
+                subscription.task.store(nullptr);
+                return;
+            }
+        }
+    }
+
+    static void notify(const void* source) {
+        // Make sure the message or state is visible before checking for subscribers
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (subscribers.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        for (auto& subscription : subscriptions) {
+            if (subscription.source.load() == source) {
+                Notifying notifying(subscription);
+                if (subscription.active.load() && subscription.source.load() == source) {
+                    xTaskNotifyGive(subscription.task.load());
+                }
+            }
+        }
+    }
+
+    static void IRAM_ATTR notifyFromISR(const void* source) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (subscribers.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        for (auto& subscription : subscriptions) {
+            if (subscription.source.load() == source) {
+                Notifying notifying(subscription);
+                if (subscription.active.load() && subscription.source.load() == source) {
+                    vTaskNotifyGiveFromISR(subscription.task.load(), &xHigherPriorityTaskWoken);
+                }
+            }
+        }
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    }
+
+private:
+    struct Subscription {
+        std::atomic<const void*> source;
+        std::atomic<TaskHandle_t> task;
+        // Set while the task can be notified; the slot stays taken until `notifying` drops to zero after it is cleared
+        std::atomic<bool> active;
+        // Number of notifiers that might be about to notify the task
+        std::atomic<uint32_t> notifying;
+    };
+
+    /**
+     * @brief Marks a notification in progress on a subscription for as long as it exists.
+     */
+    class Notifying {
+    public:
+        explicit Notifying(Subscription& subscription)
+            : subscription(subscription) {
+            subscription.notifying.fetch_add(1);
+        }
+
+        ~Notifying() {
+            subscription.notifying.fetch_sub(1);
+        }
+
+        Notifying(const Notifying&) = delete;
+        Notifying& operator=(const Notifying&) = delete;
+
+    private:
+        Subscription& subscription;
+    };
+
+    inline static std::array<Subscription, 8> subscriptions {};
+    inline static std::atomic<size_t> subscribers { 0 };
+};
+
 class BaseQueue {
 protected:
     BaseQueue(const std::string& name, size_t messageSize, size_t capacity)
@@ -32,6 +160,13 @@ public:
         return uxQueueMessagesWaiting(queue);
     }
 
+    /**
+     * @brief What to subscribe to in `TaskWakeups` to be woken up when a message arrives.
+     */
+    const void* getWakeupSource() const {
+        return queue;
+    }
+
 protected:
     const std::string name;
 
@@ -70,13 +205,16 @@ public:
         requires std::constructible_from<TMessage, Args...>
     bool offerIn(ticks timeout, Args&&... args) {
         auto copy = new TMessage(std::forward<Args>(args)...);
-        bool sentWithoutDropping = xQueueSend(getQueueHandle(), reinterpret_cast<const void*>(&copy), timeout.count()) == pdTRUE;
+        auto* queue = getQueueHandle();
+        bool sentWithoutDropping = xQueueSend(queue, reinterpret_cast<const void*>(&copy), timeout.count()) == pdTRUE;
         if (!sentWithoutDropping) {
             printf("Overflow in queue '%s', dropping message\n",
                 this->name.c_str());
             delete copy;
+            return false;
         }
-        return sentWithoutDropping;
+        TaskWakeups::notify(queue);
+        return true;
     }
 
     using MessageHandler = std::function<void(TMessage&)>;
@@ -175,29 +313,40 @@ public:
     }
 
     bool offerIn(ticks timeout, const TMessage message) {
-        bool sentWithoutDropping = xQueueSend(getQueueHandle(), &message, timeout.count()) == pdTRUE;
+        auto* queue = getQueueHandle();
+        bool sentWithoutDropping = xQueueSend(queue, &message, timeout.count()) == pdTRUE;
         if (!sentWithoutDropping) {
             printf("Overflow in queue '%s', dropping message",
                 this->name.c_str());
+            return false;
         }
-        return sentWithoutDropping;
+        TaskWakeups::notify(queue);
+        return true;
     }
 
     bool IRAM_ATTR offerFromISR(const TMessage& message) {
         BaseType_t xHigherPriorityTaskWoken;
-        bool sentWithoutDropping = xQueueSendFromISR(getQueueHandle(), &message, &xHigherPriorityTaskWoken) == pdTRUE;
+        auto* queue = getQueueHandle();
+        bool sentWithoutDropping = xQueueSendFromISR(queue, &message, &xHigherPriorityTaskWoken) == pdTRUE;
         portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+        if (sentWithoutDropping) {
+            TaskWakeups::notifyFromISR(queue);
+        }
         return sentWithoutDropping;
     }
 
     void overwrite(const TMessage message) {
-        xQueueOverwrite(getQueueHandle(), &message);
+        auto* queue = getQueueHandle();
+        xQueueOverwrite(queue, &message);
+        TaskWakeups::notify(queue);
     }
 
     void IRAM_ATTR overwriteFromISR(const TMessage& message) {
         BaseType_t xHigherPriorityTaskWoken;
-        xQueueOverwriteFromISR(getQueueHandle(), &message, &xHigherPriorityTaskWoken);
+        auto* queue = getQueueHandle();
+        xQueueOverwriteFromISR(queue, &message, &xHigherPriorityTaskWoken);
         portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+        TaskWakeups::notifyFromISR(queue);
     }
 
     TMessage take() {
@@ -226,6 +375,355 @@ public:
     }
 };
 
+enum class QueueProducers : uint8_t {
+    // Messages are only ever offered by a single task or ISR
+    Single,
+    // Messages can be offered by any number of tasks or ISRs at the same time
+    Multiple,
+};
+
+/**
+ * @brief Queue that constructs messages in place in a fixed array of slots allocated up front,
+ * instead of allocating each message on the heap like `Queue` does.
+ *
+ * Messages are passed through the slots without taking any locks; semaphores are only
+ * used to wake up a consumer waiting for a message, or producers waiting for a free slot.
+ * Offering a message with `QueueProducers::Single` does not even need compare-and-swap.
+ *
+ * Messages must be consumed by a single task. Capacity is rounded up to a power of two.
+ * The consumer may destroy the queue as soon as it received the last message: the destructor
+ * waits for senders that are still waking up waiters after sending it.
+ *
+ * The slots are allocated when the queue is created and kept until it is destroyed:
+ * `getFootprint()` bytes, i.e. `capacity` times the size of a message plus a sequence number,
+ * whether or not any messages are queued. Size queues with that in mind.
+ */
+template <typename TMessage, QueueProducers Producers = QueueProducers::Multiple>
+class PooledQueue {
+public:
+    PooledQueue(const std::string& name, size_t capacity = 16)
+        : name(name)
+        , capacity(std::bit_ceil(std::max<size_t>(capacity, 2)))
+        , slots(std::make_unique<Slot[]>(this->capacity))
+        , messageAvailable(xSemaphoreCreateBinary())
+        , slotAvailable(xSemaphoreCreateBinary()) {
+        for (size_t i = 0; i < this->capacity; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~PooledQueue() {
+        while (sendersInProgress.load(std::memory_order_acquire) > 0) {
+            vTaskDelay(1);
+        }
+        clear();
+        vSemaphoreDelete(messageAvailable);
+        vSemaphoreDelete(slotAvailable);
+    }
+
+    PooledQueue(const PooledQueue&) = delete;
+    PooledQueue& operator=(const PooledQueue&) = delete;
+
+    /**
+     * @brief Bytes permanently allocated for the slots of the queue.
+     */
+    size_t getFootprint() const {
+        return capacity * sizeof(Slot);
+    }
+
+    template <typename... Args>
+        requires std::constructible_from<TMessage, Args...>
+    void put(Args&&... args) {
+        while (!offerIn(ticks::max(), std::forward<Args>(args)...)) { }
+    }
+
+    template <typename... Args>
+        requires std::constructible_from<TMessage, Args...>
+    bool offer(Args&&... args) {
+        return offerIn(ticks::zero(), std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+        requires std::constructible_from<TMessage, Args...>
+    bool offerIn(ticks timeout, Args&&... args) {
+        SendInProgress sending(sendersInProgress);
+        const void* source = getWakeupSource();
+        // Arguments are only forwarded once a slot is claimed, so they are intact for retries
+        bool sentWithoutDropping = waitFor(timeout, slotWaiters, slotAvailable, [&]() {
+            return tryOffer(std::forward<Args>(args)...);
+        });
+        if (!sentWithoutDropping) {
+            printf("Overflow in queue '%s', dropping message\n",
+                name.c_str());
+            return false;
+        }
+        notify(consumerWaiters, messageAvailable);
+        TaskWakeups::notify(source);
+        return true;
+    }
+
+    /**
+     * @brief Offer a message without blocking, and without reporting overflows; the caller keeps count of them instead.
+     */
+    template <typename... Args>
+        requires std::constructible_from<TMessage, Args...>
+    bool offerQuietly(Args&&... args) {
+        SendInProgress sending(sendersInProgress);
+        const void* source = getWakeupSource();
+        if (!tryOffer(std::forward<Args>(args)...)) {
+            return false;
+        }
+        notify(consumerWaiters, messageAvailable);
+        TaskWakeups::notify(source);
+        return true;
+    }
+
+    /**
+     * @brief Offer a message from an ISR without blocking.
+     *
+     * The message's constructor must be safe to call from an ISR, too.
+     */
+    template <typename... Args>
+        requires std::constructible_from<TMessage, Args...>
+    bool IRAM_ATTR offerFromISR(Args&&... args) {
+        SendInProgress sending(sendersInProgress);
+        const void* source = getWakeupSource();
+        if (!tryOffer(std::forward<Args>(args)...)) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumerWaiters.load(std::memory_order_relaxed) > 0) {
+            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+            xSemaphoreGiveFromISR(messageAvailable, &xHigherPriorityTaskWoken);
+            portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+        }
+        TaskWakeups::notifyFromISR(source);
+        return true;
+    }
+
+    using MessageHandler = std::function<void(TMessage&)>;
+
+    size_t drain(const MessageHandler& handler) {
+        return drain(SIZE_MAX, handler);
+    }
+
+    size_t drain(size_t maxItems, const MessageHandler& handler) {
+        size_t count = 0;
+        while (count < maxItems) {
+            if (!poll(handler)) {
+                break;
+            }
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Wait for the first item to appear within the given timeout,
+     * then drain any items remaining in the queue.
+     */
+    size_t drainIn(ticks timeout, const MessageHandler& handler) {
+        return drainIn(SIZE_MAX, timeout, handler);
+    }
+
+    /**
+     * @brief Wait for the first item to appear within the given timeout,
+     * then drain no more than `maxItems` items remaining in the queue.
+     */
+    size_t drainIn(size_t maxItems, ticks timeout, const MessageHandler& handler) {
+        size_t count = 0;
+        ticks nextTimeout = timeout;
+        while (count < maxItems) {
+            if (!pollIn(nextTimeout, handler)) {
+                break;
+            }
+            count++;
+            nextTimeout = ticks::zero();
+        }
+        return count;
+    }
+
+    void take() {
+        take([](const TMessage& message) { });
+    }
+
+    void take(const MessageHandler& handler) {
+        while (!pollIn(ticks::max(), handler)) { }
+    }
+
+    bool poll() {
+        return poll([](const TMessage& message) { });
+    }
+
+    bool poll(const MessageHandler& handler) {
+        return pollIn(ticks::zero(), handler);
+    }
+
+    bool pollIn(ticks timeout) {
+        return pollIn(timeout, [](const TMessage& message) { });
+    }
+
+    bool pollIn(ticks timeout, const MessageHandler& handler) {
+        Slot* slot = waitFor(timeout, consumerWaiters, messageAvailable, [this]() {
+            return peek();
+        });
+        if (slot == nullptr) {
+            return false;
+        }
+        handler(*slot->message());
+        slot->message()->~TMessage();
+        auto position = dequeuePosition.load(std::memory_order_relaxed);
+        slot->sequence.store(position + capacity, std::memory_order_release);
+        dequeuePosition.store(position + 1, std::memory_order_relaxed);
+        notify(slotWaiters, slotAvailable);
+        return true;
+    }
+
+    void clear() {
+        drain([](const TMessage& message) { });
+    }
+
+    size_t size() const {
+        return enqueuePosition.load(std::memory_order_relaxed) - dequeuePosition.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief What to subscribe to in `TaskWakeups` to be woken up when a message arrives.
+     */
+    const void* getWakeupSource() const {
+        return this;
+    }
+
+private:
+    struct Slot {
+        // Equals the position of the next message to be written to the slot while the slot is free,
+        // and the position plus one while it holds a message
+        std::atomic<size_t> sequence;
+        alignas(TMessage) std::byte storage[sizeof(TMessage)];
+
+        TMessage* message() {
+            return std::launder(reinterpret_cast<TMessage*>(storage));
+        }
+    };
+
+    /**
+     * @brief Counts a send from before its message is published until after waiters are notified about it.
+     */
+    class SendInProgress {
+    public:
+        explicit SendInProgress(std::atomic<size_t>& senders)
+            : senders(senders) {
+            senders.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ~SendInProgress() {
+            senders.fetch_sub(1, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<size_t>& senders;
+    };
+
+    template <typename... Args>
+    bool IRAM_ATTR tryOffer(Args&&... args) {
+        auto position = enqueuePosition.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[position & (capacity - 1)];
+            auto sequence = slot->sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+            if (difference < 0) {
+                // The slot still holds a message from the previous round, the queue is full
+                return false;
+            }
+            if (difference == 0) {
+                if constexpr (Producers == QueueProducers::Single) {
+                    enqueuePosition.store(position + 1, std::memory_order_relaxed);
+                    break;
+                } else if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else {
+                // Another producer claimed the slot first
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+        new (slot->storage) TMessage(std::forward<Args>(args)...);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    Slot* peek() {
+        auto position = dequeuePosition.load(std::memory_order_relaxed);
+        Slot* slot = &slots[position & (capacity - 1)];
+        if (slot->sequence.load(std::memory_order_acquire) != position + 1) {
+            return nullptr;
+        }
+        return slot;
+    }
+
+    /**
+     * @brief Retry `attempt` until it succeeds, sleeping on `signal` in between, but no longer than `timeout`.
+     */
+    template <typename Attempt>
+    static auto waitFor(ticks timeout, std::atomic<size_t>& waiters, SemaphoreHandle_t signal, Attempt&& attempt) -> decltype(attempt()) {
+        auto result = attempt();
+        if (result || timeout == ticks::zero()) {
+            return result;
+        }
+        // Let the other side catch up before going to sleep, it is much cheaper than being woken up
+        taskYIELD();
+        result = attempt();
+        if (result) {
+            return result;
+        }
+        TimeOut_t timeOut;
+        vTaskSetTimeOutState(&timeOut);
+        TickType_t remaining = timeout.count();
+        while (true) {
+            // Register as waiting before checking again, so a notification cannot slip in between
+            waiters.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            result = attempt();
+            if (result) {
+                waiters.fetch_sub(1, std::memory_order_relaxed);
+                break;
+            }
+            bool signalled = xSemaphoreTake(signal, remaining) == pdTRUE;
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (!signalled || xTaskCheckForTimeOut(&timeOut, &remaining) == pdTRUE) {
+                return attempt();
+            }
+        }
+        // The signal only wakes one waiter, pass it on in case there is room for others, too
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            xSemaphoreGive(signal);
+        }
+        return result;
+    }
+
+    static void notify(std::atomic<size_t>& waiters, SemaphoreHandle_t signal) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            xSemaphoreGive(signal);
+        }
+    }
+
+    const std::string name;
+    const size_t capacity;
+    const std::unique_ptr<Slot[]> slots;
+
+    std::atomic<size_t> enqueuePosition { 0 };
+    std::atomic<size_t> dequeuePosition { 0 };
+
+    std::atomic<size_t> consumerWaiters { 0 };
+    const SemaphoreHandle_t messageAvailable;
+    std::atomic<size_t> slotWaiters { 0 };
+    const SemaphoreHandle_t slotAvailable;
+
+    std::atomic<size_t> sendersInProgress { 0 };
+};
+
 class MutexBase {
 public:
     virtual ~MutexBase() = default;
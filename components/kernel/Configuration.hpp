@@ -1,16 +1,28 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <concepts>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <list>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <ArduinoJson.h>
 
 #include <FileSystem.hpp>
+#include <PowerManagementLock.hpp>
 
 using std::list;
 using std::ref;
@@ -32,6 +44,16 @@ public:
     const std::string message;
 };
 
+/**
+ * @brief 64-bit FNV-1a; good enough to tell whether something has changed, cheap to run over whole files.
+ */
+inline uint64_t fnv1a64(std::string_view data, uint64_t hash = 14695981039346656037ULL) {
+    for (auto byte : data) {
+        hash = (hash ^ static_cast<uint8_t>(byte)) * 1099511628211ULL;
+    }
+    return hash;
+}
+
 class JsonAsString {
 public:
     JsonAsString() = default;
@@ -61,34 +83,100 @@ class ConfigurationEntry {
 public:
     virtual ~ConfigurationEntry() = default;
 
+    virtual void load(JsonObjectConst json) = 0;
+    virtual void reset() = 0;
+    virtual void store(JsonObject& json) const = 0;
+    virtual bool hasValue() const = 0;
+};
+
+class ConfigurationSection;
+
+/**
+ * @brief An entry stored under its own key in its parent section.
+ */
+class KeyedConfigurationEntry : public ConfigurationEntry {
+public:
+    KeyedConfigurationEntry(ConfigurationSection* parent, const std::string& name);
+
+    const std::string& getName() const {
+        return name;
+    }
+
+    void load(JsonObjectConst json) override {
+        loadValue(json[name]);
+    }
+
+    /**
+     * @brief Load from the value under this entry's key; null if the key is missing.
+     */
+    virtual void loadValue(JsonVariantConst json) = 0;
+
+    /**
+     * @brief Mark what this entry needs from its parent's JSON in `filter`.
+     */
+    virtual void populateFilter(JsonObject& filter) const {
+        filter[name] = true;
+    }
+
+protected:
+    const std::string name;
+};
+
+/**
+ * @brief A group of entries loaded from a JSON object.
+ *
+ * The first time a section is loaded it compiles its entries into a table sorted by key,
+ * so loading takes a single pass over the JSON object, looking up each key with binary search.
+ * When parsing from a string, only the keys in the table are kept, and unknown fields
+ * never make it to the heap.
+ */
+class ConfigurationSection : public ConfigurationEntry {
+public:
+    void add(KeyedConfigurationEntry& entry) {
+        auto reference = std::ref(entry);
+        entries.push_back(reference);
+        index.clear();
+        filter.clear();
+    }
+
     void loadFromString(const std::string& json) {
+        PowerManagementLockGuard parsing(Workloads::configuration);
         JsonDocument jsonDocument;
-        DeserializationError error = deserializeJson(jsonDocument, json);
+        DeserializationError error = deserialize(jsonDocument, json);
         if (error == DeserializationError::EmptyInput) {
             return;
         }
         if (error) {
             throw ConfigurationException("Cannot parse JSON configuration: " + std::string(error.c_str()) + ": " + json);
         }
-        load(jsonDocument.as<JsonObject>());
+        load(jsonDocument.as<JsonObjectConst>());
     }
 
-    virtual void load(const JsonObject& json) = 0;
-    virtual void reset() = 0;
-    virtual void store(JsonObject& json) const = 0;
-    virtual bool hasValue() const = 0;
-};
-
-class ConfigurationSection : public ConfigurationEntry {
-public:
-    void add(ConfigurationEntry& entry) {
-        auto reference = std::ref(entry);
-        entries.push_back(reference);
+    /**
+     * @brief Parse `json` into `document`, keeping only what the entries of this section need.
+     */
+    DeserializationError deserialize(JsonDocument& document, const std::string& json) const {
+        return deserializeJson(document, json, DeserializationOption::Filter(getFilter()));
     }
 
-    void load(const JsonObject& json) override {
-        for (auto& entry : entries) {
-            entry.get().load(json);
+    void load(JsonObjectConst json) override {
+        compile();
+        for (auto& indexed : index) {
+            indexed.loaded = false;
+        }
+        for (JsonPairConst pair : json) {
+            std::string_view key = pair.key().c_str();
+            auto it = std::ranges::lower_bound(index, key, {}, &IndexedEntry::key);
+            for (; it != index.end() && it->key == key; ++it) {
+                it->entry->loadValue(pair.value());
+                it->loaded = true;
+            }
+        }
+        // Missing keys load as null, the same as looking them up would
+        for (auto& indexed : index) {
+            if (!indexed.loaded) {
+                indexed.entry->loadValue(JsonVariantConst());
+            }
         }
     }
 
@@ -113,10 +201,54 @@ public:
         return false;
     }
 
+    void populateFilter(JsonObject& filter) const {
+        for (const auto& entry : entries) {
+            entry.get().populateFilter(filter);
+        }
+    }
+
+    /**
+     * @brief The filter to keep only the fields of this section when parsing; built on first use.
+     */
+    const JsonDocument& getFilter() const {
+        if (filter.isNull()) {
+            auto root = filter.to<JsonObject>();
+            populateFilter(root);
+        }
+        return filter;
+    }
+
 private:
-    list<reference_wrapper<ConfigurationEntry>> entries;
+    struct IndexedEntry {
+        std::string_view key;
+        KeyedConfigurationEntry* entry;
+        bool loaded;
+    };
+
+    void compile() {
+        if (!index.empty() || entries.empty()) {
+            return;
+        }
+        index.reserve(entries.size());
+        for (auto& entry : entries) {
+            index.push_back({ entry.get().getName(), &entry.get(), false });
+        }
+        // Stable, so entries sharing a key load in the order they were declared
+        std::ranges::stable_sort(index, {}, &IndexedEntry::key);
+    }
+
+    // In declaration order, for storing
+    list<reference_wrapper<KeyedConfigurationEntry>> entries;
+    // Sorted by key, for loading
+    std::vector<IndexedEntry> index;
+    mutable JsonDocument filter;
 };
 
+inline KeyedConfigurationEntry::KeyedConfigurationEntry(ConfigurationSection* parent, const std::string& name)
+    : name(name) {
+    parent->add(*this);
+}
+
 class EmptyConfiguration : public ConfigurationSection { };
 
 // Interface indicating the implementation supports configuration via TConfig
@@ -128,12 +260,11 @@ public:
 };
 
 template <std::derived_from<ConfigurationEntry> TDelegateEntry>
-class NamedConfigurationEntry : public ConfigurationEntry {
+class NamedConfigurationEntry : public KeyedConfigurationEntry {
 public:
     NamedConfigurationEntry(ConfigurationSection* parent, const std::string& name, std::shared_ptr<TDelegateEntry> delegate)
-        : name(name)
+        : KeyedConfigurationEntry(parent, name)
         , delegate(std::move(delegate)) {
-        parent->add(*this);
     }
 
     template <typename... Args>
@@ -142,15 +273,24 @@ public:
         : NamedConfigurationEntry(parent, name, std::make_shared<TDelegateEntry>(std::forward<Args>(args)...)) {
     }
 
-    void load(const JsonObject& json) override {
-        if (json[name].is<JsonObject>()) {
+    void loadValue(JsonVariantConst json) override {
+        if (json.is<JsonObjectConst>()) {
             namePresentAtLoad = true;
-            delegate->load(json[name]);
+            delegate->load(json.as<JsonObjectConst>());
         } else {
             reset();
         }
     }
 
+    void populateFilter(JsonObject& filter) const override {
+        if constexpr (std::derived_from<TDelegateEntry, ConfigurationSection>) {
+            auto section = filter[name].to<JsonObject>();
+            delegate->populateFilter(section);
+        } else {
+            filter[name] = true;
+        }
+    }
+
     void store(JsonObject& json) const override {
         if (hasValue()) {
             auto section = json[name].to<JsonObject>();
@@ -172,20 +312,18 @@ public:
     }
 
 private:
-    const std::string name;
     const std::shared_ptr<TDelegateEntry> delegate;
     bool namePresentAtLoad = false;
 };
 
 template <typename T>
-class Property : public ConfigurationEntry {
+class Property : public KeyedConfigurationEntry {
 public:
     Property(ConfigurationSection* parent, const std::string& name, const T& defaultValue = T(), const bool secret = false)
-        : name(name)
+        : KeyedConfigurationEntry(parent, name)
         , secret(secret)
         , value(defaultValue)
         , defaultValue(defaultValue) {
-        parent->add(*this);
     }
 
     T get() const {
@@ -203,9 +341,9 @@ public:
         return std::nullopt;
     }
 
-    void load(const JsonObject& json) override {
-        if (json[name].is<T>()) {
-            value = json[name].as<T>();
+    void loadValue(JsonVariantConst json) override {
+        if (json.is<T>()) {
+            value = json.as<T>();
             configured = true;
         } else {
             reset();
@@ -233,7 +371,6 @@ public:
     }
 
 private:
-    const std::string name;
     const bool secret;
     bool configured = false;
     T value;
@@ -241,21 +378,20 @@ private:
 };
 
 template <typename T>
-class ArrayProperty : public ConfigurationEntry {
+class ArrayProperty : public KeyedConfigurationEntry {
 public:
     ArrayProperty(ConfigurationSection* parent, const std::string& name)
-        : name(name) {
-        parent->add(*this);
+        : KeyedConfigurationEntry(parent, name) {
     }
 
     const std::list<T>& get() const {
         return entries;
     }
 
-    void load(const JsonObject& json) override {
+    void loadValue(JsonVariantConst json) override {
         reset();
-        if (json[name].is<JsonArray>()) {
-            auto jsonArray = json[name].as<JsonArray>();
+        if (json.is<JsonArrayConst>()) {
+            auto jsonArray = json.as<JsonArrayConst>();
             for (auto jsonEntry : jsonArray) {
                 const T& entry = jsonEntry.as<T>();
                 entries.push_back(entry);
@@ -279,48 +415,353 @@ public:
     }
 
 private:
-    const std::string name;
     std::list<T> entries;
 };
 
+/**
+ * @brief A binary copy of a loaded configuration file, so that booting does not have to parse its JSON again.
+ *
+ * Kept in `<path>.bin`: the filtered document in MessagePack, after a header with the size and checksum of the JSON
+ * it was taken from, a checksum of the section's filter, and a checksum of the payload. The JSON is still read to check
+ * that it has not changed, however it got changed, but it is not parsed. Firmware with different settings ignores the snapshot,
+ * and so does a boot after a torn write. The journal drops the snapshot when it changes the file, as it is out of date.
+ */
+class ConfigurationSnapshot {
+public:
+    ConfigurationSnapshot(const std::shared_ptr<FileSystem>& fs, const std::string& sourcePath, const ConfigurationSection& config)
+        : fs(fs)
+        , sourcePath(sourcePath)
+        , path(sourcePath + SUFFIX)
+        , schema(schemaOf(config)) {
+    }
+
+    /**
+     * @brief Read the snapshot into `document`, unless it is missing, damaged, or out of date.
+     */
+    bool read(JsonDocument& document) const {
+        auto contents = fs->readAll(path);
+        if (!contents.has_value()) {
+            return false;
+        }
+        Header header {};
+        if (contents->size() < sizeof(Header)) {
+            return false;
+        }
+        std::memcpy(&header, contents->data(), sizeof(Header));
+        auto payload = std::string_view(*contents).substr(sizeof(Header));
+        if (header.magic != MAGIC
+            || header.schema != schema
+            || header.sourceSize != fs->size(sourcePath)
+            || header.payloadChecksum != fnv1a64(payload)
+            || header.sourceChecksum != checksumOfSource()) {
+            LOGD("The snapshot of '%s' is out of date",
+                sourcePath.c_str());
+            return false;
+        }
+        return deserializeMsgPack(document, payload.data(), payload.size()) == DeserializationError::Ok;
+    }
+
+    /**
+     * @brief Take a snapshot of `document`, parsed from `source`.
+     */
+    void write(const JsonDocument& document, const std::string& source) const {
+        std::string payload;
+        serializeMsgPack(document, payload);
+        Header header {
+            .magic = MAGIC,
+            .sourceSize = static_cast<uint32_t>(source.size()),
+            .sourceChecksum = fnv1a64(source),
+            .schema = schema,
+            .payloadChecksum = fnv1a64(payload),
+        };
+        std::string contents(reinterpret_cast<const char*>(&header), sizeof(Header));
+        contents.append(payload);
+        if (fs->writeAll(path, contents) != contents.size()) {
+            LOGW("Cannot write snapshot of '%s'",
+                sourcePath.c_str());
+            fs->remove(path);
+        }
+    }
+
+    /**
+     * @brief Drop the snapshot of the given file, which is out of date once the file changes.
+     */
+    static void invalidate(const FileSystem& fs, const std::string& sourcePath) {
+        fs.remove(sourcePath + SUFFIX);
+    }
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t sourceSize;
+        uint64_t sourceChecksum;
+        uint64_t schema;
+        uint64_t payloadChecksum;
+    };
+    static_assert(sizeof(Header) == 32);
+
+    // "FHS1" in little-endian; a change to the format needs a new one
+    static constexpr uint32_t MAGIC = 0x31534846;
+    static constexpr const char* SUFFIX = ".bin";
+
+    /**
+     * @brief Checksum of the JSON, read a chunk at a time, so it does not need to fit in memory once more.
+     */
+    uint64_t checksumOfSource() const {
+        FILE* file = fs->open(sourcePath, "r");
+        if (file == nullptr) {
+            return 0;
+        }
+        std::array<char, 256> buffer;
+        uint64_t checksum = fnv1a64({});
+        size_t bytesRead = 0;
+        while ((bytesRead = fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+            checksum = fnv1a64(std::string_view(buffer.data(), bytesRead), checksum);
+        }
+        (void) fclose(file);
+        return checksum;
+    }
+
+    static uint64_t schemaOf(const ConfigurationSection& config) {
+        std::string filter;
+        serializeJson(config.getFilter(), filter);
+        return fnv1a64(filter);
+    }
+
+    const std::shared_ptr<FileSystem> fs;
+    const std::string sourcePath;
+    const std::string path;
+    const uint64_t schema;
+};
+
+/**
+ * @brief Replaces a configuration file so that a crash at any point leaves either its old or its new contents.
+ *
+ * New contents are first written to `<path>.new`, and only replace the file once they read back with the
+ * right checksum. The replaced contents are kept in `<path>.prev`. Until the new contents are confirmed,
+ * `<path>.pending` holds their checksum. A boot that loads pending contents leaves `<path>.tried` behind;
+ * if the next boot still finds it, the device did not come up with the new contents, and they are rolled back.
+ */
+class ConfigurationJournal {
+public:
+    ConfigurationJournal(const std::shared_ptr<FileSystem>& fs, const std::string& path)
+        : fs(fs)
+        , path(path)
+        , newPath(path + ".new")
+        , prevPath(path + ".prev")
+        , pendingPath(path + ".pending")
+        , triedPath(path + ".tried") {
+    }
+
+    /**
+     * @brief Replace the file with `contents`; throws `ConfigurationException` if it cannot.
+     *
+     * Does nothing if the file already has these contents.
+     */
+    void write(const std::string& contents) const {
+        auto checksum = fnv1a64(contents);
+        std::lock_guard lock(loadedMutex);
+        if (fs->exists(path) && checksumOf(path) == checksum) {
+            // Rewriting would only wear the flash, and make confirmed contents pending again
+            return;
+        }
+        ConfigurationSnapshot::invalidate(*fs, path);
+        fs->remove(newPath);
+        if (fs->writeAll(newPath, contents) != contents.size() || checksumOf(newPath) != checksum) {
+            fs->remove(newPath);
+            throw ConfigurationException("Cannot write config file " + newPath);
+        }
+
+        if (fs->exists(pendingPath)) {
+            // What we are replacing was never confirmed, keep the previous contents as they are
+            fs->remove(path);
+        } else {
+            fs->remove(prevPath);
+            bool saved = fs->exists(path)
+                ? fs->rename(path, prevPath) == 0
+                // There was no file before, rolling back should restore the defaults
+                : fs->writeAll(prevPath, "{}") != 0U;
+            if (!saved) {
+                repair();
+                throw ConfigurationException("Cannot keep previous config file " + prevPath);
+            }
+        }
+
+        fs->remove(triedPath);
+        auto pending = std::to_string(checksum);
+        if (fs->writeAll(pendingPath, pending) != pending.size() || fs->rename(newPath, path) != 0) {
+            repair();
+            throw ConfigurationException("Cannot replace config file " + path);
+        }
+    }
+
+    /**
+     * @brief Finish or undo a write that was interrupted, and roll back pending contents
+     * that a previous boot has already tried.
+     *
+     * @return whether the file has pending contents that need to be confirmed.
+     */
+    bool recover() const {
+        repair();
+        auto pending = readPendingChecksum();
+        if (!pending.has_value()) {
+            return false;
+        }
+        if (fs->exists(triedPath)) {
+            LOGW("The device did not start with the new contents of '%s' last time, rolling back",
+                path.c_str());
+            rollback();
+            return false;
+        }
+        if (checksumOf(path) != *pending) {
+            rollback();
+            return false;
+        }
+        fs->writeAll(triedPath, "1");
+        return true;
+    }
+
+    /**
+     * @brief Restore the previous contents of the file.
+     */
+    void rollback() const {
+        ConfigurationSnapshot::invalidate(*fs, path);
+        // Without the previous file we have already restored it, and only need to clean up
+        if (fs->exists(prevPath)) {
+            fs->remove(path);
+            fs->rename(prevPath, path);
+        }
+        fs->remove(pendingPath);
+        fs->remove(triedPath);
+    }
+
+    /**
+     * @brief Keep the new contents of the file.
+     */
+    void confirm() const {
+        fs->remove(pendingPath);
+        fs->remove(triedPath);
+    }
+
+    /**
+     * @brief Keep the new contents of the files loaded during this boot; call when the device has started.
+     *
+     * Contents written after they were loaded have not been tried yet, and are left pending for the next boot.
+     */
+    static void confirmLoaded() {
+        std::lock_guard lock(loadedMutex);
+        for (const auto& [journal, checksum] : loaded) {
+            if (journal.readPendingChecksum() != checksum) {
+                LOGI("Contents of '%s' changed since they were loaded, leaving them for the next boot to confirm",
+                    journal.path.c_str());
+                continue;
+            }
+            LOGI("Confirming new contents of '%s'",
+                journal.path.c_str());
+            journal.confirm();
+        }
+        loaded.clear();
+    }
+
+    /**
+     * @brief Remember that this boot has loaded the pending contents of the file.
+     */
+    void markLoaded() const {
+        std::lock_guard lock(loadedMutex);
+        if (auto checksum = readPendingChecksum(); checksum.has_value()) {
+            loaded.emplace_back(*this, *checksum);
+        }
+    }
+
+private:
+    void repair() const {
+        if (fs->exists(newPath)) {
+            auto pending = readPendingChecksum();
+            if (pending.has_value() && !fs->exists(path) && checksumOf(newPath) == *pending) {
+                // Interrupted right before the new contents took the place of the old
+                fs->rename(newPath, path);
+            } else {
+                // Interrupted while writing the new contents
+                fs->remove(newPath);
+            }
+        }
+        if (!fs->exists(path) && fs->exists(prevPath)) {
+            // Interrupted after moving the old contents away
+            LOGW("Restoring previous contents of '%s'",
+                path.c_str());
+            rollback();
+        }
+    }
+
+    std::optional<uint64_t> readPendingChecksum() const {
+        auto contents = fs->readAll(pendingPath);
+        if (!contents.has_value()) {
+            return std::nullopt;
+        }
+        // A marker we cannot read matches nothing, so we roll back
+        char* end = nullptr;
+        auto checksum = std::strtoull(contents->c_str(), &end, 10);
+        return end != contents->c_str() && *end == '\0' ? checksum : 0;
+    }
+
+    uint64_t checksumOf(const std::string& filePath) const {
+        auto contents = fs->readAll(filePath);
+        return contents.has_value() ? fnv1a64(*contents) : 0;
+    }
+
+    const std::shared_ptr<FileSystem> fs;
+    const std::string path;
+    const std::string newPath;
+    const std::string prevPath;
+    const std::string pendingPath;
+    const std::string triedPath;
+
+    // Also held while writing, so a write cannot slip in between checking and confirming contents
+    inline static std::mutex loadedMutex;
+    // Journals with pending contents loaded during this boot, with the checksum of what was loaded
+    inline static std::list<std::pair<ConfigurationJournal, uint64_t>> loaded;
+};
+
 template <std::derived_from<ConfigurationSection> TConfiguration>
 class ConfigurationFile {
 public:
     ConfigurationFile(const std::shared_ptr<FileSystem>& fs, const std::string& path, std::shared_ptr<TConfiguration> config)
         : path(path)
         , config(std::move(config)) {
+        ConfigurationJournal journal(fs, path);
+        bool pending = journal.recover();
         if (!fs->exists(path)) {
             LOGD("The configuration file '%s' was not found, falling back to defaults",
                 path.c_str());
         } else {
-            auto contents = fs->readAll(path);
-            if (!contents.has_value()) {
-                throw ConfigurationException("Cannot open config file " + path);
+            PowerManagementLockGuard parsing(Workloads::configuration);
+            ConfigurationSnapshot snapshot(fs, path, *this->config);
+            // Pending contents are always parsed, as failing to parse them is what rolls them back
+            if (pending || !loadSnapshot(snapshot)) {
+                try {
+                    loadFile(*fs, pending ? nullptr : &snapshot);
+                } catch (const ConfigurationException& e) {
+                    if (!pending) {
+                        throw;
+                    }
+                    LOGW("Cannot load new contents of '%s', rolling back: %s",
+                        path.c_str(), e.what());
+                    journal.rollback();
+                    pending = false;
+                    this->config->reset();
+                    loadFile(*fs, &snapshot);
+                }
             }
-
-            JsonDocument json;
-            DeserializationError error = deserializeJson(json, contents.value());
-            switch (error.code()) {
-                case DeserializationError::Code::Ok:
-                    break;
-                case DeserializationError::Code::EmptyInput:
-                    LOGD("The configuration file '%s' is empty, falling back to defaults",
-                        path.c_str());
-                    break;
-                default:
-                    throw ConfigurationException("Cannot open config file " + path + " (" + std::string(error.c_str()) + ")");
+            if (pending) {
+                journal.markLoaded();
             }
-            update(json.as<JsonObject>());
             LOGD("Effective configuration for '%s': %s",
                 path.c_str(), toString().c_str());
         }
-        onUpdate([fs, path](const JsonObject& json) {
+        onUpdate([journal](const JsonObject& json) {
             std::string contents;
             serializeJson(json, contents);
-            bool success = fs->writeAll(path, contents) != 0U;
-            if (!success) {
-                throw ConfigurationException("Cannot write config file " + path);
-            }
+            journal.write(contents);
         });
     }
 
@@ -358,6 +799,45 @@ public:
     }
 
 private:
+    bool loadSnapshot(const ConfigurationSnapshot& snapshot) {
+        JsonDocument json;
+        if (!snapshot.read(json)) {
+            return false;
+        }
+        update(json.as<JsonObject>());
+        return true;
+    }
+
+    /**
+     * @brief Parse the file; if `snapshot` is given, take a snapshot of what was parsed for the next boot.
+     */
+    void loadFile(const FileSystem& fs, const ConfigurationSnapshot* snapshot) {
+        auto contents = fs.readAll(path);
+        if (!contents.has_value()) {
+            throw ConfigurationException("Cannot open config file " + path);
+        }
+        loadJson(*contents, snapshot);
+    }
+
+    void loadJson(const std::string& contents, const ConfigurationSnapshot* snapshot) {
+        JsonDocument json;
+        DeserializationError error = config->deserialize(json, contents);
+        switch (error.code()) {
+            case DeserializationError::Code::Ok:
+                break;
+            case DeserializationError::Code::EmptyInput:
+                LOGD("The configuration file '%s' is empty, falling back to defaults",
+                    path.c_str());
+                break;
+            default:
+                throw ConfigurationException("Cannot open config file " + path + " (" + std::string(error.c_str()) + ")");
+        }
+        update(json.as<JsonObject>());
+        if (snapshot != nullptr && error == DeserializationError::Ok) {
+            snapshot->write(json, contents);
+        }
+    }
+
     const std::string path;
     std::shared_ptr<TConfiguration> config;
     std::list<std::function<void(const JsonObject&)>> callbacks;
@@ -1,8 +1,24 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <esp_system.h>
+
 #include <Concurrent.hpp>
+#include <CrashLog.hpp>
+#include <DeferredLog.hpp>
 #include <Log.hpp>
-#include <utility>
+#include <Task.hpp>
 
 namespace farmhub::kernel {
 
@@ -17,47 +33,112 @@ namespace farmhub::kernel {
 #define FARMHUB_LOG_BOLD(COLOR) "\033[1;" COLOR "m"
 #define FARMHUB_LOG_RESET_COLOR "\033[0m"
 
+/**
+ * @brief Takes over ESP-IDF logging: log calls only capture their messages, and the "console" task
+ * formats them, prints them to the console, and passes them on to be published.
+ *
+ * Costs the rings of the `DeferredLog` (see `DeferredLog::getFootprint()`, 8 KB on a dual-core chip)
+ * plus the console task's stack of `CONSOLE_STACK_SIZE` bytes.
+ *
+ * Messages still waiting for the console task are lost on a reset; `flush()` gets them out before a planned
+ * one, and it runs on `esp_restart()`, too.
+ *
+ * Warnings and errors are also formatted right away on the logging task, to keep them in the crash log
+ * even if the device crashes before they are drained. Info and lower levels are only formatted by the console task.
+ */
 class ConsoleProvider {
 public:
-    static void init(std::shared_ptr<Queue<LogRecord>> logRecords, Level recordedLevel) {
+    static void init(std::shared_ptr<PooledQueue<LogRecord>> logRecords, Level recordedLevel, std::shared_ptr<CrashLog> crashLog) {
         ConsoleProvider::logRecords = std::move(logRecords);
         ConsoleProvider::recordedLevel = recordedLevel;
+        ConsoleProvider::crashLog = std::move(crashLog);
+        ConsoleProvider::deferredLog = std::make_shared<DeferredLog>();
+        ConsoleProvider::partialMessages.resize(ConsoleProvider::deferredLog->getRingCount());
+        Task::loop("console", CONSOLE_STACK_SIZE, [deferredLog = ConsoleProvider::deferredLog](Task& /*task*/) {
+            deferredLog->awaitMessages();
+            deferredLog->drain(processLog);
+        });
         ConsoleProvider::originalVprintf = esp_log_set_vprintf(ConsoleProvider::processLogFunc);
+        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_register_shutdown_handler([]() {
+            flush(clampTicks(FLUSH_ON_RESTART_TIMEOUT));
+        }));
+    }
+
+    /**
+     * @brief Print and pass on the messages captured so far on the calling task, without waiting for the console task.
+     *
+     * Gives up if the console task is still busy with earlier messages after `timeout`.
+     */
+    static void flush(ticks timeout) {
+        if (deferredLog == nullptr) {
+            return;
+        }
+        deferredLog->drain(processLog, timeout);
+        (void) fflush(stdout);
+    }
+
+    /**
+     * @brief Bytes permanently allocated for the rings of the deferred log.
+     */
+    static size_t getFootprint() {
+        return deferredLog == nullptr ? 0 : deferredLog->getFootprint();
+    }
+
+    /**
+     * @brief Number of log records dropped because the queue was full.
+     */
+    static size_t getDroppedRecords() {
+        return droppedRecords;
+    }
+
+    /**
+     * @brief Number of log messages dropped before formatting, because too many were logged at once.
+     */
+    static size_t getOverflows() {
+        return deferredLog == nullptr ? 0 : deferredLog->getOverflows();
     }
 
 private:
     static int processLogFunc(const char* format, va_list args) {
-        std::string message = renderMessage(format, args);
-        return processLog(message);
+        // Log formats start with the level, like the lines they produce
+        Level level = getLevel(std::string_view(format, strnlen(format, 2)));
+        if (level <= CRASH_LOG_LEVEL) {
+            va_list copy;
+            va_copy(copy, args);
+            recordForCrash(level, format, copy);
+            va_end(copy);
+        }
+        deferredLog->write(format, args);
+        return 0;
     }
 
-    static int processLog(const std::string& message) {
+    // Only called while draining the deferred log, one drain at a time
+    static void processLog(size_t ring, const std::string& message) {
         if (message.empty()) {
-            return 0;
+            return;
         }
 
-        std::string assembledMessage;
-        {
-            std::lock_guard<std::mutex> lock(partialMessageMutex);
-            if (message[message.length() - 1] != '\n') {
-                partialMessage += message;
-                return 0;
-            }
-            if (!partialMessage.empty()) {
-                assembledMessage = partialMessage + message;
-                partialMessage.clear();
-            }
+        // Rings are drained one after the other, so each needs its own unfinished line
+        auto& partialMessage = partialMessages[ring];
+        if (message[message.length() - 1] != '\n') {
+            partialMessage += message;
+            return;
         }
-        if (assembledMessage.empty()) {
-            return processLogLine(message);
+        if (partialMessage.empty()) {
+            processLogLine(message);
+        } else {
+            partialMessage += message;
+            processLogLine(partialMessage);
+            partialMessage.clear();
         }
-        return processLogLine(assembledMessage);
     }
 
     static int processLogLine(const std::string& message) {
         Level level = getLevel(message);
         if (level <= recordedLevel) {
-            logRecords->offer(level, message);
+            if (!logRecords->offer(level, message)) {
+                droppedRecords++;
+            }
         }
 
         int count = 0;
@@ -101,29 +182,30 @@ private:
         return count;
     }
 
-    static std::string renderMessage(const char* format, va_list args) {
-        int length;
-        {
-            std::lock_guard<std::mutex> lock(bufferMutex);
-            length = vsnprintf(buffer, BUFFER_SIZE, format, args);
-            if (length < 0) {
-                return "<Encoding error>";
-            }
-            if (length < BUFFER_SIZE) {
-                return { buffer, static_cast<size_t>(length) };
-            }
+    /**
+     * @brief Keep the line in the crash log right when it is logged, on the logging task.
+     *
+     * Lines waiting to be drained are lost when the device crashes, so this can't wait for the console task.
+     * Only the part that fits into a crash log record is formatted.
+     */
+    static void recordForCrash(Level level, const char* format, va_list args) {
+        auto uptime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch());
+        // Level prefix, message, newline and terminator
+        std::array<char, 2 + CrashLog::MESSAGE_SIZE + 2> buffer;
+        int length = vsnprintf(buffer.data(), buffer.size(), format, args);
+        if (length < 0) {
+            return;
         }
-
-        // The buffer was too small, try again with a heap-allocated buffer instead, but still limit length
-        length = std::min(length, 2048);
-        char* heapBuffer = new char[length + 1];
-        (void) vsnprintf(heapBuffer, length + 1, format, args);
-        std::string result(heapBuffer, length);
-        delete[] heapBuffer;
-        return result;
+        std::string_view message(buffer.data(), std::min<size_t>(length, buffer.size() - 1));
+        // Remove the level prefix and the trailing newline
+        message.remove_prefix(std::min<size_t>(2, message.length()));
+        if (message.ends_with('\n')) {
+            message.remove_suffix(1);
+        }
+        crashLog->record(level, static_cast<uint32_t>(uptime.count()), message);
     }
 
-    static Level getLevel(const std::string& message) {
+    static Level getLevel(std::string_view message) {
         // Anything that doesn't look like 'X ...' is a debug message
         if (message.length() < 2 || message[1] != ' ') {
             return Level::Debug;
@@ -146,22 +228,25 @@ private:
     }
 
     static vprintf_like_t originalVprintf;
-    static std::shared_ptr<Queue<LogRecord>> logRecords;
+    static std::shared_ptr<PooledQueue<LogRecord>> logRecords;
     static Level recordedLevel;
-    static std::mutex bufferMutex;
-    static constexpr size_t BUFFER_SIZE = 128;
-    static char buffer[];
-
-    static std::mutex partialMessageMutex;
-    static std::string partialMessage;
+    static std::atomic<size_t> droppedRecords;
+    // Lines this severe are kept in the crash log; formatting them costs the logging task, so not Info, the level of most lines
+    static constexpr Level CRASH_LOG_LEVEL = Level::Warning;
+    static constexpr uint32_t CONSOLE_STACK_SIZE = 4096;
+    static constexpr milliseconds FLUSH_ON_RESTART_TIMEOUT = 100ms;
+    static std::shared_ptr<CrashLog> crashLog;
+    static std::shared_ptr<DeferredLog> deferredLog;
+    // Unfinished line per ring of the deferred log
+    static std::vector<std::string> partialMessages;
 };
 
 vprintf_like_t ConsoleProvider::originalVprintf;
-std::shared_ptr<Queue<LogRecord>> ConsoleProvider::logRecords;
+std::shared_ptr<PooledQueue<LogRecord>> ConsoleProvider::logRecords;
 Level ConsoleProvider::recordedLevel;
-std::mutex ConsoleProvider::bufferMutex;
-char ConsoleProvider::buffer[BUFFER_SIZE];
-std::mutex ConsoleProvider::partialMessageMutex;
-std::string ConsoleProvider::partialMessage;
+std::atomic<size_t> ConsoleProvider::droppedRecords;
+std::shared_ptr<CrashLog> ConsoleProvider::crashLog;
+std::shared_ptr<DeferredLog> ConsoleProvider::deferredLog;
+std::vector<std::string> ConsoleProvider::partialMessages;
 
 }    // namespace farmhub::kernel
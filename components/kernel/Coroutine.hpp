@@ -0,0 +1,651 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <list>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <freertos/FreeRTOS.h>    // NOLINT(misc-header-include-cycle)
+#include <freertos/task.h>        // NOLINT(misc-header-include-cycle)
+
+#include <Concurrent.hpp>
+#include <Log.hpp>
+#include <State.hpp>
+#include <Task.hpp>
+#include <Time.hpp>
+
+using namespace std::chrono;
+
+namespace farmhub::kernel {
+
+class CoroutineRunner;
+
+/**
+ * @brief Something a suspended coroutine is waiting for.
+ *
+ * Waiters live in the frame of the suspended coroutine, and are only ever touched by the runner's task.
+ */
+class CoroutineWaiter {
+public:
+    virtual ~CoroutineWaiter() = default;
+
+protected:
+    explicit CoroutineWaiter(ticks timeout) {
+        if (timeout != ticks::max()) {
+            deadline = steady_clock::now() + timeout;
+        }
+    }
+
+    /**
+     * @brief Checks if the coroutine can continue; called by the runner before the deadline.
+     */
+    virtual bool poll() = 0;
+
+    /**
+     * @brief Whether the runner needs to wake up periodically to call `poll()`,
+     * because nothing wakes it up when the awaited condition changes.
+     */
+    virtual bool needsPolling() const {
+        return true;
+    }
+
+    void suspend(CoroutineRunner* runner, std::coroutine_handle<> handle);
+
+private:
+    std::optional<steady_clock::time_point> deadline;
+    std::coroutine_handle<> handle;
+
+    friend class CoroutineRunner;
+};
+
+template <typename TCheck>
+class ConditionAwaiter;
+class DelayAwaiter;
+class CoroutineNotification;
+
+/**
+ * @brief A coroutine that is run by a `CoroutineRunner`, sharing the runner's task with other coroutines.
+ *
+ * A coroutine suspends when it awaits a delay, a queue, a state or a notification, and the runner
+ * resumes it once the awaited event happens. Coroutines can also await other coroutines, which then
+ * run as part of the awaiting coroutine. Only the coroutine's frame is allocated while it is
+ * suspended, which is usually a lot smaller than a task's stack. Blocking calls such as
+ * `Task::delay()` or `Queue::take()` block every coroutine on the same runner, so use their
+ * awaitable counterparts instead.
+ *
+ * Coroutine lambdas must not capture anything, as the lambda can be gone by the time the coroutine
+ * resumes; pass state in parameters instead, those are kept in the frame.
+ */
+class Coroutine {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct FrameStats {
+        size_t count;
+        size_t bytes;
+    };
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(Handle handle) noexcept;
+
+        void await_resume() const noexcept {
+        }
+    };
+
+    struct promise_type {
+        Coroutine get_return_object() {
+            return Coroutine { Handle::from_promise(*this) };
+        }
+
+        std::suspend_always initial_suspend() const noexcept {
+            return {};
+        }
+
+        FinalAwaiter final_suspend() const noexcept {
+            return {};
+        }
+
+        void return_void() const noexcept {
+        }
+
+        void unhandled_exception() noexcept {
+            exception = std::current_exception();
+        }
+
+        static void* operator new(size_t size) {
+            liveFrames.fetch_add(1, std::memory_order_relaxed);
+            liveFrameBytes.fetch_add(size, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+
+        static void operator delete(void* frame, size_t size) {
+            liveFrames.fetch_sub(1, std::memory_order_relaxed);
+            liveFrameBytes.fetch_sub(size, std::memory_order_relaxed);
+            ::operator delete(frame);
+        }
+
+        CoroutineRunner* runner = nullptr;
+        // The coroutine awaiting this one to finish, if any
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+    };
+
+    Coroutine(Coroutine&& other) noexcept
+        : handle(std::exchange(other.handle, nullptr)) {
+    }
+
+    Coroutine(const Coroutine&) = delete;
+    Coroutine& operator=(const Coroutine&) = delete;
+    Coroutine& operator=(Coroutine&&) = delete;
+
+    ~Coroutine() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    /**
+     * @brief Run the coroutine as part of the awaiting coroutine, and continue once it finishes.
+     *
+     * Exceptions thrown by the coroutine are rethrown to the awaiting coroutine.
+     */
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            Handle await_suspend(Handle awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                handle.promise().runner = awaiting.promise().runner;
+                return handle;
+            }
+
+            void await_resume() const {
+                if (handle.promise().exception) {
+                    std::rethrow_exception(handle.promise().exception);
+                }
+            }
+
+            Handle handle;
+        };
+        return Awaiter { handle };
+    }
+
+    /**
+     * @brief Suspend the coroutine for the given duration, letting other coroutines run.
+     */
+    static DelayAwaiter delay(ticks time);
+
+    /**
+     * @brief Let other coroutines that are ready to run go first.
+     */
+    static DelayAwaiter yield();
+
+    /**
+     * @brief Wait for a message to arrive in `queue`, or until the timeout elapses.
+     *
+     * Works with any queue that has a non-blocking `poll(handler)` method, like `Queue` and `PooledQueue`;
+     * queues that also have `getWakeupSource()` wake the runner as soon as a message arrives.
+     *
+     * @return Whether a message was handled.
+     */
+    template <typename TQueue, typename THandler>
+    static auto poll(TQueue& queue, ticks timeout, THandler handler);
+
+    /**
+     * @brief Wait for a message to arrive in `queue`, or until the timeout elapses.
+     */
+    template <typename TMessage>
+    static auto poll(CopyQueue<TMessage>& queue, ticks timeout);
+
+    /**
+     * @brief Wait for the state to be set, or until the timeout elapses.
+     *
+     * @return Whether the state was set before the timeout elapsed.
+     */
+    static auto awaitSet(const State& state, ticks timeout = ticks::max());
+
+    /**
+     * @brief Wait for the notification to be given, or until the timeout elapses.
+     *
+     * @return The number of times the notification was given since it was last taken, or zero on timeout.
+     */
+    static auto take(CoroutineNotification& notification, ticks timeout = ticks::max());
+
+    /**
+     * @brief Number and total size of coroutine frames currently allocated.
+     */
+    static FrameStats getFrameStats() {
+        return {
+            liveFrames.load(std::memory_order_relaxed),
+            liveFrameBytes.load(std::memory_order_relaxed),
+        };
+    }
+
+private:
+    explicit Coroutine(Handle handle)
+        : handle(handle) {
+    }
+
+    Handle release() {
+        return std::exchange(handle, nullptr);
+    }
+
+    Handle handle;
+
+    inline static std::atomic<size_t> liveFrames { 0 };
+    inline static std::atomic<size_t> liveFrameBytes { 0 };
+
+    friend class CoroutineRunner;
+};
+
+/**
+ * @brief Runs any number of coroutines on a single task.
+ *
+ * Coroutines run one after the other, each until it suspends. Delays, notifications, queues and
+ * states wake the runner when they are due. Only when a queue has no `getWakeupSource()`, or
+ * `TaskWakeups` has no more room, does the runner check on it every `pollInterval` instead.
+ */
+class CoroutineRunner {
+public:
+    CoroutineRunner(const std::string& name, uint32_t stackSize, milliseconds pollInterval = 20ms)
+        : CoroutineRunner(name, stackSize, DEFAULT_PRIORITY, pollInterval) {
+    }
+
+    CoroutineRunner(const std::string& name, uint32_t stackSize, UBaseType_t priority, milliseconds pollInterval = 20ms)
+        : pollInterval(pollInterval) {
+        Task::run(name, stackSize, priority, [this](Task& /*task*/) {
+            runnerTask.store(xTaskGetCurrentTaskHandle());
+            while (!stopping.load()) {
+                runOnce();
+            }
+            // Destroy the coroutines while the task is still alive, so their waiters can stop waking it up
+            adoptSpawned();
+            for (auto handle : coroutines) {
+                handle.destroy();
+            }
+            stopped.put(true);
+        });
+    }
+
+    /**
+     * @brief Stops the runner's task, and destroys the coroutines that have not finished yet.
+     */
+    ~CoroutineRunner() {
+        stopping.store(true);
+        wake();
+        stopped.take();
+    }
+
+    CoroutineRunner(const CoroutineRunner&) = delete;
+    CoroutineRunner& operator=(const CoroutineRunner&) = delete;
+
+    /**
+     * @brief Start running `coroutine` on the runner's task. Can be called from any task.
+     */
+    void spawn(Coroutine coroutine) {
+        auto handle = coroutine.release();
+        handle.promise().runner = this;
+        {
+            Lock lock(spawnMutex);
+            spawned.push_back(handle);
+        }
+        wake();
+    }
+
+    /**
+     * @brief Number of coroutines running on this runner, including suspended ones.
+     */
+    size_t size() const {
+        return running.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Number of times a coroutine was resumed.
+     */
+    size_t getResumes() const {
+        return resumes.load(std::memory_order_relaxed);
+    }
+
+private:
+    void runOnce() {
+        adoptSpawned();
+
+        auto now = steady_clock::now();
+        std::erase_if(waiting, [&](CoroutineWaiter* waiter) {
+            if (waiter->poll() || (waiter->deadline.has_value() && *waiter->deadline <= now)) {
+                ready.push_back(waiter->handle);
+                return true;
+            }
+            return false;
+        });
+
+        if (!ready.empty()) {
+            resumeReady();
+            return;
+        }
+
+        ulTaskNotifyTake(pdTRUE, nextTimeout(now).count());
+    }
+
+    void adoptSpawned() {
+        Lock lock(spawnMutex);
+        for (auto handle : spawned) {
+            ready.push_back(handle);
+            coroutines.push_back(handle);
+            running.fetch_add(1, std::memory_order_relaxed);
+        }
+        spawned.clear();
+    }
+
+    void resumeReady() {
+        std::vector<std::coroutine_handle<>> resuming;
+        std::swap(resuming, ready);
+        for (auto handle : resuming) {
+            resumes.fetch_add(1, std::memory_order_relaxed);
+            handle.resume();
+            destroyFinished();
+        }
+    }
+
+    void destroyFinished() {
+        while (!finished.empty()) {
+            auto handle = finished.front();
+            finished.pop_front();
+            coroutines.remove(handle);
+            running.fetch_sub(1, std::memory_order_relaxed);
+            auto exception = handle.promise().exception;
+            handle.destroy();
+            if (exception) {
+                std::rethrow_exception(exception);
+            }
+        }
+    }
+
+    ticks nextTimeout(steady_clock::time_point now) const {
+        auto timeout = ticks::max();
+        for (const auto* waiter : waiting) {
+            if (waiter->needsPolling()) {
+                timeout = std::min(timeout, clampTicks(pollInterval));
+            }
+            if (waiter->deadline.has_value()) {
+                timeout = std::min(timeout, clampTicks(ceil<milliseconds>(*waiter->deadline - now)));
+            }
+        }
+        return timeout;
+    }
+
+    void wait(CoroutineWaiter* waiter) {
+        waiting.push_back(waiter);
+    }
+
+    void finish(Coroutine::Handle handle) {
+        finished.push_back(handle);
+    }
+
+    /**
+     * @brief Make the runner check on its coroutines. Can be called from any task.
+     */
+    void wake() {
+        auto task = runnerTask.load();
+        if (task != nullptr) {
+            xTaskNotifyGive(task);
+        }
+    }
+
+    void IRAM_ATTR wakeFromISR() {
+        auto task = runnerTask.load();
+        if (task != nullptr) {
+            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+            vTaskNotifyGiveFromISR(task, &xHigherPriorityTaskWoken);
+            portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+        }
+    }
+
+    const milliseconds pollInterval;
+    std::atomic<TaskHandle_t> runnerTask { nullptr };
+    std::atomic<bool> stopping { false };
+    CopyQueue<bool> stopped { "coroutines-stopped", 1 };
+
+    Mutex spawnMutex;
+    std::list<Coroutine::Handle> spawned;
+
+    // Only touched by the runner's task
+    std::vector<std::coroutine_handle<>> ready;
+    std::vector<CoroutineWaiter*> waiting;
+    std::list<Coroutine::Handle> finished;
+    // Top-level coroutines that have not finished yet
+    std::list<Coroutine::Handle> coroutines;
+
+    std::atomic<size_t> running { 0 };
+    std::atomic<size_t> resumes { 0 };
+
+    friend class Coroutine;
+    friend class CoroutineWaiter;
+    friend class CoroutineNotification;
+    friend struct Coroutine::FinalAwaiter;
+};
+
+inline void CoroutineWaiter::suspend(CoroutineRunner* runner, std::coroutine_handle<> handle) {
+    this->handle = handle;
+    runner->wait(this);
+}
+
+inline std::coroutine_handle<> Coroutine::FinalAwaiter::await_suspend(Handle handle) noexcept {
+    auto continuation = handle.promise().continuation;
+    if (continuation) {
+        return continuation;
+    }
+    handle.promise().runner->finish(handle);
+    return std::noop_coroutine();
+}
+
+/**
+ * @brief Suspends the awaiting coroutine until the delay elapses.
+ */
+class DelayAwaiter : public CoroutineWaiter {
+public:
+    explicit DelayAwaiter(ticks time)
+        : CoroutineWaiter(time) {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(Coroutine::Handle handle) {
+        suspend(handle.promise().runner, handle);
+    }
+
+    void await_resume() const noexcept {
+    }
+
+protected:
+    bool poll() override {
+        return false;
+    }
+
+    bool needsPolling() const override {
+        return false;
+    }
+};
+
+/**
+ * @brief Suspends the awaiting coroutine until `check()` returns something truthy, or the timeout elapses.
+ *
+ * Awaiting results in the last value `check()` returned. The runner checks again whenever
+ * `wakeupSource` is notified via `TaskWakeups`; without one it has to poll.
+ */
+template <typename TCheck>
+class ConditionAwaiter : public CoroutineWaiter {
+public:
+    using Result = std::invoke_result_t<TCheck&>;
+
+    ConditionAwaiter(ticks timeout, TCheck check, bool eventDriven = false)
+        : CoroutineWaiter(timeout)
+        , check(std::move(check))
+        , eventDriven(eventDriven)
+        , timeout(timeout) {
+    }
+
+    ConditionAwaiter(ticks timeout, TCheck check, const void* wakeupSource)
+        : ConditionAwaiter(timeout, std::move(check)) {
+        this->wakeupSource = wakeupSource;
+    }
+
+    ~ConditionAwaiter() override {
+        if (subscribedTask != nullptr) {
+            TaskWakeups::unsubscribe(wakeupSource, subscribedTask);
+        }
+    }
+
+    ConditionAwaiter(const ConditionAwaiter&) = delete;
+    ConditionAwaiter& operator=(const ConditionAwaiter&) = delete;
+
+    bool await_ready() {
+        return poll() || timeout == ticks::zero();
+    }
+
+    void await_suspend(Coroutine::Handle handle) {
+        // The runner checks every waiter again before going to sleep, so nothing is missed between here and then
+        auto* runnerTask = xTaskGetCurrentTaskHandle();
+        if (wakeupSource != nullptr && TaskWakeups::subscribe(wakeupSource, runnerTask)) {
+            subscribedTask = runnerTask;
+        }
+        suspend(handle.promise().runner, handle);
+    }
+
+    Result await_resume() {
+        return std::move(*result);
+    }
+
+protected:
+    bool poll() override {
+        result.emplace(check());
+        return static_cast<bool>(*result);
+    }
+
+    bool needsPolling() const override {
+        return !eventDriven && subscribedTask == nullptr;
+    }
+
+private:
+    TCheck check;
+    const bool eventDriven;
+    const ticks timeout;
+    const void* wakeupSource = nullptr;
+    TaskHandle_t subscribedTask = nullptr;
+    std::optional<Result> result;
+};
+
+/**
+ * @brief A counting notification that coroutines can wait for, given by any task or ISR.
+ *
+ * The coroutine counterpart of FreeRTOS task notifications: giving it wakes the runner right away.
+ */
+class CoroutineNotification {
+public:
+    void give() {
+        count.fetch_add(1);
+        auto* runner = waitingRunner.load();
+        if (runner != nullptr) {
+            runner->wake();
+        }
+    }
+
+    void IRAM_ATTR giveFromISR() {
+        count.fetch_add(1);
+        auto* runner = waitingRunner.load();
+        if (runner != nullptr) {
+            runner->wakeFromISR();
+        }
+    }
+
+    /**
+     * @brief Take all pending notifications without waiting.
+     *
+     * @return The number of notifications taken.
+     */
+    uint32_t take() {
+        return count.exchange(0);
+    }
+
+private:
+    std::atomic<uint32_t> count { 0 };
+    std::atomic<CoroutineRunner*> waitingRunner { nullptr };
+
+    friend class Coroutine;
+};
+
+inline DelayAwaiter Coroutine::delay(ticks time) {
+    return DelayAwaiter { time };
+}
+
+inline DelayAwaiter Coroutine::yield() {
+    return DelayAwaiter { ticks::zero() };
+}
+
+template <typename TQueue, typename THandler>
+inline auto Coroutine::poll(TQueue& queue, ticks timeout, THandler handler) {
+    auto check = [&queue, handler = std::move(handler)]() {
+        return queue.poll(handler);
+    };
+    if constexpr (requires { queue.getWakeupSource(); }) {
+        return ConditionAwaiter(timeout, std::move(check), queue.getWakeupSource());
+    } else {
+        return ConditionAwaiter(timeout, std::move(check));
+    }
+}
+
+template <typename TMessage>
+inline auto Coroutine::poll(CopyQueue<TMessage>& queue, ticks timeout) {
+    return ConditionAwaiter(timeout, [&queue]() { return queue.poll(); }, queue.getWakeupSource());
+}
+
+inline auto Coroutine::awaitSet(const State& state, ticks timeout) {
+    return ConditionAwaiter(timeout, [&state]() { return state.isSet(); }, state.getWakeupSource());
+}
+
+inline auto Coroutine::take(CoroutineNotification& notification, ticks timeout) {
+    struct TakeNotification {
+        uint32_t operator()() const {
+            return notification->take();
+        }
+
+        CoroutineNotification* notification;
+    };
+
+    // The runner only learns which notification to listen to once the coroutine awaits it
+    struct Awaiter : ConditionAwaiter<TakeNotification> {
+        Awaiter(CoroutineNotification& notification, ticks timeout)
+            : ConditionAwaiter(timeout, TakeNotification { &notification }, true)
+            , notification(notification) {
+        }
+
+        void await_suspend(Handle handle) {
+            notification.waitingRunner.store(handle.promise().runner);
+            ConditionAwaiter::await_suspend(handle);
+            // Catch notifications given before the runner was registered
+            if (notification.count.load() > 0) {
+                handle.promise().runner->wake();
+            }
+        }
+
+        CoroutineNotification& notification;
+    };
+    return Awaiter { notification, timeout };
+}
+
+}    // namespace farmhub::kernel
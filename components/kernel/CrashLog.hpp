@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include <Log.hpp>
+
+namespace farmhub::kernel {
+
+/**
+ * @brief Keeps the last few log lines in memory that survives resets, so they can be reported after a crash.
+ *
+ * The ring lives in a caller-provided `Storage` blob, typically placed in `RTC_NOINIT_ATTR` memory.
+ * Every record carries its own checksum, so a record torn by a reset in the middle of writing it
+ * is simply discarded on the next boot. Writing a record does not lock, and does not allocate.
+ */
+class CrashLog {
+public:
+    static constexpr size_t RECORDS = 32;
+    static constexpr size_t MESSAGE_SIZE = 64;
+
+    struct Record {
+        uint32_t sequence;
+        // Milliseconds since boot
+        uint32_t uptime;
+        uint16_t boot;
+        Level level;
+        uint8_t length;
+        char message[MESSAGE_SIZE];
+        uint32_t checksum;
+
+        std::string_view getMessage() const {
+            return { message, length };
+        }
+    };
+
+    struct Storage {
+        uint32_t magic;
+        uint32_t layout;
+        uint32_t boot;
+        uint32_t checksum;
+        Record records[RECORDS];
+    };
+
+    /**
+     * @brief Take over the ring in `storage`, starting a new boot.
+     *
+     * Records from earlier boots are kept if their checksums match; anything else is wiped.
+     */
+    explicit CrashLog(Storage& storage)
+        : storage(storage) {
+        if (storage.magic != MAGIC || storage.layout != LAYOUT || storage.checksum != headerChecksum(storage)) {
+            memset(&storage, 0, sizeof(Storage));
+            storage.magic = MAGIC;
+            storage.layout = LAYOUT;
+            storage.boot = 0;
+        } else {
+            storage.boot++;
+        }
+        storage.checksum = headerChecksum(storage);
+
+        uint32_t lastSequence = 0;
+        for (auto& record : storage.records) {
+            if (record.sequence == 0 && record.checksum == 0) {
+                // Never written
+                continue;
+            }
+            if (record.length > MESSAGE_SIZE || record.checksum != recordChecksum(record)) {
+                corrupted++;
+                memset(&record, 0, sizeof(Record));
+                continue;
+            }
+            lastSequence = std::max(lastSequence, record.sequence);
+            if (static_cast<uint16_t>(record.boot + 1) == getBoot()) {
+                previousBoot.push_back(record);
+            }
+        }
+        std::ranges::sort(previousBoot, {}, &Record::sequence);
+        nextSequence.store(lastSequence + 1, std::memory_order_relaxed);
+    }
+
+    CrashLog(const CrashLog&) = delete;
+    CrashLog& operator=(const CrashLog&) = delete;
+
+    /**
+     * @brief Record a log line, overwriting the oldest one. Messages longer than `MESSAGE_SIZE` are truncated.
+     */
+    void record(Level level, uint32_t uptime, std::string_view message) {
+        uint32_t sequence = nextSequence.fetch_add(1, std::memory_order_relaxed);
+        auto& record = storage.records[sequence % RECORDS];
+        // Invalidate the record first, so a reset in the middle of writing it cannot leave a valid-looking record
+        record.checksum = ~record.checksum;
+        record.sequence = sequence;
+        record.uptime = uptime;
+        record.boot = getBoot();
+        record.level = level;
+        record.length = static_cast<uint8_t>(std::min(message.length(), MESSAGE_SIZE));
+        memcpy(record.message, message.data(), record.length);
+        record.checksum = recordChecksum(record);
+    }
+
+    /**
+     * @brief The records logged during the previous boot that survived the reset, oldest first.
+     */
+    const std::vector<Record>& getPreviousBoot() const {
+        return previousBoot;
+    }
+
+    /**
+     * @brief Number of records discarded at startup because of checksum mismatch.
+     */
+    size_t getCorrupted() const {
+        return corrupted;
+    }
+
+    uint16_t getBoot() const {
+        return static_cast<uint16_t>(storage.boot);
+    }
+
+    void reportPreviousBoot(JsonArray json) const {
+        for (const auto& record : previousBoot) {
+            auto recordJson = json.add<JsonObject>();
+            recordJson["uptime"] = record.uptime;
+            recordJson["level"] = static_cast<int>(record.level);
+            recordJson["message"] = record.getMessage();
+        }
+    }
+
+private:
+    static constexpr uint32_t MAGIC = 0x46484c47;    // "FHLG"
+    static constexpr uint32_t LAYOUT = (sizeof(Record) << 16) | RECORDS;
+
+    // FNV-1a, cheap enough to run for every record written
+    static uint32_t fnv1a(const void* data, size_t length, uint32_t hash = 2166136261U) {
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < length; i++) {
+            hash = (hash ^ bytes[i]) * 16777619U;
+        }
+        return hash;
+    }
+
+    static uint32_t headerChecksum(const Storage& storage) {
+        return fnv1a(&storage, offsetof(Storage, checksum));
+    }
+
+    static uint32_t recordChecksum(const Record& record) {
+        uint32_t hash = fnv1a(&record, offsetof(Record, message));
+        return fnv1a(record.message, record.length, hash);
+    }
+
+    Storage& storage;
+    std::atomic<uint32_t> nextSequence;
+    std::vector<Record> previousBoot;
+    size_t corrupted = 0;
+};
+
+}    // namespace farmhub::kernel
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <esp_core_dump.h>
+#include <esp_system.h>
 #include <mbedtls/base64.h>
 
 #include <ArduinoJson.h>
 
+#include <CrashLog.hpp>
 #include <NvsStore.hpp>
 #include <Strings.hpp>
 
@@ -14,7 +16,7 @@ LOGGING_TAG(CRASH, "crash")
 
 class CrashManager {
 public:
-    static void handleCrashReport(JsonObject& json) {
+    static void handleCrashReport(JsonObject& json, const CrashLog& crashLog) {
         NvsStore nvs("crash-report");
         switch (getCoreDumpStatus()) {
             case CoreDumpStatus::NoDump: {
@@ -35,9 +37,37 @@ public:
             }
         }
         nvs.set("version", farmhubVersion);
+
+        reportCrashLog(json, crashLog);
     }
 
 private:
+    static void reportCrashLog(JsonObject& json, const CrashLog& crashLog) {
+        if (crashLog.getCorrupted() > 0) {
+            LOGTW(CRASH, "Discarded %zu corrupted crash log records", crashLog.getCorrupted());
+        }
+        if (!isAbnormalReset(esp_reset_reason()) || crashLog.getPreviousBoot().empty()) {
+            return;
+        }
+        LOGTI(CRASH, "Reporting %zu log lines from before the reset",
+            crashLog.getPreviousBoot().size());
+        crashLog.reportPreviousBoot(json["crash"]["log"].to<JsonArray>());
+    }
+
+    static bool isAbnormalReset(esp_reset_reason_t reason) {
+        switch (reason) {
+            case ESP_RST_PANIC:
+            case ESP_RST_INT_WDT:
+            case ESP_RST_TASK_WDT:
+            case ESP_RST_WDT:
+            case ESP_RST_BROWNOUT:
+            case ESP_RST_UNKNOWN:
+                return true;
+            default:
+                return false;
+        }
+    }
+
     static void reportPreviousCrash(JsonObject& json, const std::string& crashedFirmwareVersion) {
         esp_core_dump_summary_t summary {};
         esp_err_t err = esp_core_dump_get_summary(&summary);
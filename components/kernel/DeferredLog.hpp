@@ -0,0 +1,635 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <freertos/FreeRTOS.h>    // NOLINT(misc-header-include-cycle)
+#include <freertos/task.h>        // NOLINT(misc-header-include-cycle)
+
+#include <sdkconfig.h>
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+extern "C" {
+// Provided by the linker and the C runtime: code and read-only data lie between these two
+extern const char __executable_start;    // NOLINT(bugprone-reserved-identifier)
+extern const char __data_start;          // NOLINT(bugprone-reserved-identifier)
+}
+#else
+#include <esp_memory_utils.h>
+#endif
+
+#include <Concurrent.hpp>
+
+namespace farmhub::kernel {
+
+/**
+ * @brief A conversion specification in a printf-style format string, like `%-8.*lld`.
+ */
+struct FormatSpec {
+    enum class Argument : uint8_t {
+        // `%%`, nothing to format
+        None,
+        Int,
+        Long,
+        LongLong,
+        Size,
+        IntMax,
+        PtrDiff,
+        Double,
+        String,
+        Pointer,
+        // Something we don't know how to defer, like `%n` or `%Lf`
+        Unsupported,
+    };
+
+    // Text of the specification, from the '%' to the conversion character
+    const char* start;
+    const char* end;
+    Argument argument;
+    bool starWidth;
+    bool starPrecision;
+    bool hasPrecision;
+    int precision;
+
+    /**
+     * @brief Find the next conversion specification in `format`.
+     *
+     * @return Whether a specification was found; if not, `start` points to the end of the string.
+     */
+    static bool next(const char* format, FormatSpec& spec) {
+        const char* p = strchr(format, '%');
+        if (p == nullptr) {
+            spec.start = format + strlen(format);
+            spec.end = spec.start;
+            return false;
+        }
+        spec = { .start = p, .end = p, .argument = Argument::Unsupported, .starWidth = false, .starPrecision = false, .hasPrecision = false, .precision = 0 };
+        p++;
+        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+            p++;
+        }
+        if (*p == '*') {
+            spec.starWidth = true;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+        if (*p == '.') {
+            spec.hasPrecision = true;
+            p++;
+            if (*p == '*') {
+                spec.starPrecision = true;
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9') {
+                    spec.precision = spec.precision * 10 + (*p - '0');
+                    p++;
+                }
+            }
+        }
+
+        enum class Length : uint8_t { Default, Long, LongLong, Size, IntMax, PtrDiff, LongDouble };
+        Length length = Length::Default;
+        if (*p == 'h') {
+            // Arguments shorter than int are promoted to int anyway
+            p += (p[1] == 'h') ? 2 : 1;
+        } else if (*p == 'l') {
+            length = (p[1] == 'l') ? Length::LongLong : Length::Long;
+            p += (p[1] == 'l') ? 2 : 1;
+        } else if (*p == 'z') {
+            length = Length::Size;
+            p++;
+        } else if (*p == 'j') {
+            length = Length::IntMax;
+            p++;
+        } else if (*p == 't') {
+            length = Length::PtrDiff;
+            p++;
+        } else if (*p == 'L') {
+            length = Length::LongDouble;
+            p++;
+        }
+
+        switch (*p) {
+            case '\0':
+                spec.end = p;
+                return true;
+            case '%':
+                spec.argument = Argument::None;
+                break;
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+            case 'c':
+                switch (length) {
+                    case Length::Default:
+                        spec.argument = Argument::Int;
+                        break;
+                    case Length::Long:
+                        spec.argument = *p == 'c' ? Argument::Unsupported : Argument::Long;
+                        break;
+                    case Length::LongLong:
+                        spec.argument = Argument::LongLong;
+                        break;
+                    case Length::Size:
+                        spec.argument = Argument::Size;
+                        break;
+                    case Length::IntMax:
+                        spec.argument = Argument::IntMax;
+                        break;
+                    case Length::PtrDiff:
+                        spec.argument = Argument::PtrDiff;
+                        break;
+                    case Length::LongDouble:
+                        break;
+                }
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                if (length == Length::Default || length == Length::Long) {
+                    spec.argument = Argument::Double;
+                }
+                break;
+            case 's':
+                if (length == Length::Default) {
+                    spec.argument = Argument::String;
+                }
+                break;
+            case 'p':
+                spec.argument = Argument::Pointer;
+                break;
+            default:
+                break;
+        }
+        spec.end = p + 1;
+        return true;
+    }
+};
+
+/**
+ * @brief A log message captured without formatting it: the format string's address and the raw arguments.
+ *
+ * Formats that are not in read-only memory, arguments that don't fit, or conversions we cannot defer
+ * are rendered right away instead. Lines too long for the record are rendered into a heap buffer.
+ */
+struct DeferredLogRecord {
+    static constexpr size_t CAPACITY = 112;
+
+    enum class Kind : uint8_t {
+        // Arguments are captured in `data` to be formatted with `format` later
+        Deferred,
+        // The rendered line is in `data`
+        Rendered,
+        // The rendered line is in `longLine`
+        Long,
+    };
+
+    DeferredLogRecord(const char* format, va_list args) {
+        if (isStatic(format)) {
+            va_list copy;
+            va_copy(copy, args);
+            bool captured = capture(format, copy);
+            va_end(copy);
+            if (captured) {
+                this->format = format;
+                kind = Kind::Deferred;
+                return;
+            }
+        }
+        render(format, args);
+    }
+
+    ~DeferredLogRecord() {
+        delete longLine;
+    }
+
+    DeferredLogRecord(const DeferredLogRecord&) = delete;
+    DeferredLogRecord& operator=(const DeferredLogRecord&) = delete;
+
+    /**
+     * @brief Format the message, appending it to `line`.
+     */
+    void appendTo(std::string& line) const {
+        switch (kind) {
+            case Kind::Rendered:
+                line.append(reinterpret_cast<const char*>(data.data()), length);
+                break;
+            case Kind::Long:
+                line.append(*longLine);
+                break;
+            case Kind::Deferred:
+                appendFormatted(line);
+                break;
+        }
+    }
+
+    Kind getKind() const {
+        return kind;
+    }
+
+    /**
+     * @brief Whether `text` lives in read-only memory, and thus stays valid until the record is formatted.
+     */
+    static bool isStatic(const char* text) {
+#ifdef CONFIG_IDF_TARGET_LINUX
+        return text >= &__executable_start && text < &__data_start;
+#else
+        return esp_ptr_in_drom(text);
+#endif
+    }
+
+private:
+    bool capture(const char* format, va_list args) {
+        FormatSpec spec {};
+        for (const char* p = format; FormatSpec::next(p, spec); p = spec.end) {
+            using Argument = FormatSpec::Argument;
+            if (spec.starWidth && !put(va_arg(args, int))) {
+                return false;
+            }
+            int precision = spec.precision;
+            if (spec.starPrecision) {
+                precision = va_arg(args, int);
+                if (!put(precision)) {
+                    return false;
+                }
+            }
+            bool fits = true;
+            switch (spec.argument) {
+                case Argument::None:
+                    break;
+                case Argument::Int:
+                    fits = put(va_arg(args, int));
+                    break;
+                case Argument::Long:
+                    fits = put(va_arg(args, long));
+                    break;
+                case Argument::LongLong:
+                    fits = put(va_arg(args, long long));
+                    break;
+                case Argument::Size:
+                    fits = put(va_arg(args, size_t));
+                    break;
+                case Argument::IntMax:
+                    fits = put(va_arg(args, intmax_t));
+                    break;
+                case Argument::PtrDiff:
+                    fits = put(va_arg(args, ptrdiff_t));
+                    break;
+                case Argument::Double:
+                    fits = put(va_arg(args, double));
+                    break;
+                case Argument::Pointer:
+                    fits = put(va_arg(args, void*));
+                    break;
+                case Argument::String: {
+                    const char* value = va_arg(args, const char*);
+                    if (value == nullptr) {
+                        value = "(null)";
+                    }
+                    // With a precision the string doesn't need to be terminated
+                    size_t valueLength = spec.hasPrecision && precision >= 0
+                        ? strnlen(value, precision)
+                        : strlen(value);
+                    fits = putString(value, valueLength);
+                    break;
+                }
+                case Argument::Unsupported:
+                    return false;
+            }
+            if (!fits) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void render(const char* format, va_list args) {
+        va_list copy;
+        va_copy(copy, args);
+        int rendered = vsnprintf(reinterpret_cast<char*>(data.data()), CAPACITY, format, copy);
+        va_end(copy);
+        if (rendered < 0) {
+            static constexpr char ENCODING_ERROR[] = "<Encoding error>\n";
+            memcpy(data.data(), ENCODING_ERROR, sizeof(ENCODING_ERROR) - 1);
+            length = sizeof(ENCODING_ERROR) - 1;
+            kind = Kind::Rendered;
+        } else if (rendered < static_cast<int>(CAPACITY)) {
+            length = rendered;
+            kind = Kind::Rendered;
+        } else {
+            // Still limit the length of what we keep
+            size_t limited = std::min(rendered, 2048);
+            longLine = new std::string(limited, '\0');
+            (void) vsnprintf(longLine->data(), limited + 1, format, args);
+            kind = Kind::Long;
+        }
+    }
+
+    void appendFormatted(std::string& line) const {
+        size_t offset = 0;
+        FormatSpec spec {};
+        const char* p = format;
+        while (true) {
+            bool found = FormatSpec::next(p, spec);
+            line.append(p, spec.start);
+            if (!found) {
+                break;
+            }
+            p = spec.end;
+
+            using Argument = FormatSpec::Argument;
+            if (spec.argument == Argument::None) {
+                line.push_back('%');
+                continue;
+            }
+
+            std::array<char, 24> conversion {};
+            size_t conversionLength = spec.end - spec.start;
+            if (conversionLength >= conversion.size()) {
+                line.append("<?>");
+                continue;
+            }
+            memcpy(conversion.data(), spec.start, conversionLength);
+
+            int star[2] {};
+            int stars = 0;
+            if (spec.starWidth) {
+                star[stars++] = get<int>(offset);
+            }
+            if (spec.starPrecision) {
+                star[stars++] = get<int>(offset);
+            }
+            switch (spec.argument) {
+                case Argument::Int:
+                    append(line, conversion.data(), star, stars, get<int>(offset));
+                    break;
+                case Argument::Long:
+                    append(line, conversion.data(), star, stars, get<long>(offset));
+                    break;
+                case Argument::LongLong:
+                    append(line, conversion.data(), star, stars, get<long long>(offset));
+                    break;
+                case Argument::Size:
+                    append(line, conversion.data(), star, stars, get<size_t>(offset));
+                    break;
+                case Argument::IntMax:
+                    append(line, conversion.data(), star, stars, get<intmax_t>(offset));
+                    break;
+                case Argument::PtrDiff:
+                    append(line, conversion.data(), star, stars, get<ptrdiff_t>(offset));
+                    break;
+                case Argument::Double:
+                    append(line, conversion.data(), star, stars, get<double>(offset));
+                    break;
+                case Argument::Pointer:
+                    append(line, conversion.data(), star, stars, get<void*>(offset));
+                    break;
+                case Argument::String: {
+                    const char* value = reinterpret_cast<const char*>(data.data() + offset);
+                    offset += strlen(value) + 1;
+                    append(line, conversion.data(), star, stars, value);
+                    break;
+                }
+                case Argument::None:
+                case Argument::Unsupported:
+                    break;
+            }
+        }
+    }
+
+    template <typename T>
+    static void append(std::string& line, const char* conversion, const int* star, int stars, T value) {
+        std::array<char, 64> buffer;
+        int length;
+        switch (stars) {
+            case 0:
+                length = snprintf(buffer.data(), buffer.size(), conversion, value);
+                break;
+            case 1:
+                length = snprintf(buffer.data(), buffer.size(), conversion, star[0], value);
+                break;
+            default:
+                length = snprintf(buffer.data(), buffer.size(), conversion, star[0], star[1], value);
+                break;
+        }
+        if (length < 0) {
+            return;
+        }
+        if (length < static_cast<int>(buffer.size())) {
+            line.append(buffer.data(), length);
+            return;
+        }
+        // Long strings and wide fields
+        auto start = line.size();
+        line.resize(start + length + 1);
+        switch (stars) {
+            case 0:
+                snprintf(line.data() + start, length + 1, conversion, value);
+                break;
+            case 1:
+                snprintf(line.data() + start, length + 1, conversion, star[0], value);
+                break;
+            default:
+                snprintf(line.data() + start, length + 1, conversion, star[0], star[1], value);
+                break;
+        }
+        line.resize(start + length);
+    }
+
+    template <typename T>
+    bool put(T value) {
+        if (length + sizeof(T) > CAPACITY) {
+            return false;
+        }
+        memcpy(data.data() + length, &value, sizeof(T));
+        length += sizeof(T);
+        return true;
+    }
+
+    bool putString(const char* value, size_t valueLength) {
+        if (length + valueLength + 1 > CAPACITY) {
+            return false;
+        }
+        memcpy(data.data() + length, value, valueLength);
+        data[length + valueLength] = '\0';
+        length += valueLength + 1;
+        return true;
+    }
+
+    template <typename T>
+    T get(size_t& offset) const {
+        T value;
+        memcpy(&value, data.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+
+    const char* format = nullptr;
+    std::string* longLine = nullptr;
+    uint8_t length = 0;
+    Kind kind = Kind::Rendered;
+    std::array<uint8_t, CAPACITY> data;
+};
+
+/**
+ * @brief Logging frontend that never waits for a lock: callers capture their messages into per-core
+ * lock-free rings, and a consumer formats them later.
+ *
+ * Messages that don't fit into the rings are dropped and counted. Messages from tasks running on
+ * the same core stay in order. A line written in fragments goes to the ring of its first fragment,
+ * even if the task moves to another core in between, so its fragments stay together and in order.
+ *
+ * The rings are allocated up front: `getFootprint()` bytes, i.e. `capacityPerCore` records of about
+ * 128 bytes each per core, so 8 KB with the default capacity on a dual-core chip.
+ */
+class DeferredLog {
+public:
+    explicit DeferredLog(size_t capacityPerCore = 32) {
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            rings.push_back(std::make_unique<Ring>("log-" + std::to_string(core), capacityPerCore));
+        }
+    }
+
+    /**
+     * @brief Capture a message; does not block.
+     *
+     * @return Whether the message was captured, or was dropped because the ring was full.
+     */
+    bool write(const char* format, va_list args) {
+        size_t ring = continuedRing < rings.size()
+            ? continuedRing
+            : currentCore();
+        // Anything not ending in a newline is a fragment; keep the rest of the line in the same ring
+        size_t formatLength = strlen(format);
+        continuedRing = formatLength > 0 && format[formatLength - 1] == '\n'
+            ? NO_RING
+            : ring;
+        if (!rings[ring]->offerQuietly(format, args)) {
+            overflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (consumerWaiting.load(std::memory_order_relaxed) && consumerWaiting.exchange(false)) {
+            xTaskNotifyGive(consumer.load());
+        }
+        return true;
+    }
+
+    /**
+     * @brief Format and pass on every captured message to `handler`, one core at a time,
+     * along with the index of the core's ring.
+     *
+     * Any task can drain the log, e.g. to get everything out before a restart; drains take turns.
+     * Gives up if another drain is still running after `timeout`.
+     *
+     * @return The number of messages handled.
+     */
+    size_t drain(const std::function<void(size_t, const std::string&)>& handler, ticks timeout = ticks::max()) {
+        if (!drainMutex.lockIn(timeout)) {
+            return 0;
+        }
+        size_t count = 0;
+        try {
+            for (size_t ring = 0; ring < rings.size(); ring++) {
+                count += rings[ring]->drain([&](DeferredLogRecord& record) {
+                    line.clear();
+                    record.appendTo(line);
+                    handler(ring, line);
+                });
+            }
+        } catch (...) {
+            drainMutex.unlock();
+            throw;
+        }
+        drainMutex.unlock();
+        return count;
+    }
+
+    /**
+     * @brief Block the calling task until there are messages to drain.
+     */
+    void awaitMessages() {
+        consumer.store(xTaskGetCurrentTaskHandle());
+        consumerWaiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // A message might have arrived before we registered
+        for (auto& ring : rings) {
+            if (ring->size() > 0) {
+                consumerWaiting.store(false);
+                return;
+            }
+        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    /**
+     * @brief Bytes permanently allocated for the rings.
+     */
+    size_t getFootprint() const {
+        size_t footprint = 0;
+        for (const auto& ring : rings) {
+            footprint += ring->getFootprint();
+        }
+        return footprint;
+    }
+
+    size_t getRingCount() const {
+        return rings.size();
+    }
+
+    /**
+     * @brief Number of messages dropped because the ring of their core was full.
+     */
+    size_t getOverflows() const {
+        return overflows.load(std::memory_order_relaxed);
+    }
+
+private:
+    using Ring = PooledQueue<DeferredLogRecord, QueueProducers::Multiple>;
+
+    static constexpr size_t NO_RING = SIZE_MAX;
+
+    static size_t currentCore() {
+#if portNUM_PROCESSORS > 1
+        return static_cast<size_t>(xPortGetCoreID());
+#else
+        return 0;
+#endif
+    }
+
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::atomic<size_t> overflows { 0 };
+
+    // The ring the calling task's unfinished line went to
+    inline static thread_local size_t continuedRing = NO_RING;
+
+    std::atomic<TaskHandle_t> consumer { nullptr };
+    std::atomic<bool> consumerWaiting { false };
+
+    // The rings only support a single consumer at a time
+    Mutex drainMutex;
+    // Only used while draining, kept around to avoid allocating for every message
+    std::string line;
+};
+
+}    // namespace farmhub::kernel
@@ -0,0 +1,351 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include <Concurrent.hpp>
+#include <Configuration.hpp>
+#include <Log.hpp>
+#include <LogJson.hpp>
+
+using namespace std::chrono;
+
+namespace farmhub::kernel {
+
+/**
+ * @brief Stretch periodic work by `factor` when the battery's state of charge is at or below `charge` percent.
+ */
+struct EnergyCurvePoint {
+    double charge = 0.0;
+    double factor = 1.0;
+};
+
+/**
+ * @brief Only publish logs up to `level` when the battery's state of charge is at or below `charge` percent.
+ */
+struct EnergyLogLevel {
+    double charge = 0.0;
+    Level level = Level::Info;
+};
+
+/**
+ * @brief What we know about the battery when planning.
+ */
+struct EnergyState {
+    // State of charge in percent
+    double charge;
+    // Consumed current in mA, negative when charging
+    std::optional<double> current;
+    // As estimated by the fuel gauge
+    std::optional<seconds> timeToEmpty;
+    // Share of time spent in light sleep since the last plan
+    std::optional<double> sleepRatio;
+    // Wall clock time, if it is in sync
+    std::optional<system_clock::time_point> time;
+};
+
+/**
+ * @brief How much to stretch periodic work, and how much to log.
+ */
+struct EnergyPlan {
+    // Telemetry intervals and sampling periods are multiplied by this
+    double factor = 1.0;
+    // Most verbose level of logs to publish
+    Level logLevel = Level::Verbose;
+    // How long the battery lasts at the current consumption
+    std::optional<hours> projectedRuntime;
+    // How long the battery needs to last to meet the target
+    std::optional<hours> targetRuntime;
+};
+
+/**
+ * @brief Decides how much to slow down periodic work based on the state of the battery.
+ *
+ * Two things can make the device slow down, and the one that asks for more wins:
+ *
+ * - a curve of factors by state of charge, and
+ * - a target: either a runtime, or a state of charge to have left at dawn, when solar charging starts.
+ *
+ * To meet a target, the current is split into a part that does not depend on how often we do things
+ * (time spent in light sleep at the configured sleep current), and the rest, which is assumed to
+ * shrink in proportion to the factor.
+ */
+class EnergyPlanner {
+public:
+    class Config : public ConfigurationSection {
+    public:
+        Property<bool> enabled { this, "enabled", true };
+
+        /**
+         * @brief Factors to stretch periodic work by, by state of charge; interpolated between points.
+         *
+         * A default curve is used when empty; a single point with a factor of 1 turns the curve off.
+         */
+        ArrayProperty<EnergyCurvePoint> curve { this, "curve" };
+
+        /**
+         * @brief Most verbose level of logs to publish, by state of charge.
+         */
+        ArrayProperty<EnergyLogLevel> logLevels { this, "logLevels" };
+
+        /**
+         * @brief Stretch periodic work at most this much.
+         */
+        Property<double> maxFactor { this, "maxFactor", 8.0 };
+
+        /**
+         * @brief How long a fully charged battery should last; zero means no target.
+         */
+        Property<hours> targetRuntime { this, "targetRuntime", hours::zero() };
+
+        /**
+         * @brief State of charge in percent the battery should have left at dawn; zero means no target.
+         */
+        Property<double> dawnCharge { this, "dawnCharge", 0.0 };
+
+        /**
+         * @brief Hour of dawn in UTC.
+         */
+        Property<int> dawnHour { this, "dawnHour", 6 };
+
+        /**
+         * @brief Capacity of the battery in mAh, to estimate runtime when the fuel gauge does not.
+         */
+        Property<double> capacity { this, "capacity", 0.0 };
+
+        /**
+         * @brief Current drawn in light sleep in mA.
+         */
+        Property<double> sleepCurrent { this, "sleepCurrent", 1.0 };
+    };
+
+    explicit EnergyPlanner(const std::shared_ptr<Config>& config)
+        : maxFactor(std::max(config->maxFactor.get(), 1.0))
+        , targetRuntime(config->targetRuntime.get())
+        , dawnCharge(config->dawnCharge.get())
+        , dawnHour(config->dawnHour.get())
+        , capacity(config->capacity.get())
+        , sleepCurrent(config->sleepCurrent.get())
+        , curve(sorted(config->curve.hasValue()
+                  ? config->curve.get()
+                  : std::list<EnergyCurvePoint> { { 50.0, 1.0 }, { 30.0, 2.0 }, { 15.0, 4.0 } }))
+        , logLevels(sorted(config->logLevels.hasValue()
+                  ? config->logLevels.get()
+                  : std::list<EnergyLogLevel> { { 30.0, Level::Warning }, { 15.0, Level::Error } })) {
+    }
+
+    EnergyPlan plan(const EnergyState& state) {
+        Lock lock(mutex);
+        EnergyPlan next;
+        next.projectedRuntime = projectRuntime(state);
+        next.targetRuntime = getTargetRuntime(state);
+        next.factor = std::clamp(std::max(factorFromCurve(state.charge), factorFromTarget(state, next.projectedRuntime, next.targetRuntime)), 1.0, maxFactor);
+        next.logLevel = logLevelFor(state.charge);
+        if (next.factor != last.factor || next.logLevel != last.logLevel) {
+            LOGI("Energy plan at %.1f%% charge: stretching periodic work %.2fx, publishing logs up to level %d",
+                state.charge, next.factor, static_cast<int>(next.logLevel));
+        }
+        last = next;
+        return next;
+    }
+
+    EnergyPlan getPlan() const {
+        Lock lock(mutex);
+        return last;
+    }
+
+    /**
+     * @brief Scale a period according to the current plan.
+     */
+    template <typename D>
+    D scale(D period) const {
+        Lock lock(mutex);
+        return duration_cast<D>(duration<double, typename D::period>(period.count() * last.factor));
+    }
+
+    void populateTelemetry(JsonObject& json) const {
+        Lock lock(mutex);
+        json["factor"] = last.factor;
+        json["log-level"] = last.logLevel;
+        if (last.projectedRuntime.has_value()) {
+            json["projected-runtime"] = last.projectedRuntime->count();
+        }
+        if (last.targetRuntime.has_value()) {
+            json["target-runtime"] = last.targetRuntime->count();
+        }
+    }
+
+    /**
+     * @brief Time until the next `hour` o'clock in UTC.
+     */
+    static seconds timeUntilHour(system_clock::time_point now, int hour) {
+        auto timestamp = system_clock::to_time_t(now);
+        std::tm utc {};
+        gmtime_r(&timestamp, &utc);
+        auto sinceMidnight = seconds(utc.tm_hour * 3600 + utc.tm_min * 60 + utc.tm_sec);
+        auto until = hours(hour) - sinceMidnight;
+        if (until <= seconds::zero()) {
+            until += 24h;
+        }
+        return until;
+    }
+
+private:
+    template <typename T>
+    static std::vector<T> sorted(const std::list<T>& points) {
+        std::vector<T> result(points.begin(), points.end());
+        std::ranges::sort(result, {}, &T::charge);
+        return result;
+    }
+
+    double factorFromCurve(double charge) const {
+        if (curve.empty()) {
+            return 1.0;
+        }
+        if (charge <= curve.front().charge) {
+            return curve.front().factor;
+        }
+        if (charge >= curve.back().charge) {
+            return curve.back().factor;
+        }
+        for (size_t i = 1; i < curve.size(); i++) {
+            const auto& lower = curve[i - 1];
+            const auto& upper = curve[i];
+            if (charge <= upper.charge) {
+                auto position = (charge - lower.charge) / (upper.charge - lower.charge);
+                return lower.factor + (upper.factor - lower.factor) * position;
+            }
+        }
+        return curve.back().factor;
+    }
+
+    Level logLevelFor(double charge) const {
+        for (const auto& threshold : logLevels) {
+            if (charge <= threshold.charge) {
+                return threshold.level;
+            }
+        }
+        return Level::Verbose;
+    }
+
+    std::optional<hours> projectRuntime(const EnergyState& state) const {
+        if (state.timeToEmpty.has_value()) {
+            return duration_cast<hours>(*state.timeToEmpty);
+        }
+        if (capacity > 0.0 && state.current.has_value() && *state.current > 0.0) {
+            return duration_cast<hours>(duration<double, std::ratio<3600>>(state.charge / 100.0 * capacity / *state.current));
+        }
+        return std::nullopt;
+    }
+
+    std::optional<hours> getTargetRuntime(const EnergyState& state) const {
+        std::optional<hours> target;
+        if (targetRuntime > hours::zero()) {
+            // A full battery should last the target runtime, so what's left should last its share of it
+            target = ceil<hours>(duration<double, std::ratio<3600>>(static_cast<double>(targetRuntime.count()) * state.charge / 100.0));
+        }
+        if (dawnCharge > 0.0 && state.time.has_value()) {
+            auto untilDawn = timeUntilHour(*state.time, dawnHour);
+            hours dawnTarget = hours::max();
+            if (state.charge > dawnCharge) {
+                // Only the charge above what we need at dawn can be used
+                dawnTarget = ceil<hours>(untilDawn * state.charge / (state.charge - dawnCharge));
+            }
+            target = std::max(target.value_or(hours::zero()), dawnTarget);
+        }
+        return target;
+    }
+
+    double factorFromTarget(const EnergyState& state, std::optional<hours> projected, std::optional<hours> target) const {
+        if (!projected.has_value() || !target.has_value() || !state.current.has_value() || *state.current <= 0.0) {
+            return 1.0;
+        }
+        // What we measure is the consumption while following the last plan
+        return requiredFactor(state, *projected, *target, last.factor);
+    }
+
+    /**
+     * @brief The factor that brings the runtime up to the target, given that the measured current is at `currentFactor`.
+     */
+    double requiredFactor(const EnergyState& state, hours projected, hours target, double currentFactor) const {
+        auto current = *state.current;
+        auto fixed = std::min(current, state.sleepRatio.value_or(0.0) * sleepCurrent);
+        // The part of the current that scales with how often we do things, as if we ran at 1x
+        auto scalable = (current - fixed) * currentFactor;
+        auto allowed = current * static_cast<double>(projected.count()) / static_cast<double>(target.count());
+        if (allowed <= fixed) {
+            return maxFactor;
+        }
+        return scalable / (allowed - fixed);
+    }
+
+    const double maxFactor;
+    const hours targetRuntime;
+    const double dawnCharge;
+    const int dawnHour;
+    const double capacity;
+    const double sleepCurrent;
+    const std::vector<EnergyCurvePoint> curve;
+    const std::vector<EnergyLogLevel> logLevels;
+
+    mutable Mutex mutex;
+    EnergyPlan last;
+};
+
+}    // namespace farmhub::kernel
+
+namespace ArduinoJson {
+
+using farmhub::kernel::EnergyCurvePoint;
+using farmhub::kernel::EnergyLogLevel;
+using farmhub::kernel::Level;
+
+template <>
+struct Converter<EnergyCurvePoint> {
+    static bool toJson(const EnergyCurvePoint& src, JsonVariant dst) {
+        dst["charge"] = src.charge;
+        dst["factor"] = src.factor;
+        return true;
+    }
+
+    static EnergyCurvePoint fromJson(JsonVariantConst src) {
+        return {
+            .charge = src["charge"].as<double>(),
+            .factor = src["factor"].as<double>(),
+        };
+    }
+
+    static bool checkJson(JsonVariantConst src) {
+        return src["charge"].is<double>() && src["factor"].is<double>();
+    }
+};
+
+template <>
+struct Converter<EnergyLogLevel> {
+    static bool toJson(const EnergyLogLevel& src, JsonVariant dst) {
+        dst["charge"] = src.charge;
+        dst["level"] = static_cast<int>(src.level);
+        return true;
+    }
+
+    static EnergyLogLevel fromJson(JsonVariantConst src) {
+        return {
+            .charge = src["charge"].as<double>(),
+            .level = static_cast<Level>(src["level"].as<int>()),
+        };
+    }
+
+    static bool checkJson(JsonVariantConst src) {
+        return src["charge"].is<double>() && src["level"].is<int>();
+    }
+};
+
+}    // namespace ArduinoJson
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include <Concurrent.hpp>
+#include <Log.hpp>
+#include <Task.hpp>
+#include <TimerWheel.hpp>
+
+using namespace std::chrono;
+
+namespace farmhub::kernel {
+
+/**
+ * @brief Periodic jobs scheduled on a timer wheel, run by whoever calls `runDue()`.
+ *
+ * Each job has a tolerance: it may run up to that much later than its period would dictate.
+ * Whenever a job has to run, all other jobs that are already due run along with it to save wakeups.
+ * Jobs are always scheduled relative to when they were due, not when they actually ran,
+ * so they don't drift. A job that throws is logged and keeps being scheduled, so it can't stop the others.
+ */
+class JobScheduler {
+public:
+    using Job = std::function<void()>;
+
+    explicit JobScheduler(milliseconds resolution, steady_clock::time_point start = steady_clock::now())
+        : wheel(resolution, start) {
+    }
+
+    /**
+     * @brief Run `job` every `period`, starting at `now`, and no later than `tolerance` after it is due.
+     *
+     * @throws std::invalid_argument if `period` is not positive.
+     */
+    void schedule(const std::string& name, milliseconds period, milliseconds tolerance, Job job, steady_clock::time_point now = steady_clock::now()) {
+        if (period <= milliseconds::zero()) {
+            throw std::invalid_argument("Job '" + name + "' must have a positive period, got " + std::to_string(period.count()) + " ms");
+        }
+        wheel.schedule(
+            ScheduledJob {
+                .name = name,
+                .period = period,
+                .tolerance = tolerance,
+                .due = now,
+                .job = std::move(job),
+            },
+            now, now + tolerance);
+    }
+
+    /**
+     * @brief Run all jobs that are due by `now`, and schedule their next runs.
+     *
+     * @return The number of jobs run.
+     */
+    size_t runDue(steady_clock::time_point now = steady_clock::now()) {
+        Wheel::Entries due;
+        wheel.advance(now, due);
+        size_t count = 0;
+        while (!due.empty()) {
+            auto entry = due.begin();
+            auto& job = entry->item;
+            LOGV("Running job '%s'", job.name.c_str());
+            try {
+                job.job();
+            } catch (const std::exception& e) {
+                LOGE("Job '%s' failed: %s", job.name.c_str(), e.what());
+                failures++;
+            } catch (...) {
+                LOGE("Job '%s' failed with an unknown exception", job.name.c_str());
+                failures++;
+            }
+            count++;
+            auto period = scaled(job.period);
+            job.due += period;
+            if (job.due + job.tolerance < now) {
+                // We fell behind, skip the missed runs while keeping the phase
+                job.due += period * ((now - job.due) / period + 1);
+            }
+            wheel.schedule(due, entry, job.due, job.due + job.tolerance);
+        }
+        if (count > 0) {
+            wakeups++;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Run jobs `scale` times less often than their periods ask for, from their next run on.
+     */
+    void setPeriodScale(double scale) {
+        periodScale = std::isnan(scale) ? 1.0 : std::max(scale, 1.0);
+    }
+
+    /**
+     * @brief When the next job is due, if there is any.
+     */
+    std::optional<steady_clock::time_point> nextWakeTime() const {
+        return wheel.nextWakeTime();
+    }
+
+    size_t size() const {
+        return wheel.size();
+    }
+
+    /**
+     * @brief Number of times jobs were run, counting jobs run together only once.
+     */
+    size_t getWakeups() const {
+        return wakeups;
+    }
+
+    /**
+     * @brief Number of times a job threw an exception.
+     */
+    size_t getFailures() const {
+        return failures;
+    }
+
+private:
+    struct ScheduledJob {
+        std::string name;
+        milliseconds period;
+        milliseconds tolerance;
+        steady_clock::time_point due;
+        Job job;
+    };
+
+    using Wheel = TimerWheel<ScheduledJob>;
+
+    milliseconds scaled(milliseconds period) const {
+        // Never shorter than a tick, so a job can't come due again right away
+        return std::max(duration_cast<milliseconds>(period * periodScale), MIN_PERIOD);
+    }
+
+    static constexpr milliseconds MIN_PERIOD = ceil<milliseconds>(ticks(1));
+
+    Wheel wheel;
+    size_t wakeups = 0;
+    size_t failures = 0;
+    double periodScale = 1.0;
+};
+
+/**
+ * @brief Runs periodic jobs in a single task, so that peripherals polling their hardware don't each need their own task.
+ *
+ * Jobs share the stack of the executor's task, and run one after the other, so they should not block for long.
+ */
+class Executor {
+public:
+    Executor(const std::string& name, uint32_t stackSize, milliseconds resolution = 10ms)
+        : scheduler(resolution) {
+        Task::loop(name, stackSize, [this](Task& /*task*/) {
+            steady_clock::time_point now;
+            std::optional<steady_clock::time_point> next;
+            {
+                Lock lock(mutex);
+                now = steady_clock::now();
+                scheduler.runDue(now);
+                next = scheduler.nextWakeTime();
+            }
+            auto timeout = next.has_value()
+                ? clampTicks(ceil<milliseconds>(*next - now))
+                : ticks::max();
+            // Wait until the next job is due, or until a new job is scheduled
+            scheduleRequests.pollIn(timeout);
+        });
+    }
+
+    /**
+     * @brief Run `job` every `period` on the executor's task, starting right away.
+     *
+     * @param tolerance How late the job can run to be coalesced with other jobs.
+     */
+    void schedule(const std::string& name, milliseconds period, milliseconds tolerance, JobScheduler::Job job) {
+        LOGD("Scheduling job '%s' every %lld ms (tolerance %lld ms)",
+            name.c_str(), period.count(), tolerance.count());
+        {
+            Lock lock(mutex);
+            scheduler.schedule(name, period, tolerance, std::move(job));
+        }
+        scheduleRequests.overwrite(true);
+    }
+
+    /**
+     * @brief Run jobs less often to save energy, see `JobScheduler::setPeriodScale()`.
+     */
+    void setPeriodScale(double scale) {
+        Lock lock(mutex);
+        scheduler.setPeriodScale(scale);
+    }
+
+private:
+    // Jobs run while holding the mutex, so schedule() waits for any running job to finish
+    RecursiveMutex mutex;
+    JobScheduler scheduler;
+    CopyQueue<bool> scheduleRequests { "executor-schedule", 1 };
+};
+
+}    // namespace farmhub::kernel
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cerrno>
+#include <cstring>
 #include <dirent.h>
 #include <expected>
 #include <functional>
@@ -20,6 +22,8 @@ static constexpr const char* PARTITION = "data";
 
 class FileSystem {
 public:
+    virtual ~FileSystem() = default;
+
     bool exists(const std::string& path) const {
         struct stat fileStat {};
         return stat(resolve(path).c_str(), &fileStat) == 0;
@@ -71,7 +75,8 @@ public:
         return bytesRead;
     }
 
-    size_t write(const std::string& path, const char* buffer, size_t size) const {
+    // Writing, removing and renaming are virtual so that tests can simulate a crash in between
+    virtual size_t write(const std::string& path, const char* buffer, size_t size) const {
         FILE* file = open(path, "w");
         if (file == nullptr) {
             return 0;
@@ -82,10 +87,43 @@ public:
         return bytesWritten;
     }
 
-    int remove(const std::string& path) const {
+    virtual size_t append(const std::string& path, const char* buffer, size_t size) const {
+        FILE* file = open(path, "a");
+        if (file == nullptr) {
+            return 0;
+        }
+
+        size_t bytesWritten = fwrite(buffer, 1, size, file);
+        (void) fclose(file);
+        return bytesWritten;
+    }
+
+    virtual int remove(const std::string& path) const {
         return unlink(resolve(path).c_str());
     }
 
+    /**
+     * @brief Rename a file; `to` must not exist.
+     */
+    virtual int rename(const std::string& from, const std::string& to) const {
+        return ::rename(resolve(from).c_str(), resolve(to).c_str());
+    }
+
+    /**
+     * @brief Create a directory unless it already exists.
+     *
+     * SPIFFS has no real directories and refuses to create them, but takes any path for files anyway,
+     * so that is not an error either.
+     */
+    bool makeDir(const std::string& path) const {
+        if (mkdir(resolve(path).c_str(), 0755) == 0 || errno == EEXIST || errno == ENOTSUP) {
+            return true;
+        }
+        LOGTE(FS, "Failed to create directory '%s': %s",
+            path.c_str(), strerror(errno));
+        return false;
+    }
+
     bool readDir(const std::string& path, const std::function<void(const std::string&, size_t)>& callback) const {
         DIR* dir = opendir(resolve(path).c_str());
         if (dir == nullptr) {
@@ -116,6 +154,15 @@ public:
         return false;
     }
 
+    /**
+     * @brief Use an already existing directory as the root of the file system, without mounting anything.
+     *
+     * Useful for running storage code against a temporary directory in tests.
+     */
+    explicit FileSystem(const std::string& mountPoint)
+        : mountPoint(mountPoint) {
+    }
+
     FileSystem()
         : mountPoint("/" + std::string(PARTITION)) {
         esp_vfs_spiffs_conf_t conf = {
@@ -10,6 +10,7 @@
 
 #include <FileSystem.hpp>
 #include <Log.hpp>
+#include <PowerManagementLock.hpp>
 #include <Watchdog.hpp>
 #include <drivers/WiFiDriver.hpp>
 #include <utility>
@@ -98,7 +99,11 @@ private:
         esp_https_ota_config_t otaConfig = {};
         otaConfig.http_config = &httpConfig;
 
-        esp_err_t ret = esp_https_ota(&otaConfig);
+        esp_err_t ret;
+        {
+            PowerManagementLockGuard updating(Workloads::update);
+            ret = esp_https_ota(&otaConfig);
+        }
         if (ret == ESP_OK) {
             LOGTI(UPDATE, "Update succeeded, rebooting in 5 seconds...");
             Task::delay(5s);
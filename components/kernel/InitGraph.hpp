@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Concurrent.hpp>
+#include <Log.hpp>
+#include <Task.hpp>
+#include <Time.hpp>
+
+using namespace std::chrono;
+
+namespace farmhub::kernel {
+
+enum class InitOutcome : uint8_t {
+    Succeeded,
+    Failed,
+    // Took longer than the timeout; might still finish later
+    TimedOut,
+    // Never started, because a resource it needs is held by something that timed out
+    Blocked,
+};
+
+struct InitResult {
+    InitOutcome outcome = InitOutcome::Blocked;
+    std::string error;
+    milliseconds duration {};
+};
+
+/**
+ * @brief Runs initializers concurrently when they do not need each other, or the same resources.
+ *
+ * A node starts after the nodes it depends on have finished, and never runs at the same time as another
+ * node that uses any of the same resources. Of the nodes that could start, the one added first goes first,
+ * so running with a concurrency of one initializes nodes in the order they were added.
+ *
+ * A node that takes longer than the timeout is reported as timed out, and the rest carry on without it.
+ * It keeps its resources until it finishes, if ever; nodes that need them are reported as blocked.
+ */
+class InitGraph {
+public:
+    InitGraph(size_t concurrency, milliseconds timeout, uint32_t stackSize = 8192)
+        : concurrency(std::max<size_t>(concurrency, 1))
+        , timeout(timeout)
+        , stackSize(stackSize) {
+    }
+
+    void add(const std::string& name, std::set<std::string> resources, std::set<std::string> dependencies, std::function<void()> init) {
+        nodes.push_back({
+            .name = name,
+            .resources = std::move(resources),
+            .dependencies = std::move(dependencies),
+            .init = std::move(init),
+        });
+    }
+
+    /**
+     * @brief Initialize every node, and return how it went, in the order the nodes were added.
+     */
+    std::vector<InitResult> run() {
+        // Shared with the tasks running the nodes, which might outlive us if they time out
+        auto shared = std::make_shared<Shared>(nodes.size());
+        std::vector<State> states(nodes.size(), State::Waiting);
+        std::vector<steady_clock::time_point> startTimes(nodes.size());
+        std::vector<InitResult> results(nodes.size());
+        std::map<std::string, size_t> holders;
+        size_t running = 0;
+
+        auto start = [&](size_t index) {
+            const auto& node = nodes[index];
+            LOGD("Initializing '%s'",
+                node.name.c_str());
+            states[index] = State::Running;
+            startTimes[index] = steady_clock::now();
+            for (const auto& resource : node.resources) {
+                holders[resource] = index;
+            }
+            running++;
+            Task::run("init:" + node.name, stackSize, [shared, index, init = node.init](Task& /*task*/) {
+                try {
+                    init();
+                } catch (const std::exception& e) {
+                    shared->errors[index] = e.what();
+                }
+                shared->finished.put(index);
+            });
+        };
+
+        auto release = [&](size_t index) {
+            for (const auto& resource : nodes[index].resources) {
+                holders.erase(resource);
+            }
+        };
+
+        while (true) {
+            for (size_t index = 0; index < nodes.size() && running < concurrency; index++) {
+                if (states[index] == State::Waiting && isSettled(index, states) && isFree(index, holders)) {
+                    start(index);
+                }
+            }
+            if (running == 0) {
+                // Nodes that depend on each other would never start, so start the first one without waiting
+                auto waiting = std::optional<size_t>();
+                for (size_t index = 0; index < nodes.size() && !waiting.has_value(); index++) {
+                    if (states[index] == State::Waiting && isFree(index, holders)) {
+                        waiting = index;
+                    }
+                }
+                if (!waiting.has_value()) {
+                    break;
+                }
+                LOGW("Initializing '%s' without waiting for what it depends on",
+                    nodes[*waiting].name.c_str());
+                start(*waiting);
+            }
+
+            auto nextDeadline = steady_clock::time_point::max();
+            for (size_t index = 0; index < nodes.size(); index++) {
+                if (states[index] == State::Running) {
+                    nextDeadline = std::min(nextDeadline, startTimes[index] + timeout);
+                }
+            }
+
+            auto finished = shared->finished.pollIn(clampTicks(duration_cast<milliseconds>(nextDeadline - steady_clock::now())));
+            auto now = steady_clock::now();
+            if (finished.has_value()) {
+                auto index = *finished;
+                auto duration = duration_cast<milliseconds>(now - startTimes[index]);
+                release(index);
+                if (states[index] == State::TimedOut) {
+                    LOGW("'%s' finished initializing after %lld ms, too late",
+                        nodes[index].name.c_str(), duration.count());
+                    continue;
+                }
+                running--;
+                states[index] = State::Done;
+                results[index].duration = duration;
+                if (shared->errors[index].empty()) {
+                    results[index].outcome = InitOutcome::Succeeded;
+                    LOGD("Initialized '%s' in %lld ms",
+                        nodes[index].name.c_str(), duration.count());
+                } else {
+                    results[index].outcome = InitOutcome::Failed;
+                    results[index].error = shared->errors[index];
+                }
+            }
+
+            for (size_t index = 0; index < nodes.size(); index++) {
+                if (states[index] == State::Running && now >= startTimes[index] + timeout) {
+                    LOGE("Initializing '%s' timed out after %lld ms",
+                        nodes[index].name.c_str(), timeout.count());
+                    running--;
+                    states[index] = State::TimedOut;
+                    results[index].outcome = InitOutcome::TimedOut;
+                    results[index].error = "Timed out after " + std::to_string(timeout.count()) + " ms";
+                    results[index].duration = timeout;
+                }
+            }
+        }
+
+        for (size_t index = 0; index < nodes.size(); index++) {
+            if (states[index] == State::Waiting) {
+                auto held = std::ranges::find_if(nodes[index].resources, [&](const std::string& resource) {
+                    return holders.contains(resource);
+                });
+                results[index].outcome = InitOutcome::Blocked;
+                results[index].error = held == nodes[index].resources.end()
+                    ? "Never started"
+                    : "Waiting for " + *held + " held by '" + nodes[holders.at(*held)].name + "'";
+                LOGE("Cannot initialize '%s': %s",
+                    nodes[index].name.c_str(), results[index].error.c_str());
+            }
+        }
+        return results;
+    }
+
+private:
+    struct Node {
+        std::string name;
+        std::set<std::string> resources;
+        std::set<std::string> dependencies;
+        std::function<void()> init;
+    };
+
+    enum class State : uint8_t {
+        Waiting,
+        Running,
+        Done,
+        TimedOut,
+    };
+
+    struct Shared {
+        explicit Shared(size_t count)
+            : finished("init-finished", std::max<size_t>(count, 1))
+            , errors(count) {
+        }
+
+        CopyQueue<size_t> finished;
+        std::vector<std::string> errors;
+    };
+
+    bool isSettled(size_t index, const std::vector<State>& states) const {
+        // Dependencies that are not in the graph are someone else's business
+        return std::ranges::all_of(nodes[index].dependencies, [&](const std::string& dependency) {
+            auto it = std::ranges::find(nodes, dependency, &Node::name);
+            return it == nodes.end() || states[it - nodes.begin()] == State::Done || states[it - nodes.begin()] == State::TimedOut;
+        });
+    }
+
+    bool isFree(size_t index, const std::map<std::string, size_t>& holders) const {
+        return std::ranges::none_of(nodes[index].resources, [&](const std::string& resource) {
+            return holders.contains(resource);
+        });
+    }
+
+    const size_t concurrency;
+    const milliseconds timeout;
+    const uint32_t stackSize;
+    std::vector<Node> nodes;
+};
+
+}    // namespace farmhub::kernel
@@ -11,9 +11,11 @@
 
 #include <freertos/FreeRTOS.h>    // NOLINT(misc-header-include-cycle)
 
+#include <CrashLog.hpp>
 #include <I2CManager.hpp>
 #include <MacAddress.hpp>
 #include <PowerManager.hpp>
+#include <ShutdownManager.hpp>
 #include <StateManager.hpp>
 #include <drivers/LedDriver.hpp>
 #include <drivers/MdnsDriver.hpp>
@@ -31,6 +33,10 @@ namespace farmhub::kernel {
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
 static RTC_DATA_ATTR int bootCount = 0;
+// Survives panics, watchdog and brownout resets too; validated by CrashLog on startup
+static RTC_NOINIT_ATTR CrashLog::Storage crashLogStorage;
+// Survives deep sleep, so the shutdown before going to sleep on low battery can be reported after waking up
+static RTC_DATA_ATTR ShutdownManager::Report shutdownReport;
 // NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
 
 class KernelStatusTask;
@@ -2,7 +2,15 @@
 
 #include <string.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 
 #include <esp_log.h>
 
@@ -51,27 +59,126 @@ inline bool loggingTagInList(const char* tag, const char* list) {
     return false;
 }
 
+/**
+ * @brief Levels of logging tags, looked up by an interned ID so that disabled log calls can be
+ * skipped before their arguments are evaluated.
+ *
+ * Tags are interned during static initialization; levels can be changed at runtime.
+ * Registering more than `MAX_TAGS` tags throws, which aborts during static initialization.
+ */
+class LogTags {
+public:
+    static constexpr size_t MAX_TAGS = 64;
+    static constexpr std::string_view PREFIX = "farmhub:";
+
+    static uint8_t intern(const char* name, esp_log_level_t defaultLevel) {
+        for (size_t id = 0; id < count; id++) {
+            if (strcmp(tags[id].name, name) == 0) {
+                return id;
+            }
+        }
+        if (count == MAX_TAGS) {
+            // Sharing a slot would silently tie the levels of unrelated tags together
+            throw std::runtime_error("Too many logging tags, cannot register '" + std::string(name) + "'; increase LogTags::MAX_TAGS");
+        }
+        auto id = count++;
+        tags[id] = { .name = name, .defaultLevel = defaultLevel };
+        levels[id].store(defaultLevel, std::memory_order_relaxed);
+        esp_log_level_set(name, defaultLevel);
+        return id;
+    }
+
+    static bool isEnabled(uint8_t id, esp_log_level_t level) {
+        return level <= levels[id].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Set the level of the tag with the given name (without the "farmhub:" prefix),
+     * or restore its default level if `level` is empty.
+     *
+     * @return Whether the tag exists.
+     */
+    static bool setLevel(std::string_view name, std::optional<Level> level) {
+        for (size_t id = 0; id < count; id++) {
+            if (getName(id) == name) {
+                auto espLevel = level.has_value() ? toEspLevel(*level) : tags[id].defaultLevel;
+                levels[id].store(espLevel, std::memory_order_relaxed);
+                esp_log_level_set(tags[id].name, espLevel);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void forEach(const std::function<void(std::string_view name, Level level)>& consumer) {
+        for (size_t id = 0; id < count; id++) {
+            consumer(getName(id), toLevel(static_cast<esp_log_level_t>(levels[id].load(std::memory_order_relaxed))));
+        }
+    }
+
+    static Level toLevel(esp_log_level_t level) {
+        return level == ESP_LOG_NONE
+            ? Level::None
+            : static_cast<Level>(level + 1);
+    }
+
+    static esp_log_level_t toEspLevel(Level level) {
+        return level == Level::None
+            ? ESP_LOG_NONE
+            : static_cast<esp_log_level_t>(std::clamp(static_cast<int>(level) - 1, static_cast<int>(ESP_LOG_ERROR), static_cast<int>(ESP_LOG_VERBOSE)));
+    }
+
+private:
+    static std::string_view getName(size_t id) {
+        std::string_view name = tags[id].name;
+        if (name.starts_with(PREFIX)) {
+            name.remove_prefix(PREFIX.length());
+        }
+        return name;
+    }
+
+    struct Tag {
+        const char* name;
+        esp_log_level_t defaultLevel;
+    };
+
+    static inline constinit std::array<Tag, MAX_TAGS> tags {};
+    static inline constinit std::array<std::atomic<uint8_t>, MAX_TAGS> levels {};
+    static inline constinit size_t count = 0;
+};
+
+struct LogTag {
+    LogTag(const char* name, esp_log_level_t defaultLevel)
+        : name(name)
+        , id(LogTags::intern(name, defaultLevel)) {
+    }
+
+    const char* const name;
+    const uint8_t id;
+};
+
 // LOGGING_TAG(varName, "tagname")
-#define LOGGING_TAG(varName, name)                             \
-    static constexpr const char* varName = "farmhub:" name;    \
-    struct varName##_LoggerInit {                              \
-        varName##_LoggerInit() {                               \
-            esp_log_level_t lvl = FARMHUB_LOG_LEVEL;           \
-            if (loggingTagInList(name, FARMHUB_LOG_VERBOSE)) { \
-                lvl = ESP_LOG_VERBOSE;                         \
-            }                                                  \
-            esp_log_level_set(varName, lvl);                   \
-        }                                                      \
-    };                                                         \
-    static const varName##_LoggerInit varName##_logger_init;
+#define LOGGING_TAG(varName, name)                                         \
+    static const ::farmhub::kernel::LogTag varName("farmhub:" name,        \
+        ::farmhub::kernel::loggingTagInList(name, FARMHUB_LOG_VERBOSE)     \
+            ? ESP_LOG_VERBOSE                                              \
+            : FARMHUB_LOG_LEVEL);
 
 LOGGING_TAG(GLOBAL, "global")
 
-#define LOGTE(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
-#define LOGTW(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
-#define LOGTI(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
-#define LOGTD(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
-#define LOGTV(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+// Arguments are only evaluated if the tag's level is enabled
+#define LOGT(level, tag, format, ...)                                                              \
+    do {                                                                                           \
+        if (LOG_LOCAL_LEVEL >= (level) && ::farmhub::kernel::LogTags::isEnabled((tag).id, level)) { \
+            ESP_LOG_LEVEL(level, (tag).name, format, ##__VA_ARGS__);                               \
+        }                                                                                          \
+    } while (0)
+
+#define LOGTE(tag, format, ...) LOGT(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define LOGTW(tag, format, ...) LOGT(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define LOGTI(tag, format, ...) LOGT(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define LOGTD(tag, format, ...) LOGT(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define LOGTV(tag, format, ...) LOGT(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
 
 #define LOGE(format, ...) LOGTE(GLOBAL, format, ##__VA_ARGS__)
 #define LOGW(format, ...) LOGTW(GLOBAL, format, ##__VA_ARGS__)
@@ -11,6 +11,7 @@
 
 #include <Concurrent.hpp>
 #include <Configuration.hpp>
+#include <PowerManagementLock.hpp>
 
 namespace farmhub::kernel {
 
@@ -136,19 +137,30 @@ public:
         const std::string& name,
         const std::string& type,
         const std::function<Handle(const FactoryT&)>& make) {
-        Lock lock(mutex);
-        if (state == State::Stopped) {
-            throw std::runtime_error("Not creating " + managed + " because the manager is stopped");
+        const FactoryT* factory = nullptr;
+        {
+            Lock lock(mutex);
+            if (state == State::Stopped) {
+                throw std::runtime_error("Not creating " + managed + " because the manager is stopped");
+            }
+
+            LOGD("Creating %s '%s' with factory '%s'",
+                managed.c_str(), name.c_str(), type.c_str());
+            auto it = factories.find(type);
+            if (it == factories.end()) {
+                throw std::runtime_error("Factory for '" + type + "' not found");
+            }
+            factory = &it->second;
         }
 
-        LOGD("Creating %s '%s' with factory '%s'",
-            managed.c_str(), name.c_str(), type.c_str());
-        auto it = factories.find(type);
-        if (it == factories.end()) {
-            throw std::runtime_error("Factory for '" + type + "' not found");
+        // Not holding the lock, so that instances can be created concurrently
+        Handle instance = make(*factory);
+
+        Lock lock(mutex);
+        if (state == State::Stopped) {
+            instance.shutdown(ShutdownParameters {});
+            throw std::runtime_error("Not keeping " + managed + " because the manager stopped while it was created");
         }
-        const auto& factory = it->second;
-        Handle instance = make(factory);
         instances.emplace(name, std::move(instance));
     }
 
@@ -176,28 +188,67 @@ public:
         : Manager<FactoryT>(std::move(managed)) {
     }
 
-    void createFromSettings(
-        const std::string& settingsAsString,
-        JsonObject initJson,
-        const std::function<Handle(const std::string&, const FactoryT&, const std::string&)>& make) {
+    /**
+     * @brief The settings of an instance, parsed: its name, the type of the factory to use, and its parameters.
+     */
+    struct ParsedSettings {
+        std::string name;
+        std::string type;
+        JsonDocument json;
+
+        JsonObjectConst getParams() const {
+            return json["params"].as<JsonObjectConst>();
+        }
+    };
+
+    ParsedSettings parseSettings(const std::string& settingsAsString) const {
         LOGI("Creating %s with settings: %s",
             this->managed.c_str(), settingsAsString.c_str());
-        std::shared_ptr<ProductSettings> settings = std::make_shared<ProductSettings>();
+        ParsedSettings parsed;
+        JsonDocument& json = parsed.json;
         try {
-            settings->loadFromString(settingsAsString);
+            PowerManagementLockGuard parsing(Workloads::configuration);
+            // Not filtered, as parameters are passed on as they are
+            DeserializationError error = deserializeJson(json, settingsAsString);
+            if (error && error != DeserializationError::EmptyInput) {
+                throw ConfigurationException("Cannot parse JSON configuration: " + std::string(error.c_str()));
+            }
+            ProductSettings settings;
+            settings.load(json.as<JsonObjectConst>());
+            parsed.name = settings.name.get();
+            parsed.type = settings.type.get();
         } catch (const std::exception& e) {
             throw std::runtime_error(
                 "Failed to parse " + this->managed + " settings because " + e.what() + ":\n" + settingsAsString);
         }
+        return parsed;
+    }
 
-        const auto& name = settings->name.get();
+    /**
+     * @brief Create an instance from its settings: its name, the type of the factory to use, and its parameters.
+     *
+     * The settings are parsed once, and `make` gets to load the parameters straight from the parsed document.
+     */
+    void createFromSettings(
+        const std::string& settingsAsString,
+        JsonObject initJson,
+        const std::function<Handle(const std::string&, const FactoryT&, JsonObjectConst)>& make) {
+        createFromParsedSettings(parseSettings(settingsAsString), initJson, make);
+    }
+
+    void createFromParsedSettings(
+        const ParsedSettings& settings,
+        JsonObject initJson,
+        const std::function<Handle(const std::string&, const FactoryT&, JsonObjectConst)>& make) {
+        const auto& name = settings.name;
         try {
-            this->createWithFactory(name, settings->type.get(), [&](const FactoryT& factory) {
+            this->createWithFactory(name, settings.type, [&](const FactoryT& factory) {
+                auto params = settings.getParams();
                 initJson["name"] = name;
                 initJson["type"] = factory.productType;
                 initJson["factory"] = factory.factoryType;
-                settings->params.store(initJson);
-                return make(name, factory, settings->params.get().get());
+                initJson["params"] = params;
+                return make(name, factory, params);
             });
         } catch (const std::exception& e) {
             throw std::runtime_error("Failed to create " + this->managed + " '" + name + "' because: " + e.what());
@@ -209,7 +260,6 @@ private:
     public:
         Property<std::string> name { this, "name" };
         Property<std::string> type { this, "type" };
-        Property<JsonAsString> params { this, "params" };
     };
 };
 
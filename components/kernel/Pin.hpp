@@ -3,6 +3,7 @@
 #include <exception>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <utility>
 #include <vector>
@@ -32,6 +33,7 @@ using InternalPinPtr = std::shared_ptr<InternalPin>;
 class Pin {
 public:
     static PinPtr byName(const std::string& name) {
+        std::lock_guard lock(REGISTRY_MUTEX);
         auto it = BY_NAME.find(name);
         if (it != BY_NAME.end()) {
             return it->second;
@@ -57,6 +59,7 @@ public:
     }
 
     static void registerPin(const std::string& name, PinPtr pin) {
+        std::lock_guard lock(REGISTRY_MUTEX);
         BY_NAME[name] = std::move(pin);
     }
 
@@ -70,9 +73,12 @@ protected:
     const std::string name;
 
     static std::map<std::string, PinPtr> BY_NAME;
+    // Peripherals look up and register pins while being initialized concurrently
+    static std::recursive_mutex REGISTRY_MUTEX;
 };
 
 std::map<std::string, PinPtr> Pin::BY_NAME;
+std::recursive_mutex Pin::REGISTRY_MUTEX;
 
 /**
  * @brief An internal GPIO pin of the MCU. These pins can do analog reads as well, and can expose the GPIO number.
@@ -81,6 +87,7 @@ class InternalPin : public Pin {
 public:
     static InternalPinPtr registerPin(const std::string& name, gpio_num_t gpio) {
         auto pin = std::make_shared<InternalPin>(name, gpio);
+        std::lock_guard lock(REGISTRY_MUTEX);
         INTERNAL_BY_GPIO[gpio] = pin;
         INTERNAL_BY_NAME[name] = pin;
         Pin::registerPin(name, pin);
@@ -88,6 +95,7 @@ public:
     }
 
     static InternalPinPtr byName(const std::string& name) {
+        std::lock_guard lock(REGISTRY_MUTEX);
         auto it = INTERNAL_BY_NAME.find(name);
         if (it != INTERNAL_BY_NAME.end()) {
             return it->second;
@@ -96,6 +104,7 @@ public:
     }
 
     static InternalPinPtr byGpio(gpio_num_t pin) {
+        std::lock_guard lock(REGISTRY_MUTEX);
         auto it = INTERNAL_BY_GPIO.find(pin);
         if (it == INTERNAL_BY_GPIO.end()) {
             std::string name = "GPIO_NUM_" + std::to_string(static_cast<int>(pin));
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+
+#include <ArduinoJson.h>
+
+#include <sdkconfig.h>
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include <esp_pm.h>
+
+#include <EspException.hpp>
+#endif
+
+using namespace std::chrono;
+
+namespace farmhub::kernel {
+
+enum class PowerManagementLockType : uint8_t {
+    // Keep the CPU at its maximum frequency
+    CpuFreqMax,
+    // Keep the APB bus at its maximum frequency, e.g. for peripherals and networking
+    ApbFreqMax,
+    // Keep the device out of light sleep, but let it slow down
+    NoLightSleep,
+    // Don't hold anything, only keep track of the time, e.g. spent waiting
+    AccountingOnly,
+};
+
+inline const char* toString(PowerManagementLockType type) {
+    switch (type) {
+        case PowerManagementLockType::CpuFreqMax:
+            return "cpu";
+        case PowerManagementLockType::ApbFreqMax:
+            return "apb";
+        case PowerManagementLockType::NoLightSleep:
+            return "no-sleep";
+        case PowerManagementLockType::AccountingOnly:
+            return "none";
+    }
+    return "unknown";
+}
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+/**
+ * @brief Power management locks provided by ESP-IDF.
+ */
+struct EspPowerManagementBackend {
+    using Handle = esp_pm_lock_handle_t;
+
+    static Handle create(const std::string& name, PowerManagementLockType type) {
+        Handle handle = nullptr;
+#ifdef CONFIG_PM_ENABLE
+        ESP_ERROR_THROW(esp_pm_lock_create(toEspLockType(type), 0, name.c_str(), &handle));
+#endif
+        return handle;
+    }
+
+    static void destroy(Handle handle) {
+        if (handle != nullptr) {
+            ESP_ERROR_CHECK(esp_pm_lock_delete(handle));
+        }
+    }
+
+    static void acquire(Handle handle) {
+        if (handle != nullptr) {
+            ESP_ERROR_THROW(esp_pm_lock_acquire(handle));
+        }
+    }
+
+    static void release(Handle handle) {
+        if (handle != nullptr) {
+            ESP_ERROR_CHECK(esp_pm_lock_release(handle));
+        }
+    }
+
+    static steady_clock::time_point now() {
+        return steady_clock::now();
+    }
+
+private:
+    static esp_pm_lock_type_t toEspLockType(PowerManagementLockType type) {
+        switch (type) {
+            case PowerManagementLockType::CpuFreqMax:
+                return ESP_PM_CPU_FREQ_MAX;
+            case PowerManagementLockType::ApbFreqMax:
+                return ESP_PM_APB_FREQ_MAX;
+            case PowerManagementLockType::NoLightSleep:
+            default:
+                return ESP_PM_NO_LIGHT_SLEEP;
+        }
+    }
+};
+
+using DefaultPowerManagementBackend = EspPowerManagementBackend;
+#else
+/**
+ * @brief There is no power management on the linux target, only the accounting is done.
+ */
+struct NoPowerManagementBackend {
+    using Handle = std::nullptr_t;
+
+    static Handle create(const std::string& /*name*/, PowerManagementLockType /*type*/) {
+        return nullptr;
+    }
+    static void destroy(Handle /*handle*/) {
+    }
+    static void acquire(Handle /*handle*/) {
+    }
+    static void release(Handle /*handle*/) {
+    }
+    static steady_clock::time_point now() {
+        return steady_clock::now();
+    }
+};
+
+using DefaultPowerManagementBackend = NoPowerManagementBackend;
+#endif
+
+/**
+ * @brief A named power management lock that keeps track of how long it has been held.
+ *
+ * Locks are counting: the lock is held as long as anyone has acquired it and not yet released it.
+ * Each owner (like a workload) should have its own lock, so the time spent holding it can be
+ * attributed to the owner.
+ *
+ * The underlying lock is only created when first acquired, so locks can be defined statically,
+ * before power management is initialized.
+ */
+template <typename TBackend>
+class BasicPowerManagementLock {
+public:
+    BasicPowerManagementLock(const std::string& name, PowerManagementLockType type)
+        : name(name)
+        , type(type) {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        registry().push_back(this);
+    }
+
+    ~BasicPowerManagementLock() {
+        {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            registry().remove(this);
+        }
+        if (handleCreated) {
+            TBackend::destroy(handle);
+        }
+    }
+
+    // Delete copy constructor and assignment operator to prevent copying
+    BasicPowerManagementLock(const BasicPowerManagementLock&) = delete;
+    BasicPowerManagementLock& operator=(const BasicPowerManagementLock&) = delete;
+
+    void acquire() {
+        if (type != PowerManagementLockType::AccountingOnly) {
+            std::call_once(handleCreation, [this]() {
+                handle = TBackend::create(name, type);
+                handleCreated = true;
+            });
+            TBackend::acquire(handle);
+        }
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if (holders++ == 0) {
+            heldSince = TBackend::now();
+            holdStarted = heldSince;
+        }
+        acquisitions++;
+    }
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            if (--holders == 0) {
+                auto now = TBackend::now();
+                heldTime += duration_cast<microseconds>(now - heldSince);
+                longestHold = std::max(longestHold, duration_cast<microseconds>(now - holdStarted));
+            }
+        }
+        if (type != PowerManagementLockType::AccountingOnly) {
+            TBackend::release(handle);
+        }
+    }
+
+    struct Stats {
+        uint32_t acquisitions;
+        microseconds heldTime;
+        microseconds longestHold;
+        bool held;
+    };
+
+    /**
+     * @brief Statistics since the last call, counting the current hold up to now if the lock is held.
+     */
+    Stats takeStats() {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        auto now = TBackend::now();
+        Stats stats {
+            .acquisitions = acquisitions,
+            .heldTime = heldTime,
+            .longestHold = longestHold,
+            .held = holders > 0,
+        };
+        if (holders > 0) {
+            stats.heldTime += duration_cast<microseconds>(now - heldSince);
+            stats.longestHold = std::max(stats.longestHold, duration_cast<microseconds>(now - holdStarted));
+            heldSince = now;
+        }
+        acquisitions = 0;
+        heldTime = microseconds::zero();
+        longestHold = microseconds::zero();
+        return stats;
+    }
+
+    /**
+     * @brief Report locks that were used since the last report, or are still held, keyed by their names.
+     */
+    static void populateTelemetry(JsonObject& json) {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        for (auto* powerLock : registry()) {
+            auto stats = powerLock->takeStats();
+            if (stats.acquisitions == 0 && !stats.held) {
+                continue;
+            }
+            auto lockJson = json[powerLock->name].template to<JsonObject>();
+            lockJson["type"] = toString(powerLock->type);
+            lockJson["count"] = stats.acquisitions;
+            lockJson["held"] = duration_cast<milliseconds>(stats.heldTime).count();
+            lockJson["longest"] = duration_cast<milliseconds>(stats.longestHold).count();
+            if (stats.held) {
+                lockJson["active"] = true;
+            }
+        }
+    }
+
+    const std::string name;
+    const PowerManagementLockType type;
+
+private:
+    static std::list<BasicPowerManagementLock*>& registry() {
+        static std::list<BasicPowerManagementLock*> locks;
+        return locks;
+    }
+
+    static std::mutex& registryMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    std::once_flag handleCreation;
+    bool handleCreated = false;
+    typename TBackend::Handle handle {};
+
+    std::mutex statsMutex;
+    uint32_t holders = 0;
+    // Start of the current hold, or of the part of it not yet reported
+    steady_clock::time_point heldSince;
+    // Start of the current hold
+    steady_clock::time_point holdStarted;
+    uint32_t acquisitions = 0;
+    microseconds heldTime = microseconds::zero();
+    microseconds longestHold = microseconds::zero();
+};
+
+template <typename TBackend>
+class BasicPowerManagementLockGuard {
+public:
+    BasicPowerManagementLockGuard(BasicPowerManagementLock<TBackend>& lock)
+        : lock(lock) {
+        lock.acquire();
+    }
+
+    ~BasicPowerManagementLockGuard() {
+        lock.release();
+    }
+
+    // Delete copy constructor and assignment operator to prevent copying
+    BasicPowerManagementLockGuard(const BasicPowerManagementLockGuard&) = delete;
+    BasicPowerManagementLockGuard& operator=(const BasicPowerManagementLockGuard&) = delete;
+
+private:
+    BasicPowerManagementLock<TBackend>& lock;
+};
+
+using PowerManagementLock = BasicPowerManagementLock<DefaultPowerManagementBackend>;
+using PowerManagementLockGuard = BasicPowerManagementLockGuard<DefaultPowerManagementBackend>;
+
+/**
+ * @brief Locks held while running workloads that should finish quickly, so the device can get back to sleep sooner.
+ */
+struct Workloads {
+    // Collecting telemetry from peripherals and functions
+    static inline PowerManagementLock telemetry { "telemetry", PowerManagementLockType::CpuFreqMax };
+    // Parsing and applying configuration
+    static inline PowerManagementLock configuration { "configuration", PowerManagementLockType::CpuFreqMax };
+    // Downloading and flashing a firmware update
+    static inline PowerManagementLock update { "update", PowerManagementLockType::CpuFreqMax };
+    // Serializing an MQTT message to be published
+    static inline PowerManagementLock publish { "mqtt-publish", PowerManagementLockType::ApbFreqMax };
+    // Waiting for a published MQTT message to be sent; nothing is held, the device may sleep meanwhile
+    static inline PowerManagementLock publishWait { "mqtt-publish-wait", PowerManagementLockType::AccountingOnly };
+};
+
+}    // namespace farmhub::kernel
@@ -1,12 +1,16 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
+#include <optional>
 
 #include <esp_pm.h>
 
 #include <Concurrent.hpp>
 #include <EspException.hpp>
+#include <PowerManagementLock.hpp>
 #include <Telemetry.hpp>
+#include <WakeupAligner.hpp>
 
 #if defined(CONFIG_IDF_TARGET_ESP32S2)
 // Apparently on ESP32S2 things start to break down if we go below 80 MHz
@@ -23,49 +27,6 @@ namespace farmhub::kernel {
 
 LOGGING_TAG(PM, "pm")
 
-class PowerManagementLock {
-public:
-    PowerManagementLock(const std::string& name, esp_pm_lock_type_t type)
-        : name(name) {
-        ESP_ERROR_THROW(esp_pm_lock_create(type, 0, name.c_str(), &lock));
-    }
-
-    ~PowerManagementLock() {
-        ESP_ERROR_CHECK(esp_pm_lock_delete(lock));
-    }
-
-    // Delete copy constructor and assignment operator to prevent copying
-    PowerManagementLock(const PowerManagementLock&) = delete;
-    PowerManagementLock& operator=(const PowerManagementLock&) = delete;
-
-private:
-    const std::string name;
-    esp_pm_lock_handle_t lock = nullptr;
-
-    friend class PowerManagementLockGuard;
-};
-
-class PowerManagementLockGuard {
-public:
-    PowerManagementLockGuard(PowerManagementLock& lock)
-        : lock(lock) {
-        ESP_ERROR_THROW(esp_pm_lock_acquire(lock.lock));
-    }
-
-    ~PowerManagementLockGuard() {
-        if (lock.lock != nullptr) {
-            ESP_ERROR_CHECK(esp_pm_lock_release(lock.lock));
-        }
-    }
-
-    // Delete copy constructor and assignment operator to prevent copying
-    PowerManagementLockGuard(const PowerManagementLockGuard&) = delete;
-    PowerManagementLockGuard& operator=(const PowerManagementLockGuard&) = delete;
-
-private:
-    PowerManagementLock& lock;
-};
-
 class PowerManager final {
 public:
     PowerManager(bool requestedSleepWhenIdle)
@@ -86,6 +47,7 @@ public:
             .exit_cb = [](int64_t timeSleptInUs, void* arg) {
                 auto* self = static_cast<PowerManager*>(arg);
                 self->lightSleepTime += microseconds(timeSleptInUs);
+                self->totalLightSleepTime += microseconds(timeSleptInUs);
                 self->lightSleepCount++;
                 return ESP_OK;
             },
@@ -123,6 +85,29 @@ public:
             json["sleep-ratio"] = currentLightSleepRatio;
             json["sleep-count"] = currentLightSleepCount;
         }
+#endif
+        WakeupAligner::shared().populateTelemetry(json);
+        auto locks = json["locks"].to<JsonObject>();
+        PowerManagementLock::populateTelemetry(locks);
+    }
+
+    /**
+     * @brief Share of time spent in light sleep since the last call, if known.
+     */
+    std::optional<double> takeSleepRatio() {
+#ifdef CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+        auto now = steady_clock::now();
+        auto total = totalLightSleepTime;
+        auto duration = duration_cast<microseconds>(now - sleepRatioLastTaken);
+        if (duration.count() <= 0) {
+            return std::nullopt;
+        }
+        auto ratio = static_cast<double>((total - totalLightSleepTimeLastTaken).count()) / static_cast<double>(duration.count());
+        sleepRatioLastTaken = now;
+        totalLightSleepTimeLastTaken = total;
+        return std::min(ratio, 1.0);
+#else
+        return std::nullopt;
 #endif
     }
 
@@ -158,9 +143,14 @@ private:
     steady_clock::time_point sleepTimeLastReported = steady_clock::now();
     microseconds lightSleepTime = microseconds::zero();
     int lightSleepCount = 0;
+
+    // Kept separately from what's reported in telemetry for the energy planner
+    microseconds totalLightSleepTime = microseconds::zero();
+    steady_clock::time_point sleepRatioLastTaken = steady_clock::now();
+    microseconds totalLightSleepTimeLastTaken = microseconds::zero();
 #endif
 };
 
-PowerManagementLock PowerManager::noLightSleep("no-light-sleep", ESP_PM_NO_LIGHT_SLEEP);
+PowerManagementLock PowerManager::noLightSleep("no-light-sleep", PowerManagementLockType::NoLightSleep);
 
 }    // namespace farmhub::kernel
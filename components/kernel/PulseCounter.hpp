@@ -141,6 +141,7 @@ static void IRAM_ATTR handlePulseCounterInterrupt(void* arg) {
 class PulseCounterManager {
 public:
     std::shared_ptr<PulseCounter> create(const PulseCounterConfig& config) {
+        Lock lock(mutex);
         if (!initialized) {
             initialized = true;
 
@@ -177,6 +178,7 @@ public:
     }
 
 private:
+    Mutex mutex;
     bool initialized = false;
     std::list<std::shared_ptr<PulseCounter>> counters;
 };
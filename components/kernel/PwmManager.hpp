@@ -4,6 +4,8 @@
 
 #include <driver/ledc.h>
 
+#include <Concurrent.hpp>
+
 namespace farmhub::kernel {
 
 // TODO Figure out what to do with low/high speed modes
@@ -96,6 +98,7 @@ private:
 class PwmManager {
 public:
     PwmPin& registerPin(const InternalPinPtr& pin, uint32_t freq, ledc_timer_bit_t dutyResolution = LEDC_TIMER_8_BIT, ledc_clk_cfg_t clkSrc = LEDC_AUTO_CLK) {
+        Lock lock(mutex);
         LedcTimer& timer = getOrCreateTimer(LEDC_LOW_SPEED_MODE, dutyResolution, freq, clkSrc);
 
         auto channel = static_cast<ledc_channel_t>(pins.size());
@@ -127,6 +130,7 @@ private:
         return timers.back();
     }
 
+    Mutex mutex;
     std::list<LedcTimer> timers;
     std::list<PwmPin> pins;
 };
@@ -1,31 +1,261 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
 #include <functional>
-#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include <ArduinoJson.h>
+
+#include <Concurrent.hpp>
+#include <Log.hpp>
 #include <Task.hpp>
+#include <Time.hpp>
+
+using namespace std::chrono;
 
 namespace farmhub::kernel {
 
+LOGGING_TAG(SHUTDOWN, "shutdown")
+
+/**
+ * @brief Phases of shutting down, in the order they run.
+ *
+ * Earlier phases are more important: they get their share of the overall deadline first.
+ */
+enum class ShutdownPhase : uint8_t {
+    // Put actuators in a safe state, e.g. close valves and stop motors
+    SafeState,
+    // Publish final telemetry and logs, and wait for the broker to acknowledge them
+    Flush,
+    // Make sure everything that needs to survive the shutdown is written out
+    Sync,
+};
+
+static constexpr size_t SHUTDOWN_PHASE_COUNT = 3;
+
+inline const char* toString(ShutdownPhase phase) {
+    switch (phase) {
+        case ShutdownPhase::SafeState:
+            return "safe-state";
+        case ShutdownPhase::Flush:
+            return "flush";
+        case ShutdownPhase::Sync:
+            return "sync";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Called during shutdown with the time by which the listener must return.
+ */
+using ShutdownListener = std::function<void(steady_clock::time_point deadline)>;
+
+/**
+ * @brief How long each shutdown phase can take at most, if the overall deadline allows.
+ */
+struct ShutdownBudgets {
+    milliseconds safeState = 3s;
+    milliseconds flush = 5s;
+    milliseconds sync = 1s;
+};
+
+/**
+ * @brief Runs shutdown listeners phase by phase, each phase within its own deadline and the overall deadline.
+ *
+ * Each phase runs on its own task, so a listener that does not return in time cannot hold up
+ * the phases after it; it is abandoned, as the device is about to go to sleep anyway.
+ * The abandoned task is not stopped, as it might hold locks later phases need: it keeps running
+ * alongside the later phases until the device goes to sleep. Listeners must therefore cope with
+ * running concurrently with listeners of later phases, e.g. a late log flush with the console sync.
+ * How long each phase took is kept in RTC memory, and reported after the next boot.
+ */
 class ShutdownManager {
 public:
-    void registerShutdownListener(const std::function<void()>& listener) {
-        shutdownListeners.push_back(listener);
+    struct PhaseReport {
+        uint32_t elapsedMs;
+        uint8_t listeners;
+        uint8_t completed;
+        bool timedOut;
+    };
+
+    /**
+     * @brief Outcome of the last shutdown; lives in RTC memory that survives deep sleep.
+     */
+    struct Report {
+        uint32_t magic;
+        uint32_t deadlineMs;
+        uint32_t elapsedMs;
+        std::array<PhaseReport, SHUTDOWN_PHASE_COUNT> phases;
+    };
+
+    explicit ShutdownManager(Report& report, ShutdownBudgets budgets = {})
+        : report(report)
+        , budgets(budgets) {
+        if (report.magic == MAGIC) {
+            previous = report;
+        }
+        report.magic = 0;
     }
 
-    void startShutdown() {
+    void registerShutdownListener(ShutdownPhase phase, const std::string& name, const ShutdownListener& listener) {
+        Lock lock(mutex);
+        listeners[static_cast<size_t>(phase)].push_back({ name, listener });
+    }
+
+    /**
+     * @brief Run all phases, returning once they are done, or `deadline` has passed.
+     *
+     * Only the first call does anything, later calls return right away.
+     */
+    void shutdown(milliseconds deadline) {
+        if (shuttingDown.exchange(true)) {
+            return;
+        }
+
+        auto start = steady_clock::now();
+        auto overallDeadline = start + deadline;
+        LOGTI(SHUTDOWN, "Shutting down within %lld ms",
+            static_cast<long long>(deadline.count()));
+
+        Report current {
+            .magic = MAGIC,
+            .deadlineMs = static_cast<uint32_t>(deadline.count()),
+            .elapsedMs = 0,
+            .phases = {},
+        };
+        for (size_t index = 0; index < SHUTDOWN_PHASE_COUNT; index++) {
+            auto phase = static_cast<ShutdownPhase>(index);
+            auto phaseStart = steady_clock::now();
+            auto phaseDeadline = std::min(phaseStart + budgetOf(phase), overallDeadline);
+            current.phases[index] = runPhase(phase, phaseDeadline);
+            current.phases[index].elapsedMs = static_cast<uint32_t>(duration_cast<milliseconds>(steady_clock::now() - phaseStart).count());
+        }
+        current.elapsedMs = static_cast<uint32_t>(duration_cast<milliseconds>(steady_clock::now() - start).count());
+        report = current;
+
+        LOGTI(SHUTDOWN, "Shutdown finished in %" PRIu32 " ms",
+            current.elapsedMs);
+    }
+
+    /**
+     * @brief The report of the shutdown before this boot, if there was one.
+     */
+    const std::optional<Report>& getPreviousShutdown() const {
+        return previous;
+    }
+
+    void reportPreviousShutdown(JsonObject& json) const {
+        if (!previous.has_value()) {
+            return;
+        }
+        json["deadline"] = previous->deadlineMs;
+        json["elapsed"] = previous->elapsedMs;
+        auto phasesJson = json["phases"].to<JsonObject>();
+        for (size_t index = 0; index < SHUTDOWN_PHASE_COUNT; index++) {
+            const auto& phase = previous->phases[index];
+            auto phaseJson = phasesJson[toString(static_cast<ShutdownPhase>(index))].to<JsonObject>();
+            phaseJson["elapsed"] = phase.elapsedMs;
+            phaseJson["listeners"] = phase.listeners;
+            phaseJson["completed"] = phase.completed;
+            if (phase.timedOut) {
+                phaseJson["timed-out"] = true;
+            }
+        }
+    }
+
+private:
+    struct NamedListener {
+        std::string name;
+        ShutdownListener listener;
+    };
+
+    // Shared with the task running the phase, which might outlive the wait for it
+    struct PhaseRun {
+        CopyQueue<bool> finished { "shutdown-phase", 1 };
+        std::atomic<uint8_t> completed = 0;
+    };
+
+    PhaseReport runPhase(ShutdownPhase phase, steady_clock::time_point deadline) {
+        std::vector<NamedListener> phaseListeners;
+        {
+            Lock lock(mutex);
+            phaseListeners = listeners[static_cast<size_t>(phase)];
+        }
+        PhaseReport phaseReport {
+            .elapsedMs = 0,
+            .listeners = static_cast<uint8_t>(phaseListeners.size()),
+            .completed = 0,
+            .timedOut = false,
+        };
+        if (phaseListeners.empty()) {
+            return phaseReport;
+        }
+        auto timeLeft = clampTicks(duration_cast<milliseconds>(deadline - steady_clock::now()));
+        if (timeLeft == ticks::zero()) {
+            // Don't start anything we could not finish before going to sleep
+            phaseReport.timedOut = true;
+            LOGTW(SHUTDOWN, "No time left for shutdown phase %s",
+                toString(phase));
+            return phaseReport;
+        }
+
+        LOGTD(SHUTDOWN, "Running %s phase with %d listeners",
+            toString(phase), static_cast<int>(phaseListeners.size()));
+        auto run = std::make_shared<PhaseRun>();
         // Run in separate task to allocate enough stack
-        Task::run("shutdown", 8192, [this](Task& /*task*/) {
-            // Notify all shutdown listeners
-            for (auto& listener : shutdownListeners) {
-                listener();
+        Task::run(std::string("shutdown:") + toString(phase), 8192, [run, phaseListeners, deadline](Task& /*task*/) {
+            for (const auto& [name, listener] : phaseListeners) {
+                try {
+                    listener(deadline);
+                } catch (const std::exception& e) {
+                    LOGTE(SHUTDOWN, "Shutdown listener '%s' failed: %s",
+                        name.c_str(), e.what());
+                }
+                run->completed++;
             }
-            printf("Shutdown process finished\n");
+            run->finished.offer(true);
         });
+
+        auto finished = run->finished.pollIn(timeLeft);
+        phaseReport.completed = run->completed.load();
+        if (!finished.has_value()) {
+            phaseReport.timedOut = true;
+            LOGTW(SHUTDOWN, "Shutdown phase %s timed out in listener '%s'",
+                toString(phase), phaseListeners[std::min<size_t>(phaseReport.completed, phaseListeners.size() - 1)].name.c_str());
+        }
+        return phaseReport;
     }
 
-private:
-    std::list<std::function<void()>> shutdownListeners;
+    milliseconds budgetOf(ShutdownPhase phase) const {
+        switch (phase) {
+            case ShutdownPhase::SafeState:
+                return budgets.safeState;
+            case ShutdownPhase::Flush:
+                return budgets.flush;
+            case ShutdownPhase::Sync:
+                return budgets.sync;
+        }
+        return milliseconds::zero();
+    }
+
+    static constexpr uint32_t MAGIC = 0x5D0E'0001;
+
+    Report& report;
+    const ShutdownBudgets budgets;
+    std::optional<Report> previous;
+
+    Mutex mutex;
+    std::array<std::vector<NamedListener>, SHUTDOWN_PHASE_COUNT> listeners;
+    std::atomic<bool> shuttingDown = false;
 };
 
 }    // namespace farmhub::kernel
@@ -4,7 +4,9 @@
 namespace farmhub::kernel {
 
 bool StateSource::setFromISR() const {
-    return hasAllBits(setBitsFromISR(eventBits | STATE_CHANGE_BIT_MASK));
+    bool set = hasAllBits(setBitsFromISR(eventBits | STATE_CHANGE_BIT_MASK));
+    TaskWakeups::notifyFromISR(eventGroup);
+    return set;
 }
 
 bool StateSource::clearFromISR() const {
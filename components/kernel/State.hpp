@@ -6,6 +6,7 @@
 #include <freertos/FreeRTOS.h>        // NOLINT(misc-header-include-cycle)
 #include <freertos/event_groups.h>    // NOLINT(misc-header-include-cycle)
 
+#include <Concurrent.hpp>
 #include <Time.hpp>
 
 using namespace std::chrono;
@@ -56,6 +57,14 @@ public:
         while (!awaitSet(ticks::max())) { }
     }
 
+    /**
+     * @brief What to subscribe to in `TaskWakeups` to be woken up when the state, or any other state
+     * in the same event group, is set.
+     */
+    const void* getWakeupSource() const {
+        return eventGroup;
+    }
+
 protected:
     bool constexpr hasAllBits(const EventBits_t bits) const {
         return (bits & eventBits) == eventBits;
@@ -79,7 +88,9 @@ public:
         = default;
 
     bool set() const {
-        return hasAllBits(setBits(eventBits | STATE_CHANGE_BIT_MASK));
+        bool set = hasAllBits(setBits(eventBits | STATE_CHANGE_BIT_MASK));
+        TaskWakeups::notify(eventGroup);
+        return set;
     }
 
     bool IRAM_ATTR setFromISR() const;
@@ -1,13 +1,21 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <list>
+#include <mutex>
+#include <string>
 
 #include <freertos/FreeRTOS.h>    // NOLINT(misc-header-include-cycle)
 #include <freertos/task.h>        // NOLINT(misc-header-include-cycle)
 
+#include <ArduinoJson.h>
+
 #include <Log.hpp>
 #include <Time.hpp>
+#include <WakeupAligner.hpp>
 #include <utility>
 
 using namespace std::chrono;
@@ -20,6 +28,104 @@ class Task;
 
 using TaskFunction = std::function<void(Task&)>;
 
+/**
+ * @brief Runtime statistics of a task, updated by the task itself without locking or allocating.
+ */
+struct TaskStats {
+    TaskStats(const std::string& name, UBaseType_t priority, uint32_t stackSize, TaskHandle_t handle)
+        : name(name)
+        , priority(priority)
+        , stackSize(stackSize)
+        , handle(handle) {
+    }
+
+    void recordIteration(microseconds time) {
+        auto timeInMicros = saturate(time.count());
+        iterations.fetch_add(1, std::memory_order_relaxed);
+        lastIterationTime.store(timeInMicros, std::memory_order_relaxed);
+        updateMax(maxIterationTime, timeInMicros);
+    }
+
+    void recordMissedDeadline(milliseconds overrun) {
+        missedDeadlines.fetch_add(1, std::memory_order_relaxed);
+        updateMax(worstOverrun, saturate(overrun.count()));
+    }
+
+    const std::string name;
+    const UBaseType_t priority;
+    const uint32_t stackSize;
+    const TaskHandle_t handle;
+
+    // Number of times the loop function of the task has run
+    std::atomic<uint32_t> iterations { 0 };
+    // Time the last and the longest loop iteration took, in microseconds, not counting
+    // time spent in `Task::delay()` and `Task::delayUntil()`
+    std::atomic<uint32_t> lastIterationTime { 0 };
+    std::atomic<uint32_t> maxIterationTime { 0 };
+    std::atomic<uint32_t> missedDeadlines { 0 };
+    // Longest overrun of a missed deadline, in milliseconds
+    std::atomic<uint32_t> worstOverrun { 0 };
+
+    // Time spent delaying during the current iteration; only ever touched by the task itself
+    microseconds delayedInIteration { 0 };
+
+private:
+    static uint32_t saturate(int64_t value) {
+        return static_cast<uint32_t>(std::clamp<int64_t>(value, 0, UINT32_MAX));
+    }
+
+    static void updateMax(std::atomic<uint32_t>& max, uint32_t value) {
+        auto current = max.load(std::memory_order_relaxed);
+        while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) { }
+    }
+};
+
+/**
+ * @brief Keeps track of all tasks started via `Task`.
+ */
+class TaskRegistry {
+public:
+    static TaskStats* add(const std::string& name, UBaseType_t priority, uint32_t stackSize, TaskHandle_t handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return &tasks.emplace_back(name, priority, stackSize, handle);
+    }
+
+    static void remove(TaskStats* stats) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.remove_if([stats](const TaskStats& task) { return &task == stats; });
+    }
+
+    static void populateTelemetry(JsonObject& json) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& task : tasks) {
+            // Task names are not necessarily unique
+            std::string key = task.name;
+            for (int i = 2; json[key].is<JsonObject>(); i++) {
+                key = task.name + "#" + std::to_string(i);
+            }
+            auto taskJson = json[key].to<JsonObject>();
+            taskJson["priority"] = task.priority;
+            taskJson["stack"] = task.stackSize;
+            taskJson["stack-free"] = uxTaskGetStackHighWaterMark(task.handle);
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+            taskJson["cpu-time"] = ulTaskGetRunTimeCounter(task.handle);
+#endif
+            auto iterations = task.iterations.load(std::memory_order_relaxed);
+            if (iterations > 0) {
+                taskJson["iterations"] = iterations;
+                taskJson["loop-time"] = task.lastIterationTime.load(std::memory_order_relaxed);
+                taskJson["max-loop-time"] = task.maxIterationTime.load(std::memory_order_relaxed);
+            }
+            taskJson["missed-deadlines"] = task.missedDeadlines.load(std::memory_order_relaxed);
+            taskJson["worst-overrun"] = task.worstOverrun.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    inline static std::mutex mutex;
+    inline static std::list<TaskStats> tasks;
+};
+
 class TaskHandle {
 public:
     TaskHandle(TaskHandle_t handle)
@@ -74,14 +180,14 @@ public:
         return Task::run(name, stackSize, DEFAULT_PRIORITY, runFunction);
     }
     static TaskHandle run(const std::string& name, uint32_t stackSize, UBaseType_t priority, const TaskFunction& runFunction) {
-        auto* taskFunction = new TaskFunction(runFunction);
+        auto* startup = new TaskStartup { runFunction, name, priority, stackSize };
         LOGD("Creating task %s with priority %u and stack size %" PRIu32,
             name.c_str(), priority, stackSize);
         TaskHandle_t handle = nullptr;
-        auto result = xTaskCreate(executeTask, name.c_str(), stackSize, taskFunction, priority, &handle);
+        auto result = xTaskCreate(executeTask, name.c_str(), stackSize, startup, priority, &handle);
         if (result != pdPASS) {
             LOGE("Failed to create task %s: %d", name.c_str(), result);
-            delete taskFunction;
+            delete startup;
             return {};
         }
         return TaskHandle { handle };
@@ -93,7 +199,11 @@ public:
     static TaskHandle loop(const std::string& name, uint32_t stackSize, UBaseType_t priority, const TaskFunction& loopFunction) {
         return Task::run(name, stackSize, priority, [loopFunction](Task& task) {
             while (true) {
+                task.stats->delayedInIteration = microseconds::zero();
+                auto start = steady_clock::now();
                 loopFunction(task);
+                auto elapsed = duration_cast<microseconds>(steady_clock::now() - start);
+                task.stats->recordIteration(elapsed - task.stats->delayedInIteration);
             }
         });
     }
@@ -101,16 +211,33 @@ public:
     static void delay(ticks time) {
         // LOGV("Task '%s' delaying for %lld ms",
         //     pcTaskGetName(nullptr), duration_cast<milliseconds>(time).count());
+        DelayTimer timer;
         vTaskDelay(time.count());
     }
 
+    /**
+     * @brief Like `delay(time)`, but lets the wakeup happen up to `slack` later, so it can be shared with other tasks.
+     */
+    static void delay(ticks time, ticks slack) {
+        delay(time + alignWakeup(time, slack, time));
+    }
+
+    /**
+     * @brief Like `delayUntil(time)`, but lets the wakeup happen up to `slack` later, so it can be shared with other tasks.
+     */
+    bool delayUntil(ticks time, ticks slack) {
+        return delayUntil(time + alignWakeup(ticksUntil(time), slack, time));
+    }
+
     bool delayUntil(ticks time) {
         if (delayUntilAtLeast(time)) {
             return true;
         }
         auto newWakeTime = xTaskGetTickCount();
+        auto overrun = duration_cast<milliseconds>(ticks(newWakeTime - lastWakeTime));
+        stats->recordMissedDeadline(overrun);
         printf("Task '%s' missed deadline by %lld ms\n",
-            pcTaskGetName(nullptr), duration_cast<milliseconds>(ticks(newWakeTime - lastWakeTime)).count());
+            pcTaskGetName(nullptr), overrun.count());
         lastWakeTime = newWakeTime;
         return false;
     }
@@ -118,6 +245,7 @@ public:
     bool delayUntilAtLeast(ticks time) {
         // LOGV("Task '%s' delaying until %lld ms",
         //     pcTaskGetName(nullptr), duration_cast<milliseconds>(time).count());
+        DelayTimer timer;
         return xTaskDelayUntil(&lastWakeTime, time.count()) != 0;
     }
 
@@ -158,20 +286,71 @@ public:
     }
 
 private:
+    struct TaskStartup {
+        TaskFunction function;
+        std::string name;
+        UBaseType_t priority;
+        uint32_t stackSize;
+    };
+
+    /**
+     * @brief Adds the time until it goes out of scope to the delays of the current task, if it was started via `Task`.
+     */
+    class DelayTimer {
+    public:
+        DelayTimer()
+            : stats(current)
+            , start(stats == nullptr ? steady_clock::time_point() : steady_clock::now()) {
+        }
+
+        ~DelayTimer() {
+            if (stats != nullptr) {
+                stats->delayedInIteration += duration_cast<microseconds>(steady_clock::now() - start);
+            }
+        }
+
+        DelayTimer(const DelayTimer&) = delete;
+        DelayTimer& operator=(const DelayTimer&) = delete;
+
+    private:
+        TaskStats* const stats;
+        const steady_clock::time_point start;
+    };
+
+    /**
+     * @brief Extra ticks to wait after `delay` for the wakeup to be aligned with other tasks.
+     */
+    static ticks alignWakeup(ticks delay, ticks slack, ticks period) {
+        auto now = steady_clock::now();
+        auto deadline = now + delay;
+        auto wakeup = WakeupAligner::shared().align(deadline, duration_cast<milliseconds>(slack), now, duration_cast<milliseconds>(period));
+        return ceil<ticks>(wakeup - deadline);
+    }
+
+    explicit Task(TaskStats* stats)
+        : stats(stats) {
+    }
+
     ~Task() {
         LOGV("Finished task %s\n",
             pcTaskGetName(nullptr));
+        TaskRegistry::remove(stats);
         vTaskDelete(nullptr);
     }
 
     static void executeTask(void* parameters) {
-        auto* taskFunction = static_cast<TaskFunction*>(parameters);
-        Task task;
-        (*taskFunction)(task);
-        delete taskFunction;
+        auto* startup = static_cast<TaskStartup*>(parameters);
+        Task task(TaskRegistry::add(startup->name, startup->priority, startup->stackSize, xTaskGetCurrentTaskHandle()));
+        current = task.stats;
+        startup->function(task);
+        delete startup;
     }
 
+    TaskStats* const stats;
     TickType_t lastWakeTime { xTaskGetTickCount() };
+
+    // Statistics of the task running on this thread, so static methods like `delay()` can find them
+    static inline thread_local TaskStats* current = nullptr;
 };
 
 }    // namespace farmhub::kernel
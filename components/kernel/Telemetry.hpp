@@ -1,19 +1,193 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <list>
+#include <map>
 #include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include <ArduinoJson.h>
 
 #include <Concurrent.hpp>
+#include <Configuration.hpp>
 
 namespace farmhub::kernel {
 
+/**
+ * @brief How much a numeric value of a feature (or telemetry section) must change before it is published again in delta mode.
+ */
+struct TelemetryDeadband {
+    // Name or type of the feature, or name of the telemetry section
+    std::string feature;
+    double deadband = 0.0;
+};
+
+/**
+ * @brief Remembers the last published values of a telemetry object to leave out fields that did not change since.
+ */
+class TelemetryDelta {
+public:
+    explicit TelemetryDelta(double deadband)
+        : deadband(deadband) {
+    }
+
+    /**
+     * @brief Remove fields that did not change by more than the deadband since they were last published.
+     *
+     * As a missing field means it did not change, fields published before but missing now are set to null.
+     * Keyframes are left intact, and replace everything remembered.
+     */
+    void filter(JsonObject& json, bool keyframe) {
+        if (keyframe) {
+            lastPublished.set(json);
+            return;
+        }
+        if (!lastPublished.is<JsonObject>()) {
+            lastPublished.to<JsonObject>();
+        }
+        filterObject(json, lastPublished.as<JsonObject>());
+    }
+
+private:
+    void filterObject(JsonObject& json, JsonObject last) {
+        std::vector<std::string> unchanged;
+        for (auto field : json) {
+            const char* key = field.key().c_str();
+            auto value = field.value();
+            auto lastValue = last[key];
+            if (value.isNull()) {
+                // Cleared below, unless there's nothing to clear
+                if (lastValue.isNull()) {
+                    unchanged.emplace_back(key);
+                }
+            } else if (value.is<JsonObject>() && lastValue.is<JsonObject>()) {
+                auto nested = value.as<JsonObject>();
+                filterObject(nested, lastValue.as<JsonObject>());
+                if (nested.size() == 0) {
+                    unchanged.emplace_back(key);
+                }
+            } else if (!changed(value, lastValue)) {
+                unchanged.emplace_back(key);
+            } else {
+                lastValue.set(value);
+            }
+        }
+        std::vector<std::string> cleared;
+        for (auto field : last) {
+            if (json[field.key()].isNull()) {
+                cleared.emplace_back(field.key().c_str());
+            }
+        }
+        for (const auto& key : unchanged) {
+            json.remove(key);
+        }
+        for (const auto& key : cleared) {
+            json[key] = nullptr;
+            last.remove(key);
+        }
+    }
+
+    bool changed(JsonVariantConst value, JsonVariantConst lastValue) const {
+        if (lastValue.isNull()) {
+            return true;
+        }
+        if (deadband > 0.0 && value.is<double>() && lastValue.is<double>()) {
+            return std::abs(value.as<double>() - lastValue.as<double>()) > deadband;
+        }
+        return value != lastValue;
+    }
+
+    const double deadband;
+    JsonDocument lastPublished;
+};
+
 class TelemetryCollector {
 public:
-    void collect(JsonArray& featuresJson) {
+    class Config : public ConfigurationSection {
+    public:
+        /**
+         * @brief Only publish fields that changed since they were last published.
+         */
+        Property<bool> delta { this, "delta", false };
+
+        /**
+         * @brief In delta mode, publish everything every this many publishes.
+         */
+        Property<size_t> keyframeInterval { this, "keyframeInterval", 12 };
+
+        /**
+         * @brief Minimum change of numeric values before they are published again in delta mode.
+         */
+        ArrayProperty<TelemetryDeadband> deadbands { this, "deadbands" };
+
+        /**
+         * @brief Include runtime statistics of tasks in telemetry.
+         */
+        Property<bool> tasks { this, "tasks", false };
+    };
+
+    TelemetryCollector()
+        : TelemetryCollector(std::make_shared<Config>()) {
+    }
+
+    explicit TelemetryCollector(const std::shared_ptr<Config>& config)
+        : deltaEnabled(config->delta.get())
+        , keyframeInterval(std::max<size_t>(config->keyframeInterval.get(), 1))
+        , deadbands(config->deadbands.get()) {
+    }
+
+    /**
+     * @brief Add the features to the telemetry message.
+     *
+     * In delta mode, fields of the features and other sections of the message that did not change
+     * since they were last published are left out, unless this is a keyframe.
+     *
+     * @return Whether everything was included.
+     */
+    bool collect(JsonObject& telemetryJson) {
+        bool keyframe = startCollecting();
+        if (deltaEnabled) {
+            std::vector<std::string> unchangedSections;
+            for (auto section : telemetryJson) {
+                if (!section.value().is<JsonObject>()) {
+                    continue;
+                }
+                std::string name = section.key().c_str();
+                auto it = sections.find(name);
+                if (it == sections.end()) {
+                    it = sections.emplace(name, TelemetryDelta(deadbandFor(name, name))).first;
+                }
+                auto sectionJson = section.value().as<JsonObject>();
+                it->second.filter(sectionJson, keyframe);
+                if (sectionJson.size() == 0) {
+                    unchangedSections.push_back(name);
+                }
+            }
+            // Sections that are gone are cleared, too
+            for (auto it = sections.begin(); it != sections.end();) {
+                if (telemetryJson[it->first].isNull()) {
+                    if (!keyframe) {
+                        telemetryJson[it->first] = nullptr;
+                    }
+                    it = sections.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            for (const auto& name : unchangedSections) {
+                telemetryJson.remove(name);
+            }
+            telemetryJson["keyframe"] = keyframe;
+        }
+
+        auto featuresJson = telemetryJson["features"].to<JsonArray>();
+        Lock lock(featuresMutex);
         for (auto& feature : features) {
+            // Populated in place, and dropped again if nothing changed, so we don't need a document per feature
             auto featureJson = featuresJson.add<JsonObject>();
             featureJson["type"] = feature.type;
             if (!feature.name.empty()) {
@@ -21,7 +195,21 @@ public:
             }
             auto data = featureJson["data"].to<JsonObject>();
             feature.populate(data);
+            if (deltaEnabled) {
+                feature.delta.filter(data, keyframe);
+                if (!keyframe && data.size() == 0) {
+                    featuresJson.remove(featuresJson.size() - 1);
+                }
+            }
         }
+        return keyframe;
+    }
+
+    /**
+     * @brief Include everything the next time telemetry is collected, e.g. after reconnecting.
+     */
+    void requestKeyframe() {
+        keyframeRequested = true;
     }
 
     void registerFeature(
@@ -30,7 +218,9 @@ public:
         std::function<void(JsonObject&)> populate) {
         LOGV("Registering '%s' feature '%s'",
             type.c_str(), name.c_str());
-        features.push_back({ type, name, std::move(populate) });
+        // Peripherals register their features while being initialized concurrently
+        Lock lock(featuresMutex);
+        features.push_back({ type, name, std::move(populate), TelemetryDelta(deadbandFor(name, type)) });
     }
 
 private:
@@ -38,9 +228,44 @@ private:
         std::string type;
         std::string name;
         std::function<void(JsonObject&)> populate;
+        TelemetryDelta delta;
     };
 
+    bool startCollecting() {
+        if (!deltaEnabled) {
+            return true;
+        }
+        if (keyframeRequested.exchange(false) || publishesSinceKeyframe >= keyframeInterval) {
+            publishesSinceKeyframe = 1;
+            return true;
+        }
+        publishesSinceKeyframe++;
+        return false;
+    }
+
+    double deadbandFor(const std::string& name, const std::string& type) const {
+        const TelemetryDeadband* typeMatch = nullptr;
+        for (const auto& deadband : deadbands) {
+            if (deadband.feature == name) {
+                return deadband.deadband;
+            }
+            if (deadband.feature == type) {
+                typeMatch = &deadband;
+            }
+        }
+        return typeMatch == nullptr ? 0.0 : typeMatch->deadband;
+    }
+
+    const bool deltaEnabled;
+    const size_t keyframeInterval;
+    const std::list<TelemetryDeadband> deadbands;
+
+    Mutex featuresMutex;
     std::list<Feature> features;
+    std::map<std::string, TelemetryDelta> sections;
+    // The first publish is always a keyframe
+    std::atomic<bool> keyframeRequested = true;
+    size_t publishesSinceKeyframe = 0;
 };
 
 class TelemetryPublisher {
@@ -57,3 +282,29 @@ private:
 };
 
 }    // namespace farmhub::kernel
+
+namespace ArduinoJson {
+
+using farmhub::kernel::TelemetryDeadband;
+
+template <>
+struct Converter<TelemetryDeadband> {
+    static bool toJson(const TelemetryDeadband& src, JsonVariant dst) {
+        dst["feature"] = src.feature;
+        dst["deadband"] = src.deadband;
+        return true;
+    }
+
+    static TelemetryDeadband fromJson(JsonVariantConst src) {
+        TelemetryDeadband dst;
+        dst.feature = src["feature"].as<std::string>();
+        dst.deadband = src["deadband"].as<double>();
+        return dst;
+    }
+
+    static bool checkJson(JsonVariantConst src) {
+        return src["feature"].is<std::string>() && src["deadband"].is<double>();
+    }
+};
+
+}    // namespace ArduinoJson
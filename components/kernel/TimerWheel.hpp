@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <utility>
+
+using namespace std::chrono;
+
+namespace farmhub::kernel {
+
+/**
+ * @brief Hierarchical timer wheel holding items that expire at given times.
+ *
+ * Time is divided into ticks of the given resolution. The first level has a slot for each
+ * of the next 64 ticks; each further level has 64 slots that are 64 times as wide as the
+ * ones on the level below. Items are moved down a level when their slot comes up, so
+ * scheduling and expiring items takes constant time regardless of how many there are.
+ *
+ * Items are scheduled within a window, and expire at the end of it at the latest. Whenever an item
+ * expires, all items whose window has opened by then expire along with it, so that items with
+ * overlapping windows are handled together.
+ *
+ * Items are kept in list nodes that are moved between slots without allocating.
+ */
+template <typename T>
+class TimerWheel {
+public:
+    struct Entry {
+        T item;
+        uint64_t earliest;
+        uint64_t expiry;
+    };
+
+    using Entries = std::list<Entry>;
+
+    TimerWheel(milliseconds resolution, steady_clock::time_point start)
+        : resolution(std::max(resolution, 1ms))
+        , start(start) {
+    }
+
+    /**
+     * @brief Schedule a new item to expire at some point within the `[earliest, latest]` window.
+     */
+    void schedule(T item, steady_clock::time_point earliest, steady_clock::time_point latest) {
+        Entries entries;
+        entries.push_back({ std::move(item), 0, 0 });
+        schedule(entries, entries.begin(), earliest, latest);
+    }
+
+    /**
+     * @brief Move an entry from `entries` (typically returned by `advance()`) back into the wheel,
+     * to expire at some point within the `[earliest, latest]` window.
+     */
+    void schedule(Entries& entries, typename Entries::iterator entry, steady_clock::time_point earliest, steady_clock::time_point latest) {
+        entry->earliest = toTick(earliest);
+        entry->expiry = std::max(entry->earliest, toTickRoundingDown(latest));
+        // Anything already due expires on the next tick
+        place(entries, entry, current + 1);
+        count++;
+    }
+
+    /**
+     * @brief Move time forward to `now`, and move all entries that expired by then to `expired`.
+     */
+    void advance(steady_clock::time_point now, Entries& expired) {
+        auto expiredBefore = expired.size();
+        auto target = toTickRoundingDown(now);
+        while (current < target) {
+            if (count == 0) {
+                current = target;
+                break;
+            }
+            if (levelCounts[0] == 0) {
+                // Nothing to expire on the first level, skip ahead to where the next cascade happens
+                current = std::min(target, (current | SLOT_MASK) + 1) - 1;
+            }
+            current++;
+            if ((current & SLOT_MASK) == 0) {
+                cascade(1);
+            }
+            auto& slot = slots[0][current & SLOT_MASK];
+            levelCounts[0] -= slot.size();
+            count -= slot.size();
+            for (auto entry = slot.begin(); entry != slot.end();) {
+                auto next = std::next(entry);
+                if (entry->expiry > current) {
+                    // Was placed beyond the range of the wheel, not there yet
+                    place(slot, entry, current + 1);
+                    count++;
+                } else {
+                    expired.splice(expired.end(), slot, entry);
+                }
+                entry = next;
+            }
+        }
+        if (expired.size() > expiredBefore) {
+            collectOpened(expired);
+        }
+    }
+
+    /**
+     * @brief When the next entry expires, i.e. when `advance()` needs to be called next.
+     */
+    std::optional<steady_clock::time_point> nextWakeTime() const {
+        if (count == 0) {
+            return std::nullopt;
+        }
+        auto next = UINT64_MAX;
+        for (size_t level = 0; level < LEVELS; level++) {
+            if (levelCounts[level] == 0) {
+                continue;
+            }
+            // Slots on a level come up in order starting with the one after the current one,
+            // the earliest entry of the level is in the first one that is not empty
+            auto shift = level * SLOT_BITS;
+            for (uint64_t offset = 1; offset <= SLOTS; offset++) {
+                const auto& slot = slots[level][((current >> shift) + offset) & SLOT_MASK];
+                if (!slot.empty()) {
+                    for (const auto& entry : slot) {
+                        next = std::min(next, entry.expiry);
+                    }
+                    break;
+                }
+            }
+        }
+        return toTimePoint(next);
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+private:
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS = 1 << SLOT_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+    static constexpr size_t LEVELS = 4;
+    static constexpr uint64_t MAX_DELTA = (1ULL << (SLOT_BITS * LEVELS)) - 1;
+
+    // Tick 1 starts at `start`, so that tick 0 can count as already processed
+
+    uint64_t toTick(steady_clock::time_point time) const {
+        if (time <= start) {
+            return 1;
+        }
+        auto elapsed = duration_cast<milliseconds>(time - start);
+        return 1 + (elapsed.count() + resolution.count() - 1) / resolution.count();
+    }
+
+    uint64_t toTickRoundingDown(steady_clock::time_point time) const {
+        if (time <= start) {
+            return 1;
+        }
+        return 1 + duration_cast<milliseconds>(time - start).count() / resolution.count();
+    }
+
+    steady_clock::time_point toTimePoint(uint64_t tick) const {
+        return start + resolution * (tick - 1);
+    }
+
+    /**
+     * @brief Move entries whose window has already opened to `expired`.
+     *
+     * Only the lower two levels are checked; windows wider than that are rare, and they only miss out on being coalesced.
+     */
+    void collectOpened(Entries& expired) {
+        for (size_t level = 0; level < 2; level++) {
+            if (levelCounts[level] == 0) {
+                continue;
+            }
+            for (auto& slot : slots[level]) {
+                for (auto entry = slot.begin(); entry != slot.end();) {
+                    auto next = std::next(entry);
+                    if (entry->earliest <= current) {
+                        expired.splice(expired.end(), slot, entry);
+                        levelCounts[level]--;
+                        count--;
+                    }
+                    entry = next;
+                }
+            }
+        }
+    }
+
+    void place(Entries& from, typename Entries::iterator entry, uint64_t earliestTick) {
+        auto expiry = std::max(entry->expiry, earliestTick);
+        entry->expiry = expiry;
+        auto delta = std::min(expiry - current, MAX_DELTA);
+        size_t level = 0;
+        while (delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+            level++;
+        }
+        auto placement = std::min(expiry, current + MAX_DELTA);
+        auto& slot = slots[level][(placement >> (SLOT_BITS * level)) & SLOT_MASK];
+        slot.splice(slot.end(), from, entry);
+        levelCounts[level]++;
+    }
+
+    void cascade(size_t level) {
+        if (level >= LEVELS) {
+            return;
+        }
+        auto index = (current >> (SLOT_BITS * level)) & SLOT_MASK;
+        if (index == 0) {
+            cascade(level + 1);
+        }
+        auto& slot = slots[level][index];
+        levelCounts[level] -= slot.size();
+        while (!slot.empty()) {
+            // The current tick is yet to be processed
+            place(slot, slot.begin(), current);
+        }
+    }
+
+    const milliseconds resolution;
+    const steady_clock::time_point start;
+
+    // The last tick that was processed
+    uint64_t current = 0;
+    std::array<std::array<Entries, SLOTS>, LEVELS> slots;
+    std::array<size_t, LEVELS> levelCounts {};
+    size_t count = 0;
+};
+
+}    // namespace farmhub::kernel
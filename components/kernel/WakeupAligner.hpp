@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+using namespace std::chrono;
+
+namespace farmhub::kernel {
+
+/**
+ * @brief Moves wakeups of periodic tasks later within the slack they allow, so that tasks wake up together,
+ * and a single exit from light sleep serves all of them.
+ *
+ * A wakeup joins the earliest wakeup already planned within its window, including later wakeups of
+ * periodic tasks. If there is none, it is snapped to the coarsest grid of shared wake slots that has
+ * a slot within the window, so that tasks that don't know about each other still tend to pick the same times.
+ */
+class WakeupAligner {
+public:
+    explicit WakeupAligner(steady_clock::time_point start = steady_clock::now())
+        : lastReported(start) {
+    }
+
+    /**
+     * @brief The aligner shared by all tasks.
+     */
+    static WakeupAligner& shared() {
+        static WakeupAligner instance;
+        return instance;
+    }
+
+    /**
+     * @brief Pick when to wake up, somewhere between `deadline` and `deadline + slack`.
+     *
+     * @param period How often the caller wakes up, if it is periodic; its later wakeups can be joined, too.
+     */
+    steady_clock::time_point align(steady_clock::time_point deadline, milliseconds slack, steady_clock::time_point now = steady_clock::now(), milliseconds period = milliseconds::zero()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        aligned++;
+
+        // Forget wakeups that already happened
+        std::erase_if(planned, [&](const Wakeup& wakeup) {
+            return wakeup.time < now;
+        });
+
+        auto latest = deadline + slack;
+        std::optional<steady_clock::time_point> existing;
+        for (const auto& wakeup : planned) {
+            auto time = wakeup.time;
+            if (time < deadline && wakeup.period > milliseconds::zero()) {
+                // Its next occurrence after our deadline
+                time += wakeup.period * ((deadline - time + wakeup.period - nanoseconds(1)) / wakeup.period);
+            }
+            if (time >= deadline && time <= latest && (!existing.has_value() || time < *existing)) {
+                existing = time;
+            }
+        }
+        if (existing.has_value()) {
+            saved++;
+            remember(*existing, period);
+            return *existing;
+        }
+
+        auto wakeup = snap(deadline, latest);
+        remember(wakeup, period);
+        return wakeup;
+    }
+
+    /**
+     * @brief Number of wakeups saved by joining an already planned one since the last report.
+     */
+    size_t getSaved() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return saved;
+    }
+
+    void populateTelemetry(JsonObject& json, steady_clock::time_point now = steady_clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto elapsed = duration_cast<milliseconds>(now - lastReported);
+        if (elapsed.count() <= 0) {
+            return;
+        }
+        json["aligned-wakeups"] = aligned;
+        json["saved-wakeups-per-hour"] = static_cast<double>(saved) * duration_cast<milliseconds>(1h).count() / static_cast<double>(elapsed.count());
+        aligned = 0;
+        saved = 0;
+        lastReported = now;
+    }
+
+private:
+    /**
+     * @brief Shared wake slots, coarsest first.
+     */
+    static constexpr std::array<milliseconds, 5> GRIDS { 60s, 10s, 1s, 100ms, 10ms };
+
+    static constexpr size_t MAX_PLANNED = 32;
+
+    struct Wakeup {
+        steady_clock::time_point time;
+        milliseconds period;
+    };
+
+    void remember(steady_clock::time_point time, milliseconds period) {
+        if (planned.size() < MAX_PLANNED) {
+            planned.push_back({ .time = time, .period = period });
+        }
+    }
+
+    static steady_clock::time_point snap(steady_clock::time_point earliest, steady_clock::time_point latest) {
+        for (auto grid : GRIDS) {
+            auto slot = steady_clock::time_point(ceil<milliseconds>(earliest.time_since_epoch()));
+            auto remainder = slot.time_since_epoch() % grid;
+            if (remainder != milliseconds::zero()) {
+                slot += grid - remainder;
+            }
+            if (slot <= latest) {
+                return slot;
+            }
+        }
+        return earliest;
+    }
+
+    mutable std::mutex mutex;
+    // Wakeups planned for the future
+    std::vector<Wakeup> planned;
+    size_t aligned = 0;
+    size_t saved = 0;
+    steady_clock::time_point lastReported;
+};
+
+}    // namespace farmhub::kernel
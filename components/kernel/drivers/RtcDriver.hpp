@@ -63,8 +63,8 @@ public:
                     }
                 }
 
-                // We are good for a while now
-                Task::delay(1h);
+                // We are good for a while now, no need to be exact about when we check again
+                Task::delay(1h, 1min);
             }
         });
     }
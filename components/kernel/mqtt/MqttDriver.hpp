@@ -5,6 +5,7 @@
 #include <list>
 #include <memory>
 #include <optional>
+#include <unordered_set>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -14,9 +15,19 @@
 
 #include <Concurrent.hpp>
 #include <Configuration.hpp>
+#include <FileSystem.hpp>
+#include <PowerManagementLock.hpp>
 #include <State.hpp>
 #include <Task.hpp>
 #include <drivers/MdnsDriver.hpp>
+#include <mqtt/MqttEncoding.hpp>
+#include <mqtt/MqttHandlerPool.hpp>
+#include <mqtt/MqttLogBatch.hpp>
+#include <mqtt/MqttOutbox.hpp>
+#include <mqtt/MqttPayload.hpp>
+#include <mqtt/MqttReassembly.hpp>
+#include <mqtt/MqttTopic.hpp>
+#include <mqtt/MqttTopicTrie.hpp>
 #include <mqtt/PendingMessages.hpp>
 
 using namespace std::chrono;
@@ -46,8 +57,6 @@ enum class LogPublish : uint8_t {
 
 using CommandHandler = std::function<void(const JsonObject&, JsonObject&)>;
 
-using SubscriptionHandler = std::function<void(const std::string&, const JsonObject&)>;
-
 class MqttRoot;
 
 class MqttDriver {
@@ -57,15 +66,36 @@ public:
         Property<std::string> host { this, "host", "" };
         Property<unsigned int> port { this, "port", 1883 };
         Property<std::string> clientId { this, "clientId", "" };
-        Property<size_t> queueSize { this, "queueSize", 128 };
+        /**
+         * @brief Number of outgoing messages and other events the MQTT task can have queued.
+         *
+         * Slots are allocated up front and stay allocated, about 52 bytes each on the ESP32.
+         */
+        Property<size_t> queueSize { this, "queueSize", 32 };
+
+        /**
+         * @brief Number of received messages that can wait for a handler.
+         *
+         * Slots are allocated up front and stay allocated, about 44 bytes each on the ESP32.
+         */
+        Property<size_t> incomingQueueSize { this, "incomingQueueSize", 32 };
+
+        Property<size_t> payloadBufferCount { this, "payloadBufferCount", 6 };
+        Property<size_t> payloadBufferSize { this, "payloadBufferSize", 1024 };
+        Property<MqttEncoding> encoding { this, "encoding", MqttEncoding::Json };
         ArrayProperty<std::string> serverCert { this, "serverCert" };
         ArrayProperty<std::string> clientCert { this, "clientCert" };
         ArrayProperty<std::string> clientKey { this, "clientKey" };
+        NamedConfigurationEntry<MqttOutbox::Config> outbox { this, "outbox" };
+        NamedConfigurationEntry<MqttHandlerPool::Config> handlers { this, "handlers" };
+        NamedConfigurationEntry<MqttReassembler::Config> incoming { this, "incoming" };
+        NamedConfigurationEntry<MqttLogBatch::Config> log { this, "log" };
     };
 
     MqttDriver(
         State& networkReady,
         const std::shared_ptr<MdnsDriver>& mdns,
+        const std::shared_ptr<FileSystem>& fs,
         const std::shared_ptr<Config>& config,
         const std::string& instanceName,
         StateSource& ready)
@@ -77,9 +107,16 @@ public:
         , configClientCert(joinStrings(config->clientCert.get()))
         , configClientKey(joinStrings(config->clientKey.get()))
         , clientId(getClientId(config->clientId.get(), instanceName))
+        , telemetryEncoding(config->encoding.get())
         , ready(ready)
+        , outbox(fs, config->outbox.get())
+        , payloads(config->payloadBufferCount.get(), config->payloadBufferSize.get())
+        , handlers(config->handlers.get())
+        , reassembler(config->incoming.get())
         , eventQueue("mqtt-outgoing", config->queueSize.get())
-        , incomingQueue("mqtt-incoming", config->queueSize.get()) {
+        , incomingQueue("mqtt-incoming", config->incomingQueueSize.get()) {
+        LOGTD(MQTT, "Preallocated %zu bytes for outgoing and %zu bytes for incoming messages",
+            eventQueue.getFootprint(), incomingQueue.getFootprint());
 
         Task::run("mqtt", 5120, [this](Task& task) {
             esp_mqtt_client_config_t mqttConfig = {};
@@ -90,7 +127,7 @@ public:
             runEventLoop(task);
         });
         Task::loop("mqtt:incoming", 4096, [this](Task& /*task*/) {
-            incomingQueue.take([this](const IncomingMessage& message) {
+            incomingQueue.take([this](IncomingMessage& message) {
                 processIncomingMessage(message);
             });
         });
@@ -100,6 +137,39 @@ public:
         return ready;
     }
 
+    /**
+     * @brief Encoding to publish telemetry in; everything else is always published as JSON.
+     */
+    MqttEncoding getTelemetryEncoding() const {
+        return telemetryEncoding;
+    }
+
+    /**
+     * @brief Number of times a connection to the broker has been established since boot.
+     */
+    uint32_t getConnectionCount() const {
+        return connectionCount;
+    }
+
+    /**
+     * @brief Bytes permanently allocated for the message queues and payload buffers.
+     */
+    size_t getFootprint() const {
+        return eventQueue.getFootprint() + incomingQueue.getFootprint() + payloads.getFootprint();
+    }
+
+    void populateTelemetry(JsonObject& json) {
+        json["payload-fallbacks"] = payloads.getFallbacks();
+        auto handlersJson = json["handlers"].to<JsonObject>();
+        handlers.populateTelemetry(handlersJson);
+        auto incomingJson = json["incoming"].to<JsonObject>();
+        reassembler.populateTelemetry(incomingJson);
+        if (outbox.isEnabled()) {
+            auto outboxJson = json["outbox"].to<JsonObject>();
+            outbox.populateTelemetry(outboxJson);
+        }
+    }
+
     void configMqttClient(esp_mqtt_client_config_t& config) {
         if (configHostname.empty()) {
 #ifdef WOKWI
@@ -201,18 +271,16 @@ private:
     };
 
     struct OutgoingMessage {
-        const std::string topic;
-        const std::string payload;
+        const MqttTopic topic;
+        // Not const so the payload buffer can be moved through the queue instead of copied
+        MqttPayload payload;
         const Retention retain;
         const QoS qos;
         TaskHandle_t waitingTask;
         const LogPublish log;
     };
 
-    struct IncomingMessage {
-        const std::string topic;
-        const std::string payload;
-    };
+    using IncomingMessage = MqttIncomingMessage;
 
     struct Subscription {
         const std::string topic;
@@ -220,6 +288,10 @@ private:
         const SubscriptionHandler handle;
     };
 
+    struct Unsubscription {
+        const std::string topic;
+    };
+
     struct MessagePublished {
         const int messageId;
         const bool success;
@@ -235,9 +307,15 @@ private:
 
     struct Disconnected { };
 
-    PublishStatus publish(const std::string& topic, const JsonDocument& json, Retention retain, QoS qos, ticks timeout = MQTT_NETWORK_TIMEOUT, LogPublish log = LogPublish::Log) {
-        std::string payload;
-        serializeJson(json, payload);
+    MqttTopic internTopic(std::string_view topic) {
+        return topics.intern(topic);
+    }
+
+    PublishStatus publish(const MqttTopic& topic, const JsonDocument& json, Retention retain, QoS qos, ticks timeout = MQTT_NETWORK_TIMEOUT, LogPublish log = LogPublish::Log, MqttEncoding encoding = MqttEncoding::Json) {
+        auto payload = [&]() {
+            PowerManagementLockGuard publishing(Workloads::publish);
+            return payloads.serialize(json, encoding);
+        }();
         if (log == LogPublish::Log) {
 #ifdef DUMP_MQTT
             LOGTD(MQTT, "Queuing topic '%s'%s (qos = %d, timeout = %lld ms): %s",
@@ -245,7 +323,7 @@ private:
                 (retain == Retention::Retain ? " (retain)" : ""),
                 static_cast<int>(qos),
                 duration_cast<milliseconds>(timeout).count(),
-                payload.c_str());
+                encoding == MqttEncoding::Json ? payload.data() : "<binary>");
 #else
             LOGTV(MQTT, "Queuing topic '%s'%s (qos = %d, timeout = %lld ms)",
                 topic.c_str(),
@@ -254,25 +332,27 @@ private:
                 duration_cast<milliseconds>(timeout).count());
 #endif
         }
-        return publishAndWait(topic, payload, retain, qos, timeout);
+        PowerManagementLockGuard waiting(Workloads::publishWait);
+        return publishAndWait(topic, std::move(payload), retain, qos, timeout);
     }
 
-    PublishStatus clear(const std::string& topic, Retention retain, QoS qos, ticks timeout = MQTT_NETWORK_TIMEOUT) {
+    PublishStatus clear(const MqttTopic& topic, Retention retain, QoS qos, ticks timeout = MQTT_NETWORK_TIMEOUT) {
         LOGTD(MQTT, "Clearing topic '%s' (qos = %d, timeout = %lld ms)",
             topic.c_str(),
             static_cast<int>(qos),
             duration_cast<milliseconds>(timeout).count());
-        return publishAndWait(topic, "", retain, qos, timeout);
+        PowerManagementLockGuard waiting(Workloads::publishWait);
+        return publishAndWait(topic, MqttPayload(), retain, qos, timeout);
     }
 
-    PublishStatus publishAndWait(const std::string& topic, const std::string& payload, Retention retain, QoS qos, ticks timeout) {
+    PublishStatus publishAndWait(const MqttTopic& topic, MqttPayload&& payload, Retention retain, QoS qos, ticks timeout) {
         TaskHandle_t waitingTask = timeout == ticks::zero() ? nullptr : xTaskGetCurrentTaskHandle();
 
         bool offered = eventQueue.offerIn(
             MQTT_QUEUE_TIMEOUT,
             OutgoingMessage {
                 .topic = topic,
-                .payload = payload,
+                .payload = std::move(payload),
                 .retain = retain,
                 .qos = qos,
                 .waitingTask = waitingTask,
@@ -294,6 +374,8 @@ private:
                 return PublishStatus::TimeOut;
             case PublishStatus::Success:
                 return PublishStatus::Success;
+            case PublishStatus::Deferred:
+                return PublishStatus::Deferred;
             default:
                 return PublishStatus::Failed;
         }
@@ -310,6 +392,14 @@ private:
             });
     }
 
+    bool unsubscribe(const std::string& topic) {
+        return eventQueue.offerIn(
+            MQTT_QUEUE_TIMEOUT,
+            Unsubscription {
+                .topic = topic,
+            });
+    }
+
     static std::string joinStrings(const std::list<std::string>& strings) {
         if (strings.empty()) {
             return "";
@@ -338,6 +428,9 @@ private:
         // List of messages we are waiting on
         std::list<PendingSubscription> pendingSubscriptions;
 
+        // Messages replayed from the outbox that are not yet acknowledged by the broker
+        OutboxReplay replay;
+
         while (true) {
             auto now = steady_clock::now();
 
@@ -353,6 +446,9 @@ private:
                 return false;
             });
 
+            // Release the buffer of a message whose remaining fragments never arrived
+            reassembler.expireStale(now);
+
             switch (state) {
                 case MqttState::Disconnected:
                     connect(nextSessionShouldBeClean);
@@ -370,7 +466,8 @@ private:
                     }
                     break;
                 case MqttState::Connected:
-                    // Stay connected
+                    // Stay connected, and catch up on anything published while we were offline
+                    replayOutbox(replay);
                     break;
             }
 
@@ -390,7 +487,7 @@ private:
                             if (!arg.sessionPresent) {
                                 // Re-subscribe to existing subscriptions
                                 // because we got a clean session
-                                processSubscriptions(subscriptions, pendingSubscriptions);
+                                processSubscriptions(getSubscribedTopics(), pendingSubscriptions);
                             }
                         } else if constexpr (std::is_same_v<T, Disconnected>) {
                             LOGTV(MQTT, "Processing disconnected event");
@@ -402,9 +499,15 @@ private:
 
                             // Clear pending subscriptions
                             pendingSubscriptions.clear();
+
+                            // Whatever we were replaying will be replayed again after reconnecting
+                            replay.pendingMessageIds.clear();
+                            outbox.abortBatch();
                         } else if constexpr (std::is_same_v<T, MessagePublished>) {
                             LOGTV(MQTT, "Processing message published: %d", arg.messageId);
-                            pendingMessages.handlePublished(arg.messageId, arg.success);
+                            if (!handleReplayedMessagePublished(replay, arg.messageId, arg.success)) {
+                                pendingMessages.handlePublished(arg.messageId, arg.success);
+                            }
                         } else if constexpr (std::is_same_v<T, Subscribed>) {
                             LOGTV(MQTT, "Processing subscribed event: %d", arg.messageId);
                             pendingSubscriptions.remove_if([&](const auto& pendingSubscription) {
@@ -413,10 +516,13 @@ private:
                         } else if constexpr (std::is_same_v<T, OutgoingMessage>) {
                             LOGTV(MQTT, "Processing outgoing message to %s",
                                 arg.topic.c_str());
-                            processOutgoingMessage(arg);
+                            processOutgoingMessage(arg, state == MqttState::Connected);
                         } else if constexpr (std::is_same_v<T, Subscription>) {
                             LOGTV(MQTT, "Processing subscription");
-                            subscriptions.push_back(arg);
+                            {
+                                Lock lock(subscriptionsMutex);
+                                subscriptions.insert(arg.topic, arg);
+                            }
                             if (state == MqttState::Connected) {
                                 // If we are connected, we need to subscribe immediately.
                                 processSubscriptions({ arg }, pendingSubscriptions);
@@ -425,6 +531,17 @@ private:
                                 // clean session to make the subscription.
                                 nextSessionShouldBeClean = true;
                             }
+                        } else if constexpr (std::is_same_v<T, Unsubscription>) {
+                            LOGTV(MQTT, "Processing unsubscription from '%s'",
+                                arg.topic.c_str());
+                            bool removed;
+                            {
+                                Lock lock(subscriptionsMutex);
+                                removed = subscriptions.remove(arg.topic);
+                            }
+                            if (removed && state == MqttState::Connected) {
+                                processUnsubscription(arg.topic);
+                            }
                         }
                     },
                     event);
@@ -479,6 +596,7 @@ private:
             }
             case MQTT_EVENT_CONNECTED: {
                 LOGTD(MQTT, "Connected to MQTT server");
+                connectionCount++;
                 ready.set();
                 eventQueue.offerIn(MQTT_QUEUE_TIMEOUT, Connected { static_cast<bool>(event->session_present) });
                 break;
@@ -486,6 +604,7 @@ private:
             case MQTT_EVENT_DISCONNECTED: {
                 LOGTD(MQTT, "Disconnected from MQTT server");
                 ready.clear();
+                reassembler.reset();
                 eventQueue.offerIn(MQTT_QUEUE_TIMEOUT, Disconnected {});
                 break;
             }
@@ -509,11 +628,18 @@ private:
                 break;
             }
             case MQTT_EVENT_DATA: {
-                std::string topic(event->topic, event->topic_len);
-                std::string payload(event->data, event->data_len);
-                LOGTV(MQTT, "Received message on topic '%s'",
-                    topic.c_str());
-                incomingQueue.offerIn(MQTT_QUEUE_TIMEOUT, IncomingMessage { .topic = topic, .payload = payload });
+                // Messages larger than the receive buffer arrive in multiple fragments
+                auto message = reassembler.onData(
+                    std::string_view(event->topic, event->topic_len),
+                    event->data,
+                    event->data_len,
+                    event->current_data_offset,
+                    event->total_data_len);
+                if (message.has_value()) {
+                    LOGTV(MQTT, "Received message on topic '%s'",
+                        message->topic.c_str());
+                    incomingQueue.offerIn(MQTT_QUEUE_TIMEOUT, std::move(message.value()));
+                }
                 break;
             }
             case MQTT_EVENT_ERROR: {
@@ -556,12 +682,17 @@ private:
         }
     }
 
-    void processOutgoingMessage(const OutgoingMessage& message) {
+    void processOutgoingMessage(const OutgoingMessage& message, bool connected) {
+        // Keep messages in order: while there is a backlog, new messages go to the end of it
+        if ((!connected || !outbox.isEmpty()) && deferToOutbox(message)) {
+            return;
+        }
+
         int ret = esp_mqtt_client_enqueue(
             client,
             message.topic.c_str(),
-            message.payload.c_str(),
-            static_cast<int>(message.payload.length()),
+            message.payload.data(),
+            static_cast<int>(message.payload.size()),
             static_cast<int>(message.qos),
             static_cast<int>(message.retain == Retention::Retain),
             true);
@@ -569,19 +700,122 @@ private:
         if (ret < 0) {
             LOGTD(MQTT, "Error publishing to '%s': %s",
                 message.topic.c_str(), ret == -2 ? "outbox full" : "failure");
-            PendingMessages::notifyWaitingTask(message.waitingTask, false);
+            if (!deferToOutbox(message)) {
+                PendingMessages::notifyWaitingTask(message.waitingTask, false);
+            }
         } else {
             auto messageId = ret;
 #ifdef DUMP_MQTT
             if (message.log == LogPublish::Log) {
                 LOGTV(MQTT, "Published to '%s' (size: %d), message ID: %d",
-                    message.topic.c_str(), message.payload.length(), messageId);
+                    message.topic.c_str(), message.payload.size(), messageId);
             }
 #endif
             pendingMessages.waitOn(messageId, message.waitingTask);
         }
     }
 
+    /**
+     * @brief Store a message in the persistent outbox to be published after we reconnect.
+     *
+     * Only messages published with QoS 1 or 2 are stored, as QoS 0 messages are not expected to be delivered reliably.
+     *
+     * @return Whether the message was stored.
+     */
+    bool deferToOutbox(const OutgoingMessage& message) {
+        if (message.qos == QoS::AtMostOnce || !outbox.isEnabled()) {
+            return false;
+        }
+        if (!outbox.append(message.topic.str(), message.payload.view(), static_cast<uint8_t>(message.qos), message.retain == Retention::Retain)) {
+            return false;
+        }
+        LOGTV(MQTT, "Deferred message to '%s', %zu messages in outbox",
+            message.topic.c_str(), outbox.getDepth());
+        PendingMessages::notifyWaitingTask(message.waitingTask, PublishStatus::Deferred);
+        return true;
+    }
+
+    struct OutboxReplay {
+        std::unordered_set<int> pendingMessageIds;
+        bool failed = false;
+    };
+
+    /**
+     * @brief Hand the next batch of stored messages to the MQTT client, unless a batch is already in flight.
+     */
+    void replayOutbox(OutboxReplay& replay) {
+        if (!replay.pendingMessageIds.empty() || outbox.isEmpty()) {
+            return;
+        }
+        replay.failed = false;
+        auto count = outbox.readBatch([&](const MqttOutbox::Record& record) {
+            int ret = esp_mqtt_client_enqueue(
+                client,
+                record.topic.c_str(),
+                record.payload.c_str(),
+                static_cast<int>(record.payload.length()),
+                record.qos,
+                static_cast<int>(record.retain),
+                true);
+            if (ret > 0) {
+                replay.pendingMessageIds.insert(ret);
+            } else {
+                replay.failed = true;
+            }
+        });
+        if (count == 0) {
+            return;
+        }
+        LOGTD(MQTT, "Replaying %zu messages from outbox, %zu remaining",
+            count, outbox.getDepth());
+        if (replay.pendingMessageIds.empty()) {
+            // Nothing made it into the client, try again later
+            outbox.abortBatch();
+        }
+    }
+
+    /**
+     * @brief Commits the replayed batch once all of its messages have been acknowledged.
+     *
+     * @return Whether the message ID belonged to a replayed message.
+     */
+    bool handleReplayedMessagePublished(OutboxReplay& replay, int messageId, bool success) {
+        if (replay.pendingMessageIds.erase(messageId) == 0) {
+            return false;
+        }
+        if (!success) {
+            replay.failed = true;
+        }
+        if (replay.pendingMessageIds.empty()) {
+            if (replay.failed) {
+                outbox.abortBatch();
+            } else {
+                outbox.commitBatch();
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Collects one subscription for each subscribed topic pattern, with the highest QoS requested for it.
+     */
+    std::list<Subscription> getSubscribedTopics() {
+        std::list<Subscription> topics;
+        Lock lock(subscriptionsMutex);
+        subscriptions.forEach([&](const std::string& topic, const std::vector<Subscription>& subscriptionsForTopic) {
+            QoS qos = QoS::AtMostOnce;
+            for (const auto& subscription : subscriptionsForTopic) {
+                qos = std::max(qos, subscription.qos);
+            }
+            topics.push_back(Subscription {
+                .topic = topic,
+                .qos = qos,
+                .handle = nullptr,
+            });
+        });
+        return topics;
+    }
+
     void processSubscriptions(const std::list<Subscription>& subscriptions, std::list<PendingSubscription>& pendingSubscriptions) {
         std::vector<esp_mqtt_topic_t> topics;
         for (auto it = subscriptions.begin(); it != subscriptions.end();) {
@@ -615,9 +849,17 @@ private:
         }
     }
 
-    void processIncomingMessage(const IncomingMessage& message) {
+    void processUnsubscription(const std::string& topic) {
+        int ret = esp_mqtt_client_unsubscribe(client, topic.c_str());
+        if (ret < 0) {
+            LOGTD(MQTT, "Error unsubscribing from '%s': %s",
+                topic.c_str(), ret == -2 ? "outbox full" : "failure");
+        }
+    }
+
+    void processIncomingMessage(IncomingMessage& message) {
         const std::string& topic = message.topic;
-        const std::string& payload = message.payload;
+        MqttPayload& payload = message.payload;
 
         if (payload.empty()) {
             LOGTV(MQTT, "Ignoring empty payload");
@@ -626,23 +868,24 @@ private:
 
 #ifdef DUMP_MQTT
         LOGTD(MQTT, "Received '%s' (size: %d): %s",
-            topic.c_str(), payload.length(), payload.c_str());
+            topic.c_str(), payload.size(), payload.data());
 #else
         LOGTD(MQTT, "Received '%s' (size: %d)",
-            topic.c_str(), payload.length());
+            topic.c_str(), payload.size());
 #endif
-        for (const auto& subscription : subscriptions) {
-            if (topicMatches(subscription.topic.c_str(), topic.c_str())) {
-                Task::run("mqtt:incoming-handler", 4096, [topic, payload, subscription](Task& /*task*/) {
-                    JsonDocument json;
-                    deserializeJson(json, payload);
-                    subscription.handle(topic, json.as<JsonObject>());
-                });
-                return;
-            }
+        std::vector<SubscriptionHandler> matchingHandlers;
+        {
+            Lock lock(subscriptionsMutex);
+            subscriptions.match(topic, [&](const Subscription& subscription) {
+                matchingHandlers.push_back(subscription.handle);
+            });
+        }
+        if (matchingHandlers.empty()) {
+            LOGTW(MQTT, "No handler for topic '%s'",
+                topic.c_str());
+            return;
         }
-        LOGTW(MQTT, "No handler for topic '%s'",
-            topic.c_str());
+        handlers.dispatch(topic, std::move(payload), std::move(matchingHandlers));
     }
 
     static std::string getClientId(const std::string& clientId, const std::string& instanceName) {
@@ -652,57 +895,10 @@ private:
         return "ugly-duckling-" + instanceName;
     }
 
-    static bool topicMatches(const char* pattern, const char* topic) {
-        const char* pat_ptr = pattern;
-        const char* top_ptr = topic;
-
-        while ((*pat_ptr != 0) && (*top_ptr != 0)) {
-            // Extract pattern level
-            const char* pat_end = strchr(pat_ptr, '/');
-            size_t pat_len = (pat_end != nullptr) ? static_cast<size_t>(pat_end - pat_ptr) : strlen(pat_ptr);
-
-            // Extract topic level
-            const char* top_end = strchr(top_ptr, '/');
-            size_t top_len = (top_end != nullptr) ? static_cast<size_t>(top_end - top_ptr) : strlen(top_ptr);
-
-            // Handle wildcard +
-            if (strncmp(pat_ptr, "+", pat_len) == 0) {
-                // Match any single level, so just advance
-            } else if (strncmp(pat_ptr, "#", pat_len) == 0) {
-                // # must be at the end of the pattern
-                return *(pat_ptr + pat_len) == '\0';
-            } else {
-                // Compare level literally
-                if (pat_len != top_len || strncmp(pat_ptr, top_ptr, pat_len) != 0) {
-                    return false;
-                }
-            }
-
-            // Move to next level
-            if (pat_end != nullptr) {
-                pat_ptr = pat_end + 1;
-            } else {
-                pat_ptr += pat_len;
-            }
-
-            if (top_end != nullptr) {
-                top_ptr = top_end + 1;
-            } else {
-                top_ptr += top_len;
-            }
-        }
-
-        // Handle cases like pattern: "foo/#", topic: "foo"
-        if (*pat_ptr == '#' && *(pat_ptr + 1) == '\0') {
-            return true;
-        }
-
-        return *pat_ptr == '\0' && *top_ptr == '\0';
-    }
-
     State& networkReady;
     const std::shared_ptr<MdnsDriver> mdns;
     std::atomic<bool> trustMdnsCache = true;
+    std::atomic<uint32_t> connectionCount = 0;
 
     const std::string configHostname;
     const unsigned int configPort;
@@ -710,17 +906,27 @@ private:
     const std::string configClientCert;
     const std::string configClientKey;
     const std::string clientId;
+    const MqttEncoding telemetryEncoding;
 
     StateSource& ready;
 
+    MqttOutbox outbox;
+    MqttTopicRegistry topics;
+    MqttPayloadPool payloads;
+    MqttHandlerPool handlers;
+    // Shared between the MQTT client's event handler and the event loop, which expires stale messages; guarded internally
+    MqttReassembler reassembler;
+
     std::string hostname;
     uint32_t port {};
     esp_mqtt_client_handle_t client;
 
-    Queue<std::variant<Connected, Disconnected, MessagePublished, Subscribed, OutgoingMessage, Subscription>> eventQueue;
-    Queue<IncomingMessage> incomingQueue;
-    // TODO Use a map instead
-    std::list<Subscription> subscriptions;
+    PooledQueue<std::variant<Connected, Disconnected, MessagePublished, Subscribed, OutgoingMessage, Subscription, Unsubscription>> eventQueue;
+    // Only ever offered to from the MQTT client's event handler
+    PooledQueue<IncomingMessage, QueueProducers::Single> incomingQueue;
+    // Written by the MQTT task, matched against by the incoming message task
+    Mutex subscriptionsMutex;
+    MqttTopicTrie<Subscription> subscriptions;
     PendingMessages pendingMessages;
 
     friend class MqttRoot;
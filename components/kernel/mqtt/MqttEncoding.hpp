@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <ArduinoJson.h>
+
+#include <Log.hpp>
+
+namespace farmhub::kernel::mqtt {
+
+/**
+ * @brief Wire format of published payloads.
+ */
+enum class MqttEncoding : uint8_t {
+    Json,
+    // MessagePack with the same structure as the JSON payload
+    MsgPack,
+    // MessagePack with object keys from `MqttKeyDictionary` replaced by their integer codes
+    MsgPackWithKeys,
+};
+
+/**
+ * @brief Static dictionary of object keys that appear repeatedly in telemetry.
+ *
+ * A key's code is its position in the list, so the list is append-only: never remove
+ * or reorder entries, as the server decodes payloads using the list published in `init`.
+ */
+class MqttKeyDictionary {
+public:
+    static constexpr uint8_t VERSION = 1;
+
+    static constexpr auto KEYS = std::to_array<std::string_view>({
+        // Telemetry message
+        "uptime", "timestamp", "features", "type", "name", "data", "value",
+        "battery", "voltage", "percentage", "current", "time-to-empty",
+        "wifi", "rssi",
+        "mqtt", "payload-fallbacks",
+        "handlers", "workers", "capacity", "queued", "peak-queued", "busy", "dropped",
+        "latency", "p50", "p90", "p99",
+        "incoming", "reassembled", "timeouts", "oversized", "out-of-order",
+        "outbox", "depth", "bytes", "replay-rate",
+        "memory", "free-heap", "min-heap",
+        "pm", "sleep-ratio", "sleep-count",
+        // Feature data
+        "state", "targetState", "operationState", "volume", "rate", "duration",
+        "temperature", "moisture", "humidity", "pressure", "light", "flow",
+        "valve", "door", "kalman-beta", "error", "status", "mode", "count", "total",
+    });
+
+    /**
+     * @brief Look up the code of a key, if it is in the dictionary.
+     */
+    static std::optional<uint8_t> find(std::string_view key) {
+        const auto& index = sortedIndex();
+        auto it = std::lower_bound(index.begin(), index.end(), key, [](uint8_t code, std::string_view key) {
+            return KEYS[code] < key;
+        });
+        if (it == index.end() || KEYS[*it] != key) {
+            return std::nullopt;
+        }
+        return *it;
+    }
+
+    static void populate(JsonObject& json) {
+        json["version"] = VERSION;
+        auto keys = json["keys"].to<JsonArray>();
+        for (const auto& key : KEYS) {
+            keys.add(key);
+        }
+    }
+
+private:
+    static const std::array<uint8_t, KEYS.size()>& sortedIndex() {
+        static const auto index = [] {
+            std::array<uint8_t, KEYS.size()> index;
+            for (size_t i = 0; i < index.size(); i++) {
+                index[i] = static_cast<uint8_t>(i);
+            }
+            std::sort(index.begin(), index.end(), [](uint8_t a, uint8_t b) {
+                return KEYS[a] < KEYS[b];
+            });
+            return index;
+        }();
+        return index;
+    }
+};
+
+/**
+ * @brief Writes a JSON document as MessagePack, replacing object keys found in `MqttKeyDictionary` with their codes.
+ *
+ * ArduinoJson's `serializeMsgPack()` can only write string keys, hence the separate writer.
+ * With no buffer, it only counts the bytes needed.
+ */
+class MqttMsgPackWriter {
+public:
+    MqttMsgPackWriter(char* buffer, size_t capacity)
+        : buffer(buffer)
+        , capacity(capacity) {
+    }
+
+    void write(JsonVariantConst value) {
+        if (value.is<JsonObjectConst>()) {
+            auto object = value.as<JsonObjectConst>();
+            writeLength(value.size(), 0x80, 15, 0, 0xde, 0xdf);
+            for (auto member : object) {
+                writeKey(member.key().c_str());
+                write(member.value());
+            }
+        } else if (value.is<JsonArrayConst>()) {
+            auto array = value.as<JsonArrayConst>();
+            writeLength(value.size(), 0x90, 15, 0, 0xdc, 0xdd);
+            for (auto element : array) {
+                write(element);
+            }
+        } else if (value.is<const char*>()) {
+            writeString(value.as<const char*>());
+        } else if (value.is<bool>()) {
+            writeByte(value.as<bool>() ? 0xc3 : 0xc2);
+        } else if (value.is<int64_t>()) {
+            writeInteger(value.as<int64_t>());
+        } else if (value.is<uint64_t>()) {
+            writeUnsigned(value.as<uint64_t>());
+        } else if (value.is<double>()) {
+            writeFloat(value.as<double>());
+        } else {
+            writeByte(0xc0);
+        }
+    }
+
+    /**
+     * @brief Number of bytes written, or that would have been written without a buffer.
+     */
+    size_t size() const {
+        return length;
+    }
+
+    bool overflowed() const {
+        return buffer != nullptr && length > capacity;
+    }
+
+private:
+    void writeKey(const char* key) {
+        auto code = MqttKeyDictionary::find(key);
+        if (code.has_value()) {
+            writeUnsigned(code.value());
+        } else {
+            writeString(key);
+        }
+    }
+
+    void writeString(const char* value) {
+        size_t size = strlen(value);
+        writeLength(size, 0xa0, 31, 0xd9, 0xda, 0xdb);
+        writeBytes(value, size);
+    }
+
+    void writeInteger(int64_t value) {
+        if (value >= 0) {
+            writeUnsigned(static_cast<uint64_t>(value));
+        } else if (value >= -32) {
+            writeByte(static_cast<uint8_t>(value));
+        } else if (value >= INT8_MIN) {
+            writeByte(0xd0);
+            writeBigEndian(static_cast<uint8_t>(value), 1);
+        } else if (value >= INT16_MIN) {
+            writeByte(0xd1);
+            writeBigEndian(static_cast<uint16_t>(value), 2);
+        } else if (value >= INT32_MIN) {
+            writeByte(0xd2);
+            writeBigEndian(static_cast<uint32_t>(value), 4);
+        } else {
+            writeByte(0xd3);
+            writeBigEndian(static_cast<uint64_t>(value), 8);
+        }
+    }
+
+    void writeUnsigned(uint64_t value) {
+        if (value <= 0x7f) {
+            writeByte(static_cast<uint8_t>(value));
+        } else if (value <= UINT8_MAX) {
+            writeByte(0xcc);
+            writeBigEndian(value, 1);
+        } else if (value <= UINT16_MAX) {
+            writeByte(0xcd);
+            writeBigEndian(value, 2);
+        } else if (value <= UINT32_MAX) {
+            writeByte(0xce);
+            writeBigEndian(value, 4);
+        } else {
+            writeByte(0xcf);
+            writeBigEndian(value, 8);
+        }
+    }
+
+    void writeFloat(double value) {
+        // Use single precision when it loses nothing
+        auto single = static_cast<float>(value);
+        if (static_cast<double>(single) == value) {
+            uint32_t bits;
+            memcpy(&bits, &single, sizeof(bits));
+            writeByte(0xca);
+            writeBigEndian(bits, 4);
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            writeByte(0xcb);
+            writeBigEndian(bits, 8);
+        }
+    }
+
+    void writeLength(size_t size, uint8_t fixType, size_t fixMax, uint8_t type8, uint8_t type16, uint8_t type32) {
+        if (size <= fixMax) {
+            writeByte(fixType | static_cast<uint8_t>(size));
+        } else if (type8 != 0 && size <= UINT8_MAX) {
+            writeByte(type8);
+            writeBigEndian(size, 1);
+        } else if (size <= UINT16_MAX) {
+            writeByte(type16);
+            writeBigEndian(size, 2);
+        } else {
+            writeByte(type32);
+            writeBigEndian(size, 4);
+        }
+    }
+
+    void writeBigEndian(uint64_t value, size_t bytes) {
+        for (size_t i = bytes; i > 0; i--) {
+            writeByte(static_cast<uint8_t>(value >> (8 * (i - 1))));
+        }
+    }
+
+    void writeByte(uint8_t value) {
+        if (buffer != nullptr && length < capacity) {
+            buffer[length] = static_cast<char>(value);
+        }
+        length++;
+    }
+
+    void writeBytes(const char* data, size_t size) {
+        if (buffer != nullptr && length + size <= capacity) {
+            memcpy(buffer + length, data, size);
+        }
+        length += size;
+    }
+
+    char* const buffer;
+    const size_t capacity;
+    size_t length = 0;
+};
+
+inline size_t measureMsgPackWithKeys(JsonVariantConst json) {
+    MqttMsgPackWriter writer(nullptr, 0);
+    writer.write(json);
+    return writer.size();
+}
+
+/**
+ * @return The number of bytes written, or 0 if the buffer is too small.
+ */
+inline size_t serializeMsgPackWithKeys(JsonVariantConst json, char* buffer, size_t capacity) {
+    MqttMsgPackWriter writer(buffer, capacity);
+    writer.write(json);
+    return writer.overflowed() ? 0 : writer.size();
+}
+
+}    // namespace farmhub::kernel::mqtt
+
+namespace ArduinoJson {
+
+using farmhub::kernel::mqtt::MqttEncoding;
+
+template <>
+struct Converter<MqttEncoding> {
+    static bool toJson(const MqttEncoding& src, JsonVariant dst) {
+        switch (src) {
+            case MqttEncoding::Json:
+                return dst.set("json");
+            case MqttEncoding::MsgPack:
+                return dst.set("msgpack");
+            case MqttEncoding::MsgPackWithKeys:
+                return dst.set("msgpack-keys");
+            default:
+                LOGTE(farmhub::kernel::GLOBAL, "Unknown encoding: %d", static_cast<int>(src));
+                return dst.set("json");
+        }
+    }
+
+    static MqttEncoding fromJson(JsonVariantConst src) {
+        auto encoding = src.as<std::string>();
+        if (encoding == "json") {
+            return MqttEncoding::Json;
+        }
+        if (encoding == "msgpack") {
+            return MqttEncoding::MsgPack;
+        }
+        if (encoding == "msgpack-keys") {
+            return MqttEncoding::MsgPackWithKeys;
+        }
+        LOGTE(farmhub::kernel::GLOBAL, "Unknown encoding: %s", encoding.c_str());
+        return MqttEncoding::Json;
+    }
+
+    static bool checkJson(JsonVariantConst src) {
+        return src.is<std::string>();
+    }
+};
+
+}    // namespace ArduinoJson
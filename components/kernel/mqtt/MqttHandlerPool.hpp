@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include <Concurrent.hpp>
+#include <Configuration.hpp>
+#include <Log.hpp>
+#include <Task.hpp>
+#include <mqtt/MqttPayload.hpp>
+
+using namespace std::chrono;
+
+namespace farmhub::kernel::mqtt {
+
+LOGGING_TAG(MQTT_HANDLERS, "mqtt:handlers")
+
+using SubscriptionHandler = std::function<void(const std::string&, const JsonObject&)>;
+
+/**
+ * @brief Fixed set of worker tasks running the handlers of incoming MQTT messages.
+ *
+ * Messages are assigned to workers by topic, so messages on the same topic are handled
+ * in the order they arrived. Each worker has a bounded backlog; when it is full, dispatching
+ * waits for a short while to push back on the sender, and then drops the message.
+ */
+class MqttHandlerPool {
+public:
+    class Config : public ConfigurationSection {
+    public:
+        /**
+         * @brief Number of worker tasks running handlers.
+         */
+        Property<size_t> workers { this, "workers", 2 };
+
+        /**
+         * @brief Maximum number of messages waiting to be handled, split evenly between workers.
+         */
+        Property<size_t> backlog { this, "backlog", 16 };
+
+        /**
+         * @brief How long to wait for room in a full backlog before dropping a message.
+         */
+        Property<milliseconds> backlogTimeout { this, "backlogTimeout", 500ms };
+
+        /**
+         * @brief Stack size of each worker task.
+         */
+        Property<uint32_t> stackSize { this, "stackSize", 4096 };
+    };
+
+    explicit MqttHandlerPool(const std::shared_ptr<Config>& config)
+        : backlogTimeout(config->backlogTimeout.get())
+        , capacity(std::max<size_t>(config->backlog.get(), 1)) {
+        size_t workerCount = std::max<size_t>(config->workers.get(), 1);
+        size_t workerBacklog = std::max<size_t>(capacity / workerCount, 1);
+        for (size_t i = 0; i < workerCount; i++) {
+            auto worker = std::make_unique<Worker>("mqtt-handlers-" + std::to_string(i), workerBacklog);
+            Task::loop("mqtt:handler-" + std::to_string(i), config->stackSize.get(), [this, queue = &worker->queue](Task& /*task*/) {
+                queue->take([this](Job& job) {
+                    handle(job);
+                });
+            });
+            workers.push_back(std::move(worker));
+        }
+    }
+
+    /**
+     * @brief Queue the message to be handled by the given handlers.
+     *
+     * @return Whether the message was queued, false if it was dropped because the backlog is full.
+     */
+    bool dispatch(const std::string& topic, MqttPayload&& payload, std::vector<SubscriptionHandler>&& handlers) {
+        auto& worker = workers[std::hash<std::string> {}(topic) % workers.size()];
+        // Count before queueing so the worker can't decrement first
+        updatePeak(++queued);
+        bool offered = worker->queue.offerIn(
+            clampTicks(backlogTimeout),
+            Job {
+                .topic = topic,
+                .payload = std::move(payload),
+                .handlers = std::move(handlers),
+                .dispatchedAt = steady_clock::now(),
+            });
+        if (!offered) {
+            queued--;
+            dropped++;
+            LOGTW(MQTT_HANDLERS, "Backlog full, dropping message on '%s'",
+                topic.c_str());
+        }
+        return offered;
+    }
+
+    size_t getQueued() const {
+        return queued;
+    }
+
+    size_t getDropped() const {
+        return dropped;
+    }
+
+    void populateTelemetry(JsonObject& json) {
+        json["workers"] = workers.size();
+        json["capacity"] = capacity;
+        json["queued"] = queued.load();
+        json["peak-queued"] = peakQueued.exchange(queued.load());
+        json["busy"] = busy.load();
+        json["dropped"] = dropped.load();
+        auto latencyJson = json["latency"].to<JsonObject>();
+        latency.populateTelemetry(latencyJson);
+    }
+
+private:
+    struct Job {
+        std::string topic;
+        MqttPayload payload;
+        std::vector<SubscriptionHandler> handlers;
+        steady_clock::time_point dispatchedAt;
+    };
+
+    struct Worker {
+        Worker(const std::string& name, size_t backlog)
+            : queue(name, backlog) {
+        }
+
+        Queue<Job> queue;
+    };
+
+    /**
+     * @brief Keeps the most recent latency samples to calculate percentiles from.
+     */
+    class LatencyWindow {
+    public:
+        void record(milliseconds sample) {
+            Lock lock(mutex);
+            samples[next] = sample;
+            next = (next + 1) % samples.size();
+            count = std::min(count + 1, samples.size());
+        }
+
+        void populateTelemetry(JsonObject& json) {
+            std::array<milliseconds, WINDOW> sorted;
+            size_t sampleCount;
+            {
+                Lock lock(mutex);
+                sampleCount = count;
+                std::copy_n(samples.begin(), sampleCount, sorted.begin());
+            }
+            if (sampleCount == 0) {
+                return;
+            }
+            std::sort(sorted.begin(), sorted.begin() + sampleCount);
+            auto percentile = [&](size_t p) {
+                return sorted[(sampleCount - 1) * p / 100].count();
+            };
+            json["p50"] = percentile(50);
+            json["p90"] = percentile(90);
+            json["p99"] = percentile(99);
+        }
+
+    private:
+        static constexpr size_t WINDOW = 64;
+
+        Mutex mutex;
+        std::array<milliseconds, WINDOW> samples {};
+        size_t next = 0;
+        size_t count = 0;
+    };
+
+    void handle(const Job& job) {
+        busy++;
+        JsonDocument json;
+        // Parse straight from the pooled buffer
+        auto error = deserializeJson(json, job.payload.data(), job.payload.size());
+        if (error) {
+            LOGTE(MQTT_HANDLERS, "Failed to parse message on '%s': %s",
+                job.topic.c_str(), error.c_str());
+        } else {
+            for (const auto& handler : job.handlers) {
+                handler(job.topic, json.as<JsonObject>());
+            }
+        }
+        latency.record(duration_cast<milliseconds>(steady_clock::now() - job.dispatchedAt));
+        busy--;
+        queued--;
+    }
+
+    void updatePeak(size_t current) {
+        size_t peak = peakQueued;
+        while (current > peak && !peakQueued.compare_exchange_weak(peak, current)) { }
+    }
+
+    const milliseconds backlogTimeout;
+    const size_t capacity;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::atomic<size_t> queued = 0;
+    std::atomic<size_t> peakQueued = 0;
+    std::atomic<size_t> busy = 0;
+    std::atomic<size_t> dropped = 0;
+    LatencyWindow latency;
+};
+
+}    // namespace farmhub::kernel::mqtt
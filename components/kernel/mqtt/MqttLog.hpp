@@ -1,37 +1,95 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+
+#include <Console.hpp>
 #include <LogJson.hpp>
 #include <Task.hpp>
+#include <mqtt/MqttLogBatch.hpp>
 #include <mqtt/MqttRoot.hpp>
 
 namespace farmhub::kernel::mqtt {
 
 class MqttLog {
 public:
-    static void init(Level publishLevel, const std::shared_ptr<Queue<LogRecord>>& logRecords, std::shared_ptr<MqttRoot> mqttRoot) {
-        Task::loop("mqtt:log", 3072, [publishLevel, logRecords, mqttRoot](Task& /*task*/) {
-            logRecords->take([&](const LogRecord& record) {
-                if (record.level > publishLevel) {
+    static std::shared_ptr<MqttLog> init(Level publishLevel, const std::shared_ptr<PooledQueue<LogRecord>>& logRecords, const std::shared_ptr<MqttRoot>& mqttRoot, const std::shared_ptr<MqttLogBatch::Config>& config) {
+        auto log = std::make_shared<MqttLog>(logRecords, publishLevel);
+        auto batch = std::make_shared<MqttLogBatch>(config);
+        auto qos = static_cast<QoS>(std::min<uint8_t>(config->qos.get(), static_cast<uint8_t>(QoS::ExactlyOnce)));
+        auto logTopic = mqttRoot->topic("log");
+        Task::loop("mqtt:log", 3072, [log, logRecords, mqttRoot, logTopic, batch, qos, reportedDrops = static_cast<size_t>(0)](Task& /*task*/) mutable {
+            bool flushNow = false;
+            bool flushRequested = false;
+            logRecords->pollIn(clampTicks(batch->timeUntilDue()), [&](const LogRecord& record) {
+                if (record.level == Level::None) {
+                    flushRequested = true;
+                    return;
+                }
+                if (record.level > log->publishLevel.load()) {
                     return;
                 }
-                auto length = record.message.length();
-                // Remove the level prefix
-                auto messageStart = 2;
-                // Remove trailing newline
-                auto messageEnd = record.message[length - 1] == '\n'
-                    ? length - 1
-                    : length;
-                std::string message = record.message.substr(messageStart, messageEnd - messageStart);
-
-                mqttRoot->publish(
-                    "log", [level = record.level, message](JsonObject& json) {
-                        json["level"] = level;
-                        json["message"] = message;
-                    },
-                    Retention::NoRetain, QoS::ExactlyOnce, 2s, LogPublish::Silent);
+                flushNow = batch->add(record.level, MqttLogBatch::lineOf(record.message));
             });
+
+            auto drops = ConsoleProvider::getDroppedRecords() + ConsoleProvider::getOverflows();
+            batch->countDropped(drops - reportedDrops);
+            reportedDrops = drops;
+
+            if (flushRequested && batch->empty()) {
+                log->flushed.offer(PublishStatus::Success);
+                return;
+            }
+            if (!flushNow && !flushRequested && !batch->isDue()) {
+                return;
+            }
+            size_t lines = 0;
+            auto status = mqttRoot->publish(
+                logTopic, [&](JsonObject& json) {
+                    lines = batch->flush(json);
+                },
+                Retention::NoRetain,
+                // Flushes are waited for until the broker acknowledges them
+                flushRequested ? std::max(qos, QoS::AtLeastOnce) : qos,
+                2s, LogPublish::Silent);
+            if (status != PublishStatus::Success && status != PublishStatus::Pending && status != PublishStatus::Deferred) {
+                batch->countDropped(lines);
+            }
+            if (flushRequested) {
+                log->flushed.offer(status);
+            }
         });
+        return log;
+    }
+
+    MqttLog(const std::shared_ptr<PooledQueue<LogRecord>>& logRecords, Level publishLevel)
+        : logRecords(logRecords)
+        , publishLevel(publishLevel) {
+    }
+
+    /**
+     * @brief Only publish lines up to `level` from now on.
+     */
+    void setPublishLevel(Level level) {
+        publishLevel = level;
     }
+
+    /**
+     * @brief Publish the lines logged so far right away, and wait for the broker to acknowledge them.
+     */
+    PublishStatus flush(ticks timeout) {
+        flushed.clear();
+        // An empty record with no level asks the publishing task to flush
+        if (!logRecords->offerIn(timeout, Level::None, "")) {
+            return PublishStatus::QueueFull;
+        }
+        return flushed.pollIn(timeout).value_or(PublishStatus::TimeOut);
+    }
+
+private:
+    const std::shared_ptr<PooledQueue<LogRecord>> logRecords;
+    std::atomic<Level> publishLevel;
+    CopyQueue<PublishStatus> flushed { "mqtt-log-flushed", 1 };
 };
 
 }    // namespace farmhub::kernel::mqtt
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include <Configuration.hpp>
+#include <Log.hpp>
+#include <LogJson.hpp>
+
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace farmhub::kernel::mqtt {
+
+/**
+ * @brief Log lines waiting to be published together in a single message.
+ *
+ * Consecutive lines that only differ in their timestamp are collapsed into the first of them,
+ * with a count of how many times it was repeated.
+ */
+class MqttLogBatch {
+public:
+    class Config : public ConfigurationSection {
+    public:
+        /**
+         * @brief Publish the batch once its messages add up to this many bytes.
+         */
+        Property<size_t> maxSize { this, "maxSize", 2048 };
+
+        /**
+         * @brief Publish the batch once its oldest line has waited this long.
+         */
+        Property<milliseconds> maxAge { this, "maxAge", 10000ms };
+
+        /**
+         * @brief Publish the batch right away when a line of this level or more severe is added.
+         */
+        Property<Level> flushLevel { this, "flushLevel", Level::Warning };
+
+        /**
+         * @brief MQTT QoS to publish batches with.
+         */
+        Property<uint8_t> qos { this, "qos", 1 };
+    };
+
+    explicit MqttLogBatch(const std::shared_ptr<Config>& config)
+        : maxSize(config->maxSize.get())
+        , maxAge(config->maxAge.get())
+        , flushLevel(config->flushLevel.get()) {
+    }
+
+    /**
+     * @brief The line of a console log record without its level prefix and trailing newline.
+     */
+    static std::string_view lineOf(std::string_view record) {
+        record.remove_prefix(std::min<size_t>(2, record.length()));
+        if (record.ends_with('\n')) {
+            record.remove_suffix(1);
+        }
+        return record;
+    }
+
+    /**
+     * @brief Add a line, like `(12345) tag: message`, to the batch.
+     *
+     * @return Whether the batch should be published now.
+     */
+    bool add(Level level, std::string_view message, steady_clock::time_point now = steady_clock::now()) {
+        auto textStart = timestampLength(message);
+        auto text = message.substr(textStart);
+        if (!lines.empty() && lines.back().level == level && lines.back().text() == text) {
+            lines.back().repeated++;
+        } else {
+            if (lines.empty()) {
+                oldest = now;
+            }
+            lines.push_back({ level, std::string(message), textStart, 1 });
+            size += message.size();
+        }
+        return size >= maxSize || level <= flushLevel;
+    }
+
+    /**
+     * @brief Count lines that were lost before making it into a batch, or with a batch that failed to publish.
+     */
+    void countDropped(size_t count) {
+        dropped += count;
+    }
+
+    bool empty() const {
+        return lines.empty();
+    }
+
+    /**
+     * @brief Whether the oldest line in the batch has waited long enough.
+     */
+    bool isDue(steady_clock::time_point now = steady_clock::now()) const {
+        return !lines.empty() && now - oldest >= maxAge;
+    }
+
+    /**
+     * @brief How long until the batch is due, or `milliseconds::max()` if it is empty.
+     */
+    milliseconds timeUntilDue(steady_clock::time_point now = steady_clock::now()) const {
+        if (lines.empty()) {
+            return milliseconds::max();
+        }
+        auto waited = duration_cast<milliseconds>(now - oldest);
+        return waited >= maxAge ? milliseconds::zero() : maxAge - waited;
+    }
+
+    /**
+     * @brief Write the batch to the message, and start a new batch.
+     *
+     * @return The number of lines in the message, counting repeats.
+     */
+    size_t flush(JsonObject& json) {
+        json["seq"] = sequence++;
+        json["dropped"] = dropped;
+        dropped = 0;
+        size_t count = 0;
+        auto linesJson = json["lines"].to<JsonArray>();
+        for (const auto& line : lines) {
+            auto lineJson = linesJson.add<JsonObject>();
+            lineJson["level"] = line.level;
+            lineJson["message"] = line.message;
+            if (line.repeated > 1) {
+                lineJson["repeated"] = line.repeated;
+            }
+            count += line.repeated;
+        }
+        // Keep the capacity for the next batch
+        lines.clear();
+        size = 0;
+        return count;
+    }
+
+private:
+    struct Line {
+        Level level;
+        // The first of the repeated lines, with its timestamp
+        std::string message;
+        size_t textStart;
+        size_t repeated;
+
+        std::string_view text() const {
+            return std::string_view(message).substr(textStart);
+        }
+    };
+
+    /**
+     * @brief Length of the `(...) ` timestamp the console puts at the start of lines, or zero if there is none.
+     */
+    static size_t timestampLength(std::string_view message) {
+        if (!message.starts_with('(')) {
+            return 0;
+        }
+        auto end = message.find(") ");
+        return end == std::string_view::npos ? 0 : end + 2;
+    }
+
+    const size_t maxSize;
+    const milliseconds maxAge;
+    const Level flushLevel;
+
+    std::vector<Line> lines;
+    size_t size = 0;
+    steady_clock::time_point oldest;
+    uint32_t sequence = 0;
+    size_t dropped = 0;
+};
+
+}    // namespace farmhub::kernel::mqtt
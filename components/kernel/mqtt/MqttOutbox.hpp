@@ -0,0 +1,426 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <ArduinoJson.h>
+
+#include <Configuration.hpp>
+#include <FileSystem.hpp>
+#include <Log.hpp>
+
+using namespace std::chrono;
+
+namespace farmhub::kernel::mqtt {
+
+LOGGING_TAG(OUTBOX, "mqtt:outbox")
+
+/**
+ * @brief Persistent store-and-forward outbox for MQTT messages published while the broker is unreachable.
+ *
+ * Messages are appended to a ring of segment files under `/outbox` on the file system.
+ * When the last segment is full, a new one is started; when the ring is full, the oldest segment
+ * is dropped to make room.
+ *
+ * Only per-segment metadata is kept in memory, so the memory used by the index is bounded by the
+ * number of segments, not the size of the backlog. Replay reads one record at a time from the oldest
+ * segment in batches, and a batch is only removed from the outbox once it is committed, i.e. after
+ * the broker acknowledged every message in it. Replay is at-least-once: a batch that was read but not
+ * committed before a disconnect or a reboot is replayed again.
+ */
+class MqttOutbox {
+public:
+    class Config : public ConfigurationSection {
+    public:
+        /**
+         * @brief Number of segments in the ring, zero disables the outbox.
+         */
+        Property<size_t> segments { this, "segments", 4 };
+
+        /**
+         * @brief Maximum size of a single segment file in bytes.
+         */
+        Property<size_t> segmentSize { this, "segmentSize", 8192 };
+
+        /**
+         * @brief Maximum number of messages to replay in a single batch after reconnecting.
+         */
+        Property<size_t> replayBatchSize { this, "replayBatchSize", 8 };
+    };
+
+    struct Record {
+        std::string topic;
+        std::string payload;
+        uint8_t qos;
+        bool retain;
+    };
+
+    using RecordHandler = std::function<void(const Record&)>;
+
+    MqttOutbox(const std::shared_ptr<FileSystem>& fs, const std::shared_ptr<Config>& config)
+        : fs(fs)
+        , maxSegments(config->segments.get())
+        , segmentSize(config->segmentSize.get())
+        , replayBatchSize(config->replayBatchSize.get()) {
+        if (isEnabled()) {
+            fs->makeDir(DIRECTORY);
+            recover();
+        }
+    }
+
+    bool isEnabled() const {
+        return maxSegments > 0 && fs != nullptr;
+    }
+
+    bool isEmpty() const {
+        return depth == 0;
+    }
+
+    size_t getDepth() const {
+        return depth;
+    }
+
+    size_t getBytes() const {
+        return bytes;
+    }
+
+    size_t getReplayBatchSize() const {
+        return replayBatchSize;
+    }
+
+    /**
+     * @brief Append a message to the end of the outbox.
+     *
+     * @return Whether the message was stored.
+     */
+    bool append(std::string_view topic, std::string_view payload, uint8_t qos, bool retain) {
+        if (!isEnabled()) {
+            return false;
+        }
+        RecordHeader header {
+            .magic = RECORD_MAGIC,
+            .qos = qos,
+            .retain = static_cast<uint8_t>(retain ? 1 : 0),
+            .topicLength = static_cast<uint16_t>(topic.length()),
+            .payloadLength = static_cast<uint32_t>(payload.length()),
+        };
+        size_t recordSize = sizeof(RecordHeader) + topic.length() + payload.length();
+        if (topic.length() > UINT16_MAX || recordSize > segmentSize) {
+            LOGTW(OUTBOX, "Message to '%.*s' is too large to store (%zu bytes)",
+                static_cast<int>(topic.length()), topic.data(), recordSize);
+            dropped++;
+            return false;
+        }
+
+        if (segments.empty() || segments.back().sealed || segments.back().bytes + recordSize > segmentSize) {
+            startSegment();
+        }
+
+        auto& tail = segments.back();
+        size_t written = writeRecord(segmentPath(tail.id), header, topic, payload);
+        if (written != recordSize) {
+            LOGTE(OUTBOX, "Failed to append to segment %" PRIu32 " (%zu of %zu bytes written)",
+                tail.id, written, recordSize);
+            // Don't append any more to a segment that might have a torn record at the end
+            tail.sealed = true;
+            dropped++;
+            return false;
+        }
+        tail.bytes += recordSize;
+        tail.records++;
+        depth++;
+        bytes += recordSize;
+        return true;
+    }
+
+    /**
+     * @brief Read the next batch of messages from the head of the outbox without removing them.
+     *
+     * A batch never spans multiple segments. Call `commitBatch()` once all messages in the batch
+     * have been delivered, or `abortBatch()` to have them read again by the next batch.
+     * A corrupt record ends the batch, and the rest of its segment is dropped once the batch
+     * is committed, since the records after it cannot be located anymore.
+     *
+     * @return The number of records passed to the handler.
+     */
+    size_t readBatch(const RecordHandler& handler) {
+        abortBatch();
+        releaseConsumedSegments();
+        if (segments.empty() || depth == 0) {
+            return 0;
+        }
+        auto& head = segments.front();
+
+        FILE* file = fs->open(segmentPath(head.id), "r");
+        if (file == nullptr) {
+            LOGTE(OUTBOX, "Cannot open segment %" PRIu32 ", dropping it", head.id);
+            dropHead();
+            return 0;
+        }
+        size_t offset = head.readOffset;
+        if (fseek(file, static_cast<long>(offset), SEEK_SET) != 0) {
+            (void) fclose(file);
+            dropHead();
+            return 0;
+        }
+
+        size_t count = 0;
+        bool corrupt = false;
+        Record record;
+        while (count < replayBatchSize && head.readRecords + count < head.records) {
+            size_t recordSize = readRecord(file, record);
+            if (recordSize == 0) {
+                LOGTE(OUTBOX, "Corrupt record in segment %" PRIu32 " at offset %zu, dropping rest of segment",
+                    head.id, offset);
+                corrupt = true;
+                break;
+            }
+            handler(record);
+            offset += recordSize;
+            count++;
+        }
+        (void) fclose(file);
+
+        if (count == 0) {
+            dropHead();
+            return 0;
+        }
+        batch = { .records = count, .endOffset = offset, .dropsRestOfSegment = corrupt };
+        return count;
+    }
+
+    /**
+     * @brief Remove the last batch returned by `readBatch()` from the outbox.
+     */
+    void commitBatch() {
+        if (batch.records == 0 || segments.empty()) {
+            return;
+        }
+        auto& head = segments.front();
+        size_t batchBytes = batch.endOffset - head.readOffset;
+        head.readOffset = batch.endOffset;
+        head.readRecords += batch.records;
+        depth -= batch.records;
+        bytes -= batchBytes;
+        replayed += batch.records;
+        bool dropsRestOfSegment = batch.dropsRestOfSegment;
+        batch = {};
+        if (dropsRestOfSegment) {
+            dropHead();
+        } else {
+            releaseConsumedSegments();
+        }
+    }
+
+    void abortBatch() {
+        batch = {};
+    }
+
+    void populateTelemetry(JsonObject& json) {
+        auto now = steady_clock::now();
+        auto elapsed = duration_cast<milliseconds>(now - replayRateLastReported);
+        json["depth"] = depth.load();
+        json["bytes"] = bytes.load();
+        auto replayedSinceLastReport = replayed.exchange(0);
+        if (elapsed.count() > 0) {
+            json["replay-rate"] = static_cast<double>(replayedSinceLastReport) * 1000.0 / static_cast<double>(elapsed.count());
+        }
+        json["dropped"] = dropped.load();
+        replayRateLastReported = now;
+    }
+
+private:
+    static constexpr uint16_t RECORD_MAGIC = 0xFB01;
+    static constexpr const char* DIRECTORY = "/outbox";
+
+    struct __attribute__((packed)) RecordHeader {
+        uint16_t magic;
+        uint8_t qos;
+        uint8_t retain;
+        uint16_t topicLength;
+        uint32_t payloadLength;
+    };
+
+    struct Segment {
+        uint32_t id;
+        size_t bytes = 0;
+        size_t records = 0;
+        size_t readOffset = 0;
+        size_t readRecords = 0;
+        // Sealed segments are not appended to anymore
+        bool sealed = false;
+    };
+
+    struct Batch {
+        size_t records = 0;
+        size_t endOffset = 0;
+        // The batch ended at a corrupt record
+        bool dropsRestOfSegment = false;
+    };
+
+    static std::string segmentPath(uint32_t id) {
+        char name[16];
+        (void) snprintf(name, sizeof(name), "%08" PRIx32, id);
+        return std::string(DIRECTORY) + "/" + name;
+    }
+
+    size_t writeRecord(const std::string& path, const RecordHeader& header, std::string_view topic, std::string_view payload) const {
+        FILE* file = fs->open(path, "a");
+        if (file == nullptr) {
+            return 0;
+        }
+        size_t written = fwrite(&header, 1, sizeof(RecordHeader), file);
+        written += fwrite(topic.data(), 1, topic.length(), file);
+        written += fwrite(payload.data(), 1, payload.length(), file);
+        (void) fclose(file);
+        return written;
+    }
+
+    /**
+     * @brief Reads a single record from the current position of the file.
+     *
+     * @return The size of the record read, or zero if there is no valid record at the current position.
+     */
+    static size_t readRecord(FILE* file, Record& record) {
+        RecordHeader header {};
+        if (fread(&header, sizeof(RecordHeader), 1, file) != 1 || header.magic != RECORD_MAGIC) {
+            return 0;
+        }
+        record.topic.resize(header.topicLength);
+        record.payload.resize(header.payloadLength);
+        if (fread(record.topic.data(), 1, header.topicLength, file) != header.topicLength
+            || fread(record.payload.data(), 1, header.payloadLength, file) != header.payloadLength) {
+            return 0;
+        }
+        record.qos = header.qos;
+        record.retain = header.retain != 0;
+        return sizeof(RecordHeader) + header.topicLength + header.payloadLength;
+    }
+
+    /**
+     * @brief Walks the record headers in a segment to rebuild its metadata without loading payloads.
+     */
+    Segment scanSegment(uint32_t id) const {
+        Segment segment { .id = id };
+        FILE* file = fs->open(segmentPath(id), "r");
+        if (file == nullptr) {
+            segment.sealed = true;
+            return segment;
+        }
+        RecordHeader header {};
+        while (fread(&header, sizeof(RecordHeader), 1, file) == 1 && header.magic == RECORD_MAGIC) {
+            size_t bodySize = header.topicLength + header.payloadLength;
+            if (fseek(file, static_cast<long>(bodySize), SEEK_CUR) != 0) {
+                break;
+            }
+            segment.bytes += sizeof(RecordHeader) + bodySize;
+            segment.records++;
+        }
+        long end = (fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+        (void) fclose(file);
+        if (end < 0 || static_cast<size_t>(end) != segment.bytes) {
+            LOGTW(OUTBOX, "Segment %" PRIu32 " has a torn record at the end, ignoring %ld bytes",
+                id, end - static_cast<long>(segment.bytes));
+            segment.sealed = true;
+        }
+        return segment;
+    }
+
+    void recover() {
+        std::deque<uint32_t> ids;
+        fs->readDir(DIRECTORY, [&](const std::string& name, size_t /*size*/) {
+            char* end = nullptr;
+            auto id = static_cast<uint32_t>(strtoul(name.c_str(), &end, 16));
+            if (end == nullptr || *end != '\0' || name.empty()) {
+                return;
+            }
+            ids.insert(std::upper_bound(ids.begin(), ids.end(), id), id);
+        });
+
+        for (auto id : ids) {
+            auto segment = scanSegment(id);
+            if (segment.records == 0) {
+                fs->remove(segmentPath(id));
+                continue;
+            }
+            depth += segment.records;
+            bytes += segment.bytes;
+            segments.push_back(segment);
+            nextSegmentId = id + 1;
+        }
+        while (segments.size() > maxSegments) {
+            dropHead();
+        }
+        if (depth > 0) {
+            LOGTI(OUTBOX, "Recovered %zu messages (%zu bytes) in %zu segments",
+                depth.load(), bytes.load(), segments.size());
+        }
+    }
+
+    /**
+     * @brief Remove fully replayed segments from the head, except for the segment we are still appending to.
+     */
+    void releaseConsumedSegments() {
+        while (!segments.empty()) {
+            auto& head = segments.front();
+            if (head.readRecords < head.records || (!head.sealed && segments.size() == 1)) {
+                break;
+            }
+            fs->remove(segmentPath(head.id));
+            segments.pop_front();
+        }
+    }
+
+    void startSegment() {
+        if (!segments.empty()) {
+            segments.back().sealed = true;
+            releaseConsumedSegments();
+        }
+        while (segments.size() >= maxSegments) {
+            LOGTW(OUTBOX, "Outbox full, dropping oldest segment");
+            dropHead();
+        }
+        segments.push_back(Segment { .id = nextSegmentId++ });
+        // Make sure we don't append to a left-over file
+        fs->remove(segmentPath(segments.back().id));
+    }
+
+    void dropHead() {
+        if (segments.empty()) {
+            return;
+        }
+        abortBatch();
+        auto& head = segments.front();
+        size_t remainingRecords = head.records - head.readRecords;
+        depth -= remainingRecords;
+        bytes -= head.bytes - head.readOffset;
+        dropped += remainingRecords;
+        fs->remove(segmentPath(head.id));
+        segments.pop_front();
+    }
+
+    const std::shared_ptr<FileSystem> fs;
+    const size_t maxSegments;
+    const size_t segmentSize;
+    const size_t replayBatchSize;
+
+    std::deque<Segment> segments;
+    uint32_t nextSegmentId = 0;
+    Batch batch;
+
+    std::atomic<size_t> depth = 0;
+    std::atomic<size_t> bytes = 0;
+    std::atomic<size_t> dropped = 0;
+    std::atomic<size_t> replayed = 0;
+    steady_clock::time_point replayRateLastReported = steady_clock::now();
+};
+
+}    // namespace farmhub::kernel::mqtt
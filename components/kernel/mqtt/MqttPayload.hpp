@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include <Concurrent.hpp>
+#include <mqtt/MqttEncoding.hpp>
+
+namespace farmhub::kernel::mqtt {
+
+/**
+ * @brief Takes back buffers handed out in an `MqttPayload`.
+ */
+class MqttBufferOwner {
+public:
+    virtual ~MqttBufferOwner() = default;
+
+    virtual void release(char* buffer, size_t capacity) = 0;
+};
+
+/**
+ * @brief Owns a buffer holding a serialized MQTT payload.
+ *
+ * The buffer is returned to the pool it was taken from when the payload is destroyed,
+ * so ownership should be moved, not copied, until the payload is handed to the MQTT client.
+ */
+class MqttPayload {
+public:
+    MqttPayload() = default;
+
+    MqttPayload(MqttPayload&& other) noexcept
+        : owner(std::exchange(other.owner, nullptr))
+        , buffer(std::exchange(other.buffer, nullptr))
+        , bufferCapacity(std::exchange(other.bufferCapacity, 0))
+        , length(std::exchange(other.length, 0)) {
+    }
+
+    MqttPayload& operator=(MqttPayload&& other) noexcept {
+        if (this != &other) {
+            release();
+            owner = std::exchange(other.owner, nullptr);
+            buffer = std::exchange(other.buffer, nullptr);
+            bufferCapacity = std::exchange(other.bufferCapacity, 0);
+            length = std::exchange(other.length, 0);
+        }
+        return *this;
+    }
+
+    MqttPayload(const MqttPayload&) = delete;
+    MqttPayload& operator=(const MqttPayload&) = delete;
+
+    ~MqttPayload() {
+        release();
+    }
+
+    const char* data() const {
+        return buffer == nullptr ? "" : buffer;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    bool empty() const {
+        return length == 0;
+    }
+
+    size_t capacity() const {
+        return bufferCapacity;
+    }
+
+    std::string_view view() const {
+        return { data(), length };
+    }
+
+    /**
+     * @brief Append data to the end of the payload, keeping it null-terminated if there is room.
+     *
+     * @return Whether the data fit in the buffer.
+     */
+    bool append(const char* data, size_t size) {
+        if (length + size > bufferCapacity) {
+            return false;
+        }
+        memcpy(buffer + length, data, size);
+        length += size;
+        if (length < bufferCapacity) {
+            buffer[length] = '\0';
+        }
+        return true;
+    }
+
+private:
+    MqttPayload(MqttBufferOwner* owner, char* buffer, size_t capacity)
+        : owner(owner)
+        , buffer(buffer)
+        , bufferCapacity(capacity) {
+    }
+
+    void release() {
+        if (buffer == nullptr) {
+            return;
+        }
+        if (owner != nullptr) {
+            owner->release(buffer, bufferCapacity);
+        } else {
+            delete[] buffer;
+        }
+        buffer = nullptr;
+        length = 0;
+    }
+
+    MqttBufferOwner* owner = nullptr;
+    char* buffer = nullptr;
+    size_t bufferCapacity = 0;
+    size_t length = 0;
+
+    friend class MqttPayloadPool;
+    friend class MqttSizeClassPool;
+};
+
+/**
+ * @brief Fixed set of preallocated payload buffers.
+ *
+ * Payloads are serialized straight into a pooled buffer of the measured size. When the payload
+ * does not fit in a pooled buffer, or all buffers are in use, a buffer is allocated on the heap instead.
+ */
+class MqttPayloadPool : public MqttBufferOwner {
+public:
+    MqttPayloadPool(size_t bufferCount, size_t bufferSize)
+        : bufferCount(bufferCount)
+        , bufferSize(bufferSize)
+        , storage(std::make_unique<char[]>(bufferCount * bufferSize))
+        , freeBuffers("mqtt-payloads", std::max<size_t>(bufferCount, 1)) {
+        for (size_t i = 0; i < bufferCount; i++) {
+            freeBuffers.offer(storage.get() + i * bufferSize);
+        }
+    }
+
+    /**
+     * @brief Serialize the JSON document into a buffer of exactly the required size.
+     */
+    MqttPayload serialize(const JsonDocument& json, MqttEncoding encoding = MqttEncoding::Json) {
+        switch (encoding) {
+            case MqttEncoding::MsgPack: {
+                auto payload = acquire(measureMsgPack(json));
+                payload.length = serializeMsgPack(json, payload.buffer, payload.bufferCapacity);
+                return payload;
+            }
+            case MqttEncoding::MsgPackWithKeys: {
+                auto payload = acquire(measureMsgPackWithKeys(json));
+                payload.length = serializeMsgPackWithKeys(json, payload.buffer, payload.bufferCapacity);
+                return payload;
+            }
+            default: {
+                // Leave room for the null terminator
+                auto payload = acquire(measureJson(json) + 1);
+                payload.length = serializeJson(json, payload.buffer, payload.bufferCapacity);
+                return payload;
+            }
+        }
+    }
+
+    /**
+     * @brief Number of payloads that had to be allocated on the heap.
+     */
+    size_t getFallbacks() const {
+        return fallbacks;
+    }
+
+    /**
+     * @brief Bytes permanently allocated for the buffers.
+     */
+    size_t getFootprint() const {
+        return bufferCount * bufferSize;
+    }
+
+    void release(char* buffer, size_t /*capacity*/) override {
+        freeBuffers.offer(buffer);
+    }
+
+private:
+    MqttPayload acquire(size_t size) {
+        if (size <= bufferSize) {
+            auto buffer = freeBuffers.poll();
+            if (buffer.has_value()) {
+                return { this, buffer.value(), bufferSize };
+            }
+        }
+        fallbacks++;
+        return { nullptr, new char[size], size };
+    }
+
+    const size_t bufferCount;
+    const size_t bufferSize;
+    const std::unique_ptr<char[]> storage;
+    CopyQueue<char*> freeBuffers;
+    std::atomic<size_t> fallbacks = 0;
+};
+
+/**
+ * @brief Buffers in power-of-two size classes, allocated on first use and kept for reuse.
+ *
+ * Reusing buffers of the same few sizes keeps large, short-lived payloads from fragmenting the heap.
+ */
+class MqttSizeClassPool : public MqttBufferOwner {
+public:
+    MqttSizeClassPool(size_t maxSize, size_t cachedPerClass)
+        : cachedPerClass(cachedPerClass) {
+        for (size_t size = MIN_CLASS_SIZE; size / 2 < maxSize; size *= 2) {
+            classes.emplace_back(size);
+            classes.back().freeBuffers.reserve(cachedPerClass);
+        }
+    }
+
+    ~MqttSizeClassPool() override {
+        for (auto& sizeClass : classes) {
+            for (auto* buffer : sizeClass.freeBuffers) {
+                delete[] buffer;
+            }
+        }
+    }
+
+    /**
+     * @brief Get an empty payload with room for at least the given number of bytes.
+     */
+    MqttPayload acquire(size_t size) {
+        for (auto& sizeClass : classes) {
+            if (size > sizeClass.size) {
+                continue;
+            }
+            {
+                Lock lock(mutex);
+                if (!sizeClass.freeBuffers.empty()) {
+                    auto* buffer = sizeClass.freeBuffers.back();
+                    sizeClass.freeBuffers.pop_back();
+                    return { this, buffer, sizeClass.size };
+                }
+            }
+            return { this, new char[sizeClass.size], sizeClass.size };
+        }
+        return { nullptr, new char[size], size };
+    }
+
+    void release(char* buffer, size_t capacity) override {
+        {
+            Lock lock(mutex);
+            for (auto& sizeClass : classes) {
+                if (sizeClass.size == capacity && sizeClass.freeBuffers.size() < cachedPerClass) {
+                    sizeClass.freeBuffers.push_back(buffer);
+                    return;
+                }
+            }
+        }
+        delete[] buffer;
+    }
+
+private:
+    static constexpr size_t MIN_CLASS_SIZE = 256;
+
+    struct SizeClass {
+        explicit SizeClass(size_t size)
+            : size(size) {
+        }
+
+        const size_t size;
+        std::vector<char*> freeBuffers;
+    };
+
+    const size_t cachedPerClass;
+    Mutex mutex;
+    std::vector<SizeClass> classes;
+};
+
+}    // namespace farmhub::kernel::mqtt
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <ArduinoJson.h>
+
+#include <Concurrent.hpp>
+#include <Configuration.hpp>
+#include <Log.hpp>
+#include <mqtt/MqttPayload.hpp>
+
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace farmhub::kernel::mqtt {
+
+LOGGING_TAG(MQTT_INCOMING, "mqtt:incoming")
+
+/**
+ * @brief A complete incoming message with its payload in a pooled buffer.
+ */
+struct MqttIncomingMessage {
+    std::string topic;
+    MqttPayload payload;
+};
+
+/**
+ * @brief Puts incoming messages larger than the MQTT client's receive buffer back together.
+ *
+ * The client delivers such messages in consecutive fragments, only the first of which carries
+ * the topic. Fragments are copied into a buffer from a size-classed pool as they arrive, and the
+ * message is returned once the last fragment is in. Fragments must be fed from the MQTT client's
+ * event handler only; messages whose next fragment is overdue can be expired from any task.
+ */
+class MqttReassembler {
+public:
+    class Config : public ConfigurationSection {
+    public:
+        /**
+         * @brief Largest incoming message accepted, in bytes; larger messages are dropped.
+         */
+        Property<size_t> maxMessageSize { this, "maxMessageSize", 32768 };
+
+        /**
+         * @brief How long to wait for the next fragment of a message before giving up on it.
+         */
+        Property<milliseconds> fragmentTimeout { this, "fragmentTimeout", 5000ms };
+
+        /**
+         * @brief Number of free buffers kept for reuse in each size class.
+         */
+        Property<size_t> cachedBuffers { this, "cachedBuffers", 2 };
+    };
+
+    explicit MqttReassembler(const std::shared_ptr<Config>& config)
+        : maxMessageSize(config->maxMessageSize.get())
+        , fragmentTimeout(config->fragmentTimeout.get())
+        // Leave room for the null terminator
+        , buffers(maxMessageSize + 1, config->cachedBuffers.get()) {
+    }
+
+    /**
+     * @brief Feed a fragment of an incoming message.
+     *
+     * @param topic the topic of the message; only present in the first fragment.
+     * @param offset the position of the fragment within the whole message.
+     * @param totalLength the length of the whole message.
+     * @return The whole message once its last fragment has arrived.
+     */
+    std::optional<MqttIncomingMessage> onData(std::string_view topic, const char* data, size_t length, size_t offset, size_t totalLength, steady_clock::time_point now = steady_clock::now()) {
+        Lock lock(partialMutex);
+        if (offset == 0) {
+            if (partial.has_value()) {
+                LOGTW(MQTT_INCOMING, "Abandoning incomplete message on '%s' (received %zu of %zu bytes)",
+                    partial->message.topic.c_str(), partial->message.payload.size(), partial->totalLength);
+                timeouts++;
+                partial.reset();
+            }
+            skipping = false;
+            if (totalLength > maxMessageSize) {
+                LOGTW(MQTT_INCOMING, "Dropping message of %zu bytes on '%.*s', maximum is %zu bytes",
+                    totalLength, static_cast<int>(topic.length()), topic.data(), maxMessageSize);
+                oversized++;
+                skipping = length < totalLength;
+                return std::nullopt;
+            }
+            if (length == totalLength) {
+                auto payload = buffers.acquire(length + 1);
+                payload.append(data, length);
+                return MqttIncomingMessage { .topic = std::string(topic), .payload = std::move(payload) };
+            }
+            partial.emplace(std::string(topic), buffers.acquire(totalLength + 1), totalLength, now);
+        } else if (!partial.has_value()) {
+            // Rest of an oversized or abandoned message
+            if (!skipping) {
+                LOGTD(MQTT_INCOMING, "Ignoring fragment at offset %zu without a message in progress",
+                    offset);
+            }
+            return std::nullopt;
+        } else if (offset != partial->message.payload.size() || totalLength != partial->totalLength) {
+            LOGTW(MQTT_INCOMING, "Unexpected fragment at offset %zu of %zu bytes on '%s', expected offset %zu of %zu bytes",
+                offset, totalLength, partial->message.topic.c_str(), partial->message.payload.size(), partial->totalLength);
+            outOfOrder++;
+            partial.reset();
+            return std::nullopt;
+        } else if (now - partial->lastFragmentAt > fragmentTimeout) {
+            LOGTW(MQTT_INCOMING, "Timed out waiting for fragment at offset %zu on '%s'",
+                offset, partial->message.topic.c_str());
+            timeouts++;
+            partial.reset();
+            return std::nullopt;
+        }
+
+        if (!partial->message.payload.append(data, length)) {
+            // Cannot happen with consistent lengths, but never write past the buffer
+            outOfOrder++;
+            partial.reset();
+            return std::nullopt;
+        }
+        partial->lastFragmentAt = now;
+        if (partial->message.payload.size() < partial->totalLength) {
+            return std::nullopt;
+        }
+
+        reassembled++;
+        auto message = std::move(partial->message);
+        partial.reset();
+        return message;
+    }
+
+    /**
+     * @brief Drop the message in progress, e.g. when the connection is lost.
+     */
+    void reset() {
+        Lock lock(partialMutex);
+        if (partial.has_value()) {
+            timeouts++;
+            partial.reset();
+        }
+        skipping = false;
+    }
+
+    /**
+     * @brief Drop the message in progress if its next fragment is overdue.
+     *
+     * Otherwise an abandoned message would hold on to its buffer until the next message arrives.
+     */
+    void expireStale(steady_clock::time_point now = steady_clock::now()) {
+        Lock lock(partialMutex);
+        if (partial.has_value() && now - partial->lastFragmentAt > fragmentTimeout) {
+            LOGTW(MQTT_INCOMING, "Timed out waiting for fragment at offset %zu on '%s'",
+                partial->message.payload.size(), partial->message.topic.c_str());
+            timeouts++;
+            partial.reset();
+            // Ignore the rest of the message should it arrive after all
+            skipping = true;
+        }
+    }
+
+    size_t getReassembled() const {
+        return reassembled;
+    }
+
+    size_t getTimeouts() const {
+        return timeouts;
+    }
+
+    size_t getOversized() const {
+        return oversized;
+    }
+
+    size_t getOutOfOrder() const {
+        return outOfOrder;
+    }
+
+    void populateTelemetry(JsonObject& json) const {
+        json["reassembled"] = reassembled.load();
+        json["timeouts"] = timeouts.load();
+        json["oversized"] = oversized.load();
+        json["out-of-order"] = outOfOrder.load();
+    }
+
+private:
+    struct PartialMessage {
+        PartialMessage(std::string topic, MqttPayload payload, size_t totalLength, steady_clock::time_point now)
+            : message { .topic = std::move(topic), .payload = std::move(payload) }
+            , totalLength(totalLength)
+            , lastFragmentAt(now) {
+        }
+
+        MqttIncomingMessage message;
+        const size_t totalLength;
+        steady_clock::time_point lastFragmentAt;
+    };
+
+    const size_t maxMessageSize;
+    const milliseconds fragmentTimeout;
+    MqttSizeClassPool buffers;
+
+    Mutex partialMutex;
+    std::optional<PartialMessage> partial;
+    // Set while the remaining fragments of a dropped message are arriving
+    bool skipping = false;
+
+    std::atomic<size_t> reassembled = 0;
+    std::atomic<size_t> timeouts = 0;
+    std::atomic<size_t> oversized = 0;
+    std::atomic<size_t> outOfOrder = 0;
+};
+
+}    // namespace farmhub::kernel::mqtt
@@ -2,6 +2,7 @@
 
 #include <chrono>
 #include <memory>
+#include <string_view>
 #include <unordered_map>
 
 #include <mqtt/MqttDriver.hpp>
@@ -17,17 +18,17 @@ public:
         const std::string commandsTopic = fullTopic("commands/#");
         const auto commandsPrefixLength = commandsTopic.length() - 1;
         mqtt->subscribe(commandsTopic, QoS::ExactlyOnce, [this, commandsPrefixLength](const std::string& topic, const JsonObject& request) {
-            std::string command = topic.substr(commandsPrefixLength);
+            std::string_view command = std::string_view(topic).substr(commandsPrefixLength);
             auto it = commandHandlers.find(command);
             if (it != commandHandlers.end()) {
                 JsonDocument responseDoc;
                 auto response = responseDoc.to<JsonObject>();
-                it->second(request, response);
+                it->second.handler(request, response);
                 if (response.size() > 0) {
-                    publish("responses/" + command, responseDoc, Retention::NoRetain, QoS::ExactlyOnce);
+                    publish(it->second.responseTopic, responseDoc, Retention::NoRetain, QoS::ExactlyOnce);
                 }
             } else {
-                LOGTE(MQTT, "Unknown command: %s", command.c_str());
+                LOGTE(MQTT, "Unknown command: %.*s", static_cast<int>(command.length()), command.data());
             }
         });
     }
@@ -36,46 +37,132 @@ public:
         return std::make_shared<MqttRoot>(mqtt, rootTopic + "/" + suffix);
     }
 
-    PublishStatus publish(const std::string& suffix, const JsonDocument& json, Retention retain = Retention::NoRetain, QoS qos = QoS::AtMostOnce, ticks timeout = MqttDriver::MQTT_NETWORK_TIMEOUT, LogPublish log = LogPublish::Log) {
-        return mqtt->publish(fullTopic(suffix), json, retain, qos, timeout, log);
+    /**
+     * @brief Registers the given topic under the topic prefix.
+     *
+     * The full topic name is only built and allocated the first time a suffix is registered;
+     * publishing to the returned handle doesn't need to build it again.
+     * Registered topics are kept for good, so only register topics with a fixed suffix.
+     */
+    MqttTopic topic(std::string_view suffix) {
+        Lock lock(topicsMutex);
+        auto it = topics.find(suffix);
+        if (it == topics.end()) {
+            it = topics.emplace(suffix, mqtt->internTopic(fullTopic(suffix))).first;
+        }
+        return it->second;
+    }
+
+    /**
+     * @brief The topic under the topic prefix, without registering it if it is not registered yet.
+     */
+    MqttTopic transientTopic(std::string_view suffix) {
+        Lock lock(topicsMutex);
+        auto it = topics.find(suffix);
+        if (it != topics.end()) {
+            return it->second;
+        }
+        return MqttTopic::transient(fullTopic(suffix));
+    }
+
+    PublishStatus publish(const MqttTopic& topic, const JsonDocument& json, Retention retain = Retention::NoRetain, QoS qos = QoS::AtMostOnce, ticks timeout = MqttDriver::MQTT_NETWORK_TIMEOUT, LogPublish log = LogPublish::Log) {
+        return mqtt->publish(topic, json, retain, qos, timeout, log);
+    }
+
+    PublishStatus publish(const MqttTopic& topic, const std::function<void(JsonObject&)>& populate, Retention retain = Retention::NoRetain, QoS qos = QoS::AtMostOnce, ticks timeout = MqttDriver::MQTT_NETWORK_TIMEOUT, LogPublish log = LogPublish::Log) {
+        JsonDocument doc;
+        JsonObject root = doc.to<JsonObject>();
+        populate(root);
+        return publish(topic, doc, retain, qos, timeout, log);
+    }
+
+    PublishStatus publish(std::string_view suffix, const JsonDocument& json, Retention retain = Retention::NoRetain, QoS qos = QoS::AtMostOnce, ticks timeout = MqttDriver::MQTT_NETWORK_TIMEOUT, LogPublish log = LogPublish::Log) {
+        return publish(transientTopic(suffix), json, retain, qos, timeout, log);
+    }
+
+    PublishStatus publish(std::string_view suffix, const std::function<void(JsonObject&)>& populate, Retention retain = Retention::NoRetain, QoS qos = QoS::AtMostOnce, ticks timeout = MqttDriver::MQTT_NETWORK_TIMEOUT, LogPublish log = LogPublish::Log) {
+        return publish(transientTopic(suffix), populate, retain, qos, timeout, log);
     }
 
-    PublishStatus publish(const std::string& suffix, const std::function<void(JsonObject&)>& populate, Retention retain = Retention::NoRetain, QoS qos = QoS::AtMostOnce, ticks timeout = MqttDriver::MQTT_NETWORK_TIMEOUT, LogPublish log = LogPublish::Log) {
+    /**
+     * @brief Publishes telemetry in the encoding configured for the device.
+     */
+    PublishStatus publishTelemetry(const MqttTopic& topic, const std::function<void(JsonObject&)>& populate, Retention retain = Retention::NoRetain, QoS qos = QoS::AtMostOnce, ticks timeout = MqttDriver::MQTT_NETWORK_TIMEOUT) {
         JsonDocument doc;
         JsonObject root = doc.to<JsonObject>();
         populate(root);
-        return publish(suffix, doc, retain, qos, timeout, log);
+        return mqtt->publish(topic, doc, retain, qos, timeout, LogPublish::Log, mqtt->getTelemetryEncoding());
     }
 
-    PublishStatus clear(const std::string& suffix, Retention retain = Retention::NoRetain, QoS qos = QoS::AtMostOnce, ticks timeout = MqttDriver::MQTT_NETWORK_TIMEOUT) {
-        return mqtt->clear(fullTopic(suffix), retain, qos, timeout);
+    MqttEncoding getTelemetryEncoding() const {
+        return mqtt->getTelemetryEncoding();
+    }
+
+    uint32_t getConnectionCount() const {
+        return mqtt->getConnectionCount();
+    }
+
+    PublishStatus clear(std::string_view suffix, Retention retain = Retention::NoRetain, QoS qos = QoS::AtMostOnce, ticks timeout = MqttDriver::MQTT_NETWORK_TIMEOUT) {
+        return mqtt->clear(transientTopic(suffix), retain, qos, timeout);
     }
 
     bool subscribe(const std::string& suffix, SubscriptionHandler handler) {
         return subscribe(suffix, QoS::ExactlyOnce, std::move(handler));
     }
 
+    void populateTelemetry(JsonObject& json) {
+        mqtt->populateTelemetry(json);
+    }
+
+    size_t getFootprint() const {
+        return mqtt->getFootprint();
+    }
+
+    /**
+     * @brief Registers a handler for `commands/<name>`, responding on `responses/<name>`.
+     *
+     * Both topics are registered, so handling a command or clearing it does not build them again.
+     */
     void registerCommand(const std::string& name, const CommandHandler& handler) {
-        commandHandlers.emplace(name, handler);
+        (void) topic("commands/" + name);
+        commandHandlers.emplace(name, RegisteredCommand { handler, topic("responses/" + name) });
     }
 
     /**
      * @brief Subscribes to the given topic under the topic prefix.
      *
-     * Note that subscription does not support wildcards.
+     * The topic can contain `+` and `#` wildcards. Messages matching multiple subscriptions
+     * are delivered to each of them.
      */
     bool subscribe(const std::string& suffix, QoS qos, SubscriptionHandler handler) {
         return mqtt->subscribe(fullTopic(suffix), qos, std::move(handler));
     }
 
+    /**
+     * @brief Removes all subscriptions to the given topic under the topic prefix.
+     */
+    bool unsubscribe(const std::string& suffix) {
+        return mqtt->unsubscribe(fullTopic(suffix));
+    }
+
 private:
-    std::string fullTopic(const std::string& suffix) const {
-        return rootTopic + "/" + suffix;
+    struct RegisteredCommand {
+        const CommandHandler handler;
+        const MqttTopic responseTopic;
+    };
+
+    std::string fullTopic(std::string_view suffix) const {
+        std::string topic;
+        topic.reserve(rootTopic.length() + 1 + suffix.length());
+        topic.append(rootTopic).append("/").append(suffix);
+        return topic;
     }
 
     const std::shared_ptr<MqttDriver> mqtt;
     const std::string rootTopic;
-    std::unordered_map<std::string, CommandHandler> commandHandlers;
+    Mutex topicsMutex;
+    std::unordered_map<std::string, MqttTopic, StringViewHash, std::equal_to<>> topics;
+    std::unordered_map<std::string, RegisteredCommand, StringViewHash, std::equal_to<>> commandHandlers;
 };
 
 }    // namespace farmhub::kernel::mqtt
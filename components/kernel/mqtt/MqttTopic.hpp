@@ -0,0 +1,90 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+
+#include <Concurrent.hpp>
+
+namespace farmhub::kernel::mqtt {
+
+/**
+ * @brief Hash for looking up `std::string` keys via `std::string_view` without creating a temporary string.
+ */
+struct StringViewHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view value) const {
+        return std::hash<std::string_view> {}(value);
+    }
+};
+
+/**
+ * @brief Handle to a topic name, either interned in a `MqttTopicRegistry`, or owned by the handle.
+ *
+ * Handles are cheap to copy. Interned names live as long as the registry; transient names,
+ * used for topics published only once or with a dynamic suffix, live as long as the last copy of the handle.
+ */
+class MqttTopic {
+public:
+    /**
+     * @brief A topic that is not interned, so it does not stay in memory after it has been published.
+     */
+    static MqttTopic transient(std::string name) {
+        auto owned = std::make_shared<const std::string>(std::move(name));
+        const auto* pointer = owned.get();
+        return MqttTopic(pointer, std::move(owned));
+    }
+
+    const std::string& str() const {
+        return *name;
+    }
+
+    const char* c_str() const {
+        return name->c_str();
+    }
+
+    bool operator==(const MqttTopic& other) const {
+        // Interned names are unique, so comparing addresses is enough unless one of them is transient
+        return name == other.name || ((owned != nullptr || other.owned != nullptr) && *name == *other.name);
+    }
+
+private:
+    explicit MqttTopic(const std::string* name, std::shared_ptr<const std::string> owned = nullptr)
+        : name(name)
+        , owned(std::move(owned)) {
+    }
+
+    const std::string* name;
+    std::shared_ptr<const std::string> owned;
+
+    friend class MqttTopicRegistry;
+};
+
+/**
+ * @brief Interns topic names so each one is only allocated once, when it is first registered.
+ *
+ * Interned names are never released, so only intern topics from a fixed set, like the ones
+ * registered at startup; use `MqttTopic::transient()` for the rest.
+ */
+class MqttTopicRegistry {
+public:
+    MqttTopic intern(std::string_view topic) {
+        Lock lock(mutex);
+        auto it = topics.find(topic);
+        if (it == topics.end()) {
+            it = topics.emplace(topic).first;
+        }
+        // Elements of an unordered_set are never moved, so it's safe to hand out their address
+        return MqttTopic(&*it);
+    }
+
+private:
+    Mutex mutex;
+    std::unordered_set<std::string, StringViewHash, std::equal_to<>> topics;
+};
+
+}    // namespace farmhub::kernel::mqtt
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <mqtt/MqttTopic.hpp>
+
+namespace farmhub::kernel::mqtt {
+
+/**
+ * @brief Checks whether a single topic matches a single subscription pattern.
+ *
+ * Prefer `MqttTopicTrie` when matching a topic against many patterns.
+ */
+inline bool topicMatches(const char* pattern, const char* topic) {
+    const char* pat_ptr = pattern;
+    const char* top_ptr = topic;
+
+    while ((*pat_ptr != 0) && (*top_ptr != 0)) {
+        // Extract pattern level
+        const char* pat_end = strchr(pat_ptr, '/');
+        size_t pat_len = (pat_end != nullptr) ? static_cast<size_t>(pat_end - pat_ptr) : strlen(pat_ptr);
+
+        // Extract topic level
+        const char* top_end = strchr(top_ptr, '/');
+        size_t top_len = (top_end != nullptr) ? static_cast<size_t>(top_end - top_ptr) : strlen(top_ptr);
+
+        // Handle wildcard +
+        if (strncmp(pat_ptr, "+", pat_len) == 0) {
+            // Match any single level, so just advance
+        } else if (strncmp(pat_ptr, "#", pat_len) == 0) {
+            // # must be at the end of the pattern
+            return *(pat_ptr + pat_len) == '\0';
+        } else {
+            // Compare level literally
+            if (pat_len != top_len || strncmp(pat_ptr, top_ptr, pat_len) != 0) {
+                return false;
+            }
+        }
+
+        // Move to next level
+        if (pat_end != nullptr) {
+            pat_ptr = pat_end + 1;
+        } else {
+            pat_ptr += pat_len;
+        }
+
+        if (top_end != nullptr) {
+            top_ptr = top_end + 1;
+        } else {
+            top_ptr += top_len;
+        }
+    }
+
+    // Handle cases like pattern: "foo/#", topic: "foo"
+    if (*pat_ptr == '#' && *(pat_ptr + 1) == '\0') {
+        return true;
+    }
+
+    return *pat_ptr == '\0' && *top_ptr == '\0';
+}
+
+/**
+ * @brief Subscription patterns indexed by topic level, supporting the `+` and `#` wildcards.
+ *
+ * Matching a topic takes time proportional to the number of levels in the topic
+ * (plus the number of wildcard branches taken), regardless of how many patterns are stored.
+ * Every value whose pattern matches is returned, not only the first one.
+ */
+template <typename T>
+class MqttTopicTrie {
+public:
+    /**
+     * @brief Adds a value under the given pattern. The same pattern can hold multiple values.
+     */
+    void insert(std::string_view pattern, T value) {
+        Node* node = &root;
+        forEachLevel(pattern, [&](std::string_view level) {
+            auto it = node->children.find(level);
+            if (it == node->children.end()) {
+                it = node->children.emplace(level, std::make_unique<Node>()).first;
+            }
+            node = it->second.get();
+        });
+        if (node->values.empty()) {
+            node->pattern = pattern;
+            patternCount++;
+        }
+        node->values.push_back(std::move(value));
+    }
+
+    /**
+     * @brief Removes all values stored under the given pattern.
+     *
+     * @return Whether anything was removed.
+     */
+    bool remove(std::string_view pattern) {
+        std::vector<Node*> path { &root };
+        bool found = true;
+        forEachLevel(pattern, [&](std::string_view level) {
+            if (!found) {
+                return;
+            }
+            auto& children = path.back()->children;
+            auto it = children.find(level);
+            if (it == children.end()) {
+                found = false;
+                return;
+            }
+            path.push_back(it->second.get());
+        });
+        if (!found || path.back()->values.empty()) {
+            return false;
+        }
+        path.back()->values.clear();
+        path.back()->pattern.clear();
+        patternCount--;
+
+        // Prune nodes that no longer lead anywhere
+        for (size_t i = path.size() - 1; i > 0; i--) {
+            Node* node = path[i];
+            if (!node->values.empty() || !node->children.empty()) {
+                break;
+            }
+            auto& siblings = path[i - 1]->children;
+            for (auto it = siblings.begin(); it != siblings.end(); ++it) {
+                if (it->second.get() == node) {
+                    siblings.erase(it);
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Calls the visitor with every value whose pattern matches the topic.
+     *
+     * @return The number of matching values.
+     */
+    size_t match(std::string_view topic, const std::function<void(const T&)>& visitor) const {
+        // Wildcards in the first level must not match topics starting with '$'
+        bool system = !topic.empty() && topic.front() == '$';
+        return matchFrom(&root, topic, 0, system, visitor);
+    }
+
+    /**
+     * @brief Calls the visitor with each pattern and the values stored under it.
+     */
+    void forEach(const std::function<void(const std::string&, const std::vector<T>&)>& visitor) const {
+        forEachFrom(&root, visitor);
+    }
+
+    size_t size() const {
+        return patternCount;
+    }
+
+    bool empty() const {
+        return patternCount == 0;
+    }
+
+private:
+    struct Node {
+        std::unordered_map<std::string, std::unique_ptr<Node>, StringViewHash, std::equal_to<>> children;
+        std::vector<T> values;
+        std::string pattern;
+
+        const Node* child(std::string_view level) const {
+            auto it = children.find(level);
+            return it == children.end() ? nullptr : it->second.get();
+        }
+    };
+
+    template <typename F>
+    static void forEachLevel(std::string_view topic, F&& visitor) {
+        size_t start = 0;
+        while (true) {
+            size_t end = topic.find('/', start);
+            if (end == std::string_view::npos) {
+                visitor(topic.substr(start));
+                return;
+            }
+            visitor(topic.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    static size_t visitAll(const std::vector<T>& values, const std::function<void(const T&)>& visitor) {
+        for (const auto& value : values) {
+            visitor(value);
+        }
+        return values.size();
+    }
+
+    static size_t matchFrom(const Node* node, std::string_view topic, size_t start, bool system, const std::function<void(const T&)>& visitor) {
+        bool firstLevel = start == 0;
+        // '#' also matches the parent level, e.g. "a/#" matches "a"
+        size_t count = 0;
+        if (!(firstLevel && system)) {
+            if (const auto* multiLevel = node->child("#")) {
+                count += visitAll(multiLevel->values, visitor);
+            }
+        }
+        if (start > topic.length()) {
+            return count + visitAll(node->values, visitor);
+        }
+
+        size_t end = topic.find('/', start);
+        if (end == std::string_view::npos) {
+            end = topic.length();
+        }
+        std::string_view level = topic.substr(start, end - start);
+
+        if (const auto* literal = node->child(level)) {
+            count += matchFrom(literal, topic, end + 1, system, visitor);
+        }
+        if (!(firstLevel && system)) {
+            if (const auto* singleLevel = node->child("+")) {
+                count += matchFrom(singleLevel, topic, end + 1, system, visitor);
+            }
+        }
+        return count;
+    }
+
+    static void forEachFrom(const Node* node, const std::function<void(const std::string&, const std::vector<T>&)>& visitor) {
+        if (!node->values.empty()) {
+            visitor(node->pattern, node->values);
+        }
+        for (const auto& [level, child] : node->children) {
+            forEachFrom(child.get(), visitor);
+        }
+    }
+
+    Node root;
+    size_t patternCount = 0;
+};
+
+}    // namespace farmhub::kernel::mqtt
@@ -12,7 +12,9 @@ enum class PublishStatus : uint8_t {
     Success = 1,
     Failed = 2,
     Pending = 3,
-    QueueFull = 4
+    QueueFull = 4,
+    // Stored in the persistent outbox to be published after reconnecting
+    Deferred = 5
 };
 
 static constexpr uint32_t PUBLISH_SUCCESS = 1;
@@ -80,8 +82,11 @@ public:
     }
 
     static void notifyWaitingTask(TaskHandle_t task, bool success) {
+        notifyWaitingTask(task, success ? PublishStatus::Success : PublishStatus::Failed);
+    }
+
+    static void notifyWaitingTask(TaskHandle_t task, PublishStatus status) {
         if (task != nullptr) {
-            auto status = success ? PublishStatus::Success : PublishStatus::Failed;
             xTaskNotify(task, static_cast<int>(status), eSetValueWithOverwrite);
         }
     }
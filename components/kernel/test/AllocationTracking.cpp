@@ -0,0 +1,59 @@
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "AllocationTracking.hpp"
+
+std::atomic<bool> countAllocations = false;
+std::atomic<size_t> allocationCount = 0;
+std::atomic<size_t> allocatedBytes = 0;
+std::atomic<size_t> liveBytes = 0;
+std::atomic<size_t> peakBytes = 0;
+std::atomic<size_t> measurement = 0;
+
+namespace {
+
+// Each allocation is prefixed with the bytes counted for it and the measurement it was counted in,
+// so frees can be tracked too
+struct Header {
+    size_t counted;
+    size_t measurement;
+};
+
+constexpr size_t HEADER_SIZE = (sizeof(Header) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+}    // namespace
+
+void* operator new(size_t size) {
+    size_t counted = 0;
+    if (countAllocations) {
+        counted = size;
+        allocationCount++;
+        allocatedBytes += size;
+        auto live = liveBytes += size;
+        auto peak = peakBytes.load();
+        while (live > peak && !peakBytes.compare_exchange_weak(peak, live)) { }
+    }
+    auto* block = static_cast<unsigned char*>(malloc(HEADER_SIZE + size));
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<Header*>(block) = { counted, measurement };
+    return block + HEADER_SIZE;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto* block = static_cast<unsigned char*>(ptr) - HEADER_SIZE;
+    auto header = *reinterpret_cast<Header*>(block);
+    if (header.counted != 0 && header.measurement == measurement) {
+        liveBytes -= header.counted;
+    }
+    free(block);
+}
+
+void operator delete(void* ptr, size_t /*size*/) noexcept {
+    operator delete(ptr);
+}
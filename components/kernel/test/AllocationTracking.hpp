@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Every heap allocation in the test binary is counted, but only recorded while measuring
+extern std::atomic<bool> countAllocations;
+extern std::atomic<size_t> allocationCount;
+extern std::atomic<size_t> allocatedBytes;
+// Bytes allocated while measuring and not yet freed, and the most of them at any one time
+extern std::atomic<size_t> liveBytes;
+extern std::atomic<size_t> peakBytes;
+// Frees of blocks allocated during an earlier measurement are not counted
+extern std::atomic<size_t> measurement;
+
+struct AllocationStats {
+    size_t count;
+    size_t bytes;
+    size_t peakBytes;
+};
+
+template <typename F>
+AllocationStats measureAllocations(F&& action) {
+    measurement++;
+    allocationCount = 0;
+    allocatedBytes = 0;
+    liveBytes = 0;
+    peakBytes = 0;
+    countAllocations = true;
+    action();
+    countAllocations = false;
+    return { allocationCount, allocatedBytes, peakBytes };
+}
@@ -0,0 +1,288 @@
+#include <sdkconfig.h>
+
+// Needs a writable file system, see TemporaryFileSystem.hpp
+#if CONFIG_IDF_TARGET_LINUX
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <set>
+#include <string>
+
+#include <Configuration.hpp>
+
+#include <TemporaryFileSystem.hpp>
+
+using namespace farmhub::kernel;
+using namespace farmhub::test;
+
+namespace {
+
+struct TestConfig : ConfigurationSection {
+    Property<std::string> value { this, "value", "default" };
+};
+
+struct SimulatedCrash { };
+
+/**
+ * @brief Crashes right before the given write, remove or rename; a crashing write only writes half of its data.
+ */
+class CrashingFileSystem : public FileSystem {
+public:
+    CrashingFileSystem(const std::string& root, int crashAt)
+        : FileSystem(root)
+        , remaining(crashAt) {
+    }
+
+    size_t write(const std::string& path, const char* buffer, size_t size) const override {
+        if (shouldCrash()) {
+            FileSystem::write(path, buffer, size / 2);
+            throw SimulatedCrash();
+        }
+        return FileSystem::write(path, buffer, size);
+    }
+
+    size_t append(const std::string& path, const char* buffer, size_t size) const override {
+        if (shouldCrash()) {
+            FileSystem::append(path, buffer, size / 2);
+            throw SimulatedCrash();
+        }
+        return FileSystem::append(path, buffer, size);
+    }
+
+    int remove(const std::string& path) const override {
+        if (shouldCrash()) {
+            throw SimulatedCrash();
+        }
+        return FileSystem::remove(path);
+    }
+
+    int rename(const std::string& from, const std::string& to) const override {
+        if (shouldCrash()) {
+            throw SimulatedCrash();
+        }
+        return FileSystem::rename(from, to);
+    }
+
+    /**
+     * @brief Stop crashing, as the device would after it has restarted.
+     */
+    void disarm() {
+        remaining = -1;
+    }
+
+private:
+    bool shouldCrash() const {
+        return remaining-- == 0;
+    }
+
+    mutable int remaining;
+};
+
+constexpr const char* PATH = "/config.json";
+
+std::string boot(const std::shared_ptr<FileSystem>& fs) {
+    auto config = std::make_shared<TestConfig>();
+    ConfigurationFile<TestConfig> file(fs, PATH, config);
+    return config->value.get();
+}
+
+void update(const std::shared_ptr<FileSystem>& fs, const std::string& value) {
+    auto config = std::make_shared<TestConfig>();
+    ConfigurationFile<TestConfig> file(fs, PATH, config);
+    JsonDocument json;
+    json["value"] = value;
+    file.update(json.as<JsonObject>());
+}
+
+void bootAndStart(const std::shared_ptr<FileSystem>& fs) {
+    boot(fs);
+    ConfigurationJournal::confirmLoaded();
+}
+
+}    // namespace
+
+TEST_CASE("updates keep the previous contents until confirmed") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-journal-test");
+    fs->writeAll(PATH, R"({"value":"old"})");
+    bootAndStart(fs);
+
+    update(fs, "new");
+    REQUIRE(*fs->readAll(PATH) == R"({"value":"new"})");
+    REQUIRE(*fs->readAll("/config.json.prev") == R"({"value":"old"})");
+    REQUIRE(fs->exists("/config.json.pending"));
+    REQUIRE(!fs->exists("/config.json.new"));
+
+    REQUIRE(boot(fs) == "new");
+    ConfigurationJournal::confirmLoaded();
+    REQUIRE(!fs->exists("/config.json.pending"));
+    REQUIRE(!fs->exists("/config.json.tried"));
+
+    // Confirmed contents stay after any number of boots
+    REQUIRE(boot(fs) == "new");
+    REQUIRE(boot(fs) == "new");
+    REQUIRE(*fs->readAll("/config.json.prev") == R"({"value":"old"})");
+}
+
+TEST_CASE("updates are rolled back when the device does not start") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-journal-test");
+    fs->writeAll(PATH, R"({"value":"old"})");
+    bootAndStart(fs);
+
+    update(fs, "new");
+    // Crashes before reaching kernelReady
+    REQUIRE(boot(fs) == "new");
+    REQUIRE(boot(fs) == "old");
+    REQUIRE(!fs->exists("/config.json.pending"));
+    REQUIRE(!fs->exists("/config.json.tried"));
+    REQUIRE(boot(fs) == "old");
+}
+
+TEST_CASE("updates are rolled back when the device restarts before kernelReady") {
+    constexpr const char* FUNCTION_PATH = "/f/plot";
+    auto fs = std::make_shared<TemporaryFileSystem>("config-journal-test");
+    REQUIRE(fs->makeDir("/f"));
+    auto bootFunction = [&]() {
+        auto config = std::make_shared<TestConfig>();
+        ConfigurationFile<TestConfig> file(fs, FUNCTION_PATH, config);
+        return config->value.get();
+    };
+    fs->writeAll(PATH, R"({"value":"old"})");
+    fs->writeAll(FUNCTION_PATH, R"({"value":"old"})");
+
+    update(fs, "new");
+    ConfigurationJournal(fs, FUNCTION_PATH).write(R"({"value":"new"})");
+
+    // Loads the device configuration, then the function's as it is created,
+    // and restarts before reaching kernelReady, where the loaded contents are confirmed
+    REQUIRE(boot(fs) == "new");
+    REQUIRE(bootFunction() == "new");
+
+    REQUIRE(boot(fs) == "old");
+    REQUIRE(bootFunction() == "old");
+    ConfigurationJournal::confirmLoaded();
+    REQUIRE(!fs->exists("/config.json.pending"));
+    REQUIRE(!fs->exists("/f/plot.pending"));
+    REQUIRE(boot(fs) == "old");
+    REQUIRE(bootFunction() == "old");
+}
+
+TEST_CASE("updates not yet confirmed are replaced without losing the last confirmed contents") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-journal-test");
+    fs->writeAll(PATH, R"({"value":"old"})");
+    bootAndStart(fs);
+
+    update(fs, "new");
+    update(fs, "newer");
+    REQUIRE(*fs->readAll("/config.json.prev") == R"({"value":"old"})");
+
+    REQUIRE(boot(fs) == "newer");
+    REQUIRE(boot(fs) == "old");
+}
+
+TEST_CASE("writing the current contents again does not replace them") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-journal-test");
+    fs->writeAll(PATH, R"({"value":"old"})");
+    bootAndStart(fs);
+    update(fs, "new");
+    bootAndStart(fs);
+
+    update(fs, "new");
+    REQUIRE(!fs->exists("/config.json.pending"));
+    REQUIRE(*fs->readAll("/config.json.prev") == R"({"value":"old"})");
+    REQUIRE(boot(fs) == "new");
+}
+
+TEST_CASE("contents written after loading are not confirmed") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-journal-test");
+    fs->writeAll(PATH, R"({"value":"old"})");
+    bootAndStart(fs);
+
+    update(fs, "new");
+    REQUIRE(boot(fs) == "new");
+    // Another update arrives before the device has started
+    ConfigurationJournal(fs, PATH).write(R"({"value":"newer"})");
+    ConfigurationJournal::confirmLoaded();
+    REQUIRE(fs->exists("/config.json.pending"));
+
+    // The next boot tries the newer contents; if it fails, they are rolled back
+    REQUIRE(boot(fs) == "newer");
+    REQUIRE(boot(fs) == "old");
+}
+
+TEST_CASE("the first update is rolled back to the defaults") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-journal-test");
+    REQUIRE(boot(fs) == "default");
+
+    update(fs, "new");
+    REQUIRE(boot(fs) == "new");
+    REQUIRE(boot(fs) == "default");
+}
+
+TEST_CASE("updates are rolled back when they cannot be loaded") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-journal-test");
+    fs->writeAll(PATH, R"({"value":"old"})");
+    bootAndStart(fs);
+
+    ConfigurationJournal(fs, PATH).write(R"({"value":)");
+    REQUIRE(boot(fs) == "old");
+    REQUIRE(!fs->exists("/config.json.pending"));
+}
+
+TEST_CASE("a crash at any point leaves either the old or the new contents") {
+    TemporaryDirectory root("config-journal-test");
+    int caseCount = 0;
+
+    for (bool overPending : { false, true }) {
+        // Crash before every write, remove and rename during the update, until there is nothing left to crash
+        bool updateCompleted = false;
+        for (int crashAt = 0; !updateCompleted; crashAt++) {
+            // Also crash at every point of the first boot after the crash
+            bool recoveryCompleted = false;
+            for (int recoveryCrashAt = 0; !recoveryCompleted; recoveryCrashAt++) {
+                CAPTURE(overPending, crashAt, recoveryCrashAt);
+                auto name = "/" + std::to_string(caseCount++);
+                REQUIRE(FileSystem(root.getPath()).makeDir(name));
+                auto dir = root.getPath() + name;
+                auto fs = std::make_shared<FileSystem>(dir);
+
+                fs->writeAll(PATH, R"({"value":"confirmed"})");
+                bootAndStart(fs);
+                std::set<std::string> expected { "confirmed", "new" };
+                if (overPending) {
+                    update(fs, "pending");
+                    expected.insert("pending");
+                }
+
+                auto crashingFs = std::make_shared<CrashingFileSystem>(dir, crashAt);
+                try {
+                    update(crashingFs, "new");
+                    updateCompleted = true;
+                } catch (const SimulatedCrash&) {
+                }
+                crashingFs->disarm();
+
+                auto crashingRecoveryFs = std::make_shared<CrashingFileSystem>(dir, recoveryCrashAt);
+                try {
+                    auto value = boot(crashingRecoveryFs);
+                    REQUIRE(expected.contains(value));
+                    recoveryCompleted = true;
+                } catch (const SimulatedCrash&) {
+                }
+                crashingRecoveryFs->disarm();
+
+                auto value = boot(fs);
+                REQUIRE(expected.contains(value));
+                REQUIRE(!fs->exists("/config.json.new"));
+
+                // The device starts, and keeps what it started with
+                ConfigurationJournal::confirmLoaded();
+                REQUIRE(boot(fs) == value);
+                REQUIRE(!fs->exists("/config.json.pending"));
+            }
+        }
+    }
+    WARN("Simulated " << caseCount << " crashes");
+}
+
+#endif
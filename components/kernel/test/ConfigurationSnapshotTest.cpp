@@ -0,0 +1,161 @@
+#include <sdkconfig.h>
+
+// Needs a writable file system, see TemporaryFileSystem.hpp
+#if CONFIG_IDF_TARGET_LINUX
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <string>
+
+#include <Configuration.hpp>
+
+#include <TemporaryFileSystem.hpp>
+
+using namespace farmhub::kernel;
+using namespace farmhub::test;
+
+namespace {
+
+struct TestConfig : ConfigurationSection {
+    Property<std::string> value { this, "value", "default" };
+    Property<int> count { this, "count" };
+};
+
+// The same settings as before, plus a new one
+struct TestExtendedConfig : TestConfig {
+    Property<bool> enabled { this, "enabled" };
+};
+
+constexpr const char* PATH = "/config.json";
+constexpr const char* SNAPSHOT_PATH = "/config.json.bin";
+
+template <typename TConfig = TestConfig>
+std::shared_ptr<TConfig> boot(const std::shared_ptr<FileSystem>& fs) {
+    auto config = std::make_shared<TConfig>();
+    ConfigurationFile<TConfig> file(fs, PATH, config);
+    return config;
+}
+
+void update(const std::shared_ptr<FileSystem>& fs, const std::string& value) {
+    auto config = std::make_shared<TestConfig>();
+    ConfigurationFile<TestConfig> file(fs, PATH, config);
+    JsonDocument json;
+    json["value"] = value;
+    file.update(json.as<JsonObject>());
+}
+
+/**
+ * @brief Changes the snapshot, so we can tell whether a boot loaded it or parsed the JSON.
+ */
+void tamperWithSnapshot(const std::shared_ptr<FileSystem>& fs, const std::string& value) {
+    auto config = std::make_shared<TestConfig>();
+    ConfigurationSnapshot snapshot(fs, PATH, *config);
+    JsonDocument json;
+    json["value"] = value;
+    snapshot.write(json, *fs->readAll(PATH));
+}
+
+}    // namespace
+
+TEST_CASE("the first boot takes a snapshot that later boots load") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-snapshot-test");
+    fs->writeAll(PATH, R"({"value":"stored","count":3,"unknown":[1,2,3]})");
+
+    auto config = boot(fs);
+    REQUIRE(config->value.get() == "stored");
+    REQUIRE(fs->exists(SNAPSHOT_PATH));
+
+    tamperWithSnapshot(fs, "from snapshot");
+    REQUIRE(boot(fs)->value.get() == "from snapshot");
+}
+
+TEST_CASE("snapshots load the same as the JSON") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-snapshot-test");
+    fs->writeAll(PATH, R"({"value":"stored","count":3,"unknown":[1,2,3]})");
+
+    auto parsed = boot(fs);
+    auto loaded = boot(fs);
+    REQUIRE(loaded->value.get() == parsed->value.get());
+    REQUIRE(loaded->count.get() == 3);
+    // Unknown fields are filtered out before taking the snapshot
+    REQUIRE(fs->size(SNAPSHOT_PATH) < fs->size(PATH));
+}
+
+TEST_CASE("updates drop the snapshot, and the next one is taken once they are confirmed") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-snapshot-test");
+    fs->writeAll(PATH, R"({"value":"old"})");
+    boot(fs);
+    ConfigurationJournal::confirmLoaded();
+    REQUIRE(fs->exists(SNAPSHOT_PATH));
+
+    update(fs, "new");
+    REQUIRE(!fs->exists(SNAPSHOT_PATH));
+
+    // Pending contents are parsed, to roll them back if they cannot be
+    REQUIRE(boot(fs)->value.get() == "new");
+    REQUIRE(!fs->exists(SNAPSHOT_PATH));
+    ConfigurationJournal::confirmLoaded();
+
+    REQUIRE(boot(fs)->value.get() == "new");
+    REQUIRE(fs->exists(SNAPSHOT_PATH));
+    REQUIRE(boot(fs)->value.get() == "new");
+}
+
+TEST_CASE("rolled back contents are not loaded from the snapshot") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-snapshot-test");
+    fs->writeAll(PATH, R"({"value":"old"})");
+    boot(fs);
+    ConfigurationJournal::confirmLoaded();
+
+    update(fs, "new");
+    // Crashes before confirming the new contents
+    REQUIRE(boot(fs)->value.get() == "new");
+    REQUIRE(boot(fs)->value.get() == "old");
+    REQUIRE(boot(fs)->value.get() == "old");
+}
+
+TEST_CASE("damaged snapshots are ignored") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-snapshot-test");
+    fs->writeAll(PATH, R"({"value":"stored"})");
+    boot(fs);
+    auto snapshot = *fs->readAll(SNAPSHOT_PATH);
+
+    // Torn while writing
+    fs->writeAll(SNAPSHOT_PATH, snapshot.substr(0, snapshot.size() - 1));
+    REQUIRE(boot(fs)->value.get() == "stored");
+    REQUIRE(*fs->readAll(SNAPSHOT_PATH) == snapshot);
+
+    fs->writeAll(SNAPSHOT_PATH, snapshot.substr(0, 10));
+    REQUIRE(boot(fs)->value.get() == "stored");
+
+    snapshot.back() ^= 1;
+    fs->writeAll(SNAPSHOT_PATH, snapshot);
+    REQUIRE(boot(fs)->value.get() == "stored");
+}
+
+TEST_CASE("snapshots are ignored when the file changes around the journal") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-snapshot-test");
+    fs->writeAll(PATH, R"({"value":"stored"})");
+    boot(fs);
+
+    fs->writeAll(PATH, R"({"value":"changed"})");
+    REQUIRE(boot(fs)->value.get() == "changed");
+
+    // Same size as before
+    fs->writeAll(PATH, R"({"value":"altered"})");
+    REQUIRE(boot(fs)->value.get() == "altered");
+}
+
+TEST_CASE("snapshots taken by firmware with different settings are ignored") {
+    auto fs = std::make_shared<TemporaryFileSystem>("config-snapshot-test");
+    fs->writeAll(PATH, R"({"value":"stored","enabled":true})");
+    boot(fs);
+
+    // The snapshot was filtered without the new setting
+    auto config = boot<TestExtendedConfig>(fs);
+    REQUIRE(config->enabled.get() == true);
+    REQUIRE(config->value.get() == "stored");
+}
+
+#endif
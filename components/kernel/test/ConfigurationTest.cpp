@@ -1,12 +1,24 @@
+#include <sdkconfig.h>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers.hpp>
 #include <catch2/matchers/catch_matchers_exception.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <memory>
 #include <string>
 
 #include <Configuration.hpp>
 
+#include "AllocationTracking.hpp"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <TemporaryFileSystem.hpp>
+#endif
+
 using namespace std::chrono;
 using namespace std::chrono_literals;
 using namespace farmhub::kernel;
@@ -23,6 +35,12 @@ struct TestConfig : ConfigurationSection {
     NamedConfigurationEntry<TestNestedConfig> nested { this, "nested" };
 };
 
+std::string toString(const JsonDocument& json) {
+    std::string jsonString;
+    serializeJson(json, jsonString);
+    return jsonString;
+}
+
 std::string toString(const ConfigurationEntry& config) {
     JsonDocument json;
     auto root = json.to<JsonObject>();
@@ -165,3 +183,270 @@ TEST_CASE("throws on invalid JSON") {
         ConfigurationException,
         Catch::Matchers::Message("ConfigurationException: Cannot parse JSON configuration: InvalidInput: NOT JSON"));
 }
+
+TEST_CASE("unknown fields are ignored, and dropped while parsing") {
+    TestConfig config;
+    REQUIRE(toString(config.getFilter()) == R"({"intValue":true,"stringValue":true,"boolValue":true,"secondsValue":true,"nested":{"intValue":true}})");
+
+    JsonDocument doc;
+    REQUIRE(config.deserialize(doc, R"({"unknown":[1,2,3],"nested":{"intValue":7,"other":"x"},"intValue":42})") == DeserializationError::Ok);
+    REQUIRE(toString(doc) == R"({"nested":{"intValue":7},"intValue":42})");
+
+    config.load(doc.as<JsonObject>());
+    REQUIRE(config.intValue.get() == 42);
+    REQUIRE(config.nested.get()->intValue.get() == 7);
+    REQUIRE(!config.stringValue.hasValue());
+}
+
+TEST_CASE("reloading resets entries missing from the new JSON") {
+    TestConfig config;
+    config.loadFromString(R"({"intValue":42,"stringValue":"hello","nested":{"intValue":7}})");
+    config.loadFromString(R"({"stringValue":"world"})");
+    REQUIRE(!config.intValue.hasValue());
+    REQUIRE(config.stringValue.get() == "world");
+    REQUIRE(!config.nested.hasValue());
+    REQUIRE(!config.nested.get()->intValue.hasValue());
+}
+
+struct TestSharedKeyConfig : ConfigurationSection {
+    Property<int> first { this, "value" };
+    Property<int> other { this, "other" };
+    Property<int> second { this, "value", 5 };
+};
+
+TEST_CASE("entries sharing a key are all loaded") {
+    TestSharedKeyConfig config;
+    config.loadFromString(R"({"value":3})");
+    REQUIRE(config.first.get() == 3);
+    REQUIRE(config.second.get() == 3);
+    REQUIRE(!config.other.hasValue());
+}
+
+namespace {
+
+// Same shape as the device settings
+struct TestDeviceSettings : ConfigurationSection {
+    Property<std::string> model { this, "model", "mk6" };
+    Property<std::string> instance { this, "instance" };
+    Property<std::string> location { this, "location" };
+    NamedConfigurationEntry<TestNestedConfig> ntp { this, "ntp" };
+    ArrayProperty<JsonAsString> peripherals { this, "peripherals" };
+    ArrayProperty<JsonAsString> functions { this, "functions" };
+    Property<bool> sleepWhenIdle { this, "sleepWhenIdle", true };
+    Property<seconds> publishInterval { this, "publishInterval", 5min };
+    NamedConfigurationEntry<TestConfig> telemetry { this, "telemetry" };
+    Property<int> publishLogs { this, "publishLogs", 3 };
+    Property<seconds> watchdogTimeout { this, "watchdogTimeout", 15min };
+};
+
+// data-templates/plot-controller-wokwi.json, the largest template
+constexpr const char* PLOT_CONTROLLER_CONFIG = R"({
+  "instance": "test-wokwi",
+  "location": "bumblebee",
+  "functions": [
+    {
+      "name": "plot",
+      "type": "plot-controller",
+      "params": {
+        "flowMeter": "flow-meter",
+        "valve": "valve",
+        "soilMoistureSensor": "soil-moisture"
+      }
+    }
+  ],
+  "peripherals": [
+    {
+      "name": "flow-meter",
+      "type": "flow-meter",
+      "params": {
+        "pin": "B1"
+      }
+    },
+    {
+      "name": "valve",
+      "type": "valve",
+      "params": {
+        "motor": "b"
+      }
+    },
+    {
+      "name": "soil-temperature",
+      "type": "environment:ntc-temperature-sensor",
+      "params": {
+        "pin": "A2"
+      }
+    },
+    {
+      "name": "raw-soil-moisture",
+      "type": "environment:soil-moisture",
+      "params": {
+        "air": 3017,
+        "pin": "A1",
+        "water": 1105
+      }
+    },
+    {
+      "name": "soil-moisture",
+      "type": "environment:kalman-soil-moisture",
+      "params": {
+        "rawMoistureSensor": "raw-soil-moisture",
+        "temperatureSensor": "soil-temperature"
+      }
+    }
+  ]
+})";
+
+/**
+ * @brief Keeps track of the JSON document's own heap, which does not go through `operator new`.
+ */
+class TrackingAllocator : public ArduinoJson::Allocator {
+public:
+    void* allocate(size_t size) override {
+        auto* block = static_cast<size_t*>(malloc(HEADER_SIZE + size));
+        *block = size;
+        track(size);
+        return reinterpret_cast<unsigned char*>(block) + HEADER_SIZE;
+    }
+
+    void deallocate(void* ptr) override {
+        auto* block = header(ptr);
+        live -= *block;
+        free(block);
+    }
+
+    void* reallocate(void* ptr, size_t newSize) override {
+        auto* block = header(ptr);
+        live -= *block;
+        block = static_cast<size_t*>(realloc(block, HEADER_SIZE + newSize));
+        *block = newSize;
+        track(newSize);
+        return reinterpret_cast<unsigned char*>(block) + HEADER_SIZE;
+    }
+
+    size_t peak = 0;
+
+private:
+    static constexpr size_t HEADER_SIZE = alignof(std::max_align_t);
+
+    static size_t* header(void* ptr) {
+        return reinterpret_cast<size_t*>(static_cast<unsigned char*>(ptr) - HEADER_SIZE);
+    }
+
+    void track(size_t size) {
+        live += size;
+        peak = std::max(peak, live);
+    }
+
+    size_t live = 0;
+};
+
+// How sections were loaded before they were compiled: a full parse, then a lookup per property
+void loadLegacy(TestDeviceSettings& settings, const std::string& json, ArduinoJson::Allocator* allocator) {
+    JsonDocument doc(allocator);
+    deserializeJson(doc, json);
+    auto root = doc.as<JsonObject>();
+    settings.model.load(root);
+    settings.instance.load(root);
+    settings.location.load(root);
+    settings.ntp.load(root);
+    settings.peripherals.load(root);
+    settings.functions.load(root);
+    settings.sleepWhenIdle.load(root);
+    settings.publishInterval.load(root);
+    settings.telemetry.load(root);
+    settings.publishLogs.load(root);
+    settings.watchdogTimeout.load(root);
+}
+
+void loadCompiled(TestDeviceSettings& settings, const std::string& json, ArduinoJson::Allocator* allocator) {
+    JsonDocument doc(allocator);
+    settings.deserialize(doc, json);
+    settings.load(doc.as<JsonObject>());
+}
+
+}    // namespace
+
+TEST_CASE("compiled sections load the same as looking up each property") {
+    TestDeviceSettings legacy;
+    TestDeviceSettings compiled;
+    TrackingAllocator allocator;
+    loadLegacy(legacy, PLOT_CONTROLLER_CONFIG, &allocator);
+    loadCompiled(compiled, PLOT_CONTROLLER_CONFIG, &allocator);
+
+    REQUIRE(toString(compiled) == toString(legacy));
+    REQUIRE(compiled.peripherals.get().size() == 5);
+}
+
+// Figures are only meaningful with the real ArduinoJson
+TEST_CASE("configuration parsing benchmark", "[.][benchmark]") {
+    TestDeviceSettings settings;
+    TrackingAllocator legacyAllocator;
+    TrackingAllocator compiledAllocator;
+    // Warm up the compiled table and filter
+    loadCompiled(settings, PLOT_CONTROLLER_CONFIG, &compiledAllocator);
+    compiledAllocator.peak = 0;
+
+    auto legacyStats = measureAllocations([&]() {
+        loadLegacy(settings, PLOT_CONTROLLER_CONFIG, &legacyAllocator);
+    });
+    auto compiledStats = measureAllocations([&]() {
+        loadCompiled(settings, PLOT_CONTROLLER_CONFIG, &compiledAllocator);
+    });
+    WARN("Loading plot-controller-wokwi.json: legacy peak " << legacyAllocator.peak << " bytes in document, "
+                                                            << legacyStats.peakBytes << " bytes on heap, " << legacyStats.count << " allocations; "
+                                                            << "compiled peak " << compiledAllocator.peak << " bytes in document, "
+                                                            << compiledStats.peakBytes << " bytes on heap, " << compiledStats.count << " allocations");
+
+    BENCHMARK("legacy") {
+        loadLegacy(settings, PLOT_CONTROLLER_CONFIG, &legacyAllocator);
+    };
+
+    BENCHMARK("compiled") {
+        loadCompiled(settings, PLOT_CONTROLLER_CONFIG, &compiledAllocator);
+    };
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+// Needs a writable file system, see TemporaryFileSystem.hpp
+TEST_CASE("configuration snapshot benchmark", "[.][benchmark]") {
+    constexpr const char* PATH = "/device-config.json";
+    auto fs = std::make_shared<farmhub::test::TemporaryFileSystem>("config-snapshot-benchmark");
+    fs->writeAll(PATH, PLOT_CONTROLLER_CONFIG);
+
+    // How the file was loaded at every boot before there were snapshots
+    auto parseFile = [&]() {
+        auto settings = std::make_shared<TestDeviceSettings>();
+        auto contents = fs->readAll(PATH);
+        JsonDocument json;
+        settings->deserialize(json, *contents);
+        settings->load(json.as<JsonObject>());
+        return settings;
+    };
+    auto bootFromSnapshot = [&]() {
+        auto settings = std::make_shared<TestDeviceSettings>();
+        ConfigurationFile<TestDeviceSettings> file(fs, PATH, settings);
+        return settings;
+    };
+
+    // The first boot parses the JSON and takes the snapshot
+    auto parsed = parseFile();
+    auto firstBoot = measureAllocations([&]() { bootFromSnapshot(); });
+    REQUIRE(fs->exists("/device-config.json.bin"));
+    auto parsing = measureAllocations([&]() { parseFile(); });
+    std::shared_ptr<TestDeviceSettings> loaded;
+    auto snapshot = measureAllocations([&]() { loaded = bootFromSnapshot(); });
+    REQUIRE(toString(*loaded) == toString(*parsed));
+    WARN("Loading plot-controller-wokwi.json: "
+        << "parsing the JSON reads " << fs->size(PATH) << " bytes, peak " << parsing.peakBytes << " bytes on heap, " << parsing.count << " allocations; "
+        << "the snapshot reads " << fs->size(PATH) + fs->size("/device-config.json.bin") << " bytes with the JSON it checks, peak " << snapshot.peakBytes << " bytes on heap, " << snapshot.count << " allocations; "
+        << "taking the snapshot peaks at " << firstBoot.peakBytes << " bytes on heap");
+
+    BENCHMARK("parsing the JSON") {
+        return parseFile();
+    };
+
+    BENCHMARK("from the snapshot") {
+        return bootFromSnapshot();
+    };
+}
+#endif
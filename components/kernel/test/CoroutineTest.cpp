@@ -0,0 +1,341 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include <Concurrent.hpp>
+#include <Coroutine.hpp>
+#include <State.hpp>
+#include <Task.hpp>
+
+using namespace farmhub::kernel;
+
+namespace {
+
+Coroutine record(std::vector<int>* events, int first, int second, CopyQueue<bool>* done) {
+    events->push_back(first);
+    co_await Coroutine::yield();
+    events->push_back(second);
+    done->put(true);
+}
+
+// Spawned on the runner's own task, so neither starts before both are spawned
+Coroutine spawnRecorders(CoroutineRunner* runner, std::vector<int>* events, CopyQueue<bool>* done) {
+    runner->spawn(record(events, 1, 3, done));
+    runner->spawn(record(events, 2, 4, done));
+    co_return;
+}
+
+Coroutine forward(CopyQueue<int>* input, ticks timeout, CopyQueue<std::optional<int>>* output) {
+    auto message = co_await Coroutine::poll(*input, timeout);
+    output->put(message);
+}
+
+Coroutine fail(std::string message) {
+    co_await Coroutine::delay(1ms);
+    throw std::runtime_error(message);
+}
+
+Coroutine catchFailure(CopyQueue<bool>* caught) {
+    try {
+        co_await fail("failed");
+    } catch (const std::runtime_error& e) {
+        caught->put(std::string(e.what()) == "failed");
+    }
+}
+
+Coroutine takeNotification(CoroutineNotification* notification, ticks timeout, CopyQueue<uint32_t>* taken) {
+    taken->put(co_await Coroutine::take(*notification, timeout));
+}
+
+Coroutine awaitState(const State* state, CopyQueue<bool>* result) {
+    result->put(co_await Coroutine::awaitSet(*state, 1s));
+}
+
+Coroutine yieldTimes(int times, CopyQueue<bool>* done) {
+    for (int i = 0; i < times; i++) {
+        co_await Coroutine::yield();
+    }
+    done->put(true);
+}
+
+Coroutine pingPong(int times, CoroutineNotification* in, CoroutineNotification* out, CopyQueue<bool>* done) {
+    for (int i = 0; i < times; i++) {
+        co_await Coroutine::take(*in);
+        out->give();
+    }
+    done->put(true);
+}
+
+// A typical peripheral loop: wait for a command, act on it, then wait for the hardware to settle
+Coroutine controlLoop(CopyQueue<int>* commands, CopyQueue<int>* applied) {
+    while (true) {
+        auto command = co_await Coroutine::poll(*commands, ticks::max());
+        if (command.has_value()) {
+            co_await Coroutine::delay(1ms);
+            applied->put(*command);
+        }
+    }
+}
+
+}    // namespace
+
+TEST_CASE("coroutines take turns on a single task") {
+    std::vector<int> events;
+    CopyQueue<bool> done("done", 2);
+    CoroutineRunner runner("coroutines", 4096);
+    runner.spawn(spawnRecorders(&runner, &events, &done));
+    done.take();
+    done.take();
+    REQUIRE(events == std::vector<int> { 1, 2, 3, 4 });
+}
+
+TEST_CASE("coroutines wait for queue messages") {
+    CopyQueue<int> input("input", 1);
+    CopyQueue<std::optional<int>> output("output", 1);
+    CoroutineRunner runner("coroutines", 4096);
+
+    runner.spawn(forward(&input, ticks(20), &output));
+    REQUIRE(output.take() == std::nullopt);
+
+    runner.spawn(forward(&input, ticks::max(), &output));
+    Task::delay(ticks(10));
+    input.put(42);
+    REQUIRE(output.take() == 42);
+}
+
+TEST_CASE("exceptions are passed to the awaiting coroutine") {
+    CopyQueue<bool> caught("caught", 1);
+    CoroutineRunner runner("coroutines", 4096);
+    runner.spawn(catchFailure(&caught));
+    REQUIRE(caught.take() == true);
+}
+
+TEST_CASE("notifications wake up coroutines") {
+    CoroutineNotification notification;
+    CopyQueue<uint32_t> taken("taken", 1);
+    CoroutineRunner runner("coroutines", 4096);
+
+    runner.spawn(takeNotification(&notification, ticks(20), &taken));
+    REQUIRE(taken.take() == 0);
+
+    runner.spawn(takeNotification(&notification, ticks::max(), &taken));
+    Task::delay(ticks(10));
+    notification.give();
+    notification.give();
+    REQUIRE(taken.take() >= 1);
+}
+
+TEST_CASE("coroutines wait for states") {
+    auto* eventGroup = xEventGroupCreate();
+    StateSource state("ready", eventGroup, 1 << 1);
+    CopyQueue<bool> result("result", 1);
+    {
+        CoroutineRunner runner("coroutines", 4096);
+        runner.spawn(awaitState(&state, &result));
+        Task::delay(ticks(10));
+        state.set();
+        REQUIRE(result.take() == true);
+    }
+    vEventGroupDelete(eventGroup);
+}
+
+TEST_CASE("queues and states wake the runner without polling") {
+    CopyQueue<int> input("input", 1);
+    CopyQueue<std::optional<int>> output("output", 1);
+    auto* eventGroup = xEventGroupCreate();
+    StateSource state("ready", eventGroup, 1 << 1);
+    CopyQueue<bool> result("result", 1);
+    {
+        // Polling would only check again once the timeouts elapse
+        CoroutineRunner runner("coroutines", 4096, 1h);
+
+        runner.spawn(forward(&input, ticks(5000), &output));
+        Task::delay(ticks(10));
+        input.put(42);
+        auto forwarded = output.pollIn(ticks(500));
+        REQUIRE(forwarded.has_value());
+        REQUIRE(*forwarded == 42);
+
+        // Waits for a second at most
+        runner.spawn(awaitState(&state, &result));
+        Task::delay(ticks(10));
+        state.set();
+        REQUIRE(result.pollIn(ticks(500)) == true);
+    }
+    vEventGroupDelete(eventGroup);
+}
+
+TEST_CASE("tasks are not woken up once they unsubscribed") {
+    int first = 0;
+    int second = 0;
+    auto* self = xTaskGetCurrentTaskHandle();
+    (void) ulTaskNotifyTake(pdTRUE, 0);
+
+    REQUIRE(TaskWakeups::subscribe(&first, self));
+    TaskWakeups::notify(&first);
+    REQUIRE(ulTaskNotifyTake(pdTRUE, 0) == 1);
+    TaskWakeups::unsubscribe(&first, self);
+
+    // The freed slot is taken by the next subscription
+    REQUIRE(TaskWakeups::subscribe(&second, self));
+    TaskWakeups::notify(&first);
+    REQUIRE(ulTaskNotifyTake(pdTRUE, 0) == 0);
+    TaskWakeups::notify(&second);
+    REQUIRE(ulTaskNotifyTake(pdTRUE, 0) == 1);
+    TaskWakeups::unsubscribe(&second, self);
+}
+
+TEST_CASE("subscribers can exit while they are being notified") {
+    int source = 0;
+    std::atomic<bool> notifying { true };
+    CopyQueue<bool> notifierDone("notifier-done", 1);
+    Task::run("notifier", 4096, [&](Task& /*task*/) {
+        while (notifying.load()) {
+            for (int i = 0; i < 16; i++) {
+                TaskWakeups::notify(&source);
+            }
+            // Let the subscribers run even if we have a higher priority
+            Task::delay(ticks(1));
+        }
+        notifierDone.put(true);
+    });
+
+    for (int round = 0; round < 100; round++) {
+        CopyQueue<bool> subscribed("subscribed", 1);
+        Task::run("subscriber", 2048, [&](Task& /*task*/) {
+            auto* self = xTaskGetCurrentTaskHandle();
+            bool success = TaskWakeups::subscribe(&source, self);
+            (void) ulTaskNotifyTake(pdTRUE, ticks(1).count());
+            if (success) {
+                TaskWakeups::unsubscribe(&source, self);
+            }
+            // The task is deleted right after this, the notifier must not touch it anymore
+            subscribed.put(success);
+        });
+        REQUIRE(subscribed.pollIn(ticks(1000)) == true);
+    }
+    notifying.store(false);
+    notifierDone.take();
+}
+
+TEST_CASE("unfinished coroutines are destroyed with their runner") {
+    CopyQueue<int> commands("commands", 1);
+    CopyQueue<int> applied("applied", 1);
+    auto before = Coroutine::getFrameStats();
+    {
+        CoroutineRunner runner("coroutines", 4096);
+        runner.spawn(controlLoop(&commands, &applied));
+        commands.put(1);
+        REQUIRE(applied.take() == 1);
+        REQUIRE(runner.size() == 1);
+    }
+    REQUIRE(Coroutine::getFrameStats().count == before.count);
+}
+
+TEST_CASE("coroutine frames are freed when they finish") {
+    CopyQueue<bool> done("done", 1);
+    auto before = Coroutine::getFrameStats();
+    CoroutineRunner runner("coroutines", 4096);
+
+    runner.spawn(yieldTimes(10, &done));
+    done.take();
+    Task::delay(ticks(10));
+    REQUIRE(Coroutine::getFrameStats().count == before.count);
+    REQUIRE(runner.size() == 0);
+    REQUIRE(runner.getResumes() == 11);
+}
+
+TEST_CASE("coroutine benchmark", "[.][benchmark]") {
+    constexpr int SWITCHES = 1000;
+    CopyQueue<bool> done("done", 2);
+
+    // Memory needed for a control loop waiting for commands: a coroutine frame vs. a task's stack
+    {
+        CopyQueue<int> commands("commands", 1);
+        CopyQueue<int> applied("applied", 1);
+        auto before = Coroutine::getFrameStats();
+        size_t frameBytes = 0;
+        {
+            CoroutineRunner runner("coroutines", 4096);
+            runner.spawn(controlLoop(&commands, &applied));
+            commands.put(1);
+            applied.take();
+            frameBytes = Coroutine::getFrameStats().bytes - before.bytes;
+        }
+
+        CopyQueue<TaskHandle_t> nativeTask("native-task", 1);
+        Task::run("native", 4096, [&](Task& /*task*/) {
+            auto command = commands.take();
+            Task::delay(1ms);
+            applied.put(command);
+            nativeTask.put(xTaskGetCurrentTaskHandle());
+            Task::suspend();
+        });
+        commands.put(1);
+        applied.take();
+        auto stackUsed = 4096 - uxTaskGetStackHighWaterMark(nativeTask.take());
+        WARN("Control loop uses " << frameBytes << " bytes as a coroutine, "
+                                  << stackUsed << " bytes of stack as a task");
+    }
+
+    CoroutineNotification ping;
+    CoroutineNotification pong;
+    CoroutineRunner runner("coroutines", 4096);
+
+    BENCHMARK("Coroutine yield") {
+        runner.spawn(yieldTimes(SWITCHES, &done));
+        runner.spawn(yieldTimes(SWITCHES, &done));
+        done.take();
+        done.take();
+    };
+
+    BENCHMARK("Task yield") {
+        for (int i = 0; i < 2; i++) {
+            Task::run("yielder", 2048, [&](Task& /*task*/) {
+                for (int j = 0; j < SWITCHES; j++) {
+                    Task::yield();
+                }
+                done.put(true);
+            });
+        }
+        done.take();
+        done.take();
+    };
+
+    BENCHMARK("Coroutine notification ping-pong") {
+        runner.spawn(pingPong(SWITCHES, &ping, &pong, &done));
+        runner.spawn(pingPong(SWITCHES, &pong, &ping, &done));
+        ping.give();
+        done.take();
+        done.take();
+        ping.take();
+        pong.take();
+    };
+
+    BENCHMARK("Task notification ping-pong") {
+        auto* pinger = xTaskGetCurrentTaskHandle();
+        CopyQueue<TaskHandle_t> ponger("ponger", 1);
+        Task::run("ponger", 2048, [&](Task& /*task*/) {
+            ponger.put(xTaskGetCurrentTaskHandle());
+            for (int i = 0; i < SWITCHES; i++) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                xTaskNotifyGive(pinger);
+            }
+            done.put(true);
+        });
+        auto* pongerTask = ponger.take();
+        for (int i = 0; i < SWITCHES; i++) {
+            xTaskNotifyGive(pongerTask);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+        done.take();
+    };
+}
@@ -0,0 +1,149 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <ArduinoJson.h>
+
+#include <CrashLog.hpp>
+
+using namespace farmhub::kernel;
+
+namespace {
+
+// Stands in for RTC memory, which contains garbage after power-on
+std::unique_ptr<CrashLog::Storage> createGarbageStorage() {
+    auto storage = std::make_unique<CrashLog::Storage>();
+    memset(storage.get(), 0xA5, sizeof(CrashLog::Storage));
+    return storage;
+}
+
+}    // namespace
+
+TEST_CASE("garbage storage is wiped") {
+    auto storage = createGarbageStorage();
+    CrashLog log(*storage);
+    REQUIRE(log.getBoot() == 0);
+    REQUIRE(log.getPreviousBoot().empty());
+    REQUIRE(log.getCorrupted() == 0);
+}
+
+TEST_CASE("records of the previous boot survive a reset") {
+    auto storage = createGarbageStorage();
+    {
+        CrashLog log(*storage);
+        log.record(Level::Info, 100, "starting");
+        log.record(Level::Error, 200, "about to crash");
+    }
+
+    CrashLog log(*storage);
+    REQUIRE(log.getBoot() == 1);
+    const auto& records = log.getPreviousBoot();
+    REQUIRE(records.size() == 2);
+    REQUIRE(records[0].getMessage() == "starting");
+    REQUIRE(records[0].uptime == 100);
+    REQUIRE(records[1].getMessage() == "about to crash");
+    REQUIRE(records[1].level == Level::Error);
+}
+
+TEST_CASE("only records of the previous boot are reported") {
+    auto storage = createGarbageStorage();
+    {
+        CrashLog log(*storage);
+        log.record(Level::Info, 100, "first boot");
+    }
+    {
+        CrashLog log(*storage);
+        log.record(Level::Info, 100, "second boot");
+    }
+
+    CrashLog log(*storage);
+    REQUIRE(log.getPreviousBoot().size() == 1);
+    REQUIRE(log.getPreviousBoot()[0].getMessage() == "second boot");
+}
+
+TEST_CASE("the ring keeps the most recent records") {
+    auto storage = createGarbageStorage();
+    {
+        CrashLog log(*storage);
+        for (size_t i = 0; i < CrashLog::RECORDS + 5; i++) {
+            log.record(Level::Info, i, "line " + std::to_string(i));
+        }
+    }
+
+    CrashLog log(*storage);
+    const auto& records = log.getPreviousBoot();
+    REQUIRE(records.size() == CrashLog::RECORDS);
+    REQUIRE(records.front().getMessage() == "line 5");
+    REQUIRE(records.back().getMessage() == "line " + std::to_string(CrashLog::RECORDS + 4));
+}
+
+TEST_CASE("long messages are truncated") {
+    auto storage = createGarbageStorage();
+    std::string message(CrashLog::MESSAGE_SIZE + 10, 'x');
+    {
+        CrashLog log(*storage);
+        log.record(Level::Warning, 0, message);
+    }
+
+    CrashLog log(*storage);
+    REQUIRE(log.getPreviousBoot()[0].getMessage() == message.substr(0, CrashLog::MESSAGE_SIZE));
+}
+
+TEST_CASE("corrupted records are discarded") {
+    auto storage = createGarbageStorage();
+    {
+        CrashLog log(*storage);
+        log.record(Level::Info, 100, "intact");
+        log.record(Level::Info, 200, "torn");
+    }
+    // Simulate a reset in the middle of writing the second record
+    storage->records[2].message[0] = 'X';
+
+    CrashLog log(*storage);
+    REQUIRE(log.getCorrupted() == 1);
+    REQUIRE(log.getPreviousBoot().size() == 1);
+    REQUIRE(log.getPreviousBoot()[0].getMessage() == "intact");
+}
+
+TEST_CASE("corrupted header wipes the ring") {
+    auto storage = createGarbageStorage();
+    {
+        CrashLog log(*storage);
+        log.record(Level::Info, 100, "lost");
+    }
+    storage->boot ^= 0x100;
+
+    CrashLog log(*storage);
+    REQUIRE(log.getBoot() == 0);
+    REQUIRE(log.getPreviousBoot().empty());
+}
+
+TEST_CASE("previous boot is reported as JSON") {
+    auto storage = createGarbageStorage();
+    {
+        CrashLog log(*storage);
+        log.record(Level::Error, 1234, "brownout imminent");
+    }
+
+    CrashLog log(*storage);
+    JsonDocument doc;
+    auto records = doc.to<JsonArray>();
+    log.reportPreviousBoot(records);
+    REQUIRE(records.size() == 1);
+    REQUIRE(records[0]["uptime"] == 1234);
+    REQUIRE(records[0]["level"] == static_cast<int>(Level::Error));
+    REQUIRE(records[0]["message"] == "brownout imminent");
+}
+
+TEST_CASE("crash log benchmark", "[.][benchmark]") {
+    auto storage = createGarbageStorage();
+    CrashLog log(*storage);
+    std::string message = "(123456) farmhub:mqtt: Published to 'devices/ugly-duckling/test/telemetry'";
+
+    BENCHMARK("Record log line") {
+        log.record(Level::Info, 123456, message);
+    };
+}
@@ -0,0 +1,235 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <Concurrent.hpp>
+#include <DeferredLog.hpp>
+#include <Task.hpp>
+
+using namespace farmhub::kernel;
+
+namespace {
+
+std::string capture(DeferredLogRecord::Kind& kind, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    DeferredLogRecord record(format, args);
+    va_end(args);
+    kind = record.getKind();
+    std::string line;
+    record.appendTo(line);
+    return line;
+}
+
+std::string render(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    std::string line(vsnprintf(nullptr, 0, format, args), '\0');
+    va_end(args);
+    va_start(args, format);
+    vsnprintf(line.data(), line.size() + 1, format, args);
+    va_end(args);
+    return line;
+}
+
+bool write(DeferredLog& log, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    bool written = log.write(format, args);
+    va_end(args);
+    return written;
+}
+
+#define REQUIRE_DEFERRED(format, ...)                                                                 \
+    do {                                                                                              \
+        DeferredLogRecord::Kind kind;                                                                 \
+        REQUIRE(capture(kind, format __VA_OPT__(, ) __VA_ARGS__) == render(format __VA_OPT__(, ) __VA_ARGS__)); \
+        REQUIRE(kind == DeferredLogRecord::Kind::Deferred);                                           \
+    } while (false)
+
+}    // namespace
+
+TEST_CASE("deferred records format like printf") {
+    REQUIRE_DEFERRED("plain text\n");
+    REQUIRE_DEFERRED("I (%lu) %s: %d%%\n", 123456UL, "tag", -42);
+    REQUIRE_DEFERRED("%lld %llu %zu %td %jd\n", -1234567890123LL, 1234567890123ULL, sizeof(long), static_cast<ptrdiff_t>(-7), static_cast<intmax_t>(99));
+    REQUIRE_DEFERRED("%5.2f|%-8.3e|%g\n", 3.14159, 0.000123, 1e10);
+    REQUIRE_DEFERRED("%*d|%-*d|%.*f\n", 6, 42, 6, 42, 2, 2.71828);
+    REQUIRE_DEFERRED("%x %08X %o %c %p\n", 255U, 0xBEEFU, 8U, 'A', reinterpret_cast<void*>(0x1234));
+    REQUIRE_DEFERRED("%10s|%-10s|\n", "right", "left");
+    REQUIRE_DEFERRED("%s\n", static_cast<const char*>(nullptr));
+}
+
+TEST_CASE("strings with a precision need not be terminated") {
+    // The string argument is copied into the record, the buffer can go away
+    char buffer[] = { 'a', 'b', 'c', 'd' };
+    DeferredLogRecord::Kind kind;
+    REQUIRE(capture(kind, "[%.*s]\n", 3, buffer) == "[abc]\n");
+    REQUIRE(kind == DeferredLogRecord::Kind::Deferred);
+}
+
+TEST_CASE("records render formats outside read-only memory right away") {
+    char format[] = "dynamic %d\n";
+    REQUIRE_FALSE(DeferredLogRecord::isStatic(format));
+    DeferredLogRecord::Kind kind;
+    std::string line = capture(kind, format, 42);
+    format[0] = 'D';
+    REQUIRE(line == "dynamic 42\n");
+    REQUIRE(kind == DeferredLogRecord::Kind::Rendered);
+}
+
+TEST_CASE("records render long lines on the heap") {
+    std::string text(300, 'x');
+    DeferredLogRecord::Kind kind;
+    REQUIRE(capture(kind, "%s\n", text.c_str()) == text + "\n");
+    REQUIRE(kind == DeferredLogRecord::Kind::Long);
+}
+
+TEST_CASE("deferred log keeps the order of messages and counts overflows") {
+    DeferredLog log(4);
+    for (int i = 0; i < 6; i++) {
+        write(log, "message %d\n", i);
+    }
+    REQUIRE(log.getOverflows() == 2);
+
+    std::vector<std::string> lines;
+    REQUIRE(log.drain([&](size_t /*ring*/, const std::string& line) {
+        lines.push_back(line);
+    }) == 4);
+    REQUIRE(lines == std::vector<std::string> { "message 0\n", "message 1\n", "message 2\n", "message 3\n" });
+
+    REQUIRE(write(log, "message %d\n", 6));
+    REQUIRE(log.getOverflows() == 2);
+}
+
+TEST_CASE("fragments of a line go to the same ring") {
+    DeferredLog log;
+    write(log, "I (%lu) test: ", 1234UL);
+    write(log, "value %d", 42);
+    write(log, "\n");
+
+    std::vector<size_t> rings;
+    std::string line;
+    REQUIRE(log.drain([&](size_t ring, const std::string& fragment) {
+        rings.push_back(ring);
+        line += fragment;
+    }) == 3);
+    REQUIRE(line == "I (1234) test: value 42\n");
+    REQUIRE(rings.size() == 3);
+    REQUIRE(std::all_of(rings.begin(), rings.end(), [&](size_t ring) { return ring == rings[0]; }));
+    REQUIRE(rings[0] < log.getRingCount());
+}
+
+TEST_CASE("deferred log wakes up its consumer") {
+    DeferredLog log;
+    CopyQueue<int> drained("drained", 1);
+    Task::run("consumer", 4096, [&](Task& /*task*/) {
+        log.awaitMessages();
+        drained.put(static_cast<int>(log.drain([](size_t /*ring*/, const std::string& /*line*/) { })));
+    });
+    Task::delay(ticks(10));
+    write(log, "hello %s\n", "world");
+    REQUIRE(drained.take() == 1);
+}
+
+TEST_CASE("deferred log can be drained by any task, one at a time") {
+    DeferredLog log;
+    CopyQueue<bool> draining("draining", 1);
+    CopyQueue<bool> release("release", 1);
+    CopyQueue<int> drained("drained", 1);
+    write(log, "first\n");
+    Task::run("consumer", 4096, [&](Task& /*task*/) {
+        drained.put(static_cast<int>(log.drain([&](size_t /*ring*/, const std::string& line) {
+            if (line == "first\n") {
+                draining.put(true);
+                release.take();
+            }
+        })));
+    });
+    draining.take();
+
+    // The consumer is still busy
+    write(log, "second\n");
+    REQUIRE(log.drain([](size_t /*ring*/, const std::string& /*line*/) { }, ticks(10)) == 0);
+
+    // Once it is done, either of them gets the second message
+    release.put(true);
+    REQUIRE(log.drain([](size_t /*ring*/, const std::string& /*line*/) { }) + drained.take() == 2);
+}
+
+TEST_CASE("deferred log benchmark", "[.][benchmark]") {
+    constexpr int PRODUCERS = 8;
+    constexpr int MESSAGES = 1000;
+
+    // Each producer logs a typical line, and records the worst latency of a single call
+    auto produce = [](auto&& log, CopyQueue<int64_t>& done) {
+        for (int i = 0; i < PRODUCERS; i++) {
+            Task::run("producer", 4096, [&, i](Task& /*task*/) {
+                int64_t worst = 0;
+                for (int j = 0; j < MESSAGES; j++) {
+                    auto start = std::chrono::steady_clock::now();
+                    log("I (%lu) producer-%d: message %d, value %.2f\n", 123456UL, i, j, j * 0.5);
+                    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                    worst = std::max<int64_t>(worst, duration);
+                }
+                done.put(worst);
+            });
+        }
+        int64_t worst = 0;
+        for (int i = 0; i < PRODUCERS; i++) {
+            worst = std::max(worst, done.take());
+        }
+        return worst;
+    };
+
+    CopyQueue<int64_t> done("done", PRODUCERS);
+
+    // Every line formatted by the caller under a lock, like the console did before
+    {
+        Mutex bufferMutex;
+        std::atomic<size_t> formatted { 0 };
+        auto start = std::chrono::steady_clock::now();
+        auto worst = produce([&](const char* format, auto... args) {
+            Lock lock(bufferMutex);
+            char buffer[128];
+            snprintf(buffer, sizeof(buffer), format, args...);
+            formatted++;
+        },
+            done);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        WARN("Locked formatting: " << formatted << " lines in " << elapsed << " us, worst call " << worst << " ns");
+    }
+
+    // Lines captured in rings, formatted by a separate consumer
+    {
+        DeferredLog log(256);
+        std::atomic<bool> stopping { false };
+        std::atomic<size_t> formatted { 0 };
+        CopyQueue<bool> stopped("stopped", 1);
+        Task::run("consumer", 4096, [&](Task& /*task*/) {
+            while (!stopping) {
+                log.awaitMessages();
+                formatted += log.drain([](size_t /*ring*/, const std::string& /*line*/) { });
+            }
+            stopped.put(true);
+        });
+        auto start = std::chrono::steady_clock::now();
+        auto worst = produce([&](const char* format, auto... args) {
+            write(log, format, args...);
+        },
+            done);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        stopping = true;
+        write(log, "stop\n");
+        stopped.take();
+        WARN("Deferred logging: " << formatted << " lines in " << elapsed << " us, worst call " << worst << " ns, "
+                                  << log.getOverflows() << " overflows");
+    }
+}
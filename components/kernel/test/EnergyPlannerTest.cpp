@@ -0,0 +1,174 @@
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <ArduinoJson.h>
+
+#include <EnergyPlanner.hpp>
+
+using namespace std::chrono;
+using namespace farmhub::kernel;
+
+namespace {
+
+std::shared_ptr<EnergyPlanner> createPlanner(const std::string& json) {
+    auto config = std::make_shared<EnergyPlanner::Config>();
+    config->loadFromString(json);
+    return std::make_shared<EnergyPlanner>(config);
+}
+
+/**
+ * @brief A battery powered device that publishes telemetry and samples sensors periodically,
+ * and sleeps in between.
+ */
+struct DischargeModel {
+    double capacity = 2000.0;          // mAh
+    double sleepCurrent = 1.0;         // mA
+    seconds telemetryInterval = 5min;  // Publishing takes 2 s at 120 mA
+    seconds samplingInterval = 10s;    // Sampling takes 50 ms at 30 mA
+
+    double awakeShare(double factor) const {
+        return (2.0 / static_cast<double>(telemetryInterval.count()) + 0.05 / static_cast<double>(samplingInterval.count())) / factor;
+    }
+
+    double current(double factor) const {
+        double active = (2.0 * 120.0 / static_cast<double>(telemetryInterval.count()) + 0.05 * 30.0 / static_cast<double>(samplingInterval.count())) / factor;
+        return sleepCurrent * (1.0 - awakeShare(factor)) + active;
+    }
+
+    /**
+     * @brief Run the device until the battery is empty, planning every hour, and return how long it lasted.
+     */
+    hours simulate(EnergyPlanner* planner) const {
+        double remaining = capacity;
+        double factor = 1.0;
+        hours elapsed = 0h;
+        while (remaining > 0.0 && elapsed < 24h * 365) {
+            auto current = this->current(factor);
+            if (planner != nullptr) {
+                auto plan = planner->plan(EnergyState {
+                    .charge = remaining / capacity * 100.0,
+                    .current = current,
+                    .timeToEmpty = duration_cast<seconds>(duration<double, std::ratio<3600>>(remaining / current)),
+                    .sleepRatio = 1.0 - awakeShare(factor),
+                    .time = std::nullopt,
+                });
+                factor = plan.factor;
+                current = this->current(factor);
+            }
+            remaining -= current;
+            elapsed += 1h;
+        }
+        return elapsed;
+    }
+};
+
+}    // namespace
+
+TEST_CASE("periodic work is stretched along the curve") {
+    auto planner = createPlanner(R"({})");
+
+    auto plan = planner->plan({ .charge = 80.0 });
+    REQUIRE(plan.factor == 1.0);
+    REQUIRE(plan.logLevel == Level::Verbose);
+
+    plan = planner->plan({ .charge = 40.0 });
+    REQUIRE(plan.factor == Catch::Approx(1.5));
+
+    plan = planner->plan({ .charge = 20.0 });
+    REQUIRE(plan.factor == Catch::Approx(4.0 - 2.0 / 3.0));
+    REQUIRE(plan.logLevel == Level::Warning);
+
+    plan = planner->plan({ .charge = 5.0 });
+    REQUIRE(plan.factor == 4.0);
+    REQUIRE(plan.logLevel == Level::Error);
+
+    REQUIRE(planner->scale(seconds(300)) == 1200s);
+}
+
+TEST_CASE("curves and log levels can be configured") {
+    auto planner = createPlanner(R"({
+        "curve": [ { "charge": 10, "factor": 20 }, { "charge": 90, "factor": 1 } ],
+        "logLevels": [ { "charge": 50, "level": 4 } ],
+        "maxFactor": 10
+    })");
+
+    auto plan = planner->plan({ .charge = 95.0 });
+    REQUIRE(plan.factor == 1.0);
+    REQUIRE(plan.logLevel == Level::Verbose);
+
+    plan = planner->plan({ .charge = 50.0 });
+    REQUIRE(plan.factor == Catch::Approx(10.0));
+    REQUIRE(plan.logLevel == Level::Info);
+}
+
+TEST_CASE("decisions are reported in telemetry") {
+    auto planner = createPlanner(R"({"targetRuntime": 1000})");
+    planner->plan({ .charge = 50.0, .current = 2.0, .timeToEmpty = 400h });
+
+    JsonDocument doc;
+    auto json = doc.to<JsonObject>();
+    planner->populateTelemetry(json);
+    REQUIRE(json["factor"].as<double>() > 1.0);
+    REQUIRE(json["log-level"].as<int>() == static_cast<int>(Level::Verbose));
+    REQUIRE(json["projected-runtime"].as<int>() == 400);
+    REQUIRE(json["target-runtime"].as<int>() == 500);
+}
+
+TEST_CASE("the state of charge left at dawn can be a target") {
+    // 20:00 UTC, dawn is in 10 hours
+    auto evening = system_clock::time_point(20h);
+    REQUIRE(EnergyPlanner::timeUntilHour(evening, 6) == 10h);
+    REQUIRE(EnergyPlanner::timeUntilHour(system_clock::time_point(5h), 6) == 1h);
+
+    DischargeModel device;
+    auto current = device.current(1.0);
+    auto state = EnergyState {
+        .charge = 60.0,
+        .current = current,
+        .timeToEmpty = duration_cast<seconds>(duration<double, std::ratio<3600>>(0.6 * device.capacity / current)),
+        .sleepRatio = 1.0 - device.awakeShare(1.0),
+        .time = evening,
+    };
+
+    // Plenty of charge left for the night
+    auto relaxed = createPlanner(R"({"dawnCharge": 50})");
+    REQUIRE(relaxed->plan(state).factor == 1.0);
+
+    // 0.5% of 2000 mAh for 10 hours allows 1 mA, which is not much more than sleeping
+    auto strict = createPlanner(R"({"dawnCharge": 59.5, "maxFactor": 8})");
+    auto plan = strict->plan(state);
+    REQUIRE(plan.targetRuntime == 1200h);
+    REQUIRE(plan.factor == 8.0);
+}
+
+TEST_CASE("a target runtime is met by stretching periodic work") {
+    DischargeModel device;
+    auto fixed = device.simulate(nullptr);
+
+    auto planner = createPlanner(R"({
+        "curve": [ { "charge": 0, "factor": 1 } ],
+        "targetRuntime": 1400,
+        "sleepCurrent": 1.0
+    })");
+    auto planned = device.simulate(planner.get());
+
+    WARN("Runtime: fixed intervals " << fixed.count() << " h, with target " << planned.count() << " h");
+    REQUIRE(fixed < 1400h);
+    REQUIRE(planned >= 1400h);
+    // Not stretching more than needed
+    REQUIRE(planned < 1600h);
+}
+
+TEST_CASE("the default curve extends battery life") {
+    DischargeModel device;
+    auto fixed = device.simulate(nullptr);
+    auto planner = createPlanner(R"({})");
+    auto planned = device.simulate(planner.get());
+
+    WARN("Runtime: fixed intervals " << fixed.count() << " h, default curve " << planned.count() << " h");
+    REQUIRE(planned > fixed * 11 / 10);
+}
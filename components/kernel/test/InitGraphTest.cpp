@@ -0,0 +1,219 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <InitGraph.hpp>
+#include <Task.hpp>
+
+using namespace std::chrono;
+using namespace farmhub::kernel;
+
+namespace {
+
+/**
+ * @brief Records which nodes ran, in what order, and how many of them ran at the same time.
+ */
+struct Recorder {
+    std::function<void()> node(const std::string& name, milliseconds duration) {
+        return [this, name, duration]() {
+            {
+                std::lock_guard lock(mutex);
+                started.push_back(name);
+                maxRunning = std::max(maxRunning, ++running);
+            }
+            Task::delay(ticks(duration));
+            {
+                std::lock_guard lock(mutex);
+                running--;
+                finished.push_back(name);
+            }
+        };
+    }
+
+    size_t indexOf(const std::vector<std::string>& list, const std::string& name) {
+        std::lock_guard lock(mutex);
+        return std::ranges::find(list, name) - list.begin();
+    }
+
+    std::mutex mutex;
+    std::vector<std::string> started;
+    std::vector<std::string> finished;
+    int running = 0;
+    int maxRunning = 0;
+};
+
+/**
+ * @brief A node that blocks until released, like a sensor that never answers.
+ */
+struct Hang {
+    std::function<void()> node() {
+        return [released = released]() {
+            while (!released->load()) {
+                Task::delay(ticks(10ms));
+            }
+        };
+    }
+
+    ~Hang() {
+        released->store(true);
+    }
+
+    std::shared_ptr<std::atomic<bool>> released = std::make_shared<std::atomic<bool>>(false);
+};
+
+}    // namespace
+
+TEST_CASE("independent nodes are initialized at the same time") {
+    Recorder recorder;
+    InitGraph graph(4, 5s);
+    graph.add("a", { "pin A1" }, {}, recorder.node("a", 100ms));
+    graph.add("b", { "pin A2" }, {}, recorder.node("b", 100ms));
+    graph.add("c", { "pin A3" }, {}, recorder.node("c", 100ms));
+
+    auto results = graph.run();
+    REQUIRE(results.size() == 3);
+    for (const auto& result : results) {
+        REQUIRE(result.outcome == InitOutcome::Succeeded);
+    }
+    REQUIRE(recorder.maxRunning == 3);
+}
+
+TEST_CASE("at most as many nodes run at the same time as allowed") {
+    Recorder recorder;
+    InitGraph graph(2, 5s);
+    for (int i = 0; i < 5; i++) {
+        auto name = "node-" + std::to_string(i);
+        graph.add(name, {}, {}, recorder.node(name, 50ms));
+    }
+
+    graph.run();
+    REQUIRE(recorder.finished.size() == 5);
+    REQUIRE(recorder.maxRunning == 2);
+}
+
+TEST_CASE("nodes using the same resource are initialized one after the other") {
+    Recorder recorder;
+    InitGraph graph(4, 5s);
+    graph.add("sensor-1", { "pin C1", "pin C4" }, {}, recorder.node("sensor-1", 50ms));
+    graph.add("sensor-2", { "pin C1", "pin C4" }, {}, recorder.node("sensor-2", 50ms));
+    graph.add("sensor-3", { "pin C1", "pin C4" }, {}, recorder.node("sensor-3", 50ms));
+
+    graph.run();
+    REQUIRE(recorder.maxRunning == 1);
+    // In the order they were added
+    REQUIRE(recorder.started == std::vector<std::string> { "sensor-1", "sensor-2", "sensor-3" });
+}
+
+TEST_CASE("nodes are initialized after what they depend on") {
+    Recorder recorder;
+    InitGraph graph(4, 5s);
+    graph.add("valve", { "pin relay:0" }, { "relay" }, recorder.node("valve", 10ms));
+    graph.add("relay", { "pin C1", "pin C4" }, {}, recorder.node("relay", 50ms));
+    graph.add("flow-meter", { "pin B1" }, {}, recorder.node("flow-meter", 10ms));
+
+    auto results = graph.run();
+    REQUIRE(results[0].outcome == InitOutcome::Succeeded);
+    REQUIRE(recorder.indexOf(recorder.finished, "relay") < recorder.indexOf(recorder.started, "valve"));
+    // Not waiting for the relay
+    REQUIRE(recorder.indexOf(recorder.finished, "flow-meter") < recorder.indexOf(recorder.finished, "relay"));
+}
+
+TEST_CASE("with a concurrency of one, nodes are initialized in the order they were added") {
+    Recorder recorder;
+    InitGraph graph(1, 5s);
+    graph.add("a", { "pin A1" }, {}, recorder.node("a", 10ms));
+    graph.add("b", { "pin A2" }, {}, recorder.node("b", 10ms));
+    graph.add("c", { "pin A3" }, {}, recorder.node("c", 10ms));
+
+    graph.run();
+    REQUIRE(recorder.started == std::vector<std::string> { "a", "b", "c" });
+}
+
+TEST_CASE("failures are reported without stopping the rest") {
+    Recorder recorder;
+    InitGraph graph(4, 5s);
+    graph.add("broken", {}, {}, []() {
+        throw std::runtime_error("No response");
+    });
+    graph.add("dependent", {}, { "broken" }, recorder.node("dependent", 10ms));
+    graph.add("other", {}, {}, recorder.node("other", 10ms));
+
+    auto results = graph.run();
+    REQUIRE(results[0].outcome == InitOutcome::Failed);
+    REQUIRE(results[0].error == "No response");
+    // It is up to the dependent to tell whether it can work without what it depends on
+    REQUIRE(results[1].outcome == InitOutcome::Succeeded);
+    REQUIRE(results[2].outcome == InitOutcome::Succeeded);
+}
+
+TEST_CASE("a hung node does not block the rest") {
+    Recorder recorder;
+    Hang hang;
+    InitGraph graph(2, 200ms);
+    graph.add("hung", { "pin C1" }, {}, hang.node());
+    graph.add("same-bus", { "pin C1" }, {}, recorder.node("same-bus", 10ms));
+    graph.add("other-1", { "pin A1" }, {}, recorder.node("other-1", 10ms));
+    graph.add("other-2", { "pin A2" }, {}, recorder.node("other-2", 10ms));
+
+    auto results = graph.run();
+
+    REQUIRE(results[0].outcome == InitOutcome::TimedOut);
+    REQUIRE(results[1].outcome == InitOutcome::Blocked);
+    REQUIRE(results[1].error == "Waiting for pin C1 held by 'hung'");
+    REQUIRE(results[2].outcome == InitOutcome::Succeeded);
+    REQUIRE(results[3].outcome == InitOutcome::Succeeded);
+}
+
+TEST_CASE("nodes that depend on each other are still initialized") {
+    Recorder recorder;
+    InitGraph graph(4, 5s);
+    graph.add("a", {}, { "b" }, recorder.node("a", 10ms));
+    graph.add("b", {}, { "a" }, recorder.node("b", 10ms));
+
+    auto results = graph.run();
+    REQUIRE(results[0].outcome == InitOutcome::Succeeded);
+    REQUIRE(results[1].outcome == InitOutcome::Succeeded);
+    REQUIRE(recorder.started == std::vector<std::string> { "a", "b" });
+}
+
+// On the linux target delays and the clock are virtual, so this shows how the schedule plays out, not how long it really takes
+TEST_CASE("initializing slow peripherals at boot", "[.][benchmark]") {
+    // Roughly what these take on real hardware, scaled down by 10
+    auto addPeripherals = [](InitGraph& graph, Recorder& recorder) {
+        // DS18B20 conversion at 12-bit resolution
+        graph.add("soil-temperature", { "pin A2" }, {}, recorder.node("soil-temperature", 75ms));
+        // SHT3x soft reset and first measurement
+        graph.add("environment", { "pin C1", "pin C4" }, {}, recorder.node("environment", 20ms));
+        // INA219 calibration on the same bus
+        graph.add("battery-monitor", { "pin C1", "pin C4" }, {}, recorder.node("battery-monitor", 10ms));
+        // Motorized valve homing
+        graph.add("valve", { "pin B3" }, {}, recorder.node("valve", 150ms));
+        graph.add("flow-meter", { "pin B1" }, {}, recorder.node("flow-meter", 5ms));
+        graph.add("raw-soil-moisture", { "pin A1" }, {}, recorder.node("raw-soil-moisture", 10ms));
+        graph.add("soil-moisture", {}, { "raw-soil-moisture", "soil-temperature" }, recorder.node("soil-moisture", 5ms));
+    };
+
+    auto measure = [&](size_t concurrency) {
+        Recorder recorder;
+        InitGraph graph(concurrency, 5s);
+        addPeripherals(graph, recorder);
+        auto start = steady_clock::now();
+        auto results = graph.run();
+        auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+        for (const auto& result : results) {
+            REQUIRE(result.outcome == InitOutcome::Succeeded);
+        }
+        return elapsed;
+    };
+
+    auto sequential = measure(1);
+    auto parallel = measure(4);
+
+    // The valve homing is the longest chain
+    WARN("Initializing peripherals: sequential " << sequential.count() << " ms, parallel " << parallel.count() << " ms");
+}
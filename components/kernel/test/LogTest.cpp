@@ -0,0 +1,90 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <string_view>
+
+#include <Log.hpp>
+
+using namespace farmhub::kernel;
+
+namespace {
+
+LOGGING_TAG(LOG_TEST, "log-test")
+
+int evaluations = 0;
+
+int evaluate() {
+    return ++evaluations;
+}
+
+std::optional<Level> getLevel(std::string_view tag) {
+    std::optional<Level> result;
+    LogTags::forEach([&](std::string_view name, Level level) {
+        if (name == tag) {
+            result = level;
+        }
+    });
+    return result;
+}
+
+}    // namespace
+
+TEST_CASE("disabled tags skip evaluating arguments") {
+    evaluations = 0;
+    REQUIRE(LogTags::setLevel("log-test", Level::None));
+    LOGTE(LOG_TEST, "Value: %d", evaluate());
+    REQUIRE(evaluations == 0);
+
+    REQUIRE(LogTags::setLevel("log-test", Level::Error));
+    LOGTW(LOG_TEST, "Value: %d", evaluate());
+    REQUIRE(evaluations == 0);
+    LOGTE(LOG_TEST, "Value: %d", evaluate());
+    REQUIRE(evaluations == 1);
+
+    REQUIRE(LogTags::setLevel("log-test", std::nullopt));
+}
+
+TEST_CASE("tag levels can be changed and restored by name") {
+    auto defaultLevel = getLevel("log-test");
+    REQUIRE(defaultLevel.has_value());
+
+    REQUIRE(LogTags::setLevel("log-test", Level::Verbose));
+    REQUIRE(getLevel("log-test") == Level::Verbose);
+    REQUIRE(LogTags::isEnabled(LOG_TEST.id, ESP_LOG_VERBOSE));
+
+    REQUIRE(LogTags::setLevel("log-test", std::nullopt));
+    REQUIRE(getLevel("log-test") == defaultLevel);
+
+    REQUIRE_FALSE(LogTags::setLevel("no-such-tag", Level::Verbose));
+}
+
+TEST_CASE("tags with the same name share their level") {
+    LogTag other("farmhub:log-test", ESP_LOG_ERROR);
+    REQUIRE(other.id == LOG_TEST.id);
+}
+
+TEST_CASE("levels convert to ESP-IDF levels") {
+    REQUIRE(LogTags::toEspLevel(Level::None) == ESP_LOG_NONE);
+    REQUIRE(LogTags::toEspLevel(Level::Error) == ESP_LOG_ERROR);
+    REQUIRE(LogTags::toEspLevel(Level::Verbose) == ESP_LOG_VERBOSE);
+    REQUIRE(LogTags::toLevel(ESP_LOG_NONE) == Level::None);
+    REQUIRE(LogTags::toLevel(ESP_LOG_WARN) == Level::Warning);
+    REQUIRE(LogTags::toLevel(ESP_LOG_DEBUG) == Level::Debug);
+}
+
+TEST_CASE("log benchmark", "[.][benchmark]") {
+    REQUIRE(LogTags::setLevel("log-test", Level::None));
+    std::string topic = "devices/ugly-duckling/test/telemetry";
+
+    BENCHMARK("Filtered-out log call") {
+        LOGTE(LOG_TEST, "Published to '%s': %s", topic.c_str(), std::to_string(evaluate()).c_str());
+    };
+
+    // What a filtered-out call costs if its arguments are evaluated before the level is checked
+    BENCHMARK("Evaluating the arguments only") {
+        return std::to_string(evaluate()).length() + topic.length();
+    };
+
+    REQUIRE(LogTags::setLevel("log-test", std::nullopt));
+}
@@ -0,0 +1,214 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include <Configuration.hpp>
+#include <Manager.hpp>
+
+#include "AllocationTracking.hpp"
+
+using namespace std::chrono;
+using namespace farmhub::kernel;
+
+namespace {
+
+struct TestProductSettings : ConfigurationSection {
+    Property<std::string> pin { this, "pin" };
+    Property<int> air { this, "air", 3000 };
+    Property<int> water { this, "water", 1000 };
+    Property<seconds> interval { this, "interval", 1min };
+};
+
+struct TestProduct {
+    std::shared_ptr<TestProductSettings> settings;
+};
+
+using TestCreateFn = std::function<Handle(JsonObjectConst settings)>;
+using TestFactory = Factory<TestCreateFn>;
+
+TestFactory makeTestFactory(const std::string& type) {
+    return TestFactory {
+        .factoryType = type,
+        .productType = type,
+        .create = [](JsonObjectConst jsonSettings) {
+            auto settings = std::make_shared<TestProductSettings>();
+            settings->load(jsonSettings);
+            return Handle::wrap(std::make_shared<TestProduct>(settings));
+        },
+    };
+}
+
+std::string toJsonString(JsonVariantConst json) {
+    std::string jsonString;
+    serializeJson(json, jsonString);
+    return jsonString;
+}
+
+std::string productSettings(int index) {
+    return R"({"name":"sensor-)" + std::to_string(index) + R"(","type":"soil-moisture","params":{"pin":"A)" + std::to_string(index % 8) + R"(","air":3017,"water":1105,"interval":30}})";
+}
+
+// How products were created before: parameters went through a string, parsed once more to create the product
+// and once more to report them in the init message
+struct LegacyProductSettings : ConfigurationSection {
+    Property<std::string> name { this, "name" };
+    Property<std::string> type { this, "type" };
+    Property<JsonAsString> params { this, "params" };
+};
+
+std::shared_ptr<TestProductSettings> createLegacy(const std::string& settingsAsString, JsonObject initJson) {
+    LegacyProductSettings settings;
+    settings.loadFromString(settingsAsString);
+    initJson["name"] = settings.name.get();
+    initJson["type"] = settings.type.get();
+    settings.params.store(initJson);
+    auto product = std::make_shared<TestProductSettings>();
+    product->loadFromString(settings.params.get().get());
+    return product;
+}
+
+}    // namespace
+
+TEST_CASE("products are created with their parameters") {
+    SettingsBasedManager<TestFactory> manager("product");
+    manager.registerFactory(makeTestFactory("soil-moisture"));
+
+    JsonDocument initDoc;
+    auto initJson = initDoc.to<JsonObject>();
+    manager.createFromSettings(productSettings(3), initJson, [](const std::string& /*name*/, const TestFactory& factory, JsonObjectConst params) {
+        return factory.create(params);
+    });
+
+    auto product = manager.getInstance<TestProduct>("sensor-3");
+    REQUIRE(product->settings->pin.get() == "A3");
+    REQUIRE(product->settings->air.get() == 3017);
+    REQUIRE(product->settings->interval.get() == 30s);
+
+    REQUIRE(initJson["name"] == "sensor-3");
+    REQUIRE(initJson["factory"] == "soil-moisture");
+    REQUIRE(initJson["params"]["pin"] == "A3");
+    REQUIRE(initJson["params"]["water"] == 1105);
+}
+
+TEST_CASE("products without parameters get the defaults") {
+    SettingsBasedManager<TestFactory> manager("product");
+    manager.registerFactory(makeTestFactory("soil-moisture"));
+
+    JsonDocument initDoc;
+    auto initJson = initDoc.to<JsonObject>();
+    manager.createFromSettings(R"({"name":"plain","type":"soil-moisture"})", initJson, [](const std::string& /*name*/, const TestFactory& factory, JsonObjectConst params) {
+        return factory.create(params);
+    });
+
+    auto product = manager.getInstance<TestProduct>("plain");
+    REQUIRE(!product->settings->pin.hasValue());
+    REQUIRE(product->settings->air.get() == 3000);
+    REQUIRE(initJson["params"].isNull());
+}
+
+TEST_CASE("invalid settings are reported") {
+    SettingsBasedManager<TestFactory> manager("product");
+    manager.registerFactory(makeTestFactory("soil-moisture"));
+
+    JsonDocument initDoc;
+    auto make = [](const std::string& /*name*/, const TestFactory& factory, JsonObjectConst params) {
+        return factory.create(params);
+    };
+    REQUIRE_THROWS(manager.createFromSettings("NOT JSON", initDoc.to<JsonObject>(), make));
+    REQUIRE_THROWS(manager.createFromSettings(R"({"name":"x","type":"unknown"})", initDoc.to<JsonObject>(), make));
+}
+
+TEST_CASE("borrowed parameters match the ones passed through strings") {
+    constexpr int PRODUCTS = 30;
+    JsonDocument legacyInitDoc;
+    auto legacyInitJson = legacyInitDoc.to<JsonArray>();
+    std::vector<std::shared_ptr<TestProductSettings>> legacyProducts;
+    SettingsBasedManager<TestFactory> manager("product");
+    manager.registerFactory(makeTestFactory("soil-moisture"));
+    JsonDocument initDoc;
+    auto initJson = initDoc.to<JsonArray>();
+    for (int i = 0; i < PRODUCTS; i++) {
+        auto setting = productSettings(i);
+        legacyProducts.push_back(createLegacy(setting, legacyInitJson.add<JsonObject>()));
+        manager.createFromSettings(setting, initJson.add<JsonObject>(), [](const std::string& /*name*/, const TestFactory& factory, JsonObjectConst params) {
+            return factory.create(params);
+        });
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        auto product = manager.getInstance<TestProduct>("sensor-" + std::to_string(i));
+        REQUIRE(product->settings->pin.get() == legacyProducts[i]->pin.get());
+        REQUIRE(toJsonString(initJson[i]["params"]) == toJsonString(legacyInitJson[i]["params"]));
+    }
+}
+
+// Figures are only meaningful with the real ArduinoJson
+TEST_CASE("product creation benchmark", "[.][benchmark]") {
+    constexpr int PRODUCTS = 30;
+    std::vector<std::string> settings;
+    for (int i = 0; i < PRODUCTS; i++) {
+        settings.push_back(productSettings(i));
+    }
+
+    {
+        JsonDocument legacyInitDoc;
+        auto legacyInitJson = legacyInitDoc.to<JsonArray>();
+        std::vector<std::shared_ptr<TestProductSettings>> legacyProducts;
+        auto legacyStart = steady_clock::now();
+        auto legacy = measureAllocations([&]() {
+            for (const auto& setting : settings) {
+                legacyProducts.push_back(createLegacy(setting, legacyInitJson.add<JsonObject>()));
+            }
+        });
+        auto legacyTime = duration_cast<microseconds>(steady_clock::now() - legacyStart);
+
+        // The way peripherals are created at boot: all settings are parsed first,
+        // then each product is created from its parsed settings with its own init message
+        using ParsedSettings = SettingsBasedManager<TestFactory>::ParsedSettings;
+        SettingsBasedManager<TestFactory> manager("product");
+        manager.registerFactory(makeTestFactory("soil-moisture"));
+        std::vector<ParsedSettings> parsed;
+        std::vector<JsonDocument> initDocs(PRODUCTS);
+        auto borrowedStart = steady_clock::now();
+        auto borrowed = measureAllocations([&]() {
+            parsed.reserve(PRODUCTS);
+            for (const auto& setting : settings) {
+                parsed.push_back(manager.parseSettings(setting));
+            }
+            for (int i = 0; i < PRODUCTS; i++) {
+                manager.createFromParsedSettings(parsed[i], initDocs[i].to<JsonObject>(), [](const std::string& /*name*/, const TestFactory& factory, JsonObjectConst params) {
+                    return factory.create(params);
+                });
+            }
+        });
+        auto borrowedTime = duration_cast<microseconds>(steady_clock::now() - borrowedStart);
+        REQUIRE(manager.getInstance<TestProduct>("sensor-29")->settings->pin.get() == "A5");
+
+        WARN("Creating " << PRODUCTS << " products: "
+                         << "through strings " << legacyTime.count() << " us, " << legacy.count << " allocations, peak " << legacy.peakBytes << " bytes; "
+                         << "borrowed " << borrowedTime.count() << " us, " << borrowed.count << " allocations, peak " << borrowed.peakBytes << " bytes");
+    }
+
+    BENCHMARK("through strings") {
+        JsonDocument initDoc;
+        return createLegacy(settings[1], initDoc.to<JsonObject>());
+    };
+
+    BENCHMARK("borrowed") {
+        // A fresh manager each time, as names must be unique
+        SettingsBasedManager<TestFactory> manager("product");
+        manager.registerFactory(makeTestFactory("soil-moisture"));
+        JsonDocument initDoc;
+        manager.createFromSettings(settings[1], initDoc.to<JsonObject>(), [](const std::string& /*name*/, const TestFactory& factory, JsonObjectConst params) {
+            return factory.create(params);
+        });
+        return manager.getInstance<TestProduct>("sensor-1");
+    };
+}
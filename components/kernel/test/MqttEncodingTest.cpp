@@ -0,0 +1,146 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <mqtt/MqttEncoding.hpp>
+#include <mqtt/MqttPayload.hpp>
+
+using namespace farmhub::kernel::mqtt;
+
+namespace {
+
+void addFeature(JsonArray& features, const char* type, const char* name, const std::function<void(JsonObject&)>& populate) {
+    auto feature = features.add<JsonObject>();
+    feature["type"] = type;
+    feature["name"] = name;
+    auto data = feature["data"].to<JsonObject>();
+    populate(data);
+}
+
+// Telemetry as published by data-templates/plot-controller-mk6-fully-equipped.json
+JsonDocument plotControllerTelemetry() {
+    JsonDocument doc;
+    auto telemetry = doc.to<JsonObject>();
+    telemetry["uptime"] = 86400123;
+    telemetry["timestamp"] = 1760601600123LL;
+    auto battery = telemetry["battery"].to<JsonObject>();
+    battery["voltage"] = 3.912;
+    battery["percentage"] = 78;
+    auto wifi = telemetry["wifi"].to<JsonObject>();
+    wifi["rssi"] = -67;
+    auto mqtt = telemetry["mqtt"].to<JsonObject>();
+    mqtt["payload-fallbacks"] = 0;
+    auto handlers = mqtt["handlers"].to<JsonObject>();
+    handlers["workers"] = 2;
+    handlers["capacity"] = 16;
+    handlers["queued"] = 0;
+    handlers["peak-queued"] = 1;
+    handlers["busy"] = 0;
+    handlers["dropped"] = 0;
+    auto latency = handlers["latency"].to<JsonObject>();
+    latency["p50"] = 3;
+    latency["p90"] = 12;
+    latency["p99"] = 40;
+    auto incoming = mqtt["incoming"].to<JsonObject>();
+    incoming["reassembled"] = 0;
+    incoming["timeouts"] = 0;
+    incoming["oversized"] = 0;
+    incoming["out-of-order"] = 0;
+    auto pm = telemetry["pm"].to<JsonObject>();
+    pm["sleep-ratio"] = 0.93;
+    pm["sleep-count"] = 1204;
+
+    auto features = telemetry["features"].to<JsonArray>();
+    addFeature(features, "flow", "flow-meter", [](JsonObject& data) {
+        data["volume"] = 1.25;
+        data["rate"] = 4.6875;
+    });
+    addFeature(features, "valve", "valve", [](JsonObject& data) {
+        data["state"] = 1;
+    });
+    addFeature(features, "temperature", "soil-temperature", [](JsonObject& data) {
+        data["value"] = 18.4375;
+    });
+    addFeature(features, "moisture", "raw-soil-moisture", [](JsonObject& data) {
+        data["value"] = 41.73;
+    });
+    addFeature(features, "moisture", "soil-moisture", [](JsonObject& data) {
+        data["value"] = 42.118;
+    });
+    addFeature(features, "kalman-beta", "soil-moisture", [](JsonObject& data) {
+        data["value"] = 0.0021;
+    });
+    return doc;
+}
+
+std::vector<uint8_t> bytesOf(const MqttPayload& payload) {
+    return { payload.data(), payload.data() + payload.size() };
+}
+
+}    // namespace
+
+TEST_CASE("key dictionary codes are unique and stable") {
+    std::set<std::string_view> keys(MqttKeyDictionary::KEYS.begin(), MqttKeyDictionary::KEYS.end());
+    REQUIRE(keys.size() == MqttKeyDictionary::KEYS.size());
+    REQUIRE(MqttKeyDictionary::KEYS.size() <= 128);
+    for (size_t i = 0; i < MqttKeyDictionary::KEYS.size(); i++) {
+        REQUIRE(MqttKeyDictionary::find(MqttKeyDictionary::KEYS[i]) == i);
+    }
+    // Codes are part of the wire format
+    REQUIRE(MqttKeyDictionary::find("uptime") == 0);
+    REQUIRE(MqttKeyDictionary::find("features") == 2);
+    REQUIRE(MqttKeyDictionary::find("value") == 6);
+    REQUIRE_FALSE(MqttKeyDictionary::find("no-such-key").has_value());
+}
+
+TEST_CASE("dictionary keys are written as integers") {
+    MqttPayloadPool pool(1, 256);
+    JsonDocument doc;
+    doc["value"] = 1;
+    doc["other"] = true;
+    auto payload = pool.serialize(doc, MqttEncoding::MsgPackWithKeys);
+    REQUIRE(bytesOf(payload) == std::vector<uint8_t> { 0x82, 0x06, 0x01, 0xa5, 'o', 't', 'h', 'e', 'r', 0xc3 });
+}
+
+TEST_CASE("keys outside the dictionary are written like plain MessagePack") {
+    MqttPayloadPool pool(2, 256);
+    JsonDocument doc;
+    doc["a"] = -1000;
+    doc["b"] = 3000000000U;
+    doc["c"] = 1.5;
+    doc["d"] = 0.1;
+    doc["e"] = "text";
+    doc["f"].to<JsonArray>().add<JsonVariant>();
+    auto plain = pool.serialize(doc, MqttEncoding::MsgPack);
+    auto withKeys = pool.serialize(doc, MqttEncoding::MsgPackWithKeys);
+    REQUIRE(bytesOf(withKeys) == bytesOf(plain));
+}
+
+TEST_CASE("binary encodings shrink plot controller telemetry") {
+    MqttPayloadPool pool(3, 1024);
+    auto doc = plotControllerTelemetry();
+    auto json = pool.serialize(doc, MqttEncoding::Json);
+    auto msgPack = pool.serialize(doc, MqttEncoding::MsgPack);
+    auto msgPackWithKeys = pool.serialize(doc, MqttEncoding::MsgPackWithKeys);
+    REQUIRE(pool.getFallbacks() == 0);
+    REQUIRE(msgPack.size() < json.size());
+    REQUIRE(msgPackWithKeys.size() < msgPack.size());
+}
+
+TEST_CASE("telemetry encoding benchmark", "[.][benchmark]") {
+    MqttPayloadPool pool(1, 2048);
+    auto doc = plotControllerTelemetry();
+
+    for (auto encoding : { MqttEncoding::Json, MqttEncoding::MsgPack, MqttEncoding::MsgPackWithKeys }) {
+        JsonDocument name;
+        name.set(encoding);
+        auto label = name.as<std::string>();
+        WARN(label << ": " << pool.serialize(doc, encoding).size() << " bytes");
+        BENCHMARK(label.c_str()) {
+            return pool.serialize(doc, encoding).size();
+        };
+    }
+}
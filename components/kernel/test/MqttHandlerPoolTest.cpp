@@ -0,0 +1,106 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Concurrent.hpp>
+#include <Task.hpp>
+
+#include <mqtt/MqttHandlerPool.hpp>
+
+using namespace std::chrono_literals;
+using namespace farmhub::kernel;
+using namespace farmhub::kernel::mqtt;
+
+namespace {
+
+std::shared_ptr<MqttHandlerPool::Config> createConfig(const std::string& json) {
+    auto config = std::make_shared<MqttHandlerPool::Config>();
+    config->loadFromString(json);
+    return config;
+}
+
+// Worker tasks run forever, so pools created in tests are never destroyed
+MqttHandlerPool& createPool(const std::string& json) {
+    return *new MqttHandlerPool(createConfig(json));
+}
+
+MqttPayload payloadOf(const std::string& json) {
+    static MqttSizeClassPool buffers(1024, 4);
+    auto payload = buffers.acquire(json.length() + 1);
+    payload.append(json.data(), json.length());
+    return payload;
+}
+
+void awaitIdle(MqttHandlerPool& pool) {
+    for (int i = 0; i < 200 && pool.getQueued() > 0; i++) {
+        Task::delay(10ms);
+    }
+}
+
+}    // namespace
+
+TEST_CASE("handler pool delivers messages on the same topic in order") {
+    auto& pool = createPool(R"({"workers":3,"backlog":60})");
+
+    Mutex mutex;
+    std::map<std::string, std::vector<int>> received;
+    SubscriptionHandler handler = [&](const std::string& topic, const JsonObject& json) {
+        Lock lock(mutex);
+        received[topic].push_back(json["seq"].as<int>());
+    };
+
+    for (int seq = 0; seq < 10; seq++) {
+        for (const auto* topic : { "functions/a/config", "functions/b/config", "functions/c/config" }) {
+            REQUIRE(pool.dispatch(topic, payloadOf(R"({"seq":)" + std::to_string(seq) + "}"), { handler }));
+        }
+    }
+    awaitIdle(pool);
+
+    Lock lock(mutex);
+    REQUIRE(received.size() == 3);
+    for (const auto& [topic, sequence] : received) {
+        REQUIRE(sequence == std::vector<int> { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 });
+    }
+}
+
+TEST_CASE("handler pool calls every handler for a message") {
+    auto& pool = createPool(R"({"workers":1})");
+
+    std::atomic<int> calls = 0;
+    SubscriptionHandler handler = [&](const std::string&, const JsonObject&) {
+        calls++;
+    };
+    REQUIRE(pool.dispatch("commands/ping", payloadOf("{}"), { handler, handler }));
+    awaitIdle(pool);
+    REQUIRE(calls == 2);
+}
+
+TEST_CASE("handler pool drops messages when the backlog is full") {
+    auto& pool = createPool(R"({"workers":1,"backlog":2,"backlogTimeout":10})");
+
+    CopyQueue<bool> release("release", 1);
+    SubscriptionHandler blockingHandler = [&](const std::string&, const JsonObject&) {
+        release.take();
+    };
+
+    // The first message is taken by the worker, the next two fill the backlog
+    int accepted = 0;
+    for (int i = 0; i < 5; i++) {
+        if (pool.dispatch("commands/slow", payloadOf("{}"), { blockingHandler })) {
+            accepted++;
+        }
+        Task::delay(20ms);
+    }
+    REQUIRE(accepted == 3);
+    REQUIRE(pool.getDropped() == 2);
+
+    for (int i = 0; i < accepted; i++) {
+        release.put(true);
+    }
+    awaitIdle(pool);
+    REQUIRE(pool.getQueued() == 0);
+}
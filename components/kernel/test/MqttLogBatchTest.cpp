@@ -0,0 +1,177 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mqtt/MqttLogBatch.hpp>
+
+#include "AllocationTracking.hpp"
+
+using namespace farmhub::kernel;
+using namespace farmhub::kernel::mqtt;
+
+namespace {
+
+std::shared_ptr<MqttLogBatch::Config> createConfig(const std::string& json) {
+    auto config = std::make_shared<MqttLogBatch::Config>();
+    config->loadFromString(json);
+    return config;
+}
+
+JsonDocument flush(MqttLogBatch& batch) {
+    JsonDocument doc;
+    auto json = doc.to<JsonObject>();
+    batch.flush(json);
+    return doc;
+}
+
+}    // namespace
+
+TEST_CASE("batch is flushed when it grows too big") {
+    MqttLogBatch batch(createConfig(R"({"maxSize":20})"));
+    REQUIRE_FALSE(batch.add(Level::Info, "0123456789"));
+    REQUIRE(batch.add(Level::Info, "abcdefghij"));
+
+    auto doc = flush(batch);
+    REQUIRE(doc["lines"].size() == 2);
+    REQUIRE(doc["lines"][0]["message"] == "0123456789");
+    REQUIRE(doc["lines"][1]["level"] == static_cast<int>(Level::Info));
+    REQUIRE(batch.empty());
+
+    // Size is counted from scratch after flushing
+    REQUIRE_FALSE(batch.add(Level::Info, "0123456789"));
+}
+
+TEST_CASE("severe lines are flushed right away") {
+    MqttLogBatch batch(createConfig(R"({"flushLevel":3})"));
+    REQUIRE_FALSE(batch.add(Level::Info, "info"));
+    REQUIRE(batch.add(Level::Warning, "warning"));
+    REQUIRE(batch.add(Level::Error, "error"));
+}
+
+TEST_CASE("batch is due once its oldest line is old enough") {
+    MqttLogBatch batch(createConfig(R"({"maxAge":1000})"));
+    steady_clock::time_point start;
+    REQUIRE_FALSE(batch.isDue(start + 1h));
+    REQUIRE(batch.timeUntilDue(start) == milliseconds::max());
+
+    batch.add(Level::Info, "first", start);
+    batch.add(Level::Info, "second", start + 600ms);
+    REQUIRE(batch.timeUntilDue(start + 600ms) == 400ms);
+    REQUIRE_FALSE(batch.isDue(start + 999ms));
+    REQUIRE(batch.isDue(start + 1000ms));
+    REQUIRE(batch.timeUntilDue(start + 2000ms) == 0ms);
+
+    flush(batch);
+    REQUIRE_FALSE(batch.isDue(start + 1h));
+}
+
+TEST_CASE("consecutive lines differing only in their timestamp are collapsed") {
+    MqttLogBatch batch(createConfig("{}"));
+    for (int i = 0; i < 5; i++) {
+        batch.add(Level::Info, "(" + std::to_string(1000 + i) + ") env: same");
+    }
+    batch.add(Level::Debug, "(1005) env: same");
+    batch.add(Level::Info, "(1006) env: other");
+    batch.add(Level::Info, "(1007) env: same");
+
+    JsonDocument doc;
+    auto json = doc.to<JsonObject>();
+    REQUIRE(batch.flush(json) == 8);
+    REQUIRE(doc["lines"].size() == 4);
+    // The first line is kept with its timestamp
+    REQUIRE(doc["lines"][0]["message"] == "(1000) env: same");
+    REQUIRE(doc["lines"][0]["repeated"] == 5);
+    REQUIRE_FALSE(doc["lines"][1]["repeated"].is<int>());
+    REQUIRE(doc["lines"][3]["message"] == "(1007) env: same");
+}
+
+TEST_CASE("lines without a timestamp are compared whole") {
+    MqttLogBatch batch(createConfig("{}"));
+    batch.add(Level::Info, "same");
+    batch.add(Level::Info, "same");
+    batch.add(Level::Info, "(1000) same");
+
+    auto doc = flush(batch);
+    REQUIRE(doc["lines"].size() == 1);
+    REQUIRE(doc["lines"][0]["message"] == "same");
+    REQUIRE(doc["lines"][0]["repeated"] == 3);
+}
+
+TEST_CASE("console records are stripped of their level and newline") {
+    REQUIRE(MqttLogBatch::lineOf("I (1234) env: measured\n") == "(1234) env: measured");
+    REQUIRE(MqttLogBatch::lineOf("E (1234) env: failed") == "(1234) env: failed");
+    REQUIRE(MqttLogBatch::lineOf("") == "");
+}
+
+TEST_CASE("batches are numbered and report dropped lines once") {
+    MqttLogBatch batch(createConfig("{}"));
+    batch.add(Level::Info, "first");
+    batch.countDropped(3);
+    auto first = flush(batch);
+    REQUIRE(first["seq"] == 0);
+    REQUIRE(first["dropped"] == 3);
+
+    batch.add(Level::Info, "second");
+    auto second = flush(batch);
+    REQUIRE(second["seq"] == 1);
+    REQUIRE(second["dropped"] == 0);
+}
+
+TEST_CASE("batching cuts publishes and allocations during a log flood") {
+    // A minute of 100 lines per second, where a misbehaving peripheral repeats the same error
+    constexpr int SECONDS = 60;
+    constexpr int LINES_PER_SECOND = 100;
+    // Records as the console produces them, with uptime in milliseconds
+    std::vector<std::string> lines;
+    for (int i = 0; i < SECONDS * LINES_PER_SECOND; i++) {
+        auto timestamp = "(" + std::to_string(i * 1000 / LINES_PER_SECOND) + ") ";
+        lines.push_back(i % 4 == 0
+                ? "I " + timestamp + "env: Reading sensor " + std::to_string(i) + "\n"
+                : "I " + timestamp + "env: Sensor busy, retrying\n");
+    }
+
+    size_t legacyPublishes = 0;
+    auto legacy = measureAllocations([&]() {
+        for (const auto& line : lines) {
+            // Every line used to be published in its own message
+            JsonDocument doc;
+            doc["level"] = Level::Info;
+            doc["message"] = MqttLogBatch::lineOf(line);
+            std::string payload;
+            serializeJson(doc, payload);
+            legacyPublishes++;
+        }
+    });
+
+    MqttLogBatch batch(createConfig("{}"));
+    size_t batchedPublishes = 0;
+    size_t batchedLines = 0;
+    steady_clock::time_point start;
+    auto publish = [&]() {
+        JsonDocument doc;
+        auto json = doc.to<JsonObject>();
+        batchedLines += batch.flush(json);
+        std::string payload;
+        serializeJson(doc, payload);
+        batchedPublishes++;
+    };
+    auto batched = measureAllocations([&]() {
+        for (size_t i = 0; i < lines.size(); i++) {
+            auto now = start + milliseconds(i * 1000 / LINES_PER_SECOND);
+            if (batch.add(Level::Info, MqttLogBatch::lineOf(lines[i]), now) || batch.isDue(now)) {
+                publish();
+            }
+        }
+        if (!batch.empty()) {
+            publish();
+        }
+    });
+
+    WARN("Per minute: legacy " << legacyPublishes << " publishes, " << legacy.count << " allocations, " << legacy.bytes << " bytes; "
+                               << "batched " << batchedPublishes << " publishes, " << batched.count << " allocations, " << batched.bytes << " bytes");
+    REQUIRE(batchedLines == lines.size());
+    REQUIRE(batchedPublishes * 10 < legacyPublishes);
+    REQUIRE(batched.count < legacy.count);
+}
@@ -0,0 +1,206 @@
+#include <sdkconfig.h>
+
+// Needs a writable file system, see TemporaryFileSystem.hpp
+#if CONFIG_IDF_TARGET_LINUX
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mqtt/MqttOutbox.hpp>
+
+#include <TemporaryFileSystem.hpp>
+
+using namespace farmhub::kernel;
+using namespace farmhub::kernel::mqtt;
+using namespace farmhub::test;
+
+namespace {
+
+std::shared_ptr<FileSystem> createTempFileSystem() {
+    return std::make_shared<TemporaryFileSystem>("outbox-test");
+}
+
+std::shared_ptr<MqttOutbox::Config> createConfig(const std::string& json) {
+    auto config = std::make_shared<MqttOutbox::Config>();
+    config->loadFromString(json);
+    return config;
+}
+
+std::string payload(int i) {
+    return "{\"value\":" + std::to_string(i) + "}";
+}
+
+std::vector<std::string> replayAll(MqttOutbox& outbox) {
+    std::vector<std::string> payloads;
+    while (outbox.readBatch([&](const MqttOutbox::Record& record) {
+        payloads.push_back(record.payload);
+    }) > 0) {
+        outbox.commitBatch();
+    }
+    return payloads;
+}
+
+}    // namespace
+
+TEST_CASE("outbox replays messages in order across segments") {
+    auto fs = createTempFileSystem();
+    MqttOutbox outbox(fs, createConfig(R"({"segments":4,"segmentSize":256,"replayBatchSize":3})"));
+    REQUIRE(outbox.isEnabled());
+    REQUIRE(outbox.isEmpty());
+    REQUIRE(fs->exists("/outbox"));
+
+    for (int i = 0; i < 10; i++) {
+        REQUIRE(outbox.append("devices/test/telemetry", payload(i), 1, false));
+    }
+    REQUIRE(outbox.getDepth() == 10);
+
+    auto replayed = replayAll(outbox);
+    REQUIRE(replayed.size() == 10);
+    for (int i = 0; i < 10; i++) {
+        REQUIRE(replayed[i] == payload(i));
+    }
+    REQUIRE(outbox.isEmpty());
+    REQUIRE(outbox.getBytes() == 0);
+}
+
+TEST_CASE("outbox replays an uncommitted batch again") {
+    auto fs = createTempFileSystem();
+    MqttOutbox outbox(fs, createConfig(R"({"replayBatchSize":2})"));
+    for (int i = 0; i < 3; i++) {
+        REQUIRE(outbox.append("topic", payload(i), 1, true));
+    }
+
+    std::vector<MqttOutbox::Record> records;
+    auto collect = [&](const MqttOutbox::Record& record) {
+        records.push_back(record);
+    };
+
+    REQUIRE(outbox.readBatch(collect) == 2);
+    // Broker went away before acknowledging the batch
+    outbox.abortBatch();
+    REQUIRE(outbox.getDepth() == 3);
+
+    records.clear();
+    REQUIRE(outbox.readBatch(collect) == 2);
+    REQUIRE(records[0].topic == "topic");
+    REQUIRE(records[0].payload == payload(0));
+    REQUIRE(records[0].qos == 1);
+    REQUIRE(records[0].retain);
+    outbox.commitBatch();
+    REQUIRE(outbox.getDepth() == 1);
+
+    records.clear();
+    REQUIRE(outbox.readBatch(collect) == 1);
+    REQUIRE(records[0].payload == payload(2));
+    outbox.commitBatch();
+    REQUIRE(outbox.isEmpty());
+}
+
+TEST_CASE("outbox drops the oldest segment when full") {
+    auto fs = createTempFileSystem();
+    // Each record is 10 bytes of header, 5 bytes of topic and 11 bytes of payload
+    MqttOutbox outbox(fs, createConfig(R"({"segments":2,"segmentSize":60})"));
+    for (int i = 0; i < 10; i++) {
+        REQUIRE(outbox.append("topic", payload(i), 1, false));
+    }
+
+    auto replayed = replayAll(outbox);
+    REQUIRE(replayed.size() < 10);
+    REQUIRE(replayed.back() == payload(9));
+    // What survives is a contiguous run of the most recent messages
+    for (size_t i = 0; i < replayed.size(); i++) {
+        REQUIRE(replayed[i] == payload(static_cast<int>(10 - replayed.size() + i)));
+    }
+}
+
+TEST_CASE("outbox rejects messages larger than a segment") {
+    auto fs = createTempFileSystem();
+    MqttOutbox outbox(fs, createConfig(R"({"segmentSize":32})"));
+    REQUIRE_FALSE(outbox.append("topic", std::string(64, 'x'), 1, false));
+    REQUIRE(outbox.isEmpty());
+}
+
+TEST_CASE("disabled outbox does not store anything") {
+    auto fs = createTempFileSystem();
+    MqttOutbox outbox(fs, createConfig(R"({"segments":0})"));
+    REQUIRE_FALSE(outbox.isEnabled());
+    REQUIRE_FALSE(outbox.append("topic", payload(0), 1, false));
+}
+
+TEST_CASE("outbox recovers messages after restart") {
+    auto fs = createTempFileSystem();
+    auto config = createConfig(R"({"segmentSize":64,"replayBatchSize":1})");
+    {
+        MqttOutbox outbox(fs, config);
+        for (int i = 0; i < 5; i++) {
+            REQUIRE(outbox.append("topic", payload(i), 1, false));
+        }
+        // Replay one message before "rebooting"
+        REQUIRE(outbox.readBatch([](const MqttOutbox::Record&) { }) == 1);
+        outbox.commitBatch();
+    }
+
+    MqttOutbox outbox(fs, config);
+    auto replayed = replayAll(outbox);
+    // Replay is at-least-once: the position within a segment is not persisted,
+    // so the already delivered first message may be delivered again
+    REQUIRE(replayed.back() == payload(4));
+    REQUIRE(replayed.size() >= 4);
+    REQUIRE(outbox.isEmpty());
+}
+
+TEST_CASE("outbox ignores a torn record at the end of a segment") {
+    auto fs = createTempFileSystem();
+    auto config = createConfig(R"({})");
+    {
+        MqttOutbox outbox(fs, config);
+        REQUIRE(outbox.append("topic", payload(0), 1, false));
+        REQUIRE(outbox.append("topic", payload(1), 1, false));
+    }
+    // Simulate power loss in the middle of writing a record
+    const char garbage[] = { 0x01, static_cast<char>(0xFB), 0x01 };
+    REQUIRE(fs->append("/outbox/00000000", garbage, sizeof(garbage)) == sizeof(garbage));
+
+    MqttOutbox outbox(fs, config);
+    REQUIRE(outbox.getDepth() == 2);
+    // New messages go to a fresh segment after the torn one
+    REQUIRE(outbox.append("topic", payload(2), 1, false));
+
+    auto replayed = replayAll(outbox);
+    REQUIRE(replayed == std::vector<std::string> { payload(0), payload(1), payload(2) });
+}
+
+TEST_CASE("outbox drops the rest of a segment after a corrupt record") {
+    auto fs = createTempFileSystem();
+    MqttOutbox outbox(fs, createConfig(R"({})"));
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(outbox.append("topic", payload(i), 1, false));
+    }
+    // Each record is 26 bytes, break the magic of the third one
+    FILE* file = fs->open("/outbox/00000000", "r+");
+    REQUIRE(file != nullptr);
+    REQUIRE(fseek(file, 2 * 26, SEEK_SET) == 0);
+    const char garbage[] = { 0x00, 0x00 };
+    REQUIRE(fwrite(garbage, 1, sizeof(garbage), file) == sizeof(garbage));
+    REQUIRE(fclose(file) == 0);
+
+    std::vector<std::string> replayed;
+    REQUIRE(outbox.readBatch([&](const MqttOutbox::Record& record) {
+        replayed.push_back(record.payload);
+    }) == 2);
+    REQUIRE(outbox.getDepth() == 4);
+    outbox.commitBatch();
+    REQUIRE(replayed == std::vector<std::string> { payload(0), payload(1) });
+    REQUIRE(outbox.isEmpty());
+    REQUIRE(outbox.getBytes() == 0);
+    REQUIRE_FALSE(fs->exists("/outbox/00000000"));
+
+    // The outbox keeps working after the corrupt segment is gone
+    REQUIRE(outbox.append("topic", payload(4), 1, false));
+    REQUIRE(replayAll(outbox) == std::vector<std::string> { payload(4) });
+}
+
+#endif
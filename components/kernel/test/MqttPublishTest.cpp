@@ -0,0 +1,203 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <string>
+
+#include <ArduinoJson.h>
+
+#include <StateManager.hpp>
+#include <mqtt/MqttPayload.hpp>
+#include <mqtt/MqttRoot.hpp>
+#include <mqtt/MqttTopic.hpp>
+
+#include "AllocationTracking.hpp"
+
+using namespace farmhub::kernel;
+using namespace farmhub::kernel::mqtt;
+
+namespace {
+
+void populateTelemetry(JsonDocument& doc) {
+    auto root = doc.to<JsonObject>();
+    root["uptime"] = 1234567;
+    root["timestamp"] = 1735689600000;
+    auto battery = root["battery"].to<JsonObject>();
+    battery["voltage"] = 3.92;
+    battery["percentage"] = 87;
+    auto wifi = root["wifi"].to<JsonObject>();
+    wifi["rssi"] = -67;
+    wifi["uptime"] = 1200000;
+    auto peripherals = root["peripherals"].to<JsonObject>();
+    peripherals["environment"]["temperature"] = 21.5;
+    peripherals["environment"]["humidity"] = 54.3;
+}
+
+const std::string rootTopic = "farm/devices/ugly-duckling/test-device";
+
+// What `MqttRoot::publish()` used to do before handing the message to the queue
+struct LegacyOutgoingMessage {
+    const std::string topic;
+    const std::string payload;
+};
+
+void legacyPublish(const std::string& suffix, const JsonDocument& doc) {
+    std::string topic = rootTopic + "/" + suffix;
+    std::string payload;
+    serializeJson(doc, payload);
+    auto* message = new LegacyOutgoingMessage { topic, payload };
+    delete message;
+}
+
+constexpr size_t PUBLISHES_PER_TOPIC = 4;
+
+/**
+ * @brief A root on a real driver that never connects, so published messages stay in its queue.
+ *
+ * The driver's tasks outlive the test, so the driver is never destroyed.
+ */
+std::shared_ptr<MqttRoot> createDisconnectedRoot() {
+    static StateManager states;
+    static StateSource networkReady = states.createStateSource("network-ready");
+    static StateSource mqttReady = states.createStateSource("mqtt-ready");
+    static auto root = []() {
+        auto config = std::make_shared<MqttDriver::Config>();
+        // Room for every measured message, each with its own pooled buffer
+        config->loadFromString(R"({"queueSize":32,"payloadBufferCount":32,"outbox":{"segments":0}})");
+        auto driver = std::make_shared<MqttDriver>(networkReady, nullptr, nullptr, config, "test-device", mqttReady);
+        return std::make_shared<MqttRoot>(driver, rootTopic);
+    }();
+    return root;
+}
+
+}    // namespace
+
+TEST_CASE("topics are interned once") {
+    MqttTopicRegistry registry;
+    auto telemetry = registry.intern(rootTopic + "/telemetry");
+    auto again = registry.intern(rootTopic + "/telemetry");
+    auto other = registry.intern(rootTopic + "/init");
+    REQUIRE(telemetry == again);
+    REQUIRE(&telemetry.str() == &again.str());
+    REQUIRE(!(telemetry == other));
+    REQUIRE(telemetry.str() == rootTopic + "/telemetry");
+
+    auto stats = measureAllocations([&]() {
+        (void) registry.intern("farm/devices/ugly-duckling/test-device/telemetry");
+    });
+    REQUIRE(stats.count == 0);
+}
+
+TEST_CASE("transient topics are not interned") {
+    MqttTopicRegistry registry;
+    auto interned = registry.intern(rootTopic + "/responses/ping");
+    auto transient = MqttTopic::transient(rootTopic + "/responses/ping");
+    REQUIRE(transient == interned);
+    REQUIRE(interned == transient);
+    REQUIRE(&transient.str() != &interned.str());
+    REQUIRE(!(transient == MqttTopic::transient(rootTopic + "/responses/restart")));
+
+    // Copies share the name
+    auto topic = MqttTopic::transient(rootTopic + "/responses/ping");
+    auto stats = measureAllocations([&]() {
+        auto copy = topic;
+        REQUIRE(&copy.str() == &topic.str());
+    });
+    REQUIRE(stats.count == 0);
+}
+
+TEST_CASE("payloads are serialized into pooled buffers") {
+    MqttPayloadPool pool(2, 512);
+    JsonDocument doc;
+    populateTelemetry(doc);
+    std::string expected;
+    serializeJson(doc, expected);
+
+    auto payload = pool.serialize(doc);
+    REQUIRE(payload.view() == expected);
+    REQUIRE(payload.capacity() == 512);
+    REQUIRE(pool.getFallbacks() == 0);
+
+    SECTION("buffers are returned to the pool") {
+        const char* buffer = payload.data();
+        payload = MqttPayload();
+        auto first = pool.serialize(doc);
+        auto second = pool.serialize(doc);
+        REQUIRE((first.data() == buffer || second.data() == buffer));
+        REQUIRE(pool.getFallbacks() == 0);
+    }
+
+    SECTION("moving a payload transfers the buffer") {
+        const char* buffer = payload.data();
+        MqttPayload moved = std::move(payload);
+        REQUIRE(moved.data() == buffer);
+        REQUIRE(moved.view() == expected);
+        REQUIRE(payload.size() == 0);
+    }
+
+    SECTION("falls back to the heap when the pool is exhausted") {
+        auto second = pool.serialize(doc);
+        auto third = pool.serialize(doc);
+        REQUIRE(third.view() == expected);
+        REQUIRE(pool.getFallbacks() == 1);
+    }
+}
+
+TEST_CASE("payloads larger than a pooled buffer are allocated on the heap") {
+    MqttPayloadPool pool(2, 16);
+    JsonDocument doc;
+    populateTelemetry(doc);
+    std::string expected;
+    serializeJson(doc, expected);
+
+    auto payload = pool.serialize(doc);
+    REQUIRE(payload.view() == expected);
+    REQUIRE(payload.capacity() == expected.length() + 1);
+    REQUIRE(pool.getFallbacks() == 1);
+}
+
+TEST_CASE("publish path benchmark", "[.][benchmark]") {
+    auto root = createDisconnectedRoot();
+    auto telemetryTopic = root->topic("telemetry");
+    root->registerCommand("ping", [](const JsonObject&, JsonObject&) { });
+    JsonDocument doc;
+    populateTelemetry(doc);
+
+    // Warm up anything lazily initialized, like power management locks
+    legacyPublish("telemetry", doc);
+    REQUIRE(root->publish(telemetryTopic, doc, Retention::NoRetain, QoS::AtMostOnce, ticks::zero()) == PublishStatus::Pending);
+
+    auto legacy = measureAllocations([&]() {
+        legacyPublish("telemetry", doc);
+    });
+    // Messages are only queued, as the driver never connects
+    auto registered = measureAllocations([&]() {
+        for (size_t i = 0; i < PUBLISHES_PER_TOPIC; i++) {
+            REQUIRE(root->publish(telemetryTopic, doc, Retention::NoRetain, QoS::AtMostOnce, ticks::zero()) == PublishStatus::Pending);
+        }
+    });
+    auto bySuffix = measureAllocations([&]() {
+        for (size_t i = 0; i < PUBLISHES_PER_TOPIC; i++) {
+            REQUIRE(root->publish("responses/ping", doc, Retention::NoRetain, QoS::AtMostOnce, ticks::zero()) == PublishStatus::Pending);
+        }
+    });
+
+    // Every copy on the legacy path lands in a freshly allocated string,
+    // so allocated bytes is also an upper bound on the bytes copied
+    WARN("Per publish: legacy " << legacy.count << " allocations, " << legacy.bytes << " bytes; "
+                                << "MqttDriver::publish() to a registered topic " << registered.count << " allocations, " << registered.bytes << " bytes "
+                                << "in " << PUBLISHES_PER_TOPIC << " publishes; "
+                                << "to a command response by suffix " << bySuffix.count << " allocations, " << bySuffix.bytes << " bytes "
+                                << "in " << PUBLISHES_PER_TOPIC << " publishes");
+    REQUIRE(registered.count == 0);
+    REQUIRE(bySuffix.count == 0);
+
+    MqttPayloadPool pool(4, 1024);
+    BENCHMARK("legacy") {
+        legacyPublish("telemetry", doc);
+    };
+
+    BENCHMARK("pooled serialization") {
+        return pool.serialize(doc);
+    };
+}
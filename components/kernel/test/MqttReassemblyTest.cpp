@@ -0,0 +1,147 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <mqtt/MqttReassembly.hpp>
+
+using namespace std::chrono_literals;
+using namespace farmhub::kernel::mqtt;
+
+namespace {
+
+std::shared_ptr<MqttReassembler::Config> createConfig(const std::string& json) {
+    auto config = std::make_shared<MqttReassembler::Config>();
+    config->loadFromString(json);
+    return config;
+}
+
+/**
+ * @brief Feeds the message in fragments the way the MQTT client does, returns what the last fragment produced.
+ */
+std::optional<MqttIncomingMessage> feed(MqttReassembler& reassembler, const std::string& topic, const std::string& payload, size_t fragmentSize) {
+    std::optional<MqttIncomingMessage> result;
+    size_t offset = 0;
+    do {
+        auto length = std::min(fragmentSize, payload.length() - offset);
+        result = reassembler.onData(
+            offset == 0 ? std::string_view(topic) : std::string_view(),
+            payload.data() + offset,
+            length,
+            offset,
+            payload.length());
+        offset += length;
+    } while (offset < payload.length());
+    return result;
+}
+
+std::string largePayload(size_t length) {
+    std::string payload = R"({"data":")";
+    payload.append(length - payload.length() - 2, 'x');
+    payload.append(R"("})");
+    return payload;
+}
+
+}    // namespace
+
+TEST_CASE("unfragmented message is passed through") {
+    MqttReassembler reassembler(createConfig("{}"));
+    auto message = feed(reassembler, "commands/ping", R"({"a":1})", 8192);
+    REQUIRE(message.has_value());
+    REQUIRE(message->topic == "commands/ping");
+    REQUIRE(message->payload.view() == R"({"a":1})");
+    REQUIRE(reassembler.getReassembled() == 0);
+}
+
+TEST_CASE("fragmented message is delivered whole") {
+    MqttReassembler reassembler(createConfig("{}"));
+    auto payload = largePayload(20000);
+    auto message = feed(reassembler, "files/write", payload, 8192);
+    REQUIRE(message.has_value());
+    REQUIRE(message->topic == "files/write");
+    REQUIRE(message->payload.view() == payload);
+    // Null-terminated so it can be logged and parsed as a C string
+    REQUIRE(message->payload.data()[payload.length()] == '\0');
+    REQUIRE(reassembler.getReassembled() == 1);
+
+    JsonDocument json;
+    REQUIRE_FALSE(deserializeJson(json, message->payload.data(), message->payload.size()));
+    REQUIRE(json["data"].as<std::string>().length() == 20000 - 11);
+}
+
+TEST_CASE("oversized message is dropped with all its fragments") {
+    MqttReassembler reassembler(createConfig(R"({"maxMessageSize":10000})"));
+    REQUIRE_FALSE(feed(reassembler, "files/write", largePayload(20000), 8192).has_value());
+    REQUIRE(reassembler.getOversized() == 1);
+    REQUIRE(reassembler.getOutOfOrder() == 0);
+
+    // The next message is unaffected
+    auto message = feed(reassembler, "commands/ping", "{}", 8192);
+    REQUIRE(message.has_value());
+    REQUIRE(message->payload.view() == "{}");
+}
+
+TEST_CASE("message waiting too long for its next fragment is dropped") {
+    MqttReassembler reassembler(createConfig(R"({"fragmentTimeout":1000})"));
+    auto payload = largePayload(10000);
+    auto start = steady_clock::now();
+    REQUIRE_FALSE(reassembler.onData("files/write", payload.data(), 8192, 0, payload.length(), start).has_value());
+    REQUIRE_FALSE(reassembler.onData("", payload.data() + 8192, payload.length() - 8192, 8192, payload.length(), start + 2s).has_value());
+    REQUIRE(reassembler.getTimeouts() == 1);
+}
+
+TEST_CASE("message abandoned mid-way is expired without further fragments") {
+    MqttReassembler reassembler(createConfig(R"({"fragmentTimeout":1000})"));
+    auto payload = largePayload(10000);
+    auto start = steady_clock::now();
+    REQUIRE_FALSE(reassembler.onData("files/write", payload.data(), 8192, 0, payload.length(), start).has_value());
+    reassembler.expireStale(start + 500ms);
+    REQUIRE(reassembler.getTimeouts() == 0);
+    reassembler.expireStale(start + 2s);
+    REQUIRE(reassembler.getTimeouts() == 1);
+
+    // A late fragment of the expired message is ignored
+    REQUIRE_FALSE(reassembler.onData("", payload.data() + 8192, payload.length() - 8192, 8192, payload.length(), start + 3s).has_value());
+    REQUIRE(reassembler.getTimeouts() == 1);
+    REQUIRE(reassembler.getReassembled() == 0);
+}
+
+TEST_CASE("incomplete message is abandoned when a new one starts") {
+    MqttReassembler reassembler(createConfig("{}"));
+    auto payload = largePayload(10000);
+    REQUIRE_FALSE(reassembler.onData("files/write", payload.data(), 8192, 0, payload.length()).has_value());
+
+    auto message = feed(reassembler, "commands/ping", "{}", 8192);
+    REQUIRE(message.has_value());
+    REQUIRE(message->topic == "commands/ping");
+    REQUIRE(reassembler.getTimeouts() == 1);
+}
+
+TEST_CASE("fragment at unexpected offset drops the message") {
+    MqttReassembler reassembler(createConfig("{}"));
+    auto payload = largePayload(20000);
+    REQUIRE_FALSE(reassembler.onData("files/write", payload.data(), 8192, 0, payload.length()).has_value());
+    REQUIRE_FALSE(reassembler.onData("", payload.data() + 16384, payload.length() - 16384, 16384, payload.length()).has_value());
+    REQUIRE(reassembler.getOutOfOrder() == 1);
+}
+
+TEST_CASE("size class pool reuses released buffers") {
+    MqttSizeClassPool pool(4096, 1);
+    const char* first;
+    {
+        auto payload = pool.acquire(1000);
+        REQUIRE(payload.capacity() == 1024);
+        first = payload.data();
+    }
+    {
+        auto payload = pool.acquire(600);
+        REQUIRE(payload.capacity() == 1024);
+        REQUIRE(payload.data() == first);
+    }
+    auto small = pool.acquire(10);
+    REQUIRE(small.capacity() == 256);
+    auto large = pool.acquire(5000);
+    REQUIRE(large.capacity() == 5000);
+}
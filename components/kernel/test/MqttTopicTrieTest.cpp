@@ -0,0 +1,170 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <mqtt/MqttTopicTrie.hpp>
+
+using namespace farmhub::kernel::mqtt;
+
+namespace {
+
+std::vector<int> matches(const MqttTopicTrie<int>& trie, const std::string& topic) {
+    std::vector<int> result;
+    trie.match(topic, [&](const int& value) {
+        result.push_back(value);
+    });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+const std::string deviceRoot = "farm/devices/ugly-duckling/plot-controller";
+
+// Each function has its own root with a config and a commands subscription
+std::vector<std::string> plotControllerSubscriptions(int functions) {
+    std::vector<std::string> topics { deviceRoot + "/commands/#" };
+    for (int i = 0; i < functions; i++) {
+        auto functionRoot = deviceRoot + "/functions/function-" + std::to_string(i);
+        topics.push_back(functionRoot + "/config");
+        topics.push_back(functionRoot + "/commands/#");
+    }
+    return topics;
+}
+
+}    // namespace
+
+TEST_CASE("exact topics match") {
+    MqttTopicTrie<int> trie;
+    trie.insert("a/b/c", 1);
+    trie.insert("a/b", 2);
+    REQUIRE(matches(trie, "a/b/c") == std::vector<int> { 1 });
+    REQUIRE(matches(trie, "a/b") == std::vector<int> { 2 });
+    REQUIRE(matches(trie, "a").empty());
+    REQUIRE(matches(trie, "a/b/c/d").empty());
+    REQUIRE(matches(trie, "a/x/c").empty());
+}
+
+TEST_CASE("single-level wildcard matches exactly one level") {
+    MqttTopicTrie<int> trie;
+    trie.insert("a/+/c", 1);
+    trie.insert("+", 2);
+    REQUIRE(matches(trie, "a/b/c") == std::vector<int> { 1 });
+    REQUIRE(matches(trie, "a//c") == std::vector<int> { 1 });
+    REQUIRE(matches(trie, "a/b/d").empty());
+    REQUIRE(matches(trie, "a/b/c/d").empty());
+    REQUIRE(matches(trie, "x") == std::vector<int> { 2 });
+}
+
+TEST_CASE("multi-level wildcard matches parent and all children") {
+    MqttTopicTrie<int> trie;
+    trie.insert("a/#", 1);
+    trie.insert("#", 2);
+    REQUIRE(matches(trie, "a") == std::vector<int> { 1, 2 });
+    REQUIRE(matches(trie, "a/b") == std::vector<int> { 1, 2 });
+    REQUIRE(matches(trie, "a/b/c") == std::vector<int> { 1, 2 });
+    REQUIRE(matches(trie, "b") == std::vector<int> { 2 });
+}
+
+TEST_CASE("wildcards in the first level do not match system topics") {
+    MqttTopicTrie<int> trie;
+    trie.insert("#", 1);
+    trie.insert("+/broker", 2);
+    trie.insert("$SYS/#", 3);
+    REQUIRE(matches(trie, "$SYS/broker") == std::vector<int> { 3 });
+}
+
+TEST_CASE("overlapping subscriptions are all delivered") {
+    MqttTopicTrie<int> trie;
+    trie.insert("root/commands/#", 1);
+    trie.insert("root/commands/ping", 2);
+    trie.insert("root/+/ping", 3);
+    trie.insert("root/commands/ping", 4);
+    REQUIRE(trie.size() == 3);
+    REQUIRE(matches(trie, "root/commands/ping") == std::vector<int> { 1, 2, 3, 4 });
+    REQUIRE(trie.match("root/commands/restart", [](const int&) { }) == 1);
+}
+
+TEST_CASE("removing a pattern removes all of its values") {
+    MqttTopicTrie<int> trie;
+    trie.insert("a/b", 1);
+    trie.insert("a/b", 2);
+    trie.insert("a/b/c", 3);
+    trie.insert("a/#", 4);
+
+    REQUIRE(trie.remove("a/b"));
+    REQUIRE(matches(trie, "a/b") == std::vector<int> { 4 });
+    REQUIRE(matches(trie, "a/b/c") == std::vector<int> { 3, 4 });
+    REQUIRE(trie.size() == 2);
+
+    REQUIRE_FALSE(trie.remove("a/b"));
+    REQUIRE_FALSE(trie.remove("x/y"));
+
+    REQUIRE(trie.remove("a/b/c"));
+    REQUIRE(trie.remove("a/#"));
+    REQUIRE(trie.empty());
+    REQUIRE(matches(trie, "a/b/c").empty());
+}
+
+TEST_CASE("patterns can be listed") {
+    MqttTopicTrie<int> trie;
+    trie.insert("a/b", 1);
+    trie.insert("a/b", 2);
+    trie.insert("a/+/c", 3);
+    std::vector<std::string> patterns;
+    trie.forEach([&](const std::string& pattern, const std::vector<int>& values) {
+        patterns.push_back(pattern + ":" + std::to_string(values.size()));
+    });
+    std::sort(patterns.begin(), patterns.end());
+    REQUIRE(patterns == std::vector<std::string> { "a/+/c:1", "a/b:2" });
+}
+
+TEST_CASE("trie agrees with linear matching for a fully equipped device") {
+    auto topics = plotControllerSubscriptions(100);
+    MqttTopicTrie<int> trie;
+    for (size_t i = 0; i < topics.size(); i++) {
+        trie.insert(topics[i], static_cast<int>(i));
+    }
+
+    std::vector<std::string> incoming {
+        deviceRoot + "/commands/ping",
+        deviceRoot + "/functions/function-42/config",
+        deviceRoot + "/functions/function-99/commands/override",
+        deviceRoot + "/functions/function-100/config",
+        deviceRoot + "/telemetry",
+    };
+    for (const auto& topic : incoming) {
+        std::vector<int> expected;
+        for (size_t i = 0; i < topics.size(); i++) {
+            if (topicMatches(topics[i].c_str(), topic.c_str())) {
+                expected.push_back(static_cast<int>(i));
+            }
+        }
+        REQUIRE(matches(trie, topic) == expected);
+    }
+}
+
+TEST_CASE("topic matching benchmark", "[.][benchmark]") {
+    auto topics = plotControllerSubscriptions(200);
+    MqttTopicTrie<int> trie;
+    for (size_t i = 0; i < topics.size(); i++) {
+        trie.insert(topics[i], static_cast<int>(i));
+    }
+    // Worst case for the linear scan: the last subscription matches
+    auto topic = deviceRoot + "/functions/function-199/commands/override";
+
+    BENCHMARK("linear scan over " + std::to_string(topics.size()) + " subscriptions") {
+        size_t count = 0;
+        for (const auto& pattern : topics) {
+            if (topicMatches(pattern.c_str(), topic.c_str())) {
+                count++;
+            }
+        }
+        return count;
+    };
+
+    BENCHMARK("trie over " + std::to_string(topics.size()) + " subscriptions") {
+        return trie.match(topic, [](const int&) { });
+    };
+}
@@ -0,0 +1,226 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <Concurrent.hpp>
+#include <Task.hpp>
+
+#include "AllocationTracking.hpp"
+
+using namespace farmhub::kernel;
+
+namespace {
+
+struct Counted {
+    explicit Counted(int value)
+        : value(value) {
+        alive++;
+    }
+    Counted(const Counted& other)
+        : value(other.value) {
+        alive++;
+    }
+    ~Counted() {
+        alive--;
+    }
+
+    int value;
+    static int alive;
+};
+
+int Counted::alive = 0;
+
+struct Sample {
+    int producer;
+    int sequence;
+};
+
+// About the size of a log record or an MQTT event
+struct Message {
+    std::array<uint8_t, 32> data {};
+};
+
+}    // namespace
+
+TEST_CASE("messages are delivered in order") {
+    PooledQueue<int> queue("test", 4);
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 3; i++) {
+            REQUIRE(queue.offer(round * 10 + i));
+        }
+        REQUIRE(queue.size() == 3);
+        std::vector<int> received;
+        queue.drain([&](int& value) {
+            received.push_back(value);
+        });
+        REQUIRE(received == std::vector<int> { round * 10, round * 10 + 1, round * 10 + 2 });
+        REQUIRE(queue.size() == 0);
+    }
+}
+
+TEST_CASE("capacity is rounded up to a power of two") {
+    PooledQueue<int, QueueProducers::Single> queue("test", 3);
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(queue.offer(i));
+    }
+    REQUIRE_FALSE(queue.offer(4));
+    REQUIRE(queue.poll());
+    REQUIRE(queue.offer(4));
+}
+
+TEST_CASE("footprint covers every slot") {
+    PooledQueue<std::array<char, 40>> queue("test", 5);
+    REQUIRE(queue.getFootprint() >= 8 * 40);
+    REQUIRE(queue.getFootprint() < 8 * (40 + 2 * sizeof(size_t)));
+}
+
+TEST_CASE("messages are constructed in place without allocating") {
+    PooledQueue<Message> queue("test", 8);
+    Message message;
+    auto stats = measureAllocations([&]() {
+        for (int i = 0; i < 100; i++) {
+            queue.offer(message);
+            queue.poll();
+        }
+    });
+    REQUIRE(stats.count == 0);
+}
+
+TEST_CASE("messages are destroyed after handling and on clear") {
+    {
+        PooledQueue<Counted> queue("test", 4);
+        queue.offer(1);
+        queue.offer(2);
+        queue.offer(3);
+        REQUIRE(Counted::alive == 3);
+        queue.poll([](Counted& message) {
+            REQUIRE(message.value == 1);
+        });
+        REQUIRE(Counted::alive == 2);
+        queue.clear();
+        REQUIRE(Counted::alive == 0);
+        queue.offer(4);
+    }
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("polling waits for a message until the timeout") {
+    PooledQueue<int> queue("test", 4);
+    auto start = xTaskGetTickCount();
+    REQUIRE_FALSE(queue.pollIn(ticks(20)));
+    REQUIRE(xTaskGetTickCount() - start >= 20);
+
+    Task::run("producer", 4096, [&queue](Task& /*task*/) {
+        Task::delay(20ms);
+        queue.offer(42);
+    });
+    int received = 0;
+    REQUIRE(queue.pollIn(ticks(1000), [&](int& value) {
+        received = value;
+    }));
+    REQUIRE(received == 42);
+}
+
+TEST_CASE("offering waits for a free slot until the timeout") {
+    PooledQueue<int> queue("test", 2);
+    queue.offer(1);
+    queue.offer(2);
+    REQUIRE_FALSE(queue.offerIn(ticks(20), 3));
+
+    Task::run("consumer", 4096, [&queue](Task& /*task*/) {
+        Task::delay(20ms);
+        queue.poll();
+    });
+    REQUIRE(queue.offerIn(ticks(1000), 3));
+}
+
+TEST_CASE("messages from multiple producers all arrive in per-producer order") {
+    constexpr int PRODUCERS = 4;
+    constexpr int MESSAGES = 5000;
+    PooledQueue<Sample> queue("test", 8);
+    for (int producer = 0; producer < PRODUCERS; producer++) {
+        Task::run("producer-" + std::to_string(producer), 4096, [&queue, producer](Task& /*task*/) {
+            for (int i = 0; i < MESSAGES; i++) {
+                queue.put(Sample { producer, i });
+            }
+        });
+    }
+
+    std::array<int, PRODUCERS> next {};
+    for (int i = 0; i < PRODUCERS * MESSAGES; i++) {
+        queue.take([&](Sample& sample) {
+            REQUIRE(sample.sequence == next[sample.producer]);
+            next[sample.producer]++;
+        });
+    }
+    REQUIRE(next == std::array<int, PRODUCERS> { MESSAGES, MESSAGES, MESSAGES, MESSAGES });
+    REQUIRE_FALSE(queue.poll());
+}
+
+TEST_CASE("the queue can be destroyed as soon as the last message is received") {
+    for (int round = 0; round < 200; round++) {
+        auto* queue = new PooledQueue<int>("test", 2);
+        Task::run("producer", 4096, [queue](Task& /*task*/) {
+            queue->offer(42);
+        });
+        REQUIRE(queue->pollIn(ticks(1000)));
+        delete queue;
+    }
+}
+
+TEST_CASE("queue benchmark", "[.][benchmark]") {
+    Queue<Message> heapQueue("heap", 16);
+    PooledQueue<Message, QueueProducers::Single> spscQueue("spsc", 16);
+    PooledQueue<Message, QueueProducers::Multiple> mpscQueue("mpsc", 16);
+    Message message;
+
+    // Latency of passing a single message through an idle queue
+    BENCHMARK("Queue offer + poll") {
+        heapQueue.offer(message);
+        return heapQueue.poll();
+    };
+    BENCHMARK("PooledQueue SPSC offer + poll") {
+        spscQueue.offer(message);
+        return spscQueue.poll();
+    };
+    BENCHMARK("PooledQueue MPSC offer + poll") {
+        mpscQueue.offer(message);
+        return mpscQueue.poll();
+    };
+
+    // Throughput of streaming messages from another task
+    constexpr int MESSAGES = 1000;
+    BENCHMARK("Queue stream") {
+        Task::run("producer", 4096, [&](Task& /*task*/) {
+            for (int i = 0; i < MESSAGES; i++) {
+                heapQueue.put(message);
+            }
+        });
+        for (int i = 0; i < MESSAGES; i++) {
+            heapQueue.take();
+        }
+    };
+    BENCHMARK("PooledQueue SPSC stream") {
+        Task::run("producer", 4096, [&](Task& /*task*/) {
+            for (int i = 0; i < MESSAGES; i++) {
+                spscQueue.put(message);
+            }
+        });
+        for (int i = 0; i < MESSAGES; i++) {
+            spscQueue.take();
+        }
+    };
+    BENCHMARK("PooledQueue MPSC stream") {
+        Task::run("producer", 4096, [&](Task& /*task*/) {
+            for (int i = 0; i < MESSAGES; i++) {
+                mpscQueue.put(message);
+            }
+        });
+        for (int i = 0; i < MESSAGES; i++) {
+            mpscQueue.take();
+        }
+    };
+}
@@ -0,0 +1,181 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <string>
+
+#include <ArduinoJson.h>
+
+#include <PowerManagementLock.hpp>
+
+using namespace std::chrono;
+using namespace farmhub::kernel;
+
+namespace {
+
+/**
+ * @brief Counts calls instead of locking anything, and uses a fake clock.
+ */
+struct FakeBackend {
+    using Handle = int;
+
+    static Handle create(const std::string& /*name*/, PowerManagementLockType /*type*/) {
+        return ++created;
+    }
+    static void destroy(Handle /*handle*/) {
+    }
+    static void acquire(Handle /*handle*/) {
+        acquired++;
+    }
+    static void release(Handle /*handle*/) {
+        released++;
+    }
+    static steady_clock::time_point now() {
+        return clock;
+    }
+
+    static void reset() {
+        acquired = 0;
+        released = 0;
+        clock = steady_clock::time_point(1s);
+    }
+
+    static inline int created = 0;
+    static inline int acquired = 0;
+    static inline int released = 0;
+    static inline steady_clock::time_point clock = steady_clock::time_point(1s);
+};
+
+using TestLock = BasicPowerManagementLock<FakeBackend>;
+using TestLockGuard = BasicPowerManagementLockGuard<FakeBackend>;
+
+}    // namespace
+
+TEST_CASE("guards acquire and release the lock") {
+    FakeBackend::reset();
+    TestLock lock("test", PowerManagementLockType::CpuFreqMax);
+    {
+        TestLockGuard guard(lock);
+        REQUIRE(FakeBackend::acquired == 1);
+        REQUIRE(FakeBackend::released == 0);
+        FakeBackend::clock += 30ms;
+    }
+    REQUIRE(FakeBackend::released == 1);
+
+    auto stats = lock.takeStats();
+    REQUIRE(stats.acquisitions == 1);
+    REQUIRE(stats.heldTime == 30ms);
+    REQUIRE(stats.longestHold == 30ms);
+    REQUIRE_FALSE(stats.held);
+
+    // Stats are reset after they are taken
+    stats = lock.takeStats();
+    REQUIRE(stats.acquisitions == 0);
+    REQUIRE(stats.heldTime == 0ms);
+}
+
+TEST_CASE("overlapping holds are only counted once for time") {
+    FakeBackend::reset();
+    TestLock lock("test", PowerManagementLockType::ApbFreqMax);
+    {
+        TestLockGuard outer(lock);
+        FakeBackend::clock += 10ms;
+        {
+            TestLockGuard inner(lock);
+            FakeBackend::clock += 20ms;
+        }
+        FakeBackend::clock += 5ms;
+    }
+    FakeBackend::clock += 100ms;
+    {
+        TestLockGuard again(lock);
+        FakeBackend::clock += 15ms;
+    }
+
+    auto stats = lock.takeStats();
+    REQUIRE(stats.acquisitions == 3);
+    REQUIRE(stats.heldTime == 50ms);
+    REQUIRE(stats.longestHold == 35ms);
+    REQUIRE(FakeBackend::acquired == FakeBackend::released);
+}
+
+TEST_CASE("ongoing holds are reported as active, and split between reports") {
+    FakeBackend::reset();
+    TestLock lock("test", PowerManagementLockType::CpuFreqMax);
+    lock.acquire();
+    FakeBackend::clock += 40ms;
+
+    auto stats = lock.takeStats();
+    REQUIRE(stats.held);
+    REQUIRE(stats.heldTime == 40ms);
+
+    FakeBackend::clock += 25ms;
+    lock.release();
+
+    stats = lock.takeStats();
+    REQUIRE_FALSE(stats.held);
+    REQUIRE(stats.acquisitions == 0);
+    REQUIRE(stats.heldTime == 25ms);
+    // The longest hold spans both reports
+    REQUIRE(stats.longestHold == 65ms);
+}
+
+TEST_CASE("telemetry breaks down time held by owner") {
+    FakeBackend::reset();
+    TestLock telemetry("telemetry", PowerManagementLockType::CpuFreqMax);
+    TestLock publish("publish", PowerManagementLockType::ApbFreqMax);
+    TestLock unused("unused", PowerManagementLockType::NoLightSleep);
+
+    {
+        TestLockGuard collecting(telemetry);
+        FakeBackend::clock += 12ms;
+    }
+    publish.acquire();
+    FakeBackend::clock += 80ms;
+
+    JsonDocument doc;
+    auto json = doc.to<JsonObject>();
+    TestLock::populateTelemetry(json);
+
+    REQUIRE(json["telemetry"]["type"].as<std::string>() == "cpu");
+    REQUIRE(json["telemetry"]["count"].as<int>() == 1);
+    REQUIRE(json["telemetry"]["held"].as<int>() == 12);
+    REQUIRE_FALSE(json["telemetry"]["active"].is<bool>());
+
+    REQUIRE(json["publish"]["type"].as<std::string>() == "apb");
+    REQUIRE(json["publish"]["held"].as<int>() == 80);
+    REQUIRE(json["publish"]["active"].as<bool>());
+
+    REQUIRE_FALSE(json["unused"].is<JsonObject>());
+
+    publish.release();
+}
+
+TEST_CASE("the underlying lock is created when first acquired") {
+    FakeBackend::reset();
+    auto created = FakeBackend::created;
+    TestLock lock("lazy", PowerManagementLockType::ApbFreqMax);
+    REQUIRE(FakeBackend::created == created);
+
+    lock.acquire();
+    lock.release();
+    lock.acquire();
+    lock.release();
+    REQUIRE(FakeBackend::created == created + 1);
+}
+
+TEST_CASE("accounting-only locks keep track of time without holding anything") {
+    FakeBackend::reset();
+    auto created = FakeBackend::created;
+    TestLock lock("waiting", PowerManagementLockType::AccountingOnly);
+    {
+        TestLockGuard waiting(lock);
+        FakeBackend::clock += 200ms;
+    }
+    REQUIRE(FakeBackend::created == created);
+    REQUIRE(FakeBackend::acquired == 0);
+    REQUIRE(FakeBackend::released == 0);
+
+    auto stats = lock.takeStats();
+    REQUIRE(stats.acquisitions == 1);
+    REQUIRE(stats.heldTime == 200ms);
+}
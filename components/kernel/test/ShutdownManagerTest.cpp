@@ -0,0 +1,177 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include <Concurrent.hpp>
+#include <ShutdownManager.hpp>
+#include <Task.hpp>
+
+using namespace std::chrono;
+using namespace farmhub::kernel;
+
+namespace {
+
+/**
+ * @brief Keeps listeners busy until released, long after their deadline.
+ */
+struct Blocker {
+    std::atomic<bool> released = false;
+
+    void block() const {
+        while (!released) {
+            Task::delay(1ms);
+        }
+    }
+};
+
+milliseconds elapsedSince(steady_clock::time_point start) {
+    return duration_cast<milliseconds>(steady_clock::now() - start);
+}
+
+}    // namespace
+
+TEST_CASE("phases run in order, listeners in the order they were registered") {
+    ShutdownManager::Report report {};
+    ShutdownManager manager(report);
+
+    auto calls = std::make_shared<std::vector<std::string>>();
+    Mutex callsMutex;
+    auto record = [&](const std::string& call) {
+        return [&, call](steady_clock::time_point /*deadline*/) {
+            Lock lock(callsMutex);
+            calls->push_back(call);
+        };
+    };
+    manager.registerShutdownListener(ShutdownPhase::Sync, "sync", record("sync"));
+    manager.registerShutdownListener(ShutdownPhase::Flush, "telemetry", record("telemetry"));
+    manager.registerShutdownListener(ShutdownPhase::SafeState, "valves", record("valves"));
+    manager.registerShutdownListener(ShutdownPhase::Flush, "log", record("log"));
+    manager.registerShutdownListener(ShutdownPhase::SafeState, "doors", record("doors"));
+
+    manager.shutdown(5s);
+
+    REQUIRE(*calls == std::vector<std::string> { "valves", "doors", "telemetry", "log", "sync" });
+    REQUIRE(report.phases[0].listeners == 2);
+    REQUIRE(report.phases[0].completed == 2);
+    REQUIRE_FALSE(report.phases[0].timedOut);
+
+    // Shutting down only happens once
+    manager.shutdown(5s);
+    REQUIRE(calls->size() == 5);
+}
+
+TEST_CASE("a phase that misses its deadline does not hold up later phases") {
+    ShutdownManager::Report report {};
+    ShutdownManager manager(report, { .safeState = 50ms, .flush = 50ms, .sync = 50ms });
+
+    auto blocker = std::make_shared<Blocker>();
+    std::atomic<bool> flushed = false;
+    manager.registerShutdownListener(ShutdownPhase::SafeState, "valves", [](steady_clock::time_point /*deadline*/) {});
+    manager.registerShutdownListener(ShutdownPhase::SafeState, "stuck", [blocker](steady_clock::time_point /*deadline*/) {
+        blocker->block();
+    });
+    manager.registerShutdownListener(ShutdownPhase::Flush, "log", [&](steady_clock::time_point /*deadline*/) {
+        flushed = true;
+    });
+
+    auto start = steady_clock::now();
+    manager.shutdown(5s);
+    auto elapsed = elapsedSince(start);
+
+    REQUIRE(flushed);
+    REQUIRE(elapsed < 1s);
+    REQUIRE(report.phases[0].timedOut);
+    REQUIRE(report.phases[0].completed == 1);
+    REQUIRE(report.phases[0].elapsedMs >= 45);
+    REQUIRE_FALSE(report.phases[1].timedOut);
+    REQUIRE(report.phases[1].completed == 1);
+
+    blocker->released = true;
+}
+
+TEST_CASE("the overall deadline is shared by phases in order") {
+    ShutdownManager::Report report {};
+    ShutdownManager manager(report);
+
+    auto blocker = std::make_shared<Blocker>();
+    auto synced = std::make_shared<std::atomic<bool>>(false);
+    auto flushDeadline = std::make_shared<steady_clock::time_point>();
+    manager.registerShutdownListener(ShutdownPhase::Flush, "telemetry", [flushDeadline, blocker](steady_clock::time_point deadline) {
+        *flushDeadline = deadline;
+        blocker->block();
+    });
+    manager.registerShutdownListener(ShutdownPhase::Sync, "sync", [synced](steady_clock::time_point /*deadline*/) {
+        *synced = true;
+    });
+
+    auto start = steady_clock::now();
+    manager.shutdown(100ms);
+    auto elapsed = elapsedSince(start);
+
+    // Flushing got all the time that was left, sync got none
+    REQUIRE(elapsed >= 95ms);
+    REQUIRE(elapsed < 1s);
+    REQUIRE(*flushDeadline - start < 105ms);
+    REQUIRE(report.deadlineMs == 100);
+    REQUIRE(report.phases[1].timedOut);
+    REQUIRE(report.phases[2].timedOut);
+    REQUIRE(report.phases[2].completed == 0);
+    REQUIRE_FALSE(*synced);
+
+    blocker->released = true;
+}
+
+TEST_CASE("failing listeners do not stop the phase") {
+    ShutdownManager::Report report {};
+    ShutdownManager manager(report);
+
+    std::atomic<bool> closed = false;
+    manager.registerShutdownListener(ShutdownPhase::SafeState, "failing", [](steady_clock::time_point /*deadline*/) {
+        throw std::runtime_error("motor driver gone");
+    });
+    manager.registerShutdownListener(ShutdownPhase::SafeState, "valves", [&](steady_clock::time_point /*deadline*/) {
+        closed = true;
+    });
+
+    manager.shutdown(1s);
+
+    REQUIRE(closed);
+    REQUIRE(report.phases[0].completed == 2);
+    REQUIRE_FALSE(report.phases[0].timedOut);
+}
+
+TEST_CASE("the report of the previous shutdown is available after the next boot") {
+    ShutdownManager::Report report {};
+    {
+        ShutdownManager manager(report);
+        REQUIRE_FALSE(manager.getPreviousShutdown().has_value());
+        manager.registerShutdownListener(ShutdownPhase::Flush, "log", [](steady_clock::time_point /*deadline*/) {
+            Task::delay(20ms);
+        });
+        manager.shutdown(1s);
+    }
+
+    // Next boot
+    ShutdownManager manager(report);
+    REQUIRE(manager.getPreviousShutdown().has_value());
+
+    JsonDocument doc;
+    auto json = doc.to<JsonObject>();
+    manager.reportPreviousShutdown(json);
+    REQUIRE(json["deadline"].as<int>() == 1000);
+    REQUIRE(json["phases"]["flush"]["listeners"].as<int>() == 1);
+    REQUIRE(json["phases"]["flush"]["completed"].as<int>() == 1);
+    REQUIRE(json["phases"]["flush"]["elapsed"].as<int>() >= 20);
+    REQUIRE_FALSE(json["phases"]["flush"]["timed-out"].is<bool>());
+    REQUIRE(json["phases"]["safe-state"]["listeners"].as<int>() == 0);
+
+    // Only reported once
+    ShutdownManager afterThat(report);
+    REQUIRE_FALSE(afterThat.getPreviousShutdown().has_value());
+}
@@ -0,0 +1,97 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <Concurrent.hpp>
+#include <Task.hpp>
+
+#include "AllocationTracking.hpp"
+
+using namespace farmhub::kernel;
+
+namespace {
+
+JsonDocument tasksTelemetry() {
+    JsonDocument doc;
+    auto json = doc.to<JsonObject>();
+    TaskRegistry::populateTelemetry(json);
+    return doc;
+}
+
+}    // namespace
+
+TEST_CASE("tasks are registered while they run") {
+    CopyQueue<bool> started("started", 1);
+    CopyQueue<bool> release("release", 1);
+    CopyQueue<bool> finished("finished", 1);
+    Task::run("registered", 3072, 3, [&](Task& /*task*/) {
+        started.put(true);
+        release.take();
+        finished.put(true);
+    });
+    started.take();
+
+    auto running = tasksTelemetry();
+    REQUIRE(running["registered"]["priority"] == 3);
+    REQUIRE(running["registered"]["stack"] == 3072);
+    REQUIRE(running["registered"]["stack-free"].is<uint32_t>());
+    // Not a loop task
+    REQUIRE_FALSE(running["registered"]["iterations"].is<uint32_t>());
+
+    release.put(true);
+    finished.take();
+    Task::delay(ticks(20));
+    REQUIRE_FALSE(tasksTelemetry()["registered"].is<JsonObject>());
+}
+
+TEST_CASE("loop iterations and missed deadlines are recorded") {
+    CopyQueue<bool> done("done", 1);
+    Task::loop("looping", 3072, [&, iteration = 0](Task& task) mutable {
+        iteration++;
+        if (iteration == 3) {
+            // Run longer than the deadline
+            Task::delay(ticks(30));
+            task.delayUntil(ticks(10));
+        } else if (iteration == 5) {
+            done.put(true);
+            Task::suspend();
+        }
+    });
+    done.take();
+
+    auto doc = tasksTelemetry();
+    auto looping = doc["looping"];
+    REQUIRE(looping["iterations"] == 4);
+    // Delaying is not counted as loop time
+    REQUIRE(looping["max-loop-time"].as<uint32_t>() < 30000);
+    REQUIRE(looping["missed-deadlines"] == 1);
+    REQUIRE(looping["worst-overrun"].as<uint32_t>() >= 20);
+}
+
+TEST_CASE("tasks with the same name are told apart") {
+    CopyQueue<bool> done("done", 2);
+    for (int i = 0; i < 2; i++) {
+        Task::run("twin", 2048, [&](Task& /*task*/) {
+            done.put(true);
+            Task::suspend();
+        });
+    }
+    done.take();
+    done.take();
+
+    auto doc = tasksTelemetry();
+    REQUIRE(doc["twin"].is<JsonObject>());
+    REQUIRE(doc["twin#2"].is<JsonObject>());
+}
+
+TEST_CASE("recording statistics does not allocate") {
+    TaskStats stats("stats", 1, 2048, nullptr);
+    auto allocations = measureAllocations([&]() {
+        stats.recordIteration(1500us);
+        stats.recordIteration(500us);
+        stats.recordMissedDeadline(20ms);
+    });
+    REQUIRE(allocations.count == 0);
+    REQUIRE(stats.iterations == 2);
+    REQUIRE(stats.lastIterationTime == 500);
+    REQUIRE(stats.maxIterationTime == 1500);
+    REQUIRE(stats.worstOverrun == 20);
+}
@@ -0,0 +1,226 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Telemetry.hpp>
+
+using namespace farmhub::kernel;
+
+namespace {
+
+std::shared_ptr<TelemetryCollector::Config> createConfig(const std::string& json) {
+    auto config = std::make_shared<TelemetryCollector::Config>();
+    config->loadFromString(json);
+    return config;
+}
+
+struct Readings {
+    double temperature = 0;
+    double moisture = 0;
+    int valveState = 0;
+    int rssi = 0;
+};
+
+std::shared_ptr<TelemetryCollector> createCollector(const std::string& json, const Readings& readings) {
+    auto collector = std::make_shared<TelemetryCollector>(createConfig(json));
+    collector->registerFeature("temperature", "soil-temperature", [&readings](JsonObject& data) {
+        data["value"] = readings.temperature;
+    });
+    collector->registerFeature("moisture", "soil-moisture", [&readings](JsonObject& data) {
+        data["value"] = readings.moisture;
+    });
+    collector->registerFeature("valve", "valve", [&readings](JsonObject& data) {
+        data["state"] = readings.valveState;
+    });
+    return collector;
+}
+
+JsonDocument collect(TelemetryCollector& collector, const Readings& readings) {
+    JsonDocument doc;
+    auto telemetry = doc.to<JsonObject>();
+    telemetry["uptime"] = 1234;
+    telemetry["wifi"].to<JsonObject>()["rssi"] = readings.rssi;
+    collector.collect(telemetry);
+    return doc;
+}
+
+std::vector<std::string> featureNames(const JsonDocument& doc) {
+    std::vector<std::string> names;
+    for (auto feature : doc["features"].as<JsonArrayConst>()) {
+        names.push_back(feature["name"].as<std::string>());
+    }
+    return names;
+}
+
+}    // namespace
+
+TEST_CASE("full mode always publishes everything") {
+    Readings readings { .temperature = 18.5, .moisture = 40.0, .valveState = 0, .rssi = -60 };
+    auto collector = createCollector("{}", readings);
+    for (int i = 0; i < 3; i++) {
+        auto doc = collect(*collector, readings);
+        REQUIRE(featureNames(doc) == std::vector<std::string> { "soil-temperature", "soil-moisture", "valve" });
+        REQUIRE(doc["wifi"]["rssi"] == -60);
+        REQUIRE_FALSE(doc["keyframe"].is<bool>());
+    }
+}
+
+TEST_CASE("delta mode only publishes changed fields") {
+    Readings readings { .temperature = 18.5, .moisture = 40.0, .valveState = 0, .rssi = -60 };
+    auto collector = createCollector(R"({"delta":true,"keyframeInterval":100})", readings);
+
+    auto first = collect(*collector, readings);
+    REQUIRE(first["keyframe"] == true);
+    REQUIRE(featureNames(first).size() == 3);
+
+    auto unchanged = collect(*collector, readings);
+    REQUIRE(unchanged["keyframe"] == false);
+    REQUIRE(featureNames(unchanged).empty());
+    REQUIRE_FALSE(unchanged["wifi"].is<JsonObject>());
+    // Top-level values are always there
+    REQUIRE(unchanged["uptime"] == 1234);
+
+    readings.valveState = 1;
+    readings.rssi = -70;
+    auto changed = collect(*collector, readings);
+    REQUIRE(featureNames(changed) == std::vector<std::string> { "valve" });
+    REQUIRE(changed["features"][0]["type"] == "valve");
+    REQUIRE(changed["features"][0]["data"]["state"] == 1);
+    REQUIRE(changed["wifi"]["rssi"] == -70);
+}
+
+TEST_CASE("fields that disappear are published as null once") {
+    auto collector = std::make_shared<TelemetryCollector>(createConfig(R"({"delta":true,"keyframeInterval":100})"));
+    bool charging = true;
+    collector->registerFeature("battery", "battery", [&charging](JsonObject& data) {
+        data["voltage"] = 3.9;
+        if (charging) {
+            data["current"] = 0.5;
+        }
+    });
+    bool lockHeld = true;
+    auto collectWithLocks = [&]() {
+        JsonDocument doc;
+        auto telemetry = doc.to<JsonObject>();
+        auto locks = telemetry["pm"].to<JsonObject>()["locks"].to<JsonObject>();
+        locks["wifi"] = 10;
+        if (lockHeld) {
+            locks["configuration"] = 20;
+        }
+        collector->collect(telemetry);
+        return doc;
+    };
+    collectWithLocks();
+
+    charging = false;
+    lockHeld = false;
+    auto gone = collectWithLocks();
+    REQUIRE(gone["features"][0]["data"]["current"].isNull());
+    REQUIRE(gone["features"][0]["data"].as<JsonObjectConst>().size() == 1);
+    REQUIRE(gone["pm"]["locks"]["configuration"].isNull());
+    REQUIRE(gone["pm"]["locks"].as<JsonObjectConst>().size() == 1);
+
+    // Only cleared once
+    auto unchanged = collectWithLocks();
+    REQUIRE(featureNames(unchanged).empty());
+    REQUIRE_FALSE(unchanged["pm"].is<JsonObject>());
+
+    // And published again when they come back
+    charging = true;
+    auto back = collectWithLocks();
+    REQUIRE(back["features"][0]["data"]["current"] == 0.5);
+}
+
+TEST_CASE("sections that disappear are published as null once") {
+    Readings readings { .rssi = -60 };
+    auto collector = createCollector(R"({"delta":true,"keyframeInterval":100})", readings);
+    collect(*collector, readings);
+
+    JsonDocument doc;
+    auto telemetry = doc.to<JsonObject>();
+    collector->collect(telemetry);
+    // Next to "keyframe" and "features"
+    REQUIRE(telemetry.size() == 3);
+    REQUIRE(telemetry["wifi"].isNull());
+
+    JsonDocument again;
+    auto telemetryAgain = again.to<JsonObject>();
+    collector->collect(telemetryAgain);
+    REQUIRE(telemetryAgain.size() == 2);
+}
+
+TEST_CASE("small changes within the deadband accumulate until they exceed it") {
+    Readings readings { .temperature = 18.5, .moisture = 40.0 };
+    auto collector = createCollector(R"({
+        "delta": true,
+        "keyframeInterval": 100,
+        "deadbands": [
+            { "feature": "moisture", "deadband": 1.0 },
+            { "feature": "soil-temperature", "deadband": 0.25 }
+        ]
+    })",
+        readings);
+    collect(*collector, readings);
+
+    readings.moisture = 40.6;
+    readings.temperature = 18.7;
+    REQUIRE(featureNames(collect(*collector, readings)).empty());
+
+    // Compared against the last published value, not the last collected one
+    readings.moisture = 41.2;
+    readings.temperature = 18.8;
+    auto doc = collect(*collector, readings);
+    REQUIRE(featureNames(doc) == std::vector<std::string> { "soil-temperature", "soil-moisture" });
+    REQUIRE(doc["features"][1]["data"]["value"] == 41.2);
+}
+
+TEST_CASE("keyframes are sent periodically and on request") {
+    Readings readings { .temperature = 18.5, .moisture = 40.0 };
+    auto collector = createCollector(R"({"delta":true,"keyframeInterval":3})", readings);
+
+    std::vector<bool> keyframes;
+    for (int i = 0; i < 7; i++) {
+        auto doc = collect(*collector, readings);
+        keyframes.push_back(doc["keyframe"].as<bool>());
+        if (keyframes.back()) {
+            REQUIRE(featureNames(doc).size() == 3);
+        }
+    }
+    REQUIRE(keyframes == std::vector<bool> { true, false, false, true, false, false, true });
+
+    collector->requestKeyframe();
+    auto doc = collect(*collector, readings);
+    REQUIRE(doc["keyframe"] == true);
+    REQUIRE(featureNames(doc).size() == 3);
+    REQUIRE(doc["wifi"]["rssi"] == 0);
+}
+
+TEST_CASE("delta mode shrinks slowly changing telemetry") {
+    // Replay a day of soil readings taken every 5 minutes
+    Readings readings { .temperature = 16.0, .moisture = 45.0, .valveState = 0, .rssi = -65 };
+    auto full = createCollector("{}", readings);
+    auto delta = createCollector(R"({
+        "delta": true,
+        "keyframeInterval": 12,
+        "deadbands": [
+            { "feature": "temperature", "deadband": 0.2 },
+            { "feature": "moisture", "deadband": 0.5 },
+            { "feature": "wifi", "deadband": 3 }
+        ]
+    })",
+        readings);
+
+    size_t fullBytes = 0;
+    size_t deltaBytes = 0;
+    for (int i = 0; i < 288; i++) {
+        readings.temperature = 16.0 + 4.0 * (i % 144) / 144.0;
+        readings.moisture = 45.0 - 0.02 * i;
+        readings.valveState = (i % 96) < 6 ? 1 : 0;
+        readings.rssi = -65 + (i % 3);
+        fullBytes += measureJson(collect(*full, readings));
+        deltaBytes += measureJson(collect(*delta, readings));
+    }
+    REQUIRE(deltaBytes * 2 < fullBytes);
+}
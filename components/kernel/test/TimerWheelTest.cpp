@@ -0,0 +1,245 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <Executor.hpp>
+#include <TimerWheel.hpp>
+
+using namespace farmhub::kernel;
+
+namespace {
+
+// Time is faked by passing explicit time points to the wheel
+const steady_clock::time_point START {};
+
+std::vector<int> expire(TimerWheel<int>& wheel, milliseconds to) {
+    TimerWheel<int>::Entries expired;
+    wheel.advance(START + to, expired);
+    std::vector<int> items;
+    for (auto& entry : expired) {
+        items.push_back(entry.item);
+    }
+    return items;
+}
+
+milliseconds sinceStart(steady_clock::time_point time) {
+    return duration_cast<milliseconds>(time - START);
+}
+
+}    // namespace
+
+TEST_CASE("items expire when their time comes") {
+    TimerWheel<int> wheel(10ms, START);
+    wheel.schedule(1, START + 50ms, START + 50ms);
+    wheel.schedule(2, START + 20ms, START + 20ms);
+    REQUIRE(wheel.size() == 2);
+    REQUIRE(sinceStart(*wheel.nextWakeTime()) == 20ms);
+
+    REQUIRE(expire(wheel, 19ms).empty());
+    REQUIRE(expire(wheel, 20ms) == std::vector<int> { 2 });
+    REQUIRE(sinceStart(*wheel.nextWakeTime()) == 50ms);
+    REQUIRE(expire(wheel, 100ms) == std::vector<int> { 1 });
+    REQUIRE(wheel.empty());
+    REQUIRE_FALSE(wheel.nextWakeTime().has_value());
+}
+
+TEST_CASE("items due in the past expire on the next tick") {
+    TimerWheel<int> wheel(10ms, START);
+    expire(wheel, 1s);
+    wheel.schedule(1, START + 500ms, START + 500ms);
+    REQUIRE(sinceStart(*wheel.nextWakeTime()) == 1010ms);
+    REQUIRE(expire(wheel, 1010ms) == std::vector<int> { 1 });
+}
+
+TEST_CASE("far away items are moved down the levels in time") {
+    TimerWheel<int> wheel(10ms, START);
+    // One for each level, and one beyond the range of the wheel
+    std::map<int, milliseconds> times {
+        { 1, 300ms },
+        { 2, 30s },
+        { 3, 1h },
+        { 4, 100h },
+        { 5, 200h },
+    };
+    for (auto [item, time] : times) {
+        wheel.schedule(item, START + time, START + time);
+    }
+    for (auto [item, time] : times) {
+        // Sleep until the next wake time every time, like the executor does
+        REQUIRE(sinceStart(*wheel.nextWakeTime()) <= time);
+        std::vector<int> expired;
+        while (expired.empty()) {
+            expired = expire(wheel, sinceStart(*wheel.nextWakeTime()));
+        }
+        REQUIRE(expired == std::vector<int> { item });
+        REQUIRE(sinceStart(*wheel.nextWakeTime().or_else([]() { return std::optional(START + 200h); })) >= time);
+    }
+}
+
+TEST_CASE("items expire at the right tick in random order") {
+    TimerWheel<int> wheel(1ms, START);
+    std::mt19937 random(1234);
+    std::uniform_int_distribution<int> delays(0, 300000);
+    std::multimap<milliseconds, int> expected;
+    for (int i = 0; i < 1000; i++) {
+        auto time = milliseconds(delays(random));
+        wheel.schedule(i, START + time, START + time);
+        expected.emplace(time, i);
+    }
+
+    milliseconds now = 0ms;
+    while (!wheel.empty()) {
+        now = sinceStart(*wheel.nextWakeTime());
+        for (auto item : expire(wheel, now)) {
+            auto it = expected.begin();
+            REQUIRE(it->first == now);
+            expected.erase(it);
+            (void) item;
+        }
+    }
+    REQUIRE(expected.empty());
+}
+
+TEST_CASE("items with overlapping windows expire together") {
+    TimerWheel<int> wheel(1ms, START);
+    wheel.schedule(1, START + 1000ms, START + 1100ms);
+    wheel.schedule(2, START + 1010ms, START + 1200ms);
+    wheel.schedule(3, START + 1050ms, START + 1060ms);
+    wheel.schedule(4, START + 1061ms, START + 1100ms);
+    REQUIRE(expire(wheel, 1059ms).empty());
+    // The others' windows are already open when 3 expires
+    auto expired = expire(wheel, 1060ms);
+    std::ranges::sort(expired);
+    REQUIRE(expired == std::vector<int> { 1, 2, 3 });
+    REQUIRE(expire(wheel, 1100ms) == std::vector<int> { 4 });
+}
+
+TEST_CASE("jobs run periodically without drifting") {
+    JobScheduler scheduler(10ms, START);
+    std::vector<milliseconds> runs;
+    steady_clock::time_point now = START;
+    scheduler.schedule("job", 1s, 0ms, [&]() { runs.push_back(sinceStart(now)); }, START);
+
+    for (int i = 0; i < 5; i++) {
+        now = *scheduler.nextWakeTime();
+        // Waking up a little late does not push later runs back
+        scheduler.runDue(now + 3ms);
+    }
+    REQUIRE(runs == std::vector<milliseconds> { 0s, 1s, 2s, 3s, 4s });
+}
+
+TEST_CASE("jobs that fell behind skip missed runs") {
+    JobScheduler scheduler(10ms, START);
+    int runs = 0;
+    scheduler.schedule("job", 1s, 100ms, [&]() { runs++; }, START);
+    // Runs at the end of its window when nothing else wakes the scheduler up
+    scheduler.runDue(START + 90ms);
+    REQUIRE(runs == 0);
+    scheduler.runDue(START + 100ms);
+    REQUIRE(runs == 1);
+    scheduler.runDue(START + 10s);
+    REQUIRE(runs == 2);
+    REQUIRE(sinceStart(*scheduler.nextWakeTime()) <= 11100ms);
+    REQUIRE(sinceStart(*scheduler.nextWakeTime()) >= 11s);
+}
+
+TEST_CASE("jobs run less often when periods are scaled") {
+    JobScheduler scheduler(10ms, START);
+    std::vector<milliseconds> runs;
+    steady_clock::time_point now = START;
+    scheduler.schedule("job", 1s, 0ms, [&]() { runs.push_back(sinceStart(now)); }, START);
+
+    for (int i = 0; i < 4; i++) {
+        if (i == 2) {
+            scheduler.setPeriodScale(2.5);
+        }
+        now = *scheduler.nextWakeTime();
+        scheduler.runDue(now);
+    }
+    // The run that was already planned is not moved
+    REQUIRE(runs == std::vector<milliseconds> { 0s, 1s, 2s, 4500ms });
+}
+
+TEST_CASE("jobs must have a positive period") {
+    JobScheduler scheduler(10ms, START);
+    REQUIRE_THROWS_AS(scheduler.schedule("zero", 0ms, 0ms, []() { }, START), std::invalid_argument);
+    REQUIRE_THROWS_AS(scheduler.schedule("negative", -1s, 0ms, []() { }, START), std::invalid_argument);
+    REQUIRE(scheduler.size() == 0);
+}
+
+TEST_CASE("a failing job doesn't stop the others") {
+    JobScheduler scheduler(10ms, START);
+    int failingRuns = 0;
+    int otherRuns = 0;
+    scheduler.schedule("failing", 1s, 0ms, [&]() {
+        failingRuns++;
+        throw std::runtime_error("sensor gone");
+    }, START);
+    scheduler.schedule("other", 1s, 0ms, [&]() { otherRuns++; }, START);
+
+    for (int i = 0; i < 3; i++) {
+        REQUIRE(scheduler.runDue(*scheduler.nextWakeTime()) == 2);
+    }
+    REQUIRE(failingRuns == 3);
+    REQUIRE(otherRuns == 3);
+    REQUIRE(scheduler.getFailures() == 3);
+    REQUIRE(scheduler.size() == 2);
+}
+
+TEST_CASE("jobs don't come due again right away") {
+    JobScheduler scheduler(1ms, START);
+    int runs = 0;
+    scheduler.schedule("fast", 1ms, 0ms, [&]() { runs++; }, START);
+    scheduler.setPeriodScale(std::nan(""));
+    // Far behind, so the job has many missed runs to skip
+    scheduler.runDue(START);
+    scheduler.runDue(START + 1h);
+    REQUIRE(runs == 2);
+    REQUIRE(*scheduler.nextWakeTime() > START + 1h);
+}
+
+TEST_CASE("tolerance lets jobs share wakeups") {
+    // Peripheral polling on a fully equipped device: flow meter, analog meters and an electric fence,
+    // started one after the other during boot
+    struct Job {
+        milliseconds period;
+        milliseconds tolerance;
+        milliseconds offset;
+    };
+    std::vector<Job> jobs {
+        { 1s, 100ms, 0ms },
+        { 1s, 100ms, 20ms },
+        { 1s, 100ms, 45ms },
+        { 2s, 200ms, 70ms },
+        { 10s, 1s, 90ms },
+        { 10s, 1s, 140ms },
+    };
+    const auto duration = 1h;
+
+    auto countWakeups = [&](bool coalesce) {
+        JobScheduler scheduler(10ms, START);
+        std::map<int, milliseconds> lastRuns;
+        for (int i = 0; i < static_cast<int>(jobs.size()); i++) {
+            auto& job = jobs[i];
+            scheduler.schedule("job-" + std::to_string(i), job.period, coalesce ? job.tolerance : 0ms, [] { }, START + job.offset);
+        }
+        while (true) {
+            auto next = *scheduler.nextWakeTime();
+            if (next > START + duration) {
+                break;
+            }
+            scheduler.runDue(next);
+        }
+        return scheduler.getWakeups();
+    };
+
+    // Wakeups of separate tasks are the same as running jobs without tolerance
+    auto separate = countWakeups(false);
+    auto coalesced = countWakeups(true);
+    WARN("Wakeups per hour: separate " << separate << ", coalesced " << coalesced);
+    REQUIRE(coalesced * 2 < separate);
+}
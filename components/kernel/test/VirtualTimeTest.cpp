@@ -0,0 +1,158 @@
+#include <sdkconfig.h>
+
+// Virtual time is only available when running tests on the host
+#ifdef CONFIG_IDF_TARGET_LINUX
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <Concurrent.hpp>
+#include <Task.hpp>
+
+#include <VirtualTime.hpp>
+
+using namespace farmhub::kernel;
+using namespace farmhub::test;
+
+TEST_CASE("tasks wake up in virtual time") {
+    VirtualTime time;
+    Task::loop("fast", 3072, [](Task& task) {
+        task.delayUntil(100ms);
+    });
+    Task::loop("slow", 3072, [](Task& task) {
+        task.delayUntil(250ms);
+    });
+
+    auto hostStart = VirtualTime::hostTime();
+    time.runFor(500ms);
+    REQUIRE(time.elapsed() == 500ms);
+    REQUIRE(time.getWakeups() == std::vector<TaskWakeup> {
+        { 100ms, "fast" },
+        { 200ms, "fast" },
+        { 250ms, "slow" },
+        { 300ms, "fast" },
+        { 400ms, "fast" },
+        { 500ms, "fast" },
+        { 500ms, "slow" },
+    });
+
+    time.clearWakeups();
+    time.runFor(1h);
+    REQUIRE(time.getWakeups().size() == 36000 + 14400);
+    // An hour passes a lot faster than that
+    REQUIRE(VirtualTime::hostTime() - hostStart < 1min);
+}
+
+TEST_CASE("queue timeouts pass in virtual time") {
+    VirtualTime time;
+    CopyQueue<int> queue("queue", 1);
+    std::vector<std::pair<milliseconds, std::optional<int>>> received;
+    Task::loop("receiver", 3072, [&](Task& /*task*/) {
+        auto message = queue.pollIn(5min);
+        received.emplace_back(time.elapsed(), message);
+    });
+
+    time.runFor(11min);
+    queue.put(42);
+    time.runFor(1min);
+    REQUIRE(received == std::vector<std::pair<milliseconds, std::optional<int>>> {
+        { 5min, std::nullopt },
+        { 10min, std::nullopt },
+        { 11min, 42 },
+    });
+}
+
+TEST_CASE("notifications wake up waiting tasks") {
+    VirtualTime time;
+    std::vector<std::pair<milliseconds, uint32_t>> received;
+    TaskHandle_t waiter = nullptr;
+    Task::loop("waiter", 3072, [&](Task& /*task*/) {
+        waiter = xTaskGetCurrentTaskHandle();
+        auto value = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        received.emplace_back(time.elapsed(), value);
+    });
+
+    time.runFor(1500ms);
+    xTaskNotifyGive(waiter);
+    xTaskNotifyGive(waiter);
+    time.runFor(100ms);
+    REQUIRE(received == std::vector<std::pair<milliseconds, uint32_t>> {
+        { 1000ms, 0 },
+        { 1500ms, 2 },
+    });
+}
+
+TEST_CASE("clocks follow virtual time") {
+    auto wallClockStart = sys_days { 2025y / June / 1 } + 6h;
+    VirtualTime time(wallClockStart);
+    auto steadyStart = steady_clock::now();
+
+    time.runFor(72h);
+    REQUIRE(steady_clock::now() - steadyStart == 72h);
+    REQUIRE(system_clock::now() == wallClockStart + 72h);
+    REQUIRE(xTaskGetTickCount() == pdMS_TO_TICKS(72 * 3600 * 1000));
+}
+
+TEST_CASE("simulations are repeatable") {
+    auto simulate = []() {
+        VirtualTime time;
+        auto queue = std::make_shared<Queue<int>>("work", 4);
+        Task::loop("producer", 3072, [queue](Task& task) {
+            queue->offer(1);
+            queue->offer(2);
+            task.delayUntil(70ms);
+        });
+        Task::loop("consumer-a", 3072, [queue](Task& /*task*/) {
+            queue->pollIn(1s, [](int /*message*/) { });
+        });
+        Task::loop("consumer-b", 3072, 2, [queue](Task& /*task*/) {
+            queue->pollIn(40ms, [](int /*message*/) { });
+        });
+        time.runFor(10s);
+        return time.getWakeups();
+    };
+
+    auto first = simulate();
+    REQUIRE(first.size() > 300);
+    REQUIRE(simulate() == first);
+}
+
+TEST_CASE("virtual time throughput", "[.][benchmark]") {
+    // Telemetry, sampling and log tasks of a typical device, plus a fast polling loop
+    VirtualTime time;
+    Task::loop("telemetry", 3072, [](Task& task) {
+        task.delayUntil(5s);
+    });
+    Task::loop("sampling", 3072, [](Task& task) {
+        task.delayUntil(1s);
+    });
+    Task::loop("polling", 3072, [](Task& task) {
+        task.delayUntil(100ms);
+    });
+    auto queue = std::make_shared<Queue<int>>("log", 16);
+    Task::loop("logger", 3072, [queue](Task& task) {
+        queue->offer(1);
+        task.delayUntil(250ms);
+    });
+    Task::loop("drain", 3072, [queue](Task& /*task*/) {
+        queue->pollIn(10s, [](int /*message*/) { });
+    });
+
+    constexpr auto SIMULATED = 24h;
+    auto hostStart = VirtualTime::hostTime();
+    time.runFor(SIMULATED);
+    auto hostElapsed = duration_cast<duration<double>>(VirtualTime::hostTime() - hostStart);
+
+    auto wakeups = time.getWakeups().size();
+    WARN("Simulated " << duration_cast<hours>(SIMULATED).count() << " h in " << hostElapsed.count() << " s of host time: "
+                      << (duration_cast<duration<double>>(SIMULATED).count() / hostElapsed.count()) << "x real time, "
+                      << (static_cast<double>(wakeups) / hostElapsed.count()) << " wakeups/s, "
+                      << (static_cast<double>(time.getContextSwitches()) / hostElapsed.count()) << " context switches/s");
+    REQUIRE(time.elapsed() == SIMULATED);
+}
+
+#endif
@@ -0,0 +1,116 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include <WakeupAligner.hpp>
+
+using namespace std::chrono;
+using namespace farmhub::kernel;
+
+namespace {
+
+// Fake clock starting at an odd time, so grids don't line up with the start by accident
+const steady_clock::time_point START = steady_clock::time_point(1234567ms);
+
+struct PeriodicTask {
+    milliseconds period;
+    milliseconds slack;
+    steady_clock::time_point nextWakeup;
+};
+
+/**
+ * @brief Run tasks waking up periodically for `duration` of fake time, and count distinct wakeups.
+ */
+size_t simulate(std::vector<PeriodicTask> tasks, milliseconds duration, WakeupAligner* aligner) {
+    std::set<steady_clock::time_point> wakeups;
+    auto end = START + duration;
+    while (true) {
+        auto& task = *std::ranges::min_element(tasks, {}, &PeriodicTask::nextWakeup);
+        auto now = task.nextWakeup;
+        if (now >= end) {
+            break;
+        }
+        wakeups.insert(now);
+        auto deadline = now + task.period;
+        task.nextWakeup = aligner == nullptr
+            ? deadline
+            : aligner->align(deadline, task.slack, now, task.period);
+    }
+    return wakeups.size();
+}
+
+}    // namespace
+
+TEST_CASE("wakeups without slack are not moved") {
+    WakeupAligner aligner(START);
+    auto deadline = START + 1234ms;
+    REQUIRE(aligner.align(deadline, 0ms, START) == deadline);
+}
+
+TEST_CASE("wakeups snap to the coarsest grid within their slack") {
+    WakeupAligner aligner(START);
+    // START is at 1234.567 s
+    REQUIRE(aligner.align(START + 5s, 2s, START) == steady_clock::time_point(1240s));
+    REQUIRE(aligner.align(START + 50s, 40s, START) == steady_clock::time_point(1320s));
+    REQUIRE(aligner.align(START + 50s, 20s, START) == steady_clock::time_point(1290s));
+    REQUIRE(aligner.align(START + 100ms, 150ms, START) == steady_clock::time_point(1234700ms));
+}
+
+TEST_CASE("wakeups join already planned wakeups") {
+    WakeupAligner aligner(START);
+    auto planned = aligner.align(START + 5s, 2s, START);
+    REQUIRE(aligner.align(START + 4500ms, 1s, START) == planned);
+    REQUIRE(aligner.getSaved() == 1);
+
+    // Too far away to join
+    auto other = aligner.align(START + 2s, 500ms, START);
+    REQUIRE(other != planned);
+    REQUIRE(aligner.getSaved() == 1);
+}
+
+TEST_CASE("wakeups join later wakeups of periodic tasks") {
+    WakeupAligner aligner(START);
+    auto planned = aligner.align(START + 5s, 2s, START, 10s);
+    REQUIRE(aligner.align(START + 44s, 2s, START) == planned + 40s);
+    REQUIRE(aligner.getSaved() == 1);
+}
+
+TEST_CASE("past wakeups are forgotten") {
+    WakeupAligner aligner(START);
+    auto planned = aligner.align(START + 5s, 2s, START);
+    // The planned wakeup already happened, so it cannot be joined anymore
+    aligner.align(planned - 100ms, 200ms, planned + 1ms);
+    REQUIRE(aligner.getSaved() == 0);
+}
+
+TEST_CASE("typical device tasks share wakeups") {
+    // Only tasks that declare slack; executor jobs and the moisture scheduler wake up on their own
+    std::vector<PeriodicTask> tasks {
+        // Battery check
+        { .period = 10s, .slack = 2s, .nextWakeup = START },
+        // Light sensor measurement
+        { .period = 60s, .slack = 6s, .nextWakeup = START + 17ms },
+        // NTP sync
+        { .period = 1h, .slack = 1min, .nextWakeup = START + 5s },
+    };
+
+    auto unaligned = simulate(tasks, 1h, nullptr);
+    WakeupAligner aligner(START);
+    auto aligned = simulate(tasks, 1h, &aligner);
+
+    // 360 + 60 + 1
+    REQUIRE(unaligned == 421);
+    // Light sensor and NTP wakeups all join the battery checks
+    REQUIRE(aligned <= 360 + 2);
+
+    JsonDocument doc;
+    auto json = doc.to<JsonObject>();
+    aligner.populateTelemetry(json, START + 1h);
+    REQUIRE(json["saved-wakeups-per-hour"].as<double>() >= static_cast<double>(unaligned - aligned));
+    REQUIRE(aligner.getSaved() == 0);
+}
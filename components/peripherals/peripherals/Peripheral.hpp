@@ -1,9 +1,12 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <list>
 #include <map>
 #include <memory>
+#include <set>
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -11,15 +14,19 @@
 
 #include <Configuration.hpp>
 #include <EspException.hpp>
+#include <Executor.hpp>
 #include <I2CManager.hpp>
+#include <InitGraph.hpp>
 #include <Manager.hpp>
 #include <Named.hpp>
 #include <PcntManager.hpp>
+#include <Pin.hpp>
 #include <PulseCounter.hpp>
 #include <PwmManager.hpp>
 #include <Telemetry.hpp>
 #include <drivers/SwitchManager.hpp>
 
+#include <peripherals/I2CSettings.hpp>
 #include <peripherals/api/IPeripheral.hpp>
 
 #include "PeripheralException.hpp"
@@ -46,6 +53,7 @@ public:
 // Peripheral factories
 
 struct PeripheralServices {
+    const std::shared_ptr<Executor> executor;
     const std::shared_ptr<I2CManager> i2c;
     const std::shared_ptr<PcntManager> pcntManager;
     const std::shared_ptr<PulseCounterManager> pulseCounterManager;
@@ -58,8 +66,14 @@ struct PeripheralInitParameters;
 
 using PeripheralCreateFn = std::function<Handle(
     PeripheralInitParameters& params,
-    const std::string& jsonSettings)>;
-using PeripheralFactory = kernel::Factory<PeripheralCreateFn>;
+    JsonObjectConst jsonSettings)>;
+
+struct PeripheralFactory {
+    std::string factoryType;      // key used for registration
+    std::string productType;      // human-readable/type-identifying string
+    PeripheralCreateFn create;    // callable to create Handle
+    bool usesI2C;                 // whether products talk to an I2C bus, see I2CSettings
+};
 
 struct PeripheralInitParameters {
     void registerFeature(const std::string& type, std::function<void(JsonObject&)> populate) {
@@ -99,18 +113,19 @@ PeripheralFactory makePeripheralFactory(const std::string& factoryType,
         .productType = std::move(effectiveType),
         .create = [settingsTuple, makeImpl = std::move(makeImpl)](
                       PeripheralInitParameters& params,
-                      const std::string& jsonSettings) -> Handle {
+                      JsonObjectConst jsonSettings) -> Handle {
             // Construct and load settings
             auto settings = std::apply([](auto&&... a) {
                 return std::make_shared<TSettings>(std::forward<decltype(a)>(a)...);
             },
                 settingsTuple);
-            settings->loadFromString(jsonSettings);
+            settings->load(jsonSettings);
 
             // Create concrete implementation via user-provided callable
             auto impl = makeImpl(params, settings);
             return Handle::wrap(std::move(std::static_pointer_cast<Type>(impl)));
         },
+        .usesI2C = std::derived_from<TSettings, I2CSettings>,
     };
 }
 
@@ -126,32 +141,84 @@ public:
         , manager("peripheral") {
     }
 
-    bool createPeripheral(const std::string& peripheralSettings, JsonArray peripheralsInitJson) {
-        auto initJson = peripheralsInitJson.add<JsonObject>();
-        try {
-            manager.createFromSettings(
-                peripheralSettings,
-                initJson,
-                [&](const std::string& name, const PeripheralFactory& factory, const std::string& settings) {
-                    PeripheralInitParameters params = {
-                        .name = name,
-                        .services = services,
-                        .telemetryCollector = telemetryCollector,
-                        .features = initJson["features"].to<JsonArray>(),
-                        .peripherals = manager,
-                    };
-                    return factory.create(params, settings);
-                });
-            return true;
-        } catch (const std::exception& e) {
-            LOGE("%s",
-                e.what());
-            initJson["error"] = std::string(e.what());
-            return false;
+    /**
+     * @brief Create peripherals, several at a time when they do not share pins or refer to each other.
+     *
+     * Pins (including the SDA and SCL pins of I2C buses) are taken from the parameters, resolved to
+     * their GPIO number when they are internal, so `"A2"` and the same pin's number are recognized as one.
+     * I2C peripherals also take their bus, the default one if they don't specify SDA and SCL.
+     * A peripheral depends on another when its parameters mention the other by name,
+     * or one of its external pins like `name:0`.
+     *
+     * @return Whether every peripheral was created.
+     */
+    bool createPeripherals(const std::list<std::string>& peripheralsSettings, JsonArray peripheralsInitJson, size_t concurrency, milliseconds timeout) {
+        std::vector<std::shared_ptr<PendingPeripheral>> pending;
+        std::set<std::string> names;
+        for (const auto& peripheralSettings : peripheralsSettings) {
+            auto peripheral = std::make_shared<PendingPeripheral>();
+            try {
+                peripheral->settings = manager.parseSettings(peripheralSettings);
+                names.insert(peripheral->settings.name);
+            } catch (const std::exception& e) {
+                LOGE("%s",
+                    e.what());
+                peripheral->error = e.what();
+            }
+            pending.push_back(peripheral);
+        }
+
+        InitGraph graph(concurrency, timeout);
+        std::vector<std::shared_ptr<PendingPeripheral>> scheduled;
+        for (const auto& peripheral : pending) {
+            if (!peripheral->error.empty()) {
+                continue;
+            }
+            std::set<std::string> resources;
+            std::set<std::string> dependencies;
+            collectResources(peripheral->settings.getParams(), "", peripheral->settings.name, names, resources, dependencies);
+            if (i2cFactoryTypes.contains(peripheral->settings.type)) {
+                resources.insert(resolveI2CBus(peripheral->settings.getParams()));
+            }
+            graph.add(peripheral->settings.name, resources, dependencies, [this, peripheral]() {
+                create(peripheral->settings, peripheral->initJson.to<JsonObject>());
+            });
+            scheduled.push_back(peripheral);
+        }
+
+        auto results = graph.run();
+        for (size_t i = 0; i < scheduled.size(); i++) {
+            const auto& result = results[i];
+            scheduled[i]->outcome = result.outcome;
+            scheduled[i]->error = result.error;
+            if (result.outcome == InitOutcome::Failed) {
+                LOGE("%s",
+                    result.error.c_str());
+            }
         }
+
+        bool success = true;
+        for (const auto& peripheral : pending) {
+            auto initJson = peripheralsInitJson.add<JsonObject>();
+            // A peripheral that timed out might still be working on its own init message
+            if (peripheral->outcome == InitOutcome::Succeeded || peripheral->outcome == InitOutcome::Failed) {
+                initJson.set(peripheral->initJson.as<JsonObjectConst>());
+            } else if (!peripheral->settings.name.empty()) {
+                initJson["name"] = peripheral->settings.name;
+                initJson["factory"] = peripheral->settings.type;
+            }
+            if (!peripheral->error.empty()) {
+                initJson["error"] = peripheral->error;
+                success = false;
+            }
+        }
+        return success;
     }
 
     void registerFactory(PeripheralFactory factory) {
+        if (factory.usesI2C) {
+            i2cFactoryTypes.insert(factory.factoryType);
+        }
         manager.registerFactory(std::move(factory));
     }
 
@@ -165,10 +232,87 @@ public:
     }
 
 private:
+    using ParsedSettings = SettingsBasedManager<PeripheralFactory>::ParsedSettings;
+
+    struct PendingPeripheral {
+        ParsedSettings settings;
+        JsonDocument initJson;
+        InitOutcome outcome = InitOutcome::Blocked;
+        std::string error;
+    };
+
+    void create(const ParsedSettings& settings, JsonObject initJson) {
+        manager.createFromParsedSettings(
+            settings,
+            initJson,
+            [&](const std::string& name, const PeripheralFactory& factory, JsonObjectConst params) {
+                PeripheralInitParameters initParams = {
+                    .name = name,
+                    .services = services,
+                    .telemetryCollector = telemetryCollector,
+                    .features = initJson["features"].to<JsonArray>(),
+                    .peripherals = manager,
+                };
+                return factory.create(initParams, params);
+            });
+    }
+
+    static bool isPinKey(const std::string& key) {
+        return key == "pin" || key == "pins" || key == "sda" || key == "scl" || key.ends_with("Pin");
+    }
+
+    static void collectResources(JsonVariantConst json, const std::string& key, const std::string& self, const std::set<std::string>& names, std::set<std::string>& resources, std::set<std::string>& dependencies) {
+        if (json.is<JsonObjectConst>()) {
+            for (auto member : json.as<JsonObjectConst>()) {
+                collectResources(member.value(), member.key().c_str(), self, names, resources, dependencies);
+            }
+        } else if (json.is<JsonArrayConst>()) {
+            for (auto element : json.as<JsonArrayConst>()) {
+                collectResources(element, key, self, names, resources, dependencies);
+            }
+        } else if (json.is<const char*>()) {
+            std::string value = json.as<std::string>();
+            for (const auto& name : names) {
+                if (name != self && (value == name || value.starts_with(name + ":"))) {
+                    dependencies.insert(name);
+                }
+            }
+            if (isPinKey(key)) {
+                resources.insert(resolvePin(json));
+            }
+        } else if (json.is<int>() && isPinKey(key)) {
+            resources.insert(resolvePin(json));
+        }
+    }
+
+    static std::string resolvePin(JsonVariantConst pin) {
+        if (pin.is<int>()) {
+            return "gpio " + std::to_string(pin.as<int>());
+        }
+        auto name = pin.as<std::string>();
+        try {
+            return "gpio " + std::to_string(static_cast<int>(InternalPin::byName(name)->getGpio()));
+        } catch (const std::runtime_error&) {
+            // External pins are only registered when the peripheral providing them is created
+            return "pin " + name;
+        }
+    }
+
+    static std::string resolveI2CBus(JsonObjectConst params) {
+        auto sda = params["sda"];
+        auto scl = params["scl"];
+        if (sda.isNull() && scl.isNull()) {
+            return "i2c default";
+        }
+        return "i2c " + (sda.isNull() ? std::string("default") : resolvePin(sda))
+            + " " + (scl.isNull() ? std::string("default") : resolvePin(scl));
+    }
+
     const std::shared_ptr<TelemetryCollector> telemetryCollector;
     const PeripheralServices services;
 
     SettingsBasedManager<PeripheralFactory> manager;
+    std::set<std::string> i2cFactoryTypes;
 };
 
 }    // namespace farmhub::peripherals
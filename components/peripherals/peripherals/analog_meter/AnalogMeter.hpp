@@ -5,11 +5,11 @@
 
 #include <Concurrent.hpp>
 #include <Configuration.hpp>
+#include <Executor.hpp>
 #include <Log.hpp>
 #include <MovingAverage.hpp>
 #include <Named.hpp>
 #include <Pin.hpp>
-#include <Task.hpp>
 #include <mqtt/MqttDriver.hpp>
 #include <peripherals/Peripheral.hpp>
 
@@ -27,10 +27,12 @@ class AnalogMeter final
 public:
     AnalogMeter(
         const std::string& name,
+        const std::shared_ptr<Executor>& executor,
         const InternalPinPtr& pin,
         double offset,
         double multiplier,
         milliseconds measurementFrequency,
+        milliseconds measurementTolerance,
         std::size_t windowSize)
         : Peripheral(name)
         , pin(pin)
@@ -39,7 +41,7 @@ public:
         LOGTI(ANALOG_METER, "Initializing analog meter on pin %s",
             pin->getName().c_str());
 
-        Task::loop(name, 3072, [this, measurementFrequency, offset, multiplier](Task& task) {
+        executor->schedule(name, measurementFrequency, measurementTolerance, [this, offset, multiplier]() {
             auto measurement = this->pin.tryAnalogRead();
             if (measurement.has_value()) {
                 auto rawValue = *measurement;
@@ -48,7 +50,6 @@ public:
                     this->name.c_str(), value, rawValue);
                 this->value.record(value);
             }
-            task.delayUntil(measurementFrequency);
         });
     }
 
@@ -69,6 +70,8 @@ public:
     Property<double> offset { this, "offset", 0.0 };
     Property<double> multiplier { this, "multiplier", 1.0 };
     Property<milliseconds> measurementFrequency { this, "measurementFrequency", 1s };
+    // How much later a measurement can be taken to coalesce it with other periodic work
+    Property<milliseconds> measurementTolerance { this, "measurementTolerance", 100ms };
     Property<std::size_t> windowSize { this, "windowSize", 1 };
 };
 
@@ -79,10 +82,12 @@ inline PeripheralFactory makeFactory() {
         [](PeripheralInitParameters& params, const std::shared_ptr<AnalogMeterSettings>& settings) {
             auto meter = std::make_shared<AnalogMeter>(
                 params.name,
+                params.services.executor,
                 settings->pin.get(),
                 settings->offset.get(),
                 settings->multiplier.get(),
                 settings->measurementFrequency.get(),
+                settings->measurementTolerance.get(),
                 settings->windowSize.get());
 
             params.registerFeature(settings->type.get(), [meter](JsonObject& telemetryJson) {
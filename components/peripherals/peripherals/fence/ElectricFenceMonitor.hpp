@@ -4,6 +4,7 @@
 #include <list>
 
 #include <Concurrent.hpp>
+#include <Executor.hpp>
 #include <PulseCounter.hpp>
 #include <Telemetry.hpp>
 
@@ -26,6 +27,8 @@ class ElectricFenceMonitorSettings
 public:
     ArrayProperty<FencePinConfig> pins { this, "pins" };
     Property<seconds> measurementFrequency { this, "measurementFrequency", 10s };
+    // How much later a measurement can be taken to coalesce it with other periodic work
+    Property<milliseconds> measurementTolerance { this, "measurementTolerance", 1s };
 };
 
 class ElectricFenceMonitor final
@@ -33,6 +36,7 @@ class ElectricFenceMonitor final
 public:
     ElectricFenceMonitor(
         const std::string& name,
+        const std::shared_ptr<Executor>& executor,
         const std::shared_ptr<PulseCounterManager>& pulseCounterManager,
         const std::shared_ptr<ElectricFenceMonitorSettings>& settings)
         : Peripheral(name) {
@@ -53,8 +57,7 @@ public:
             pins.emplace_back(pinConfig.voltage, unit);
         }
 
-        auto measurementFrequency = settings->measurementFrequency.get();
-        Task::loop(name, 3072, [this, measurementFrequency](Task& task) {
+        executor->schedule(name, settings->measurementFrequency.get(), settings->measurementTolerance.get(), [this]() {
             uint16_t lastVoltage = 0;
             for (auto& pin : pins) {
                 uint32_t count = pin.counter->reset();
@@ -68,7 +71,6 @@ public:
             this->lastVoltage = lastVoltage;
             LOGV("Last voltage: %d",
                 lastVoltage);
-            task.delayUntil(measurementFrequency);
         });
     }
 
@@ -94,6 +96,7 @@ inline PeripheralFactory makeFactory() {
         [](PeripheralInitParameters& params, const std::shared_ptr<ElectricFenceMonitorSettings>& settings) {
             auto monitor = std::make_shared<ElectricFenceMonitor>(
                 params.name,
+                params.services.executor,
                 params.services.pulseCounterManager,
                 settings);
             params.registerFeature("voltage", [monitor](JsonObject& telemetryJson) {
@@ -5,8 +5,8 @@
 #include <ArduinoJson.h>
 
 #include <Concurrent.hpp>
+#include <Executor.hpp>
 #include <PulseCounter.hpp>
-#include <Task.hpp>
 #include <Telemetry.hpp>
 #include <mqtt/MqttDriver.hpp>
 #include <utility>
@@ -27,6 +27,8 @@ public:
     // Default Q factor for YF-S201 flow sensor
     Property<double> qFactor { this, "qFactor", 7.5 };
     Property<milliseconds> measurementFrequency { this, "measurementFrequency", 1s };
+    // How much later a measurement can be taken to coalesce it with other periodic work
+    Property<milliseconds> measurementTolerance { this, "measurementTolerance", 100ms };
 };
 
 class FlowMeter final
@@ -35,10 +37,12 @@ class FlowMeter final
 public:
     FlowMeter(
         const std::string& name,
+        const std::shared_ptr<Executor>& executor,
         const std::shared_ptr<PulseCounterManager>& pulseCounterManager,
         const InternalPinPtr& pin,
         double qFactor,
-        milliseconds measurementFrequency)
+        milliseconds measurementFrequency,
+        milliseconds measurementTolerance)
         : Peripheral(name)
         , qFactor(qFactor) {
 
@@ -55,7 +59,7 @@ public:
         lastSeenFlow = now;
         lastPublished = now;
 
-        Task::loop(name, 3072, [this, measurementFrequency](Task& task) {
+        executor->schedule(name, measurementFrequency, measurementTolerance, [this]() {
             auto now = steady_clock::now();
             milliseconds elapsed = duration_cast<milliseconds>(now - lastMeasurement);
             if (elapsed.count() > 0) {
@@ -72,7 +76,6 @@ public:
                     lastSeenFlow = now;
                 }
             }
-            task.delayUntil(measurementFrequency);
         });
     }
 
@@ -128,10 +131,12 @@ inline PeripheralFactory makeFactory() {
         [](PeripheralInitParameters& params, const std::shared_ptr<FlowMeterSettings>& settings) {
             auto meter = std::make_shared<FlowMeter>(
                 params.name,
+                params.services.executor,
                 params.services.pulseCounterManager,
                 settings->pin.get(),
                 settings->qFactor.get(),
-                settings->measurementFrequency.get());
+                settings->measurementFrequency.get(),
+                settings->measurementTolerance.get());
             params.registerFeature("flow", [meter](JsonObject& telemetry) {
                 meter->populateTelemetry(telemetry);
             });
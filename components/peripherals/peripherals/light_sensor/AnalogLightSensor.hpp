@@ -9,7 +9,6 @@
 #include <Pin.hpp>
 #include <Telemetry.hpp>
 
-#include <peripherals/I2CSettings.hpp>
 #include <peripherals/Peripheral.hpp>
 #include <peripherals/light_sensor/LightSensor.hpp>
 #include <utility>
@@ -23,7 +22,7 @@ using namespace farmhub::peripherals;
 namespace farmhub::peripherals::light_sensor {
 
 class AnalogLightSensorSettings
-    : public I2CSettings {
+    : public ConfigurationSection {
 public:
     Property<InternalPinPtr> pin { this, "pin" };
     Property<double> gamma { this, "gamma", 0.7 };
@@ -54,7 +54,8 @@ protected:
                 Lock lock(updateAverageMutex);
                 level.record(currentLevel);
             }
-            task.delayUntil(measurementFrequency);
+            // Measurements can be a bit late, so they can share wakeups with other tasks
+            task.delayUntil(measurementFrequency, measurementFrequency / 10);
         });
     }
 
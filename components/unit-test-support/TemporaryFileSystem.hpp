@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#include <stdlib.h>
+
+#include <FileSystem.hpp>
+
+namespace farmhub::test {
+
+/**
+ * @brief A fresh directory under `/tmp`, removed with everything in it when destroyed.
+ *
+ * Storage code needs a writable file system, which tests only have when running on the host,
+ * i.e. with `CONFIG_IDF_TARGET_LINUX`.
+ */
+class TemporaryDirectory {
+public:
+    explicit TemporaryDirectory(const std::string& prefix)
+        : path(create(prefix)) {
+    }
+
+    ~TemporaryDirectory() {
+        std::error_code error;
+        std::filesystem::remove_all(path, error);
+    }
+
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+
+    const std::string& getPath() const {
+        return path;
+    }
+
+private:
+    static std::string create(const std::string& prefix) {
+        std::string pattern = "/tmp/" + prefix + "-XXXXXX";
+        if (mkdtemp(pattern.data()) == nullptr) {
+            throw std::runtime_error("Cannot create temporary directory '" + pattern + "': " + strerror(errno));
+        }
+        return pattern;
+    }
+
+    const std::string path;
+};
+
+/**
+ * @brief A file system rooted in a temporary directory that lives as long as the file system.
+ */
+class TemporaryFileSystem
+    : private TemporaryDirectory,
+      public farmhub::kernel::FileSystem {
+public:
+    explicit TemporaryFileSystem(const std::string& prefix)
+        : TemporaryDirectory(prefix)
+        , FileSystem(TemporaryDirectory::getPath()) {
+    }
+
+    using TemporaryDirectory::getPath;
+};
+
+}    // namespace farmhub::test
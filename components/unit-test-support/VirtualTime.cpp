@@ -0,0 +1,1281 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "VirtualTime.hpp"
+
+// The original FreeRTOS functions, for objects created outside the simulation
+extern "C" {
+BaseType_t __real_xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, BaseType_t);
+void __real_vTaskDelete(TaskHandle_t);
+void __real_vTaskDelay(TickType_t);
+BaseType_t __real_xTaskDelayUntil(TickType_t*, TickType_t);
+TickType_t __real_xTaskGetTickCount(void);
+TaskHandle_t __real_xTaskGetCurrentTaskHandle(void);
+char* __real_pcTaskGetName(TaskHandle_t);
+UBaseType_t __real_uxTaskGetStackHighWaterMark(TaskHandle_t);
+uint32_t __real_ulTaskGetRunTimeCounter(TaskHandle_t);
+UBaseType_t __real_uxTaskPriorityGet(TaskHandle_t);
+void __real_vTaskSuspend(TaskHandle_t);
+void __real_vTaskResume(TaskHandle_t);
+BaseType_t __real_xTaskAbortDelay(TaskHandle_t);
+BaseType_t __real_xTaskGenericNotify(TaskHandle_t, UBaseType_t, uint32_t, eNotifyAction, uint32_t*);
+BaseType_t __real_xTaskGenericNotifyFromISR(TaskHandle_t, UBaseType_t, uint32_t, eNotifyAction, uint32_t*, BaseType_t*);
+void __real_vTaskGenericNotifyGiveFromISR(TaskHandle_t, UBaseType_t, BaseType_t*);
+uint32_t __real_ulTaskGenericNotifyTake(UBaseType_t, BaseType_t, TickType_t);
+BaseType_t __real_xTaskGenericNotifyWait(UBaseType_t, uint32_t, uint32_t, uint32_t*, TickType_t);
+void __real_vTaskSetTimeOutState(TimeOut_t*);
+BaseType_t __real_xTaskCheckForTimeOut(TimeOut_t*, TickType_t*);
+void __real_vPortYield(void);
+
+QueueHandle_t __real_xQueueGenericCreate(UBaseType_t, UBaseType_t, uint8_t);
+QueueHandle_t __real_xQueueCreateMutex(uint8_t);
+QueueHandle_t __real_xQueueCreateCountingSemaphore(UBaseType_t, UBaseType_t);
+void __real_vQueueDelete(QueueHandle_t);
+BaseType_t __real_xQueueGenericSend(QueueHandle_t, const void*, TickType_t, BaseType_t);
+BaseType_t __real_xQueueGenericSendFromISR(QueueHandle_t, const void*, BaseType_t*, BaseType_t);
+BaseType_t __real_xQueueGiveFromISR(QueueHandle_t, BaseType_t*);
+BaseType_t __real_xQueueReceive(QueueHandle_t, void*, TickType_t);
+BaseType_t __real_xQueueReceiveFromISR(QueueHandle_t, void*, BaseType_t*);
+BaseType_t __real_xQueuePeek(QueueHandle_t, void*, TickType_t);
+BaseType_t __real_xQueueSemaphoreTake(QueueHandle_t, TickType_t);
+BaseType_t __real_xQueueTakeMutexRecursive(QueueHandle_t, TickType_t);
+BaseType_t __real_xQueueGiveMutexRecursive(QueueHandle_t);
+UBaseType_t __real_uxQueueMessagesWaiting(QueueHandle_t);
+UBaseType_t __real_uxQueueSpacesAvailable(QueueHandle_t);
+BaseType_t __real_xQueueGenericReset(QueueHandle_t, BaseType_t);
+
+EventGroupHandle_t __real_xEventGroupCreate(void);
+void __real_vEventGroupDelete(EventGroupHandle_t);
+EventBits_t __real_xEventGroupWaitBits(EventGroupHandle_t, EventBits_t, BaseType_t, BaseType_t, TickType_t);
+EventBits_t __real_xEventGroupSetBits(EventGroupHandle_t, EventBits_t);
+EventBits_t __real_xEventGroupClearBits(EventGroupHandle_t, EventBits_t);
+BaseType_t __real_xTimerPendFunctionCallFromISR(PendedFunction_t, void*, uint32_t, BaseType_t*);
+}
+
+namespace farmhub::test {
+
+namespace {
+
+using VirtualTicks = duration<uint64_t, std::ratio<1, configTICK_RATE_HZ>>;
+
+struct SimTask;
+
+/**
+ * @brief Something tasks can block on.
+ */
+struct Waitable {
+    std::vector<SimTask*> waiters;
+};
+
+enum class TaskState : uint8_t {
+    Ready,
+    Running,
+    Blocked,
+    Suspended,
+    Deleted,
+};
+
+struct Notification {
+    uint32_t value = 0;
+    bool pending = false;
+};
+
+// Tasks are waitable, too: they wait on themselves for notifications
+struct SimTask : Waitable {
+    SimTask(const char* name, UBaseType_t priority, uint32_t stackDepth)
+        : name(name == nullptr ? "" : name)
+        , priority(priority)
+        , stackDepth(stackDepth) {
+    }
+
+    Notification& notification(UBaseType_t index) {
+        if (notifications.size() <= index) {
+            notifications.resize(index + 1);
+        }
+        return notifications[index];
+    }
+
+    std::string name;
+    const UBaseType_t priority;
+    const uint32_t stackDepth;
+
+    TaskState state = TaskState::Ready;
+    std::condition_variable resumed;
+
+    Waitable* blockedOn = nullptr;
+    std::optional<uint64_t> wakeAt;
+    bool timedOut = false;
+    bool wokenUp = false;
+
+    std::vector<Notification> notifications;
+};
+
+struct SimQueue : Waitable {
+    SimQueue(uint8_t type, size_t itemSize, size_t capacity)
+        : type(type)
+        , itemSize(itemSize)
+        , capacity(capacity) {
+    }
+
+    bool isMutex() const {
+        return type == queueQUEUE_TYPE_MUTEX || type == queueQUEUE_TYPE_RECURSIVE_MUTEX;
+    }
+
+    const uint8_t type;
+    const size_t itemSize;
+    const size_t capacity;
+    std::deque<std::vector<uint8_t>> items;
+
+    SimTask* holder = nullptr;
+    UBaseType_t recursion = 0;
+};
+
+struct SimEventGroup : Waitable {
+    EventBits_t bits = 0;
+};
+
+/**
+ * @brief The state of the simulation, shared by all tasks, and guarded by `mutex`.
+ *
+ * Only the task in `current` runs, all other task threads wait for their turn.
+ */
+class Simulation {
+public:
+    static Simulation& get() {
+        // Never destroyed, as abandoned task threads might still refer to it
+        static auto* instance = new Simulation();
+        return *instance;
+    }
+
+    bool isActive() const {
+        return active.load();
+    }
+
+    uint64_t now() const {
+        return tick.load();
+    }
+
+    std::mutex mutex;
+
+    // --- Lifecycle
+
+    void start(system_clock::time_point wallClockStart) {
+        std::unique_lock lock(mutex);
+        if (active) {
+            fail("Only one virtual time simulation can run at a time");
+        }
+        tick = 0;
+        steadyStart = realClock(CLOCK_MONOTONIC);
+        wallClockStartSinceEpoch = duration_cast<nanoseconds>(wallClockStart.time_since_epoch());
+        wakeups.clear();
+        contextSwitches = 0;
+        ready.clear();
+        tasks.clear();
+
+        driver = new SimTask("test", 0, 0);
+        driver->state = TaskState::Running;
+        registerTask(driver);
+        current = driver;
+        self = driver;
+        active = true;
+    }
+
+    void stop() {
+        std::unique_lock lock(mutex);
+        for (auto* task : tasks) {
+            // Abandoned threads stay waiting for their turn forever
+            unblock(task);
+            task->state = TaskState::Deleted;
+        }
+        tasks.clear();
+        ready.clear();
+        current = nullptr;
+        driver = nullptr;
+        self = nullptr;
+        active = false;
+    }
+
+    // --- Running tasks
+
+    SimTask* currentTask() const {
+        return self;
+    }
+
+    SimTask* createTask(TaskFunction_t function, const char* name, uint32_t stackDepth, void* parameters, UBaseType_t priority) {
+        auto* task = new SimTask(name, priority, stackDepth);
+        registerTask(task);
+        makeReady(task);
+
+        // Signals must not be delivered to task threads, FreeRTOS does not know about them
+        sigset_t allSignals;
+        sigset_t previousMask;
+        sigfillset(&allSignals);
+        pthread_sigmask(SIG_SETMASK, &allSignals, &previousMask);
+        std::thread([this, task, function, parameters]() {
+            {
+                std::unique_lock lock(mutex);
+                self = task;
+                task->resumed.wait(lock, [this, task]() { return current == task; });
+            }
+            function(parameters);
+            // Tasks must not return, but if they do, treat it as deleting themselves
+            std::unique_lock lock(mutex);
+            deleteTask(lock, task);
+        }).detach();
+        pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+        return task;
+    }
+
+    void deleteTask(std::unique_lock<std::mutex>& lock, SimTask* task) {
+        if (task->state == TaskState::Deleted) {
+            return;
+        }
+        unblock(task);
+        std::erase(ready, task);
+        task->state = TaskState::Deleted;
+        if (task == self) {
+            // Never returns
+            switchAway(lock);
+        }
+    }
+
+    void suspendTask(std::unique_lock<std::mutex>& lock, SimTask* task) {
+        if (task->state == TaskState::Deleted || task->state == TaskState::Suspended) {
+            return;
+        }
+        if (task->state == TaskState::Blocked) {
+            // Whatever the task was waiting for is abandoned
+            unblock(task);
+            task->timedOut = true;
+        }
+        std::erase(ready, task);
+        task->state = TaskState::Suspended;
+        if (task == self) {
+            switchAway(lock);
+        }
+    }
+
+    void resumeTask(SimTask* task) {
+        if (task->state == TaskState::Suspended) {
+            task->wokenUp = true;
+            makeReady(task);
+        }
+    }
+
+    bool abortDelay(SimTask* task) {
+        if (task->state != TaskState::Blocked) {
+            return false;
+        }
+        wake(task, true);
+        return true;
+    }
+
+    void yield(std::unique_lock<std::mutex>& lock) {
+        makeReady(self);
+        switchAway(lock);
+    }
+
+    std::optional<uint64_t> deadlineAfter(TickType_t timeout) const {
+        if (timeout == portMAX_DELAY) {
+            return std::nullopt;
+        }
+        return now() + timeout;
+    }
+
+    /**
+     * @brief Block the current task on `waitable` until it is woken up, or until `deadline` passes.
+     *
+     * @return Whether the task was woken up before the deadline.
+     */
+    bool block(std::unique_lock<std::mutex>& lock, Waitable* waitable, std::optional<uint64_t> deadline) {
+        auto* task = self;
+        if (task == nullptr || (deadline.has_value() && *deadline <= now())) {
+            // Cannot wait outside of tasks
+            return false;
+        }
+        task->state = TaskState::Blocked;
+        task->blockedOn = waitable;
+        if (waitable != nullptr) {
+            waitable->waiters.push_back(task);
+        }
+        task->wakeAt = deadline;
+        task->timedOut = false;
+        switchAway(lock);
+        return !task->timedOut;
+    }
+
+    /**
+     * @brief Wake up all tasks waiting on `waitable`, so they can check if they can proceed.
+     */
+    void notifyAll(Waitable& waitable) {
+        auto waiters = std::move(waitable.waiters);
+        waitable.waiters.clear();
+        for (auto* task : waiters) {
+            wake(task, false);
+        }
+    }
+
+    // --- Object registry
+
+    SimQueue* registerQueue(SimQueue* queue) {
+        queues.insert(queue);
+        return queue;
+    }
+
+    SimEventGroup* registerEventGroup(SimEventGroup* group) {
+        eventGroups.insert(group);
+        return group;
+    }
+
+    void deleteQueue(SimQueue* queue) {
+        forgetWaiters(*queue);
+        queues.erase(queue);
+        delete queue;
+    }
+
+    void deleteEventGroup(SimEventGroup* group) {
+        forgetWaiters(*group);
+        eventGroups.erase(group);
+        delete group;
+    }
+
+    SimQueue* asQueue(QueueHandle_t handle) {
+        return find(queues, handle);
+    }
+
+    SimEventGroup* asEventGroup(EventGroupHandle_t handle) {
+        return find(eventGroups, handle);
+    }
+
+    /**
+     * @brief Find the simulated task for `handle`, or the current one for `nullptr`.
+     */
+    SimTask* asTask(TaskHandle_t handle) {
+        if (handle == nullptr) {
+            return self;
+        }
+        return find(taskHandles, handle);
+    }
+
+    // --- Inspection
+
+    steady_clock::time_point steadyNow() const {
+        return steady_clock::time_point(duration_cast<steady_clock::duration>(steadyStart + VirtualTicks(now())));
+    }
+
+    system_clock::time_point systemNow() const {
+        return system_clock::time_point(duration_cast<system_clock::duration>(wallClockStartSinceEpoch + VirtualTicks(now())));
+    }
+
+    static nanoseconds realClock(clockid_t clock) {
+        timespec time {};
+        clock_gettime(clock, &time);
+        return seconds(time.tv_sec) + nanoseconds(time.tv_nsec);
+    }
+
+    std::vector<TaskWakeup> wakeups;
+    size_t contextSwitches = 0;
+
+private:
+    Simulation() = default;
+
+    // Handles are only ever dereferenced after they were found among the objects created by the simulation
+    template <typename T, typename THandle>
+    static T* find(const std::unordered_set<T*>& objects, THandle handle) {
+        auto* object = reinterpret_cast<T*>(handle);
+        return objects.contains(object) ? object : nullptr;
+    }
+
+    void registerTask(SimTask* task) {
+        tasks.push_back(task);
+        taskHandles.insert(task);
+    }
+
+    /**
+     * @brief Add the task to the ready list after all tasks with the same or higher priority.
+     */
+    void makeReady(SimTask* task) {
+        task->state = TaskState::Ready;
+        auto position = std::ranges::find_if(ready, [task](SimTask* other) {
+            return other->priority < task->priority;
+        });
+        ready.insert(position, task);
+    }
+
+    /**
+     * @brief Tasks blocked on a deleted object can only wake up by timing out, like in FreeRTOS.
+     */
+    static void forgetWaiters(Waitable& waitable) {
+        for (auto* task : waitable.waiters) {
+            task->blockedOn = nullptr;
+        }
+        waitable.waiters.clear();
+    }
+
+    void unblock(SimTask* task) {
+        if (task->blockedOn != nullptr) {
+            std::erase(task->blockedOn->waiters, task);
+            task->blockedOn = nullptr;
+        }
+        task->wakeAt.reset();
+    }
+
+    void wake(SimTask* task, bool timedOut) {
+        if (task->state != TaskState::Blocked) {
+            return;
+        }
+        unblock(task);
+        task->timedOut = timedOut;
+        task->wokenUp = true;
+        makeReady(task);
+    }
+
+    /**
+     * @brief Hand over to the next task to run, and wait until the current task gets its turn again.
+     */
+    void switchAway(std::unique_lock<std::mutex>& lock) {
+        auto* task = self;
+        auto* next = pickNext();
+        if (next != task) {
+            contextSwitches++;
+            current = next;
+            next->resumed.notify_one();
+            task->resumed.wait(lock, [this, task]() { return current == task; });
+        }
+    }
+
+    SimTask* pickNext() {
+        while (ready.empty()) {
+            advanceToNextDeadline();
+        }
+        auto* next = ready.front();
+        ready.erase(ready.begin());
+        next->state = TaskState::Running;
+        if (next->wokenUp) {
+            next->wokenUp = false;
+            if (next != driver) {
+                wakeups.push_back({ duration_cast<milliseconds>(VirtualTicks(now())), next->name });
+            }
+        }
+        return next;
+    }
+
+    /**
+     * @brief Every task is blocked, so jump to the earliest deadline, and wake up the tasks waiting for it.
+     */
+    void advanceToNextDeadline() {
+        std::optional<uint64_t> next;
+        for (auto* task : tasks) {
+            if (task->state == TaskState::Blocked && task->wakeAt.has_value()) {
+                next = std::min(next.value_or(UINT64_MAX), *task->wakeAt);
+            }
+        }
+        if (!next.has_value()) {
+            reportDeadlock();
+        }
+        tick = std::max(now(), *next);
+        for (auto* task : tasks) {
+            if (task->state == TaskState::Blocked && task->wakeAt.has_value() && *task->wakeAt <= now()) {
+                wake(task, true);
+            }
+        }
+    }
+
+    [[noreturn]] void reportDeadlock() {
+        std::fprintf(stderr, "Virtual time deadlock at %llu ticks, all tasks are blocked without a timeout:\n",
+            static_cast<unsigned long long>(now()));
+        for (auto* task : tasks) {
+            std::fprintf(stderr, " - '%s' (state %d)\n", task->name.c_str(), static_cast<int>(task->state));
+        }
+        fail("Virtual time deadlock");
+    }
+
+    [[noreturn]] static void fail(const char* message) {
+        std::fprintf(stderr, "%s\n", message);
+        std::fflush(stderr);
+        std::abort();
+    }
+
+    std::atomic<bool> active { false };
+    std::atomic<uint64_t> tick { 0 };
+    nanoseconds steadyStart {};
+    nanoseconds wallClockStartSinceEpoch {};
+
+    SimTask* current = nullptr;
+    SimTask* driver = nullptr;
+    std::vector<SimTask*> ready;
+    std::vector<SimTask*> tasks;
+    // Objects created while the simulation was active; abandoned tasks stay here, too
+    std::unordered_set<SimTask*> taskHandles;
+    std::unordered_set<SimQueue*> queues;
+    std::unordered_set<SimEventGroup*> eventGroups;
+
+    static thread_local SimTask* self;
+};
+
+thread_local SimTask* Simulation::self = nullptr;
+
+Simulation& sim() {
+    return Simulation::get();
+}
+
+}    // namespace
+
+// --- Public API
+
+VirtualTime::VirtualTime(system_clock::time_point wallClockStart) {
+    sigset_t allSignals;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &previousSignalMask);
+    sim().start(wallClockStart);
+}
+
+VirtualTime::~VirtualTime() {
+    sim().stop();
+    pthread_sigmask(SIG_SETMASK, &previousSignalMask, nullptr);
+}
+
+void VirtualTime::runFor(milliseconds duration) {
+    std::unique_lock lock(sim().mutex);
+    auto deadline = sim().now() + duration_cast<VirtualTicks>(duration).count();
+    while (sim().now() < deadline) {
+        sim().block(lock, nullptr, deadline);
+    }
+}
+
+milliseconds VirtualTime::elapsed() const {
+    return duration_cast<milliseconds>(VirtualTicks(sim().now()));
+}
+
+std::vector<TaskWakeup> VirtualTime::getWakeups() const {
+    std::unique_lock lock(sim().mutex);
+    return sim().wakeups;
+}
+
+void VirtualTime::clearWakeups() {
+    std::unique_lock lock(sim().mutex);
+    sim().wakeups.clear();
+}
+
+size_t VirtualTime::getContextSwitches() const {
+    std::unique_lock lock(sim().mutex);
+    return sim().contextSwitches;
+}
+
+nanoseconds VirtualTime::hostTime() {
+    return Simulation::realClock(CLOCK_MONOTONIC);
+}
+
+}    // namespace farmhub::test
+
+// --- Clocks
+//
+// The standard clocks are wrapped at link time like the FreeRTOS functions below, see CMakeLists.txt.
+// The wrapped symbols are libstdc++'s mangled names for `steady_clock::now()` and `system_clock::now()`;
+// outside a simulation the calls go through to the real clocks.
+
+extern "C" {
+
+std::chrono::steady_clock::time_point __real__ZNSt6chrono3_V212steady_clock3nowEv() noexcept;
+std::chrono::system_clock::time_point __real__ZNSt6chrono3_V212system_clock3nowEv() noexcept;
+
+std::chrono::steady_clock::time_point __wrap__ZNSt6chrono3_V212steady_clock3nowEv() noexcept {
+    if (farmhub::test::sim().isActive()) {
+        return farmhub::test::sim().steadyNow();
+    }
+    return __real__ZNSt6chrono3_V212steady_clock3nowEv();
+}
+
+std::chrono::system_clock::time_point __wrap__ZNSt6chrono3_V212system_clock3nowEv() noexcept {
+    if (farmhub::test::sim().isActive()) {
+        return farmhub::test::sim().systemNow();
+    }
+    return __real__ZNSt6chrono3_V212system_clock3nowEv();
+}
+
+}    // extern "C"
+
+// --- FreeRTOS functions
+
+using farmhub::test::sim;
+using farmhub::test::SimEventGroup;
+using farmhub::test::SimQueue;
+using farmhub::test::SimTask;
+
+namespace {
+
+BaseType_t sendToQueue(std::unique_lock<std::mutex>& lock, SimQueue* queue, const void* item, TickType_t timeout, BaseType_t position) {
+    auto deadline = sim().deadlineAfter(timeout);
+    while (true) {
+        if (position == queueOVERWRITE && !queue->items.empty()) {
+            queue->items.pop_back();
+        }
+        if (queue->items.size() < queue->capacity) {
+            std::vector<uint8_t> data;
+            if (queue->itemSize > 0 && item != nullptr) {
+                const auto* bytes = static_cast<const uint8_t*>(item);
+                data.assign(bytes, bytes + queue->itemSize);
+            }
+            if (position == queueSEND_TO_FRONT) {
+                queue->items.push_front(std::move(data));
+            } else {
+                queue->items.push_back(std::move(data));
+            }
+            if (queue->isMutex()) {
+                queue->holder = nullptr;
+            }
+            sim().notifyAll(*queue);
+            return pdTRUE;
+        }
+        if (!sim().block(lock, queue, deadline)) {
+            return errQUEUE_FULL;
+        }
+    }
+}
+
+BaseType_t receiveFromQueue(std::unique_lock<std::mutex>& lock, SimQueue* queue, void* buffer, TickType_t timeout, bool remove) {
+    auto deadline = sim().deadlineAfter(timeout);
+    while (true) {
+        if (!queue->items.empty()) {
+            if (queue->itemSize > 0 && buffer != nullptr) {
+                std::memcpy(buffer, queue->items.front().data(), queue->itemSize);
+            }
+            if (remove) {
+                queue->items.pop_front();
+                if (queue->isMutex()) {
+                    queue->holder = sim().currentTask();
+                }
+                sim().notifyAll(*queue);
+            }
+            return pdTRUE;
+        }
+        if (!sim().block(lock, queue, deadline)) {
+            return errQUEUE_EMPTY;
+        }
+    }
+}
+
+BaseType_t notifyTask(SimTask* task, UBaseType_t index, uint32_t value, eNotifyAction action, uint32_t* previousValue) {
+    auto& notification = task->notification(index);
+    if (previousValue != nullptr) {
+        *previousValue = notification.value;
+    }
+    switch (action) {
+        case eSetBits:
+            notification.value |= value;
+            break;
+        case eIncrement:
+            notification.value++;
+            break;
+        case eSetValueWithOverwrite:
+            notification.value = value;
+            break;
+        case eSetValueWithoutOverwrite:
+            if (notification.pending) {
+                return pdFAIL;
+            }
+            notification.value = value;
+            break;
+        case eNoAction:
+            break;
+    }
+    notification.pending = true;
+    sim().notifyAll(*task);
+    return pdPASS;
+}
+
+EventBits_t setEventBits(SimEventGroup* group, EventBits_t bits) {
+    group->bits |= bits;
+    sim().notifyAll(*group);
+    return group->bits;
+}
+
+EventBits_t clearEventBits(SimEventGroup* group, EventBits_t bits) {
+    auto previousBits = group->bits;
+    group->bits &= ~bits;
+    return previousBits;
+}
+
+}    // namespace
+
+extern "C" {
+
+// Tasks
+
+BaseType_t __wrap_xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth, void* parameters, UBaseType_t priority, TaskHandle_t* createdTask, BaseType_t coreId) {
+    if (!sim().isActive()) {
+        return __real_xTaskCreatePinnedToCore(function, name, stackDepth, parameters, priority, createdTask, coreId);
+    }
+    std::unique_lock lock(sim().mutex);
+    auto* task = sim().createTask(function, name, stackDepth, parameters, priority);
+    if (createdTask != nullptr) {
+        *createdTask = reinterpret_cast<TaskHandle_t>(task);
+    }
+    return pdPASS;
+}
+
+// Only used when `xTaskCreate()` is not inlined
+BaseType_t __wrap_xTaskCreate(TaskFunction_t function, const char* name, uint32_t stackDepth, void* parameters, UBaseType_t priority, TaskHandle_t* createdTask) {
+    return __wrap_xTaskCreatePinnedToCore(function, name, stackDepth, parameters, priority, createdTask, tskNO_AFFINITY);
+}
+
+void __wrap_vTaskDelete(TaskHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = sim().asTask(handle);
+    if (task == nullptr) {
+        lock.unlock();
+        __real_vTaskDelete(handle);
+        return;
+    }
+    sim().deleteTask(lock, task);
+}
+
+void __wrap_vTaskDelay(TickType_t ticks) {
+    std::unique_lock lock(sim().mutex);
+    if (sim().currentTask() == nullptr) {
+        lock.unlock();
+        __real_vTaskDelay(ticks);
+        return;
+    }
+    if (ticks == 0) {
+        sim().yield(lock);
+        return;
+    }
+    sim().block(lock, nullptr, sim().now() + ticks);
+}
+
+BaseType_t __wrap_xTaskDelayUntil(TickType_t* previousWakeTime, TickType_t increment) {
+    std::unique_lock lock(sim().mutex);
+    if (sim().currentTask() == nullptr) {
+        lock.unlock();
+        return __real_xTaskDelayUntil(previousWakeTime, increment);
+    }
+    // Same overflow handling as FreeRTOS
+    auto tickCount = static_cast<TickType_t>(sim().now());
+    TickType_t timeToWake = *previousWakeTime + increment;
+    bool shouldDelay;
+    if (tickCount < *previousWakeTime) {
+        shouldDelay = timeToWake < *previousWakeTime && timeToWake > tickCount;
+    } else {
+        shouldDelay = timeToWake < *previousWakeTime || timeToWake > tickCount;
+    }
+    *previousWakeTime = timeToWake;
+    if (shouldDelay) {
+        sim().block(lock, nullptr, sim().now() + static_cast<TickType_t>(timeToWake - tickCount));
+    } else {
+        sim().yield(lock);
+    }
+    return shouldDelay ? pdTRUE : pdFALSE;
+}
+
+TickType_t __wrap_xTaskGetTickCount(void) {
+    if (!sim().isActive()) {
+        return __real_xTaskGetTickCount();
+    }
+    return static_cast<TickType_t>(sim().now());
+}
+
+TaskHandle_t __wrap_xTaskGetCurrentTaskHandle(void) {
+    auto* task = sim().currentTask();
+    if (task == nullptr) {
+        return __real_xTaskGetCurrentTaskHandle();
+    }
+    return reinterpret_cast<TaskHandle_t>(task);
+}
+
+char* __wrap_pcTaskGetName(TaskHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = sim().asTask(handle);
+    if (task == nullptr) {
+        lock.unlock();
+        return __real_pcTaskGetName(handle);
+    }
+    return task->name.data();
+}
+
+UBaseType_t __wrap_uxTaskGetStackHighWaterMark(TaskHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = sim().asTask(handle);
+    if (task == nullptr) {
+        lock.unlock();
+        return __real_uxTaskGetStackHighWaterMark(handle);
+    }
+    // Tasks run on host threads, there is no stack usage to report
+    return task->stackDepth;
+}
+
+uint32_t __wrap_ulTaskGetRunTimeCounter(TaskHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    if (sim().asTask(handle) == nullptr) {
+        lock.unlock();
+        return __real_ulTaskGetRunTimeCounter(handle);
+    }
+    // Tasks take no time in virtual time
+    return 0;
+}
+
+UBaseType_t __wrap_uxTaskPriorityGet(TaskHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = sim().asTask(handle);
+    if (task == nullptr) {
+        lock.unlock();
+        return __real_uxTaskPriorityGet(handle);
+    }
+    return task->priority;
+}
+
+void __wrap_vTaskSuspend(TaskHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = sim().asTask(handle);
+    if (task == nullptr) {
+        lock.unlock();
+        __real_vTaskSuspend(handle);
+        return;
+    }
+    sim().suspendTask(lock, task);
+}
+
+void __wrap_vTaskResume(TaskHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = sim().asTask(handle);
+    if (task == nullptr) {
+        lock.unlock();
+        __real_vTaskResume(handle);
+        return;
+    }
+    sim().resumeTask(task);
+}
+
+BaseType_t __wrap_xTaskAbortDelay(TaskHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = sim().asTask(handle);
+    if (task == nullptr) {
+        lock.unlock();
+        return __real_xTaskAbortDelay(handle);
+    }
+    return sim().abortDelay(task) ? pdPASS : pdFAIL;
+}
+
+void __wrap_vPortYield(void) {
+    std::unique_lock lock(sim().mutex);
+    if (sim().currentTask() == nullptr) {
+        lock.unlock();
+        __real_vPortYield();
+        return;
+    }
+    sim().yield(lock);
+}
+
+// Notifications
+
+BaseType_t __wrap_xTaskGenericNotify(TaskHandle_t handle, UBaseType_t index, uint32_t value, eNotifyAction action, uint32_t* previousValue) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = handle == nullptr ? nullptr : sim().asTask(handle);
+    if (task == nullptr) {
+        lock.unlock();
+        return __real_xTaskGenericNotify(handle, index, value, action, previousValue);
+    }
+    return notifyTask(task, index, value, action, previousValue);
+}
+
+BaseType_t __wrap_xTaskGenericNotifyFromISR(TaskHandle_t handle, UBaseType_t index, uint32_t value, eNotifyAction action, uint32_t* previousValue, BaseType_t* higherPriorityTaskWoken) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = handle == nullptr ? nullptr : sim().asTask(handle);
+    if (task == nullptr) {
+        lock.unlock();
+        return __real_xTaskGenericNotifyFromISR(handle, index, value, action, previousValue, higherPriorityTaskWoken);
+    }
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+    return notifyTask(task, index, value, action, previousValue);
+}
+
+void __wrap_vTaskGenericNotifyGiveFromISR(TaskHandle_t handle, UBaseType_t index, BaseType_t* higherPriorityTaskWoken) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = handle == nullptr ? nullptr : sim().asTask(handle);
+    if (task == nullptr) {
+        lock.unlock();
+        __real_vTaskGenericNotifyGiveFromISR(handle, index, higherPriorityTaskWoken);
+        return;
+    }
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+    notifyTask(task, index, 0, eIncrement, nullptr);
+}
+
+uint32_t __wrap_ulTaskGenericNotifyTake(UBaseType_t index, BaseType_t clearCountOnExit, TickType_t timeout) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = sim().currentTask();
+    if (task == nullptr) {
+        lock.unlock();
+        return __real_ulTaskGenericNotifyTake(index, clearCountOnExit, timeout);
+    }
+    auto deadline = sim().deadlineAfter(timeout);
+    while (task->notification(index).value == 0) {
+        if (!sim().block(lock, task, deadline)) {
+            break;
+        }
+    }
+    auto& notification = task->notification(index);
+    auto value = notification.value;
+    if (value != 0) {
+        notification.value = clearCountOnExit != pdFALSE ? 0 : value - 1;
+    }
+    notification.pending = false;
+    return value;
+}
+
+BaseType_t __wrap_xTaskGenericNotifyWait(UBaseType_t index, uint32_t bitsToClearOnEntry, uint32_t bitsToClearOnExit, uint32_t* notificationValue, TickType_t timeout) {
+    std::unique_lock lock(sim().mutex);
+    auto* task = sim().currentTask();
+    if (task == nullptr) {
+        lock.unlock();
+        return __real_xTaskGenericNotifyWait(index, bitsToClearOnEntry, bitsToClearOnExit, notificationValue, timeout);
+    }
+    if (!task->notification(index).pending) {
+        task->notification(index).value &= ~bitsToClearOnEntry;
+    }
+    auto deadline = sim().deadlineAfter(timeout);
+    while (!task->notification(index).pending) {
+        if (!sim().block(lock, task, deadline)) {
+            break;
+        }
+    }
+    auto& notification = task->notification(index);
+    if (notificationValue != nullptr) {
+        *notificationValue = notification.value;
+    }
+    auto received = notification.pending;
+    if (received) {
+        notification.value &= ~bitsToClearOnExit;
+    }
+    notification.pending = false;
+    return received ? pdTRUE : pdFALSE;
+}
+
+// Timeouts
+
+void __wrap_vTaskSetTimeOutState(TimeOut_t* timeOut) {
+    if (!sim().isActive()) {
+        __real_vTaskSetTimeOutState(timeOut);
+        return;
+    }
+    auto now = sim().now();
+    timeOut->xOverflowCount = static_cast<BaseType_t>(now >> 32);
+    timeOut->xTimeOnEntering = static_cast<TickType_t>(now);
+}
+
+BaseType_t __wrap_xTaskCheckForTimeOut(TimeOut_t* timeOut, TickType_t* ticksToWait) {
+    if (!sim().isActive()) {
+        return __real_xTaskCheckForTimeOut(timeOut, ticksToWait);
+    }
+    if (*ticksToWait == portMAX_DELAY) {
+        return pdFALSE;
+    }
+    auto entered = (static_cast<uint64_t>(timeOut->xOverflowCount) << 32) | timeOut->xTimeOnEntering;
+    auto elapsed = sim().now() - entered;
+    if (elapsed >= *ticksToWait) {
+        *ticksToWait = 0;
+        return pdTRUE;
+    }
+    *ticksToWait -= static_cast<TickType_t>(elapsed);
+    __wrap_vTaskSetTimeOutState(timeOut);
+    return pdFALSE;
+}
+
+// Queues and semaphores
+
+QueueHandle_t __wrap_xQueueGenericCreate(UBaseType_t length, UBaseType_t itemSize, uint8_t type) {
+    if (!sim().isActive()) {
+        return __real_xQueueGenericCreate(length, itemSize, type);
+    }
+    std::unique_lock lock(sim().mutex);
+    return reinterpret_cast<QueueHandle_t>(sim().registerQueue(new SimQueue(type, itemSize, length)));
+}
+
+QueueHandle_t __wrap_xQueueCreateMutex(uint8_t type) {
+    if (!sim().isActive()) {
+        return __real_xQueueCreateMutex(type);
+    }
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().registerQueue(new SimQueue(type, 0, 1));
+    // Mutexes start out available
+    queue->items.emplace_back();
+    return reinterpret_cast<QueueHandle_t>(queue);
+}
+
+QueueHandle_t __wrap_xQueueCreateCountingSemaphore(UBaseType_t maxCount, UBaseType_t initialCount) {
+    if (!sim().isActive()) {
+        return __real_xQueueCreateCountingSemaphore(maxCount, initialCount);
+    }
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().registerQueue(new SimQueue(queueQUEUE_TYPE_COUNTING_SEMAPHORE, 0, maxCount));
+    queue->items.resize(initialCount);
+    return reinterpret_cast<QueueHandle_t>(queue);
+}
+
+void __wrap_vQueueDelete(QueueHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        __real_vQueueDelete(handle);
+        return;
+    }
+    sim().deleteQueue(queue);
+}
+
+BaseType_t __wrap_xQueueGenericSend(QueueHandle_t handle, const void* item, TickType_t timeout, BaseType_t position) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_xQueueGenericSend(handle, item, timeout, position);
+    }
+    return sendToQueue(lock, queue, item, timeout, position);
+}
+
+BaseType_t __wrap_xQueueGenericSendFromISR(QueueHandle_t handle, const void* item, BaseType_t* higherPriorityTaskWoken, BaseType_t position) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_xQueueGenericSendFromISR(handle, item, higherPriorityTaskWoken, position);
+    }
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+    return sendToQueue(lock, queue, item, 0, position);
+}
+
+BaseType_t __wrap_xQueueGiveFromISR(QueueHandle_t handle, BaseType_t* higherPriorityTaskWoken) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_xQueueGiveFromISR(handle, higherPriorityTaskWoken);
+    }
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+    return sendToQueue(lock, queue, nullptr, 0, queueSEND_TO_BACK);
+}
+
+BaseType_t __wrap_xQueueReceive(QueueHandle_t handle, void* buffer, TickType_t timeout) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_xQueueReceive(handle, buffer, timeout);
+    }
+    return receiveFromQueue(lock, queue, buffer, timeout, true);
+}
+
+BaseType_t __wrap_xQueueReceiveFromISR(QueueHandle_t handle, void* buffer, BaseType_t* higherPriorityTaskWoken) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_xQueueReceiveFromISR(handle, buffer, higherPriorityTaskWoken);
+    }
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+    return receiveFromQueue(lock, queue, buffer, 0, true);
+}
+
+BaseType_t __wrap_xQueuePeek(QueueHandle_t handle, void* buffer, TickType_t timeout) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_xQueuePeek(handle, buffer, timeout);
+    }
+    return receiveFromQueue(lock, queue, buffer, timeout, false);
+}
+
+BaseType_t __wrap_xQueueSemaphoreTake(QueueHandle_t handle, TickType_t timeout) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_xQueueSemaphoreTake(handle, timeout);
+    }
+    return receiveFromQueue(lock, queue, nullptr, timeout, true);
+}
+
+BaseType_t __wrap_xQueueTakeMutexRecursive(QueueHandle_t handle, TickType_t timeout) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_xQueueTakeMutexRecursive(handle, timeout);
+    }
+    if (queue->holder != nullptr && queue->holder == sim().currentTask()) {
+        queue->recursion++;
+        return pdPASS;
+    }
+    auto result = receiveFromQueue(lock, queue, nullptr, timeout, true);
+    if (result == pdPASS) {
+        queue->recursion = 1;
+    }
+    return result;
+}
+
+BaseType_t __wrap_xQueueGiveMutexRecursive(QueueHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_xQueueGiveMutexRecursive(handle);
+    }
+    if (queue->holder == nullptr || queue->holder != sim().currentTask()) {
+        return pdFAIL;
+    }
+    if (--queue->recursion > 0) {
+        return pdPASS;
+    }
+    return sendToQueue(lock, queue, nullptr, 0, queueSEND_TO_BACK);
+}
+
+UBaseType_t __wrap_uxQueueMessagesWaiting(QueueHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_uxQueueMessagesWaiting(handle);
+    }
+    return queue->items.size();
+}
+
+UBaseType_t __wrap_uxQueueSpacesAvailable(QueueHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_uxQueueSpacesAvailable(handle);
+    }
+    return queue->capacity - queue->items.size();
+}
+
+BaseType_t __wrap_xQueueGenericReset(QueueHandle_t handle, BaseType_t newQueue) {
+    std::unique_lock lock(sim().mutex);
+    auto* queue = sim().asQueue(handle);
+    if (queue == nullptr) {
+        lock.unlock();
+        return __real_xQueueGenericReset(handle, newQueue);
+    }
+    queue->items.clear();
+    sim().notifyAll(*queue);
+    return pdPASS;
+}
+
+// Event groups
+
+EventGroupHandle_t __wrap_xEventGroupCreate(void) {
+    if (!sim().isActive()) {
+        return __real_xEventGroupCreate();
+    }
+    std::unique_lock lock(sim().mutex);
+    return reinterpret_cast<EventGroupHandle_t>(sim().registerEventGroup(new SimEventGroup()));
+}
+
+void __wrap_vEventGroupDelete(EventGroupHandle_t handle) {
+    std::unique_lock lock(sim().mutex);
+    auto* group = sim().asEventGroup(handle);
+    if (group == nullptr) {
+        lock.unlock();
+        __real_vEventGroupDelete(handle);
+        return;
+    }
+    sim().deleteEventGroup(group);
+}
+
+EventBits_t __wrap_xEventGroupWaitBits(EventGroupHandle_t handle, EventBits_t bitsToWaitFor, BaseType_t clearOnExit, BaseType_t waitForAllBits, TickType_t timeout) {
+    std::unique_lock lock(sim().mutex);
+    auto* group = sim().asEventGroup(handle);
+    if (group == nullptr) {
+        lock.unlock();
+        return __real_xEventGroupWaitBits(handle, bitsToWaitFor, clearOnExit, waitForAllBits, timeout);
+    }
+    auto satisfied = [&]() {
+        return waitForAllBits != pdFALSE
+            ? (group->bits & bitsToWaitFor) == bitsToWaitFor
+            : (group->bits & bitsToWaitFor) != 0;
+    };
+    auto deadline = sim().deadlineAfter(timeout);
+    while (!satisfied()) {
+        if (!sim().block(lock, group, deadline)) {
+            return group->bits;
+        }
+    }
+    auto bits = group->bits;
+    if (clearOnExit != pdFALSE) {
+        group->bits &= ~bitsToWaitFor;
+    }
+    return bits;
+}
+
+EventBits_t __wrap_xEventGroupSetBits(EventGroupHandle_t handle, EventBits_t bits) {
+    std::unique_lock lock(sim().mutex);
+    auto* group = sim().asEventGroup(handle);
+    if (group == nullptr) {
+        lock.unlock();
+        return __real_xEventGroupSetBits(handle, bits);
+    }
+    return setEventBits(group, bits);
+}
+
+EventBits_t __wrap_xEventGroupClearBits(EventGroupHandle_t handle, EventBits_t bits) {
+    std::unique_lock lock(sim().mutex);
+    auto* group = sim().asEventGroup(handle);
+    if (group == nullptr) {
+        lock.unlock();
+        return __real_xEventGroupClearBits(handle, bits);
+    }
+    return clearEventBits(group, bits);
+}
+
+// Setting and clearing event bits from ISRs is deferred to the timer task
+BaseType_t __wrap_xTimerPendFunctionCallFromISR(PendedFunction_t function, void* parameter1, uint32_t parameter2, BaseType_t* higherPriorityTaskWoken) {
+    std::unique_lock lock(sim().mutex);
+    auto* group = sim().asEventGroup(static_cast<EventGroupHandle_t>(parameter1));
+    if (group == nullptr || (function != vEventGroupSetBitsCallback && function != vEventGroupClearBitsCallback)) {
+        lock.unlock();
+        return __real_xTimerPendFunctionCallFromISR(function, parameter1, parameter2, higherPriorityTaskWoken);
+    }
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+    if (function == vEventGroupSetBitsCallback) {
+        setEventBits(group, parameter2);
+    } else {
+        clearEventBits(group, parameter2);
+    }
+    return pdPASS;
+}
+
+}    // extern "C"
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+
+using namespace std::chrono;
+
+namespace farmhub::test {
+
+/**
+ * @brief A task resuming after being blocked or suspended.
+ */
+struct TaskWakeup {
+    // Virtual time since the simulation started
+    milliseconds time;
+    std::string task;
+
+    bool operator==(const TaskWakeup& other) const = default;
+};
+
+/**
+ * @brief Runs FreeRTOS tasks in deterministic virtual time on the linux target.
+ *
+ * While an instance exists, tasks created by the test run one at a time, each until it blocks or yields,
+ * highest priority first. Delays, queue and semaphore timeouts, task notifications and event groups all
+ * wait in virtual time. Time only moves when every task is blocked, and then it jumps straight to the
+ * next timeout, so a simulated month passes in seconds, and every run wakes the same tasks in the same order.
+ * `steady_clock` and `system_clock` follow virtual time, too: like the FreeRTOS functions, their calls are wrapped at link time.
+ *
+ * The test itself takes part as the lowest priority task: it lets the others run by calling `runFor()`.
+ * Tasks still alive when the instance is destroyed are abandoned, and never run again.
+ *
+ * FreeRTOS calls are redirected to the simulation by the linker, see CMakeLists.txt.
+ * Objects created outside the simulation (like static mutexes) keep using FreeRTOS.
+ */
+class VirtualTime {
+public:
+    explicit VirtualTime(system_clock::time_point wallClockStart = sys_days { 2025y / January / 1 });
+    ~VirtualTime();
+
+    VirtualTime(const VirtualTime&) = delete;
+    VirtualTime& operator=(const VirtualTime&) = delete;
+
+    /**
+     * @brief Let tasks run until `duration` of virtual time has passed.
+     */
+    void runFor(milliseconds duration);
+
+    /**
+     * @brief Virtual time passed since the simulation started.
+     */
+    milliseconds elapsed() const;
+
+    /**
+     * @brief Tasks resumed so far, in order.
+     */
+    std::vector<TaskWakeup> getWakeups() const;
+
+    void clearWakeups();
+
+    /**
+     * @brief Number of times a different task got to run.
+     */
+    size_t getContextSwitches() const;
+
+    /**
+     * @brief Monotonic time of the host, for measuring how fast the simulation runs; the standard clocks are virtual.
+     */
+    static nanoseconds hostTime();
+
+private:
+    // Signals stay blocked on the test's thread, so that the FreeRTOS tick does not interfere
+    sigset_t previousSignalMask {};
+};
+
+}    // namespace farmhub::test
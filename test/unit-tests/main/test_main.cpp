@@ -1,8 +1,11 @@
 #include <iomanip>
 #include <iostream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string_view>
 
+#include <sdkconfig.h>
+
 #include <catch2/catch_session.hpp>
 #include <catch2/catch_test_case_info.hpp>
 #include <catch2/reporters/catch_reporter_event_listener.hpp>
@@ -42,8 +45,16 @@ CATCH_REGISTER_LISTENER(testRunListener)
 extern "C" void app_main(void) {
     const char* argv[] = {
         "target_test_main",
+        nullptr,
     };
-    int argc = sizeof(argv) / sizeof(argv[0]);
+    int argc = 1;
+#if CONFIG_IDF_TARGET_LINUX
+    // Select tests to run on the host, like "[benchmark]"; app_main() gets no command line
+    const char* testSpec = getenv("UNIT_TEST_SPEC");
+    if (testSpec != nullptr) {
+        argv[argc++] = testSpec;
+    }
+#endif
 
     Catch::Session session;
     session.configData().rngSeed = 12345;
@@ -53,4 +64,8 @@ extern "C" void app_main(void) {
     } else {
         printf("Test passed.\n");
     }
+#if CONFIG_IDF_TARGET_LINUX
+    // The scheduler would keep the process alive after app_main() returns; report the result to CI instead
+    exit(result);
+#endif
 }